@@ -105,6 +105,8 @@ static int64_t qemu_icount_bias;
 static int64_t vm_clock_warp_start;
 /* Conversion factor from emulated instructions to virtual clock ticks.  */
 static int icount_time_shift;
+/* Whether idle VCPUs let real time pass before QEMU_CLOCK_VIRTUAL warps.  */
+static bool icount_sleep = true;
 /* Arbitrarily pick 1MIPS as the minimum allowable speed.  */
 #define MAX_ICOUNT_SHIFT 10
 
@@ -397,7 +399,18 @@ void qemu_clock_warp(QEMUClockType type)
         return;
     }
 
-    if (deadline > 0) {
+    if (deadline > 0 && !icount_sleep) {
+        /*
+         * With sleep=off, the VCPUs never wait in real time: the virtual
+         * clock jumps straight to the next QEMU_CLOCK_VIRTUAL event.  Idle
+         * periods of the guest (e.g. WFI between timer interrupts) then
+         * take no host time at all.
+         */
+        seqlock_write_lock(&timers_state.vm_clock_seqlock);
+        qemu_icount_bias += deadline;
+        seqlock_write_unlock(&timers_state.vm_clock_seqlock);
+        qemu_clock_notify(QEMU_CLOCK_VIRTUAL);
+    } else if (deadline > 0) {
         /*
          * Ensure QEMU_CLOCK_VIRTUAL proceeds even when the virtual CPU goes to
          * sleep.  Otherwise, the CPU might be waiting for a future timer
@@ -441,20 +454,38 @@ static const VMStateDescription vmstate_timers = {
 
 void configure_icount(const char *option)
 {
+    const char *sleep;
+
     seqlock_init(&timers_state.vm_clock_seqlock, NULL);
     vmstate_register(NULL, 0, &vmstate_timers, &timers_state);
     if (!option) {
         return;
     }
 
+    sleep = strstr(option, ",sleep=");
+    if (sleep) {
+        sleep += strlen(",sleep=");
+        if (!strcmp(sleep, "off")) {
+            icount_sleep = false;
+        } else if (strcmp(sleep, "on")) {
+            fprintf(stderr, "-icount: invalid sleep option '%s'\n", sleep);
+            exit(1);
+        }
+    }
+
     icount_warp_timer = timer_new_ns(QEMU_CLOCK_REALTIME,
                                           icount_warp_rt, NULL);
-    if (strcmp(option, "auto") != 0) {
+    if (strncmp(option, "auto", 4) != 0) {
         icount_time_shift = strtol(option, NULL, 0);
         use_icount = 1;
         return;
     }
 
+    if (!icount_sleep) {
+        fprintf(stderr, "-icount: sleep=off needs a fixed N, not auto\n");
+        exit(1);
+    }
+
     use_icount = 2;
 
     /* 125MIPS seems a reasonable initial guess at the guest speed.
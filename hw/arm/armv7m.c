@@ -163,7 +163,8 @@ static void armv7m_reset(void *opaque)
 }
 
 /* Init CPU and memory for a v7-M based board.
-   flash_size and sram_size are in kb.
+   flash_size and sram_size are in kb.  A board with its own flash
+   controller passes a flash_size of 0 and maps the flash itself.
    Returns the NVIC array.  */
 
 qemu_irq *armv7m_init(MemoryRegion *address_space_mem,
@@ -210,10 +211,12 @@ qemu_irq *armv7m_init(MemoryRegion *address_space_mem,
 #endif
 
     /* Flash programming is done via the SCU, so pretend it is ROM.  */
-    memory_region_init_ram(flash, NULL, "armv7m.flash", flash_size);
-    vmstate_register_ram_global(flash);
-    memory_region_set_readonly(flash, true);
-    memory_region_add_subregion(address_space_mem, 0, flash);
+    if (flash_size) {
+        memory_region_init_ram(flash, NULL, "armv7m.flash", flash_size);
+        vmstate_register_ram_global(flash);
+        memory_region_set_readonly(flash, true);
+        memory_region_add_subregion(address_space_mem, 0, flash);
+    }
     memory_region_init_ram(sram, NULL, "armv7m.sram", sram_size);
     vmstate_register_ram_global(sram);
     memory_region_add_subregion(address_space_mem, 0x1FFF0000, sram);
@@ -234,7 +237,7 @@ qemu_irq *armv7m_init(MemoryRegion *address_space_mem,
     big_endian = 0;
 #endif
 
-    if (!kernel_filename && !qtest_enabled()) {
+    if (!kernel_filename && flash_size && !qtest_enabled()) {
         fprintf(stderr, "Guest image must be specified (using -kernel)\n");
         exit(1);
     }
@@ -243,7 +246,10 @@ qemu_irq *armv7m_init(MemoryRegion *address_space_mem,
         image_size = load_elf(kernel_filename, NULL, NULL, &entry, &lowaddr,
                               NULL, big_endian, ELF_MACHINE, 1);
         if (image_size < 0) {
-            image_size = load_image_targphys(kernel_filename, 0, flash_size);
+            /* without a flash size, up to the SRAM */
+            image_size = load_image_targphys(kernel_filename, 0,
+                                             flash_size ? flash_size :
+                                             0x1FFF0000);
             lowaddr = 0;
         }
         if (image_size < 0) {
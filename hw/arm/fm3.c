@@ -7,10 +7,16 @@
  * This code is licensed under the GNU GPL v2.
  */
 
+#include <sys/mman.h>
 #include "hw/sysbus.h"
 #include "hw/arm/arm.h"
 #include "hw/devices.h"
 #include "hw/boards.h"
+#include "net/net.h"
+#include "hw/ssi.h"
+#include "sysemu/blockdev.h"
+#include "sysemu/qtest.h"
+#include "qapi/visitor.h"
 #include "fm3.h"
 #include "fm3_board_config.h"
 #include "exec/address-spaces.h"
@@ -30,22 +36,141 @@ struct fm3_board_info_t {
     .ex_sram_size = 0,
 };
 
+/*
+ * Memory for the large regions of the board.  Pages are zero-filled when
+ * first touched, no swap is reserved and no huge pages are used, so the
+ * footprint of an instance tracks what the firmware actually touches.
+ */
+void *fm3_alloc_sparse(uint64_t size)
+{
+    void *p;
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+#ifdef MADV_NOHUGEPAGE
+    madvise(p, size, MADV_NOHUGEPAGE);
+#endif
+    return p;
+}
+
+/* pagemap entry flags */
+#define FM3_PM_PRESENT      (1ULL << 63)
+#define FM3_PM_SWAP         (1ULL << 62)
+#define FM3_PM_FILE         (1ULL << 61)
+
+/*
+ * Bytes of [host, host + size) that belong to this instance.  Pages still
+ * shared with a file, such as the erased-flash template, are not counted.
+ * Without /proc/self/pagemap every page in memory counts.
+ */
+uint64_t fm3_get_resident(void *host, uint64_t size)
+{
+    size_t page = getpagesize();
+    size_t pages = DIV_ROUND_UP(size, page);
+    uint64_t *map = g_new(uint64_t, pages);
+    unsigned char *vec;
+    uint64_t retval = 0;
+    size_t i;
+    int fd;
+
+    fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd >= 0 &&
+        pread(fd, map, pages * sizeof(*map),
+              ((uintptr_t)host / page) * sizeof(*map)) ==
+        pages * sizeof(*map)) {
+        for (i = 0; i < pages; i++) {
+            if ((map[i] & (FM3_PM_PRESENT | FM3_PM_SWAP)) &&
+                !(map[i] & FM3_PM_FILE))
+                retval += page;
+        }
+    } else {
+        vec = g_malloc(pages);
+        if (mincore(host, size, vec) == 0) {
+            for (i = 0; i < pages; i++) {
+                if (vec[i] & 1)
+                    retval += page;
+            }
+        }
+        g_free(vec);
+    }
+    if (fd >= 0)
+        close(fd);
+    g_free(map);
+    return MIN(retval, size);
+}
+
+/* /machine/<name>-resident, read with QMP qom-get */
+static void fm3_get_resident_prop(Object *obj, Visitor *v, void *opaque,
+                                  const char *name, Error **errp)
+{
+    MemoryRegion *mr = opaque;
+    uint64_t value = fm3_get_resident(memory_region_get_ram_ptr(mr),
+                                      memory_region_size(mr));
+
+    visit_type_uint64(v, &value, name, errp);
+}
+
+static void fm3_add_resident_prop(const char *name, MemoryRegion *mr)
+{
+    char *prop = g_strdup_printf("%s-resident", name);
+
+    object_property_add(qdev_get_machine(), prop, "uint64",
+                        fm3_get_resident_prop, NULL, NULL, mr, NULL);
+    g_free(prop);
+}
+
+/* NMI request from fm3.int: the NVIC pends NMI on the rising edge */
+static void fm3_nmi_set_irq(void *opaque, int n, int level)
+{
+    ARMCPU *cpu = opaque;
+
+    if (level)
+        armv7m_nvic_set_pending(cpu->env.nvic, ARMV7M_EXCP_NMI);
+}
+
 static void fm3_init(const char *kernel_filename, const char *cpu_model,
                      const struct fm3_board_info_t *bi)
 {
     MemoryRegion *sysmem = get_system_memory();
     MemoryRegion *ex_sram;
+    void *ex_sram_ptr;
     DeviceState *dev = NULL;
+    DeviceState *intc;
+    DeviceState *exti;
+    DeviceState *gpio;
+    DeviceState *spi;
+    void *bus;
+    char name[8];
+    char *image;
+    int port;
     qemu_irq *nvic;
     qemu_irq irq[FM3_IRQ_NUM];
     int n;
 
-    /* Cortex-M3 */
-    nvic = armv7m_init(sysmem, bi->flash_size/1024, bi->sram_size/1024,
+    /* Cortex-M3 (the flash is mapped below) */
+    nvic = armv7m_init(sysmem, 0, bi->sram_size/1024,
                       kernel_filename, cpu_model);
     if (!nvic)
         return;
 
+    /* Flash memory and flash interface */
+    dev = qdev_create(NULL, "fm3.flash");
+    qdev_prop_set_uint32(dev, "size", bi->flash_size);
+    qdev_init_nofail(dev);
+    sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, 0x00000000);
+    sysbus_mmio_map(SYS_BUS_DEVICE(dev), 1, 0x40000000);
+    fm3_add_resident_prop("flash",
+                          sysbus_mmio_get_region(SYS_BUS_DEVICE(dev), 0));
+    image = object_property_get_str(OBJECT(dev), "image", NULL);
+    if (!kernel_filename && !image && !qtest_enabled()) {
+        fprintf(stderr, "Guest image must be specified "
+                        "(using -kernel or -global fm3.flash.image=FILE)\n");
+        exit(1);
+    }
+    g_free(image);
+
     /* Interrupt sources */
     dev = sysbus_create_simple("fm3.int", 0x40031000, NULL);
     if (!dev)
@@ -56,24 +181,99 @@ static void fm3_init(const char *kernel_filename, const char *cpu_model,
         sysbus_connect_irq(SYS_BUS_DEVICE(dev), n, nvic[n]);
         irq[n] = qdev_get_gpio_in(dev, n);
     }
+    sysbus_connect_irq(SYS_BUS_DEVICE(dev), FM3_IRQ_NUM,
+                       qemu_allocate_irqs(fm3_nmi_set_irq,
+                                          ARM_CPU(first_cpu), 1)[0]);
+    intc = dev;
     /* Clock */
     sysbus_create_simple("fm3.cr", 0x40010000, NULL);
 
+    /* Multi-function timer (unit 0) */
+    sysbus_create_varargs("fm3.mft", 0x40020000,
+                          irq[FM3_IRQ_MFT_FRT], irq[FM3_IRQ_MFT_ICU],
+                          irq[FM3_IRQ_MFT_OCU], NULL);
+
+    /* Base timers */
+    sysbus_create_simple("fm3.bt", 0x40025000, irq[FM3_IRQ_BT]);
+
+    /* A/D converter (unit 0) */
+    sysbus_create_simple("fm3.adc", 0x40027000, irq[FM3_IRQ_ADC(0)]);
+
+    /* CAN controllers, both on the in-process bus "can" by default */
+    dev = qdev_create(NULL, "fm3.can");
+    qdev_prop_set_uint32(dev, "ch", 0);
+    qdev_init_nofail(dev);
+    sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, 0x40062000);
+    sysbus_connect_irq(SYS_BUS_DEVICE(dev), 0, irq[FM3_IRQ_CAN(0)]);
+    dev = qdev_create(NULL, "fm3.can");
+    qdev_prop_set_uint32(dev, "ch", 1);
+    qdev_init_nofail(dev);
+    sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, 0x40063000);
+    sysbus_connect_irq(SYS_BUS_DEVICE(dev), 0, irq[FM3_IRQ_CAN(1)]);
+
+    /* Ethernet MAC (channel 0) */
+    if (nd_table[0].used) {
+        qemu_check_nic_model(&nd_table[0], "fm3.ether");
+        dev = qdev_create(NULL, "fm3.ether");
+        qdev_set_nic_properties(dev, &nd_table[0]);
+        qdev_init_nofail(dev);
+        sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, 0x40064000);
+        sysbus_connect_irq(SYS_BUS_DEVICE(dev), 0, irq[FM3_IRQ_ETHER(0)]);
+    }
+
+    /* DMA controller */
+    sysbus_create_varargs("fm3.dmac", 0x40060000,
+                          irq[FM3_IRQ_DMAC(0)], irq[FM3_IRQ_DMAC(1)],
+                          irq[FM3_IRQ_DMAC(2)], irq[FM3_IRQ_DMAC(3)],
+                          irq[FM3_IRQ_DMAC(4)], irq[FM3_IRQ_DMAC(5)],
+                          irq[FM3_IRQ_DMAC(6)], irq[FM3_IRQ_DMAC(7)], NULL);
+
     /* Watchdog timers */
-    sysbus_create_simple("fm3.wdt", 0x40011000, NULL);
+    sysbus_create_varargs("fm3.wdt", 0x40011000,
+                          qdev_get_gpio_in(intc, FM3_IRQ_NMI),
+                          irq[FM3_IRQ_SWDT], NULL);
 
     /* External interrupts */
-    sysbus_create_varargs("fm3.exti", 0x40030000, irq[4], irq[5], NULL);
+    exti = sysbus_create_varargs("fm3.exti", 0x40030000,
+                                 irq[FM3_IRQ_EXTI_0_7], irq[FM3_IRQ_EXTI_8_31],
+                                 NULL);
 
     /* GPIO */
-    sysbus_create_simple("fm3.gpio", 0x40033000, NULL);
+    gpio = sysbus_create_simple("fm3.gpio", 0x40033000, NULL);
+
+    /* INTxx pins and their pin-mux routing to the external interrupts */
+    for (n = 0; n < FM3_EXTI_NUM; n++) {
+        qdev_connect_gpio_out(gpio, FM3_GPIO_LINE_EXTI(n),
+                              qdev_get_gpio_in(exti, FM3_EXTI_LINE_INPUT(n)));
+        qdev_connect_gpio_out(gpio, FM3_GPIO_LINE_EXTI_ROUTE(n),
+                              qdev_get_gpio_in(exti, FM3_EXTI_LINE_ROUTE(n)));
+    }
 
     /* UART(MFS) */
-    sysbus_create_varargs("fm3.uart", 0x40038000,
-                          irq[7],  irq[8],  /* ch0 */
-                          irq[13], irq[14], /* ch3 */
-                          irq[15], irq[16], /* ch4 */
-                          NULL);
+    dev = sysbus_create_simple("fm3.uart", 0x40038000, NULL);
+    for (n = 0; n < FM3_MFS_NUM; n++) {
+        sysbus_connect_irq(SYS_BUS_DEVICE(dev), n * 2, 
+                           irq[FM3_IRQ_MFS_RX(n)]);
+        sysbus_connect_irq(SYS_BUS_DEVICE(dev), n * 2 + 1, 
+                           irq[FM3_IRQ_MFS_TX(n)]);
+    }
+
+    /* SPI device on a CSIO channel: an SD card (-sd) or a flash (-mtdblock) */
+    for (n = 0; n < FM3_MFS_NUM; n++) {
+        port = fm3_board_get_csio_cs_port(n);
+        if (port < 0)
+            continue;
+        snprintf(name, sizeof(name), "ssi%d", n);
+        bus = qdev_get_child_bus(dev, name);
+        if (drive_get(IF_SD, 0, 0))
+            spi = ssi_create_slave(bus, "ssi-sd");
+        else if (drive_get(IF_MTD, 0, 0))
+            spi = ssi_create_slave(bus, "s25fl129p1");
+        else
+            continue;
+        qdev_connect_gpio_out(gpio, FM3_GPIO_LINE_PORT(port),
+                              qdev_get_gpio_in(spi, 0));
+    }
 
 //	/* REG Sample */
 //    sysbus_create_varargs("fm3.RegSample", 0x41000000,
@@ -83,8 +283,16 @@ static void fm3_init(const char *kernel_filename, const char *cpu_model,
     /* External memory */
     if (bi->ex_sram_size) {
         ex_sram = g_new(MemoryRegion, 1);
-        memory_region_init_ram(ex_sram, NULL, "fm3.ex-ram", bi->ex_sram_size);
+        ex_sram_ptr = fm3_alloc_sparse(bi->ex_sram_size);
+        if (!ex_sram_ptr) {
+            fprintf(stderr, "fm3: cannot allocate the external SRAM\n");
+            exit(1);
+        }
+        memory_region_init_ram_ptr(ex_sram, NULL, "fm3.ex-ram",
+                                   bi->ex_sram_size, ex_sram_ptr);
+        vmstate_register_ram_global(ex_sram);
         memory_region_add_subregion(sysmem, 0x60000000, ex_sram);
+        fm3_add_resident_prop("ex-sram", ex_sram);
     }
 }
 
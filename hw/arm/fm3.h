@@ -44,18 +44,87 @@ enum FM3_PORT_TYPE {
 #define FM3_MFS_NUM         8
 #define FM3_EXTI_NUM        32
 
+/* output lines of fm3.gpio: INTxx, the level driven on each port pin, then
+ * whether each INTxx pin is routed by the pin-mux */
+#define FM3_GPIO_LINE_EXTI(exti_no)         (exti_no)
+#define FM3_GPIO_LINE_PORT(port_no)         (FM3_EXTI_NUM + (port_no))
+#define FM3_GPIO_LINE_EXTI_ROUTE(exti_no)   (FM3_EXTI_NUM + 0x100 + (exti_no))
+#define FM3_GPIO_LINE_NUM                   (FM3_EXTI_NUM * 2 + 0x100)
+
+/* input lines of fm3.exti: INTxx, then the routing of each INTxx pin */
+#define FM3_EXTI_LINE_INPUT(exti_no)        (exti_no)
+#define FM3_EXTI_LINE_ROUTE(exti_no)        (FM3_EXTI_NUM + (exti_no))
+#define FM3_EXTI_LINE_NUM                   (FM3_EXTI_NUM * 2)
+
 #define FM3_PORT_TO_BLOCKNO(port_no)	((port_no >> 4) & 0xf)
 #define FM3_PORT_TO_BITPOS(port_no)     (port_no & 0xf)
 
-/* functions checking irq status for IRQxxMON registers */
-uint32_t fm3_uart_get_rx_irq_stat(int ch);
-uint32_t fm3_uart_get_tx_irq_stat(int ch);
-uint32_t fm3_uart_get_stat_irq_stat(int ch);
-uint32_t fm3_exti_get_irq_stat(int ch);
+/* IRQ numbers of the interrupt sources */
+#define FM3_IRQ_SWDT            1
+#define FM3_IRQ_EXTI_0_7        4
+#define FM3_IRQ_EXTI_8_31       5
+#define FM3_IRQ_MFS_RX(ch)      (7 + (ch) * 2)
+#define FM3_IRQ_MFS_TX(ch)      (8 + (ch) * 2)
+#define FM3_IRQ_ADC(unit)       (25 + (unit))
+#define FM3_IRQ_MFT_FRT         28
+#define FM3_IRQ_MFT_ICU         29
+#define FM3_IRQ_MFT_OCU         30
+#define FM3_IRQ_BT              31
+#define FM3_IRQ_CAN(ch)         (32 + (ch))
+#define FM3_IRQ_ETHER(ch)       (34 + (ch))
+#define FM3_IRQ_DMAC(ch)        (38 + (ch))
+/* input of fm3.int after the IRQs: NMI request of the HW watchdog */
+#define FM3_IRQ_NMI             FM3_IRQ_NUM
+
+/* DMA request numbers (DRQSEL bit), IS5-0 of DMACA is 0x20 + number */
+#define FM3_DRQ_ADC(unit)       (5 + (unit))
+#define FM3_DRQ_MFS_RX(ch)      (12 + (ch) * 2)
+#define FM3_DRQ_MFS_TX(ch)      (13 + (ch) * 2)
+#define FM3_DRQ_TO_IS(drq)      (0x20 + (drq))
+
+/* clock domains of fm3.cr */
+enum FM3_CLK {
+    FM3_CLK_HCLK = 0,
+    FM3_CLK_PCLK0,
+    FM3_CLK_PCLK1,
+    FM3_CLK_PCLK2,
+    FM3_CLK_NUM,
+};
+
+/* data passed to the notifiers of a domain, once per change of its rate */
+typedef struct {
+    int clk;
+    uint32_t old_hz;
+    uint32_t hz;
+} Fm3ClkChange;
+
+uint32_t fm3_clk_get_hz(int clk);
+void fm3_clk_add_notifier(int clk, Notifier *notifier);
+
+/* deadline of a count in clock cycles, moved to the new rate at "now" */
+static inline int64_t fm3_clk_rescale(int64_t deadline, int64_t now,
+                                      const Fm3ClkChange *c)
+{
+    if (deadline < now)
+        return now - muldiv64(now - deadline, c->old_hz, c->hz);
+    return now + muldiv64(deadline - now, c->old_hz, c->hz);
+}
+
+/* large memory regions: zero pages on demand, footprint via the pagemap */
+void *fm3_alloc_sparse(uint64_t size);
+uint64_t fm3_get_resident(void *host, uint64_t size);
+
+/* status words of IRQxxMON registers, pushed by the interrupt sources */
+void fm3_int_set_mon(int irq, uint32_t mask, uint32_t value);
 
-void fm3_exti_set_request(int int_ch, int level);
 int fm3_gpio_get_port_from_pin(int pin_no, enum FM3_PINPACKAGE pkg);
-uint32_t fm3_gpio_get_port_setting(uint32_t port_no);
-uint32_t fm3_gpio_get_extport_setting(uint32_t block_no);
+
+/* pin-mux routing, pushed by fm3_gpio when PFR/EPFR are changed */
+void fm3_uart_set_route(int ch, int tx, bool routed);
+
+/* level of a DMA transfer request, routed by fm3_int through DRQSEL */
+void fm3_dmac_request(int is, int level);
+/* a block has been transferred for the scan FIFO of the ADC unit */
+void fm3_adc_dma_ack(int unit);
 
 #endif
@@ -0,0 +1,957 @@
+/*
+ * Fujitsu FM3 12-bit A/D Converter
+ *
+ * This code is licensed under the GNU GPL v2.
+ *
+ * Scan conversion with the 16-stage scan FIFO, priority conversion with
+ * the 4-stage priority FIFO, and the conversion result comparison.
+ *
+ * Converted values are taken from a sample stream, the "samples" file or
+ * the "chardev" backend: each conversion consumes the next little-endian
+ * 16-bit word, of which the lower 12 bits are used.  The stream is read
+ * in chunks.  A running scan is not stepped by a timer: the conversions
+ * due at the current virtual time are done when the guest looks at the
+ * ADC, and a timer is only armed for the next conversion that raises an
+ * enabled interrupt (FIFO stage count, end of scan or overrun).
+ */
+
+#include "hw/sysbus.h"
+#include "hw/arm/arm.h"
+#include "qemu/timer.h"
+#include "sysemu/char.h"
+#include "qemu/error-report.h"
+#include "qemu/bswap.h"
+#include "qemu/host-utils.h"
+#include "fm3.h"
+
+//#define FM3_DEBUG_ADC
+#define TYPE_FM3_ADC    "fm3.adc"
+
+#ifdef FM3_DEBUG_ADC
+#define DPRINTF(fmt, ...)                                       \
+    do { printf(fmt, ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) do { } while (0)
+#endif
+
+#define FM3_ADC_REG_ADSR            (0x00)
+#define FM3_ADC_REG_ADSR_SCS        (1 << 0)
+#define FM3_ADC_REG_ADSR_PCS        (1 << 1)
+#define FM3_ADC_REG_ADSR_PCNS       (1 << 2)
+#define FM3_ADC_REG_ADSR_FDAS       (1 << 6)
+#define FM3_ADC_REG_ADSR_ADSTP      (1 << 7)
+#define FM3_ADC_REG_ADCR            (0x01)
+#define FM3_ADC_REG_ADCR_OVRIE      (1 << 0)
+#define FM3_ADC_REG_ADCR_CMPIE      (1 << 1)
+#define FM3_ADC_REG_ADCR_PCIE       (1 << 2)
+#define FM3_ADC_REG_ADCR_SCIE       (1 << 3)
+#define FM3_ADC_REG_ADCR_CMPF       (1 << 5)
+#define FM3_ADC_REG_ADCR_PCIF       (1 << 6)
+#define FM3_ADC_REG_ADCR_SCIF       (1 << 7)
+#define FM3_ADC_REG_ADCR_FLAGS      (FM3_ADC_REG_ADCR_CMPF | \
+                                     FM3_ADC_REG_ADCR_PCIF | \
+                                     FM3_ADC_REG_ADCR_SCIF)
+#define FM3_ADC_REG_SFNS            (0x08)
+#define FM3_ADC_REG_SCCR            (0x09)
+#define FM3_ADC_REG_SCCR_SSTR       (1 << 0)
+#define FM3_ADC_REG_SCCR_SHEN       (1 << 1)
+#define FM3_ADC_REG_SCCR_RPT        (1 << 2)
+#define FM3_ADC_REG_SCCR_SFCLR      (1 << 4)
+#define FM3_ADC_REG_SCCR_SOVR       (1 << 5)
+#define FM3_ADC_REG_SCCR_SFUL       (1 << 6)
+#define FM3_ADC_REG_SCCR_SEMP       (1 << 7)
+#define FM3_ADC_REG_SCFD            (0x0C)
+#define FM3_ADC_REG_SCIS23          (0x10)
+#define FM3_ADC_REG_SCIS01          (0x14)
+#define FM3_ADC_REG_PFNS            (0x18)
+#define FM3_ADC_REG_PCCR            (0x19)
+#define FM3_ADC_REG_PCCR_PSTR       (1 << 0)
+#define FM3_ADC_REG_PCCR_PHEN       (1 << 1)
+#define FM3_ADC_REG_PCCR_PEEN       (1 << 2)
+#define FM3_ADC_REG_PCCR_PFCLR      (1 << 4)
+#define FM3_ADC_REG_PCCR_POVR       (1 << 5)
+#define FM3_ADC_REG_PCCR_PFUL       (1 << 6)
+#define FM3_ADC_REG_PCCR_PEMP       (1 << 7)
+#define FM3_ADC_REG_PCFD            (0x1C)
+#define FM3_ADC_REG_PCIS            (0x20)
+#define FM3_ADC_REG_CMPCR           (0x24)
+#define FM3_ADC_REG_CMPCR_CMD0      (1 << 5)
+#define FM3_ADC_REG_CMPCR_CMD1      (1 << 6)
+#define FM3_ADC_REG_CMPCR_CMPEN     (1 << 7)
+#define FM3_ADC_REG_CMPD            (0x26)
+#define FM3_ADC_REG_ADSS23          (0x28)
+#define FM3_ADC_REG_ADSS01          (0x2C)
+#define FM3_ADC_REG_ADST1           (0x30)
+#define FM3_ADC_REG_ADST0           (0x31)
+#define FM3_ADC_REG_ADCT            (0x34)
+#define FM3_ADC_REG_PRTSL           (0x38)
+#define FM3_ADC_REG_SCTSL           (0x39)
+
+/* SCFD/PCFD */
+#define FM3_ADC_FD_SC(ch)           ((ch) & 0x1f)
+#define FM3_ADC_FD_RS_SOFTWARE      (1 << 8)
+#define FM3_ADC_FD_INVL             (1 << 12)
+#define FM3_ADC_FD_SD(v)            (((v) & 0xfff) << 20)
+
+/* IRQ25MON-27MON */
+#define FM3_ADC_MON_SCIRQ           (1 << 0)
+#define FM3_ADC_MON_PCIRQ           (1 << 1)
+#define FM3_ADC_MON_ORIRQ           (1 << 2)
+#define FM3_ADC_MON_CMPIRQ          (1 << 3)
+
+#define FM3_ADC_CH_NUM              32
+#define FM3_ADC_SCAN_FIFO           16
+#define FM3_ADC_PRIO_FIFO           4
+/* samples read from the stream at a time */
+#define FM3_ADC_CHUNK               4096
+
+typedef struct {
+    uint32_t data[FM3_ADC_SCAN_FIFO];
+    uint32_t get;
+    uint32_t count;
+} Fm3AdcFifo;
+
+typedef struct {
+    SysBusDevice busdev;
+    MemoryRegion mmio;
+    qemu_irq irq;
+    QEMUTimer *scan_timer;
+    QEMUTimer *prio_timer;
+
+    uint32_t unit;
+    char *samples_path;
+    CharDriverState *chr;
+
+    uint32_t adsr;
+    uint32_t adcr;
+    uint32_t sfns;
+    uint32_t sccr;
+    uint32_t scis;
+    uint32_t pfns;
+    uint32_t pccr;
+    uint32_t pcis;
+    uint32_t cmpcr;
+    uint32_t cmpd;
+    uint32_t adss;
+    uint32_t adst0;
+    uint32_t adst1;
+    uint32_t adct;
+    uint32_t prtsl;
+    uint32_t sctsl;
+    Fm3AdcFifo scan_fifo;
+    Fm3AdcFifo prio_fifo;
+    uint32_t scan_ch;       /* channel of the conversion in progress */
+    int64_t scan_start;     /* start of the conversion in progress */
+    uint32_t prio_ch;
+    uint32_t mon;
+    uint32_t clk_hz;        /* PCLK2 the conversion times are counted in */
+    Notifier clk_notifier;
+
+    /* sample stream */
+    FILE *file;
+    uint16_t buf[FM3_ADC_CHUNK];
+    uint32_t buf_get;
+    uint32_t buf_count;
+    uint32_t partial;       /* odd byte from the chardev, 0x100 if none */
+    uint16_t last;
+    uint64_t underrun;
+} Fm3AdcState;
+#define FM3_ADC(obj) \
+    OBJECT_CHECK(Fm3AdcState, (obj), TYPE_FM3_ADC)
+
+static Fm3AdcState *fm3_adc_state[3];
+
+static const uint32_t fm3_adc_stx[8] = {
+    1, 4, 8, 16, 32, 64, 128, 256,
+};
+
+/*
+ * sample stream
+ */
+
+static void fm3_adc_fill(Fm3AdcState *s)
+{
+    size_t n;
+
+    if (!s->file)
+        return;
+
+    n = fread(s->buf, sizeof(s->buf[0]), FM3_ADC_CHUNK, s->file);
+    if (n < FM3_ADC_CHUNK) {
+        /* the stream repeats */
+        rewind(s->file);
+        if (!n)
+            n = fread(s->buf, sizeof(s->buf[0]), FM3_ADC_CHUNK, s->file);
+    }
+    s->buf_get = 0;
+    s->buf_count = n;
+}
+
+static uint32_t fm3_adc_next_sample(Fm3AdcState *s)
+{
+    if (!s->buf_count)
+        fm3_adc_fill(s);
+
+    if (!s->buf_count) {
+        /* nothing streamed in yet: hold the last value */
+        if (s->chr)
+            s->underrun++;
+        return s->last & 0xfff;
+    }
+
+    s->last = le16_to_cpu(s->buf[s->buf_get]);
+    s->buf_get = (s->buf_get + 1) % FM3_ADC_CHUNK;
+    s->buf_count--;
+    return s->last & 0xfff;
+}
+
+static void fm3_adc_skip_samples(Fm3AdcState *s, uint64_t n)
+{
+    uint32_t len;
+
+    while (n) {
+        if (!s->buf_count)
+            fm3_adc_fill(s);
+        if (!s->buf_count)
+            break;
+        len = MIN(n, s->buf_count);
+        s->buf_get = (s->buf_get + len - 1) % FM3_ADC_CHUNK;
+        s->last = le16_to_cpu(s->buf[s->buf_get]);
+        s->buf_get = (s->buf_get + 1) % FM3_ADC_CHUNK;
+        s->buf_count -= len;
+        n -= len;
+    }
+}
+
+static int fm3_adc_can_receive(void *opaque)
+{
+    Fm3AdcState *s = (Fm3AdcState *)opaque;
+
+    return (FM3_ADC_CHUNK - s->buf_count) * 2 - (s->partial < 0x100);
+}
+
+static void fm3_adc_receive(void *opaque, const uint8_t *buf, int size)
+{
+    Fm3AdcState *s = (Fm3AdcState *)opaque;
+    uint32_t put;
+    int i;
+
+    for (i = 0; i < size; i++) {
+        if (s->partial == 0x100) {
+            s->partial = buf[i];
+            continue;
+        }
+        put = (s->buf_get + s->buf_count) % FM3_ADC_CHUNK;
+        s->buf[put] = cpu_to_le16(s->partial | (buf[i] << 8));
+        s->buf_count++;
+        s->partial = 0x100;
+    }
+}
+
+/*
+ * conversion
+ */
+
+static void fm3_adc_update_irq(Fm3AdcState *s)
+{
+    uint32_t mon = 0;
+
+    if ((s->adcr & FM3_ADC_REG_ADCR_SCIF) && (s->adcr & FM3_ADC_REG_ADCR_SCIE))
+        mon |= FM3_ADC_MON_SCIRQ;
+    if ((s->adcr & FM3_ADC_REG_ADCR_PCIF) && (s->adcr & FM3_ADC_REG_ADCR_PCIE))
+        mon |= FM3_ADC_MON_PCIRQ;
+    if (((s->sccr & FM3_ADC_REG_SCCR_SOVR) || (s->pccr & FM3_ADC_REG_PCCR_POVR))
+        && (s->adcr & FM3_ADC_REG_ADCR_OVRIE))
+        mon |= FM3_ADC_MON_ORIRQ;
+    if ((s->adcr & FM3_ADC_REG_ADCR_CMPF) && (s->adcr & FM3_ADC_REG_ADCR_CMPIE))
+        mon |= FM3_ADC_MON_CMPIRQ;
+
+    if (mon != s->mon) {
+        s->mon = mon;
+        fm3_int_set_mon(FM3_IRQ_ADC(s->unit), 0xf, mon);
+        qemu_set_irq(s->irq, mon != 0);
+    }
+}
+
+/* conversion time of a channel: sampling time plus 14 compare clocks */
+static int64_t fm3_adc_get_conv_ns(Fm3AdcState *s, uint32_t ch)
+{
+    uint32_t adst = (s->adss >> ch) & 1 ? s->adst1 : s->adst0;
+    uint64_t cycles;
+
+    cycles = (uint64_t)((adst & 0x1f) + 1) * fm3_adc_stx[(adst >> 5) & 7];
+    cycles += 14 * ((s->adct & 0xff) + 2);
+    return muldiv64(cycles, get_ticks_per_sec(), s->clk_hz);
+}
+
+/* next selected channel at or after ch, or FM3_ADC_CH_NUM */
+static uint32_t fm3_adc_next_ch(uint32_t scis, uint32_t ch)
+{
+    if (FM3_ADC_CH_NUM <= ch || !(scis >> ch))
+        return FM3_ADC_CH_NUM;
+    return ch + ctz32(scis >> ch);
+}
+
+static void fm3_adc_compare(Fm3AdcState *s, uint32_t ch, uint32_t value)
+{
+    bool hit;
+
+    if (!(s->cmpcr & FM3_ADC_REG_CMPCR_CMPEN))
+        return;
+    if (!(s->cmpcr & FM3_ADC_REG_CMPCR_CMD0) && ch != (s->cmpcr & 0x1f))
+        return;
+
+    /* CMPD holds the upper 10 bits */
+    hit = (value >> 2) >= ((s->cmpd >> 6) & 0x3ff);
+    if (!(s->cmpcr & FM3_ADC_REG_CMPCR_CMD1))
+        hit = !hit;
+    if (hit)
+        s->adcr |= FM3_ADC_REG_ADCR_CMPF;
+}
+
+static bool fm3_adc_fifo_push(Fm3AdcFifo *f, uint32_t depth, uint32_t data)
+{
+    if (depth <= f->count)
+        return false;
+    f->data[(f->get + f->count) % depth] = data;
+    f->count++;
+    return true;
+}
+
+static uint32_t fm3_adc_fifo_pop(Fm3AdcFifo *f, uint32_t depth)
+{
+    uint32_t data;
+
+    if (!f->count)
+        return FM3_ADC_FD_INVL;
+    data = f->data[f->get];
+    f->get = (f->get + 1) % depth;
+    f->count--;
+    return data;
+}
+
+static uint32_t fm3_adc_fifo_peek(Fm3AdcFifo *f)
+{
+    if (!f->count)
+        return FM3_ADC_FD_INVL;
+    return f->data[f->get];
+}
+
+/* a word, or an access to the upper half word holding SD, pops the FIFO;
+ * SCFDL/PCFDL only hold status and leave the entry in place */
+static uint32_t fm3_adc_fifo_read(Fm3AdcFifo *f, uint32_t depth,
+                                  hwaddr offset, unsigned size)
+{
+    if (size == 4 || (offset & 3) >= 2)
+        return fm3_adc_fifo_pop(f, depth);
+    return fm3_adc_fifo_peek(f);
+}
+
+static void fm3_adc_scan_convert(Fm3AdcState *s)
+{
+    uint32_t value = fm3_adc_next_sample(s);
+
+    fm3_adc_compare(s, s->scan_ch, value);
+    if (!fm3_adc_fifo_push(&s->scan_fifo, FM3_ADC_SCAN_FIFO,
+                           FM3_ADC_FD_SD(value) | FM3_ADC_FD_RS_SOFTWARE |
+                           FM3_ADC_FD_SC(s->scan_ch))) {
+        s->sccr |= FM3_ADC_REG_SCCR_SOVR;
+    } else if (s->sfns + 1 <= s->scan_fifo.count) {
+        s->adcr |= FM3_ADC_REG_ADCR_SCIF;
+    }
+}
+
+/* moves the scan to the channel after the one just converted */
+static void fm3_adc_scan_advance(Fm3AdcState *s)
+{
+    s->scan_ch = fm3_adc_next_ch(s->scis, s->scan_ch + 1);
+    if (s->scan_ch < FM3_ADC_CH_NUM)
+        return;
+
+    /* end of a scan */
+    if (!(s->sccr & FM3_ADC_REG_SCCR_RPT) || !s->scis) {
+        s->adsr &= ~FM3_ADC_REG_ADSR_SCS;
+        s->adcr |= FM3_ADC_REG_ADCR_SCIF;
+        return;
+    }
+    s->scan_ch = fm3_adc_next_ch(s->scis, 0);
+}
+
+static int64_t fm3_adc_get_round_ns(Fm3AdcState *s)
+{
+    int64_t t = 0;
+    uint32_t ch;
+
+    for (ch = fm3_adc_next_ch(s->scis, 0); ch < FM3_ADC_CH_NUM;
+         ch = fm3_adc_next_ch(s->scis, ch + 1)) {
+        t += fm3_adc_get_conv_ns(s, ch);
+    }
+    return t;
+}
+
+/* Does the scan conversions due by now. */
+static void fm3_adc_scan_catch_up(Fm3AdcState *s, int64_t now)
+{
+    int64_t t, round;
+    uint64_t rounds;
+
+    while (s->adsr & FM3_ADC_REG_ADSR_SCS) {
+        /* a full FIFO in repeat mode only drops conversions: skip whole
+         * scan rounds at once after a long idle period */
+        if (s->scan_fifo.count == FM3_ADC_SCAN_FIFO &&
+            (s->sccr & FM3_ADC_REG_SCCR_RPT) &&
+            !(s->cmpcr & FM3_ADC_REG_CMPCR_CMPEN) &&
+            s->scan_ch == fm3_adc_next_ch(s->scis, 0)) {
+            round = fm3_adc_get_round_ns(s);
+            rounds = round ? (now - s->scan_start) / round : 0;
+            if (rounds) {
+                fm3_adc_skip_samples(s, rounds * ctpop32(s->scis));
+                s->scan_start += rounds * round;
+                s->sccr |= FM3_ADC_REG_SCCR_SOVR;
+            }
+        }
+
+        t = fm3_adc_get_conv_ns(s, s->scan_ch);
+        if (now < s->scan_start + t)
+            break;
+        fm3_adc_scan_convert(s);
+        s->scan_start += t;
+        fm3_adc_scan_advance(s);
+    }
+}
+
+/* Arms the timer for the first coming conversion that raises an enabled
+ * interrupt; other conversions are left to fm3_adc_scan_catch_up(). */
+static void fm3_adc_scan_schedule(Fm3AdcState *s)
+{
+    bool scif = (s->adcr & FM3_ADC_REG_ADCR_SCIE) &&
+                !(s->adcr & FM3_ADC_REG_ADCR_SCIF);
+    bool ovr = (s->adcr & FM3_ADC_REG_ADCR_OVRIE) &&
+               !(s->sccr & FM3_ADC_REG_SCCR_SOVR);
+    bool rpt = s->sccr & FM3_ADC_REG_SCCR_RPT;
+    uint32_t ch = s->scan_ch;
+    uint32_t count = s->scan_fifo.count;
+    int64_t t = s->scan_start;
+
+    if (!(s->adsr & FM3_ADC_REG_ADSR_SCS) || !s->scis) {
+        timer_del(s->scan_timer);
+        return;
+    }
+
+    if ((s->adcr & FM3_ADC_REG_ADCR_CMPIE) &&
+        (s->cmpcr & FM3_ADC_REG_CMPCR_CMPEN)) {
+        /* every result may match */
+        timer_mod(s->scan_timer, t + fm3_adc_get_conv_ns(s, ch));
+        return;
+    }
+
+    for (;;) {
+        t += fm3_adc_get_conv_ns(s, ch);
+        count++;
+        if (scif && s->sfns + 1 <= count && count <= FM3_ADC_SCAN_FIFO)
+            break;
+        if (ovr && FM3_ADC_SCAN_FIFO < count)
+            break;
+        ch = fm3_adc_next_ch(s->scis, ch + 1);
+        if (ch == FM3_ADC_CH_NUM) {
+            if (!rpt) {
+                /* end of the scan */
+                if (s->adcr & FM3_ADC_REG_ADCR_SCIE)
+                    break;
+                timer_del(s->scan_timer);
+                return;
+            }
+            ch = fm3_adc_next_ch(s->scis, 0);
+        }
+        if (rpt && FM3_ADC_SCAN_FIFO < count && !ovr) {
+            /* nothing to tell until the guest looks */
+            timer_del(s->scan_timer);
+            return;
+        }
+    }
+    timer_mod(s->scan_timer, t);
+}
+
+static void fm3_adc_sync(Fm3AdcState *s)
+{
+    fm3_adc_scan_catch_up(s, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+}
+
+static void fm3_adc_update(Fm3AdcState *s)
+{
+    fm3_adc_scan_schedule(s);
+    fm3_adc_update_irq(s);
+}
+
+static void fm3_adc_scan_timer_cb(void *opaque)
+{
+    Fm3AdcState *s = (Fm3AdcState *)opaque;
+
+    fm3_adc_sync(s);
+    fm3_adc_update(s);
+}
+
+static void fm3_adc_scan_start(Fm3AdcState *s)
+{
+    if (s->sccr & FM3_ADC_REG_SCCR_SHEN)
+        printf("FM3_ADC: unit%d scan timer start is not supported\n", s->unit);
+    if (!s->scis)
+        return;
+    s->scan_ch = fm3_adc_next_ch(s->scis, 0);
+    s->scan_start = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    s->adsr |= FM3_ADC_REG_ADSR_SCS;
+}
+
+/* level 1 is the external trigger, level 2 the software/timer start */
+static void fm3_adc_prio_start(Fm3AdcState *s, int level)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    int64_t t;
+
+    if (s->pccr & (FM3_ADC_REG_PCCR_PHEN | FM3_ADC_REG_PCCR_PEEN))
+        printf("FM3_ADC: unit%d priority timer/external start is not "
+               "supported\n", s->unit);
+    if (s->adsr & FM3_ADC_REG_ADSR_PCS)
+        return;
+
+    /* P1A: priority level 1 channel, P2A: priority level 2 channel */
+    if (level == 1)
+        s->prio_ch = s->pcis & 7;
+    else
+        s->prio_ch = (s->pcis >> 3) & 0x1f;
+    t = fm3_adc_get_conv_ns(s, s->prio_ch);
+    s->adsr |= FM3_ADC_REG_ADSR_PCS;
+    /* the scan waits while the priority conversion runs */
+    if (s->adsr & FM3_ADC_REG_ADSR_SCS)
+        s->scan_start += t;
+    timer_mod(s->prio_timer, now + t);
+}
+
+static void fm3_adc_prio_timer_cb(void *opaque)
+{
+    Fm3AdcState *s = (Fm3AdcState *)opaque;
+    uint32_t value;
+
+    fm3_adc_sync(s);
+    s->adsr &= ~FM3_ADC_REG_ADSR_PCS;
+    value = fm3_adc_next_sample(s);
+    fm3_adc_compare(s, s->prio_ch, value);
+    if (!fm3_adc_fifo_push(&s->prio_fifo, FM3_ADC_PRIO_FIFO,
+                           FM3_ADC_FD_SD(value) | FM3_ADC_FD_RS_SOFTWARE |
+                           FM3_ADC_FD_SC(s->prio_ch))) {
+        s->pccr |= FM3_ADC_REG_PCCR_POVR;
+    } else if ((s->pfns & 3) + 1 <= s->prio_fifo.count) {
+        s->adcr |= FM3_ADC_REG_ADCR_PCIF;
+    }
+    fm3_adc_update(s);
+}
+
+/* PCLK2 has changed: the conversions due so far are done at the old rate,
+ * the ones in progress finish their remaining cycles at the new rate. */
+static void fm3_adc_clk_changed(Notifier *n, void *data)
+{
+    Fm3AdcState *s = container_of(n, Fm3AdcState, clk_notifier);
+    Fm3ClkChange *c = data;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    fm3_adc_scan_catch_up(s, now);
+    s->clk_hz = c->hz;
+    if (s->adsr & FM3_ADC_REG_ADSR_SCS)
+        s->scan_start = fm3_clk_rescale(s->scan_start, now, c);
+    if (timer_pending(s->prio_timer))
+        timer_mod(s->prio_timer,
+                  fm3_clk_rescale(timer_expire_time_ns(s->prio_timer), now, c));
+    fm3_adc_update(s);
+}
+
+/* The DMAC has served a scan FIFO request: the request is cleared. */
+void fm3_adc_dma_ack(int unit)
+{
+    Fm3AdcState *s;
+
+    if (unit < 0 || 3 <= unit || !(s = fm3_adc_state[unit]))
+        return;
+    s->adcr &= ~FM3_ADC_REG_ADCR_SCIF;
+    fm3_adc_update(s);
+}
+
+/*
+ * registers
+ */
+
+static uint32_t fm3_adc_get_sccr(Fm3AdcState *s)
+{
+    uint32_t value = s->sccr & ~(FM3_ADC_REG_SCCR_SFUL | FM3_ADC_REG_SCCR_SEMP);
+
+    if (s->scan_fifo.count == FM3_ADC_SCAN_FIFO)
+        value |= FM3_ADC_REG_SCCR_SFUL;
+    if (!s->scan_fifo.count)
+        value |= FM3_ADC_REG_SCCR_SEMP;
+    return value;
+}
+
+static uint32_t fm3_adc_get_pccr(Fm3AdcState *s)
+{
+    uint32_t value = s->pccr & ~(FM3_ADC_REG_PCCR_PFUL | FM3_ADC_REG_PCCR_PEMP);
+
+    if (s->prio_fifo.count == FM3_ADC_PRIO_FIFO)
+        value |= FM3_ADC_REG_PCCR_PFUL;
+    if (!s->prio_fifo.count)
+        value |= FM3_ADC_REG_PCCR_PEMP;
+    return value;
+}
+
+static uint32_t fm3_adc_read_byte(Fm3AdcState *s, hwaddr offset)
+{
+    switch (offset) {
+    case FM3_ADC_REG_ADSR:
+        return s->adsr;
+    case FM3_ADC_REG_ADCR:
+        return s->adcr;
+    case FM3_ADC_REG_SFNS:
+        return s->sfns;
+    case FM3_ADC_REG_SCCR:
+        return fm3_adc_get_sccr(s);
+    case FM3_ADC_REG_SCIS23:
+    case FM3_ADC_REG_SCIS23 + 1:
+        return (s->scis >> ((offset - FM3_ADC_REG_SCIS23 + 2) * 8)) & 0xff;
+    case FM3_ADC_REG_SCIS01:
+    case FM3_ADC_REG_SCIS01 + 1:
+        return (s->scis >> ((offset - FM3_ADC_REG_SCIS01) * 8)) & 0xff;
+    case FM3_ADC_REG_PFNS:
+        return s->pfns;
+    case FM3_ADC_REG_PCCR:
+        return fm3_adc_get_pccr(s);
+    case FM3_ADC_REG_PCIS:
+        return s->pcis;
+    case FM3_ADC_REG_CMPCR:
+        return s->cmpcr;
+    case FM3_ADC_REG_CMPD:
+    case FM3_ADC_REG_CMPD + 1:
+        return (s->cmpd >> ((offset - FM3_ADC_REG_CMPD) * 8)) & 0xff;
+    case FM3_ADC_REG_ADSS23:
+    case FM3_ADC_REG_ADSS23 + 1:
+        return (s->adss >> ((offset - FM3_ADC_REG_ADSS23 + 2) * 8)) & 0xff;
+    case FM3_ADC_REG_ADSS01:
+    case FM3_ADC_REG_ADSS01 + 1:
+        return (s->adss >> ((offset - FM3_ADC_REG_ADSS01) * 8)) & 0xff;
+    case FM3_ADC_REG_ADST1:
+        return s->adst1;
+    case FM3_ADC_REG_ADST0:
+        return s->adst0;
+    case FM3_ADC_REG_ADCT:
+        return s->adct;
+    case FM3_ADC_REG_PRTSL:
+        return s->prtsl;
+    case FM3_ADC_REG_SCTSL:
+        return s->sctsl;
+    }
+    return 0;
+}
+
+static void fm3_adc_write_byte(Fm3AdcState *s, hwaddr offset, uint32_t value)
+{
+    uint32_t shift;
+
+    switch (offset) {
+    case FM3_ADC_REG_ADSR:
+        if (value & FM3_ADC_REG_ADSR_ADSTP) {
+            /* forced stop */
+            s->adsr &= ~(FM3_ADC_REG_ADSR_SCS | FM3_ADC_REG_ADSR_PCS);
+            timer_del(s->prio_timer);
+        }
+        s->adsr = (s->adsr & ~FM3_ADC_REG_ADSR_FDAS) |
+                  (value & FM3_ADC_REG_ADSR_FDAS);
+        break;
+    case FM3_ADC_REG_ADCR:
+        /* flags are cleared by writing 0 */
+        s->adcr = (value & ~FM3_ADC_REG_ADCR_FLAGS) |
+                  (s->adcr & value & FM3_ADC_REG_ADCR_FLAGS);
+        break;
+    case FM3_ADC_REG_SFNS:
+        s->sfns = value & 0xf;
+        break;
+    case FM3_ADC_REG_SCCR:
+        if (value & FM3_ADC_REG_SCCR_SFCLR) {
+            s->scan_fifo.get = 0;
+            s->scan_fifo.count = 0;
+        }
+        s->sccr = (value & (FM3_ADC_REG_SCCR_SHEN | FM3_ADC_REG_SCCR_RPT)) |
+                  (s->sccr & value & FM3_ADC_REG_SCCR_SOVR);
+        if (value & FM3_ADC_REG_SCCR_SSTR)
+            fm3_adc_scan_start(s);
+        break;
+    case FM3_ADC_REG_SCIS23:
+    case FM3_ADC_REG_SCIS23 + 1:
+    case FM3_ADC_REG_SCIS01:
+    case FM3_ADC_REG_SCIS01 + 1:
+        if (offset < FM3_ADC_REG_SCIS01)
+            shift = (offset - FM3_ADC_REG_SCIS23 + 2) * 8;
+        else
+            shift = (offset - FM3_ADC_REG_SCIS01) * 8;
+        s->scis = (s->scis & ~(0xff << shift)) | (value << shift);
+        if (s->adsr & FM3_ADC_REG_ADSR_SCS) {
+            /* the next conversion follows the new selection */
+            s->scan_ch = fm3_adc_next_ch(s->scis, s->scan_ch);
+            if (s->scan_ch == FM3_ADC_CH_NUM)
+                s->scan_ch = fm3_adc_next_ch(s->scis, 0);
+            if (s->scan_ch == FM3_ADC_CH_NUM)
+                s->adsr &= ~FM3_ADC_REG_ADSR_SCS;
+        }
+        break;
+    case FM3_ADC_REG_PFNS:
+        s->pfns = value & 3;
+        break;
+    case FM3_ADC_REG_PCCR:
+        if (value & FM3_ADC_REG_PCCR_PFCLR) {
+            s->prio_fifo.get = 0;
+            s->prio_fifo.count = 0;
+        }
+        s->pccr = (value & (FM3_ADC_REG_PCCR_PHEN | FM3_ADC_REG_PCCR_PEEN)) |
+                  (s->pccr & value & FM3_ADC_REG_PCCR_POVR);
+        if (value & FM3_ADC_REG_PCCR_PSTR)
+            fm3_adc_prio_start(s, 2);
+        break;
+    case FM3_ADC_REG_PCIS:
+        s->pcis = value;
+        break;
+    case FM3_ADC_REG_CMPCR:
+        s->cmpcr = value;
+        break;
+    case FM3_ADC_REG_CMPD:
+    case FM3_ADC_REG_CMPD + 1:
+        shift = (offset - FM3_ADC_REG_CMPD) * 8;
+        s->cmpd = (s->cmpd & ~(0xff << shift)) | (value << shift);
+        break;
+    case FM3_ADC_REG_ADSS23:
+    case FM3_ADC_REG_ADSS23 + 1:
+    case FM3_ADC_REG_ADSS01:
+    case FM3_ADC_REG_ADSS01 + 1:
+        if (offset < FM3_ADC_REG_ADSS01)
+            shift = (offset - FM3_ADC_REG_ADSS23 + 2) * 8;
+        else
+            shift = (offset - FM3_ADC_REG_ADSS01) * 8;
+        s->adss = (s->adss & ~(0xff << shift)) | (value << shift);
+        break;
+    case FM3_ADC_REG_ADST1:
+        s->adst1 = value;
+        break;
+    case FM3_ADC_REG_ADST0:
+        s->adst0 = value;
+        break;
+    case FM3_ADC_REG_ADCT:
+        s->adct = value;
+        break;
+    case FM3_ADC_REG_PRTSL:
+        s->prtsl = value;
+        break;
+    case FM3_ADC_REG_SCTSL:
+        s->sctsl = value;
+        break;
+    }
+}
+
+static uint64_t fm3_adc_read(void *opaque, hwaddr offset, unsigned size)
+{
+    Fm3AdcState *s = (Fm3AdcState *)opaque;
+    uint64_t retval = 0;
+    unsigned i;
+
+    fm3_adc_sync(s);
+
+    if ((offset & ~3) == FM3_ADC_REG_SCFD) {
+        retval = fm3_adc_fifo_read(&s->scan_fifo, FM3_ADC_SCAN_FIFO,
+                                   offset, size);
+        retval >>= (offset & 3) * 8;
+    } else if ((offset & ~3) == FM3_ADC_REG_PCFD) {
+        retval = fm3_adc_fifo_read(&s->prio_fifo, FM3_ADC_PRIO_FIFO,
+                                   offset, size);
+        retval >>= (offset & 3) * 8;
+    } else {
+        for (i = 0; i < size; i++) {
+            retval |= (uint64_t)fm3_adc_read_byte(s, offset + i) << (i * 8);
+        }
+    }
+    if (size < 4)
+        retval &= (1ULL << (size * 8)) - 1;
+
+    fm3_adc_update(s);
+    DPRINTF("%s : 0x%02x ---> 0x%08x\n", __func__, (uint32_t)offset,
+            (uint32_t)retval);
+    return retval;
+}
+
+static void fm3_adc_write(void *opaque, hwaddr offset,
+                          uint64_t value, unsigned size)
+{
+    Fm3AdcState *s = (Fm3AdcState *)opaque;
+    unsigned i;
+
+    DPRINTF("%s : 0x%02x <--- 0x%08x\n", __func__, (uint32_t)offset,
+            (uint32_t)value);
+
+    /* conversions so far are done with the old settings */
+    fm3_adc_sync(s);
+    for (i = 0; i < size; i++) {
+        fm3_adc_write_byte(s, offset + i, (value >> (i * 8)) & 0xff);
+    }
+    fm3_adc_update(s);
+}
+
+static const MemoryRegionOps fm3_adc_mem_ops = {
+    .read = fm3_adc_read,
+    .write = fm3_adc_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+};
+
+static void fm3_adc_reset(DeviceState *d)
+{
+    Fm3AdcState *s = FM3_ADC(d);
+
+    timer_del(s->scan_timer);
+    timer_del(s->prio_timer);
+    s->adsr = 0;
+    s->adcr = 0;
+    s->sfns = 0;
+    s->sccr = 0;
+    s->scis = 0;
+    s->pfns = 0;
+    s->pccr = 0;
+    s->pcis = 0;
+    s->cmpcr = 0;
+    s->cmpd = 0;
+    s->adss = 0;
+    s->adst0 = 0x0f;
+    s->adst1 = 0x0f;
+    s->adct = 0x07;
+    s->prtsl = 0;
+    s->sctsl = 0;
+    memset(&s->scan_fifo, 0, sizeof(s->scan_fifo));
+    memset(&s->prio_fifo, 0, sizeof(s->prio_fifo));
+    s->scan_ch = 0;
+    s->scan_start = 0;
+    s->prio_ch = 0;
+    fm3_adc_update_irq(s);
+}
+
+static int fm3_adc_init(SysBusDevice *dev)
+{
+    Fm3AdcState *s = FM3_ADC(dev);
+
+    if (3 <= s->unit) {
+        error_report("fm3 adc: invalid unit %d", s->unit);
+        return -1;
+    }
+    if (s->samples_path && s->chr) {
+        error_report("fm3 adc: samples and chardev are exclusive");
+        return -1;
+    }
+    if (s->samples_path) {
+        s->file = fopen(s->samples_path, "rb");
+        if (!s->file) {
+            error_report("fm3 adc: cannot open '%s': %s", s->samples_path,
+                         strerror(errno));
+            return -1;
+        }
+    }
+    s->partial = 0x100;
+    if (s->chr)
+        qemu_chr_add_handlers(s->chr, fm3_adc_can_receive, fm3_adc_receive,
+                              NULL, s);
+
+    s->scan_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, fm3_adc_scan_timer_cb, s);
+    s->prio_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, fm3_adc_prio_timer_cb, s);
+    sysbus_init_irq(dev, &s->irq);
+    s->clk_hz = fm3_clk_get_hz(FM3_CLK_PCLK2);
+    s->clk_notifier.notify = fm3_adc_clk_changed;
+    fm3_clk_add_notifier(FM3_CLK_PCLK2, &s->clk_notifier);
+
+    memory_region_init_io(&s->mmio, OBJECT(s), &fm3_adc_mem_ops, s,
+                          TYPE_FM3_ADC, 0x100);
+    sysbus_init_mmio(dev, &s->mmio);
+    fm3_adc_state[s->unit] = s;
+    return 0;
+}
+
+static const VMStateDescription vmstate_fm3_adc_fifo = {
+    .name = "fm3.adc/fifo",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(data, Fm3AdcFifo, FM3_ADC_SCAN_FIFO),
+        VMSTATE_UINT32(get, Fm3AdcFifo),
+        VMSTATE_UINT32(count, Fm3AdcFifo),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_fm3_adc = {
+    .name = TYPE_FM3_ADC,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(adsr, Fm3AdcState),
+        VMSTATE_UINT32(adcr, Fm3AdcState),
+        VMSTATE_UINT32(sfns, Fm3AdcState),
+        VMSTATE_UINT32(sccr, Fm3AdcState),
+        VMSTATE_UINT32(scis, Fm3AdcState),
+        VMSTATE_UINT32(pfns, Fm3AdcState),
+        VMSTATE_UINT32(pccr, Fm3AdcState),
+        VMSTATE_UINT32(pcis, Fm3AdcState),
+        VMSTATE_UINT32(cmpcr, Fm3AdcState),
+        VMSTATE_UINT32(cmpd, Fm3AdcState),
+        VMSTATE_UINT32(adss, Fm3AdcState),
+        VMSTATE_UINT32(adst0, Fm3AdcState),
+        VMSTATE_UINT32(adst1, Fm3AdcState),
+        VMSTATE_UINT32(adct, Fm3AdcState),
+        VMSTATE_UINT32(prtsl, Fm3AdcState),
+        VMSTATE_UINT32(sctsl, Fm3AdcState),
+        VMSTATE_STRUCT(scan_fifo, Fm3AdcState, 1, vmstate_fm3_adc_fifo,
+                       Fm3AdcFifo),
+        VMSTATE_STRUCT(prio_fifo, Fm3AdcState, 1, vmstate_fm3_adc_fifo,
+                       Fm3AdcFifo),
+        VMSTATE_UINT32(scan_ch, Fm3AdcState),
+        VMSTATE_INT64(scan_start, Fm3AdcState),
+        VMSTATE_UINT32(prio_ch, Fm3AdcState),
+        VMSTATE_UINT32(mon, Fm3AdcState),
+        VMSTATE_UINT32(clk_hz, Fm3AdcState),
+        VMSTATE_TIMER(scan_timer, Fm3AdcState),
+        VMSTATE_TIMER(prio_timer, Fm3AdcState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property fm3_adc_properties[] = {
+    DEFINE_PROP_UINT32("unit", Fm3AdcState, unit, 0),
+    DEFINE_PROP_STRING("samples", Fm3AdcState, samples_path),
+    DEFINE_PROP_CHR("chardev", Fm3AdcState, chr),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void fm3_adc_class_init(ObjectClass *klass, void *data)
+{
+	DeviceClass			*dc	= DEVICE_CLASS(klass);
+	SysBusDeviceClass	*k	= SYS_BUS_DEVICE_CLASS(klass);
+
+	k->init		= fm3_adc_init;
+	dc->desc	= TYPE_FM3_ADC;
+	dc->reset	= fm3_adc_reset;
+	dc->vmsd	= &vmstate_fm3_adc;
+	dc->props	= fm3_adc_properties;
+}
+
+static const TypeInfo fm3_adc_info = {
+	.name			= TYPE_FM3_ADC,
+	.parent			= TYPE_SYS_BUS_DEVICE,
+	.instance_size	= sizeof(Fm3AdcState),
+	.class_init		= fm3_adc_class_init,
+};
+
+static void fm3_register_devices(void)
+{
+    type_register_static(&fm3_adc_info);
+}
+
+type_init(fm3_register_devices)
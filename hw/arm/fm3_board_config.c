@@ -49,6 +49,21 @@ int fm3_board_get_exti_pin(int exti_no)
     return pin_no[exti_no];
 }
 
+/* Port driving the chip select of the SPI device on a CSIO channel */
+int fm3_board_get_csio_cs_port(int csio_ch)
+{
+    static const int port_no[FM3_MFS_NUM] = {
+        [0 ... 5] = -1,
+        [6] = 0x56, /* ch6(SCK6_0, SOT6_0, SIN6_0), CS on P56 */
+        [7] = -1,
+    };
+
+    if (7 < csio_ch)
+        return -1;
+
+    return port_no[csio_ch];
+}
+
 int fm3_board_port_to_uart(int port_no)
 {
     switch (port_no) {
@@ -15,6 +15,7 @@ int fm3_board_get_uart_pin(int uart_ch, int tx);
 #define fm3_board_get_uart_tx_pin(uart_ch) fm3_board_get_uart_pin(uart_ch, 1)
 
 int fm3_board_get_exti_pin(int exti_no);
+int fm3_board_get_csio_cs_port(int csio_ch);
 int fm3_board_port_to_uart(int port_no);
 int fm3_board_port_to_extint(int port_no);
 int fm3_board_get_port_info(int port_no);
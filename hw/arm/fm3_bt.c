@@ -0,0 +1,744 @@
+/*
+ * Fujitsu FM3 Base Timer
+ *
+ * This code is licensed under the GNU GPL v2.
+ *
+ * Reload timer, PWM, PPG and PWC modes of the 8 base timer channels.
+ * Counting is left to ptimer, so the counter is only computed when TMR
+ * is read and a host timer fires once per cycle (and once more at the
+ * duty/width edge of PWM/PPG), never per count.
+ */
+
+#include "hw/sysbus.h"
+#include "hw/arm/arm.h"
+#include "hw/ptimer.h"
+#include "qemu/main-loop.h"
+#include "fm3.h"
+
+//#define FM3_DEBUG_BT
+#define TYPE_FM3_BT     "fm3.bt"
+
+#ifdef FM3_DEBUG_BT
+#define DPRINTF(fmt, ...)                                       \
+    do { printf(fmt, ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) do { } while (0)
+#endif
+
+/* channel registers */
+#define FM3_BT_REG_PCSR             (0x00)  /* PCSR/PRLL */
+#define FM3_BT_REG_PDUT             (0x04)  /* PDUT/PRLH/DTBF */
+#define FM3_BT_REG_TMR              (0x08)
+#define FM3_BT_REG_TMCR             (0x0C)
+#define FM3_BT_REG_TMCR_STRG        (1 << 0)
+#define FM3_BT_REG_TMCR_CTEN        (1 << 1)
+#define FM3_BT_REG_TMCR_MDSE        (1 << 2)
+#define FM3_BT_REG_TMCR_OSEL        (1 << 3)
+#define FM3_BT_REG_TMCR_T32         (1 << 7)
+#define FM3_BT_REG_TMCR_PMSK        (1 << 10)
+#define FM3_BT_REG_TMCR_RTGEN       (1 << 11)
+#define FM3_BT_REG_STC              (0x10)
+#define FM3_BT_REG_STC_UDIR         (1 << 0)    /* PWC: OVIR */
+#define FM3_BT_REG_STC_DTIR         (1 << 1)
+#define FM3_BT_REG_STC_TGIR         (1 << 2)    /* PWC: EDIR */
+#define FM3_BT_REG_STC_UDIE         (1 << 4)    /* PWC: OVIE */
+#define FM3_BT_REG_STC_DTIE         (1 << 5)
+#define FM3_BT_REG_STC_TGIE         (1 << 6)    /* PWC: EDIE */
+#define FM3_BT_REG_STC_ERR          (1 << 7)    /* PWC only */
+#define FM3_BT_REG_STC_REQ          (0x07)
+#define FM3_BT_REG_STC_IE           (0x70)
+#define FM3_BT_REG_TMCR2            (0x11)
+#define FM3_BT_REG_TMCR2_CKS3       (1 << 0)
+
+#define get_fmd(tmcr)               (((tmcr) >> 4) & 7)
+#define get_egs(tmcr)               (((tmcr) >> 8) & 3)
+#define get_cks(s)                  ((((s)->tmcr >> 12) & 7) | \
+                                     (((s)->tmcr2 & FM3_BT_REG_TMCR2_CKS3) << 3))
+
+/* common registers */
+#define FM3_BT_REG_BTSEL0123        (0x101)
+#define FM3_BT_REG_BTSEL4567        (0x301)
+#define FM3_BT_REG_BTSSSR           (0xFFC)
+
+enum {
+    FM3_BT_FMD_RESET = 0,
+    FM3_BT_FMD_PWM,
+    FM3_BT_FMD_PPG,
+    FM3_BT_FMD_RT,
+    FM3_BT_FMD_PWC,
+};
+
+/* EGS1-0: trigger edge (PWM/PPG/RT) or measured edges (PWC) */
+enum {
+    FM3_BT_EGS_NONE = 0,        /* PWC: "H" width (rising -> falling) */
+    FM3_BT_EGS_RISING,          /* PWC: cycle (rising -> rising) */
+    FM3_BT_EGS_FALLING,         /* PWC: cycle (falling -> falling) */
+    FM3_BT_EGS_BOTH,            /* PWC: "L" width (falling -> rising) */
+};
+
+#define FM3_BT_NUM                  8
+
+typedef struct Fm3BtState Fm3BtState;
+
+typedef struct {
+    Fm3BtState *bt;
+    uint32_t ch_no;
+    uint32_t pcsr;          /* PCSR/PRLL */
+    uint32_t pdut;          /* PDUT/PRLH */
+    uint32_t dtbf;          /* PWC result */
+    uint32_t tmr;           /* TMR while the counter is stopped */
+    uint32_t tmcr;
+    uint32_t stc;
+    uint32_t tmcr2;
+    bool running;
+    bool measuring;         /* PWC: between the start and the end edge */
+    uint64_t limit;         /* counts per cycle */
+    int32_t tioa;           /* output level before OSEL/PMSK */
+    int32_t tiob;           /* input level */
+    ptimer_state *timer;    /* underflow (PWC: overflow) */
+    ptimer_state *edge;     /* duty match (PWM) / "L" width end (PPG) */
+} Fm3BtChState;
+
+struct Fm3BtState {
+    SysBusDevice busdev;
+    MemoryRegion mmio;
+    Fm3BtChState ch[FM3_BT_NUM];
+    uint32_t btsel0123;
+    uint32_t btsel4567;
+    uint32_t irq_stat;      /* bit 2n: BTn IRQ0, bit 2n+1: BTn IRQ1 */
+    qemu_irq irq;
+    qemu_irq out[FM3_BT_NUM];   /* TIOA */
+    Notifier clk_notifier;
+};
+#define FM3_BT(obj) \
+    OBJECT_CHECK(Fm3BtState, (obj), TYPE_FM3_BT)
+
+static const uint32_t fm3_bt_clock_div[16] = {
+    1, 4, 16, 128, 256, 0, 0, 0,    /* 0 = external clock */
+    512, 1024, 2048, 0, 0, 0, 0, 0,
+};
+
+static inline Fm3BtChState *fm3_bt_get_partner(Fm3BtChState *s)
+{
+    return &s->bt->ch[s->ch_no ^ 1];
+}
+
+/* the even channel of a 32-bit pair (reload timer/PWC only) */
+static inline bool fm3_bt_is_32bit(Fm3BtChState *s)
+{
+    uint32_t fmd = get_fmd(s->tmcr);
+
+    return !(s->ch_no & 1) && (s->tmcr & FM3_BT_REG_TMCR_T32) &&
+           (fmd == FM3_BT_FMD_RT || fmd == FM3_BT_FMD_PWC);
+}
+
+/* the odd channel serving as the upper half of a 32-bit pair */
+static inline bool fm3_bt_is_upper(Fm3BtChState *s)
+{
+    return (s->ch_no & 1) && fm3_bt_is_32bit(fm3_bt_get_partner(s));
+}
+
+static uint32_t fm3_bt_get_freq(Fm3BtChState *s)
+{
+    uint32_t div = fm3_bt_clock_div[get_cks(s)];
+
+    if (!div) {
+        printf("FM3_BT: ch%d external clock is not supported\n", s->ch_no);
+        return 0;
+    }
+    return fm3_clk_get_hz(FM3_CLK_PCLK1) / div;
+}
+
+static uint64_t fm3_bt_get_cycle(Fm3BtChState *s)
+{
+    switch (get_fmd(s->tmcr)) {
+    case FM3_BT_FMD_RT:
+        if (fm3_bt_is_32bit(s))
+            return ((uint64_t)fm3_bt_get_partner(s)->pcsr << 16 | s->pcsr) + 1;
+        /* fall through */
+    case FM3_BT_FMD_PWM:
+        return (uint64_t)s->pcsr + 1;
+    case FM3_BT_FMD_PPG:
+        return (uint64_t)s->pcsr + 1 + s->pdut + 1;
+    case FM3_BT_FMD_PWC:
+        return fm3_bt_is_32bit(s) ? (1ULL << 32) : (1ULL << 16);
+    default:
+        return 0;
+    }
+}
+
+static void fm3_bt_update_irq(Fm3BtState *bt)
+{
+    Fm3BtChState *s;
+    uint32_t stat = 0;
+    uint32_t req;
+    int i;
+
+    for (i = 0; i < FM3_BT_NUM; i++) {
+        s = &bt->ch[i];
+        req = s->stc & (s->stc >> 4) & FM3_BT_REG_STC_REQ;
+        if (get_fmd(s->tmcr) == FM3_BT_FMD_PWC) {
+            /* overflow and measurement complete */
+            if (req & (FM3_BT_REG_STC_UDIR | FM3_BT_REG_STC_TGIR))
+                stat |= 1 << (i * 2);
+        } else {
+            if (req & (FM3_BT_REG_STC_UDIR | FM3_BT_REG_STC_DTIR))
+                stat |= 1 << (i * 2);
+            if (req & FM3_BT_REG_STC_TGIR)
+                stat |= 2 << (i * 2);
+        }
+    }
+
+    if (stat != bt->irq_stat) {
+        bt->irq_stat = stat;
+        fm3_int_set_mon(FM3_IRQ_BT, 0xffff, stat);
+        qemu_set_irq(bt->irq, stat != 0);
+    }
+}
+
+static void fm3_bt_set_out(Fm3BtChState *s, int level)
+{
+    int osel = !!(s->tmcr & FM3_BT_REG_TMCR_OSEL);
+
+    s->tioa = level;
+    if (s->tmcr & FM3_BT_REG_TMCR_PMSK)
+        level = 0;
+    qemu_set_irq(s->bt->out[s->ch_no], level ^ osel);
+}
+
+static void fm3_bt_stop(Fm3BtChState *s)
+{
+    ptimer_stop(s->timer);
+    ptimer_stop(s->edge);
+    s->running = false;
+    s->measuring = false;
+}
+
+/* count a PWM "L" width / PPG "L" width, the output goes "H" at the end */
+static void fm3_bt_arm_edge(Fm3BtChState *s, uint32_t freq)
+{
+    uint32_t len;
+
+    if (!freq)
+        return;
+
+    if (get_fmd(s->tmcr) == FM3_BT_FMD_PWM) {
+        if (s->pcsr < s->pdut)
+            return;     /* duty never matches: stays "L" */
+        len = s->pcsr - s->pdut;
+    } else {
+        len = s->pcsr + 1;
+    }
+
+    if (len == 0) {
+        fm3_bt_set_out(s, 1);
+        return;
+    }
+    ptimer_set_freq(s->edge, freq);
+    ptimer_set_limit(s->edge, len, 1);
+    ptimer_run(s->edge, 1);
+}
+
+static void fm3_bt_start(Fm3BtChState *s)
+{
+    uint32_t fmd = get_fmd(s->tmcr);
+    uint32_t freq;
+
+    fm3_bt_stop(s);
+    if (fmd == FM3_BT_FMD_RESET || fm3_bt_is_upper(s))
+        return;
+
+    freq = fm3_bt_get_freq(s);
+    if (!freq)
+        return;
+
+    s->running = true;
+    s->limit = fm3_bt_get_cycle(s);
+    ptimer_set_freq(s->timer, freq);
+    ptimer_set_limit(s->timer, s->limit, 1);
+
+    if (fmd == FM3_BT_FMD_PWC) {
+        /* the counter starts at the first valid edge */
+        return;
+    }
+
+    ptimer_run(s->timer, !!(s->tmcr & FM3_BT_REG_TMCR_MDSE));
+    s->stc |= FM3_BT_REG_STC_TGIR;
+    fm3_bt_set_out(s, 0);
+    if (fmd != FM3_BT_FMD_RT)
+        fm3_bt_arm_edge(s, freq);
+}
+
+static void fm3_bt_trigger(Fm3BtChState *s)
+{
+    if (!(s->tmcr & FM3_BT_REG_TMCR_CTEN))
+        return;
+
+    if (s->running && get_fmd(s->tmcr) != FM3_BT_FMD_RT &&
+        !(s->tmcr & FM3_BT_REG_TMCR_RTGEN)) {
+        return;
+    }
+
+    DPRINTF("FM3_BT: ch%d triggered\n", s->ch_no);
+    fm3_bt_start(s);
+    fm3_bt_update_irq(s->bt);
+}
+
+/* PCLK1 has changed: the counts in progress go on at the new rate */
+static void fm3_bt_clk_changed(Notifier *n, void *data)
+{
+    Fm3BtState *bt = container_of(n, Fm3BtState, clk_notifier);
+    Fm3BtChState *s;
+    uint64_t count;
+    uint32_t freq;
+    int i;
+
+    for (i = 0; i < FM3_BT_NUM; i++) {
+        s = &bt->ch[i];
+        if (!s->running)
+            continue;
+        freq = fm3_bt_get_freq(s);
+        if (!freq)
+            continue;
+        count = ptimer_get_count(s->timer);
+        ptimer_set_freq(s->timer, freq);
+        ptimer_set_count(s->timer, count);
+        count = ptimer_get_count(s->edge);
+        ptimer_set_freq(s->edge, freq);
+        ptimer_set_count(s->edge, count);
+    }
+}
+
+static uint64_t fm3_bt_get_elapsed(Fm3BtChState *s)
+{
+    uint64_t count = ptimer_get_count(s->timer);
+
+    if (count == 0 || s->limit < count)
+        return s->limit;
+    return s->limit - count;
+}
+
+static uint32_t fm3_bt_get_tmr(Fm3BtChState *s)
+{
+    uint64_t e;
+
+    if (!s->running)
+        return s->tmr;
+
+    switch (get_fmd(s->tmcr)) {
+    case FM3_BT_FMD_RT:
+    case FM3_BT_FMD_PWM:
+        return s->limit - 1 - fm3_bt_get_elapsed(s);
+    case FM3_BT_FMD_PPG:
+        e = fm3_bt_get_elapsed(s);
+        if (e <= s->pcsr)
+            return s->pcsr - e;
+        return s->pdut - (e - s->pcsr - 1);
+    case FM3_BT_FMD_PWC:
+        return s->measuring ? fm3_bt_get_elapsed(s) : 0;
+    default:
+        return s->tmr;
+    }
+}
+
+static void fm3_bt_timer_cb(void *opaque)
+{
+    Fm3BtChState *s = opaque;
+    uint32_t fmd = get_fmd(s->tmcr);
+    bool oneshot = !!(s->tmcr & FM3_BT_REG_TMCR_MDSE);
+
+    if (!s->running)
+        return;
+
+    /* underflow (PWC: overflow) */
+    s->stc |= FM3_BT_REG_STC_UDIR;
+    switch (fmd) {
+    case FM3_BT_FMD_RT:
+        fm3_bt_set_out(s, !s->tioa);
+        if (oneshot) {
+            s->tmr = s->pcsr;
+            s->running = false;
+        }
+        break;
+    case FM3_BT_FMD_PWM:
+    case FM3_BT_FMD_PPG:
+        fm3_bt_set_out(s, 0);
+        if (oneshot) {
+            s->tmr = s->pcsr;
+            fm3_bt_stop(s);
+        } else {
+            /* PCSR/PDUT written during the cycle take effect here */
+            s->limit = fm3_bt_get_cycle(s);
+            ptimer_set_limit(s->timer, s->limit, 0);
+            fm3_bt_arm_edge(s, fm3_bt_get_freq(s));
+        }
+        break;
+    default:
+        break;
+    }
+    fm3_bt_update_irq(s->bt);
+}
+
+static void fm3_bt_edge_cb(void *opaque)
+{
+    Fm3BtChState *s = opaque;
+
+    if (!s->running)
+        return;
+
+    if (get_fmd(s->tmcr) == FM3_BT_FMD_PWM)
+        s->stc |= FM3_BT_REG_STC_DTIR;
+    fm3_bt_set_out(s, 1);
+    fm3_bt_update_irq(s->bt);
+}
+
+static void fm3_bt_pwc_edge(Fm3BtChState *s, bool rising)
+{
+    uint32_t egs = get_egs(s->tmcr);
+    bool start, end;
+
+    switch (egs) {
+    case FM3_BT_EGS_NONE:
+        start = rising;
+        end = !rising;
+        break;
+    case FM3_BT_EGS_RISING:
+        start = end = rising;
+        break;
+    case FM3_BT_EGS_FALLING:
+        start = end = !rising;
+        break;
+    default:
+        start = !rising;
+        end = rising;
+        break;
+    }
+
+    if (s->measuring && end) {
+        if (s->stc & FM3_BT_REG_STC_TGIR)
+            s->stc |= FM3_BT_REG_STC_ERR;
+        s->dtbf = fm3_bt_get_elapsed(s);
+        s->stc |= FM3_BT_REG_STC_TGIR;
+        ptimer_stop(s->timer);
+        s->measuring = false;
+        if (s->tmcr & FM3_BT_REG_TMCR_MDSE) {
+            s->running = false;
+            s->tmr = s->dtbf;
+            start = false;
+        }
+        fm3_bt_update_irq(s->bt);
+    }
+
+    if (!s->measuring && start) {
+        ptimer_set_limit(s->timer, s->limit, 1);
+        ptimer_run(s->timer, 0);
+        s->measuring = true;
+    }
+}
+
+/* TIOB input */
+static void fm3_bt_set_input(void *opaque, int n, int level)
+{
+    Fm3BtState *bt = opaque;
+    Fm3BtChState *s = &bt->ch[n];
+    bool rising;
+    uint32_t egs;
+
+    level = (level != 0);
+    if (s->tiob == level)
+        return;
+    s->tiob = level;
+    rising = level;
+
+    if (get_fmd(s->tmcr) == FM3_BT_FMD_PWC) {
+        if (s->running)
+            fm3_bt_pwc_edge(s, rising);
+        return;
+    }
+
+    egs = get_egs(s->tmcr);
+    if (egs == FM3_BT_EGS_BOTH ||
+        (egs == FM3_BT_EGS_RISING && rising) ||
+        (egs == FM3_BT_EGS_FALLING && !rising)) {
+        fm3_bt_trigger(s);
+    }
+}
+
+static uint32_t fm3_bt_ch_read(Fm3BtChState *s, hwaddr offset)
+{
+    Fm3BtChState *lo;
+
+    switch (offset) {
+    case FM3_BT_REG_PCSR:
+        return s->pcsr;
+    case FM3_BT_REG_PDUT:
+        if (fm3_bt_is_upper(s))
+            return fm3_bt_get_partner(s)->dtbf >> 16;
+        if (get_fmd(s->tmcr) == FM3_BT_FMD_PWC) {
+            /* reading DTBF clears EDIR */
+            s->stc &= ~(FM3_BT_REG_STC_TGIR | FM3_BT_REG_STC_ERR);
+            fm3_bt_update_irq(s->bt);
+            return s->dtbf & 0xffff;
+        }
+        return s->pdut;
+    case FM3_BT_REG_TMR:
+        if (fm3_bt_is_upper(s)) {
+            lo = fm3_bt_get_partner(s);
+            return fm3_bt_get_tmr(lo) >> 16;
+        }
+        return fm3_bt_get_tmr(s) & 0xffff;
+    case FM3_BT_REG_TMCR:
+        return s->tmcr;
+    case FM3_BT_REG_STC:
+        return s->stc;
+    case FM3_BT_REG_TMCR2:
+        return s->tmcr2;
+    default:
+        return 0;
+    }
+}
+
+static void fm3_bt_ch_write(Fm3BtChState *s, hwaddr offset, uint32_t value)
+{
+    uint32_t old;
+
+    switch (offset) {
+    case FM3_BT_REG_PCSR:
+        s->pcsr = value & 0xffff;
+        break;
+    case FM3_BT_REG_PDUT:
+        if (get_fmd(s->tmcr) != FM3_BT_FMD_PWC)
+            s->pdut = value & 0xffff;
+        break;
+    case FM3_BT_REG_TMCR:
+        old = s->tmcr;
+        s->tmcr = value & ~FM3_BT_REG_TMCR_STRG & 0x7fff;
+        if (get_fmd(old) != get_fmd(s->tmcr)) {
+            /* changing the function resets the channel */
+            fm3_bt_stop(s);
+            s->stc = 0;
+            s->tmr = 0;
+            s->dtbf = 0;
+            fm3_bt_set_out(s, 0);
+        }
+        if (!(s->tmcr & FM3_BT_REG_TMCR_CTEN)) {
+            if (s->running)
+                s->tmr = fm3_bt_get_tmr(s);
+            fm3_bt_stop(s);
+        } else if (value & FM3_BT_REG_TMCR_STRG) {
+            fm3_bt_trigger(s);
+        } else if (get_fmd(s->tmcr) == FM3_BT_FMD_PWC && !s->running) {
+            /* PWC waits for edges as soon as it is enabled */
+            fm3_bt_start(s);
+        }
+        fm3_bt_update_irq(s->bt);
+        break;
+    case FM3_BT_REG_STC:
+        s->stc = (value & FM3_BT_REG_STC_IE) |
+                 (s->stc & value & FM3_BT_REG_STC_REQ) |
+                 (s->stc & FM3_BT_REG_STC_ERR);
+        fm3_bt_update_irq(s->bt);
+        break;
+    case FM3_BT_REG_TMCR2:
+        s->tmcr2 = value & FM3_BT_REG_TMCR2_CKS3;
+        break;
+    default:
+        break;
+    }
+}
+
+static Fm3BtChState *fm3_bt_get_ch(Fm3BtState *bt, hwaddr offset)
+{
+    /* ch0-3: 0x000-0x0FF, ch4-7: 0x200-0x2FF */
+    if (offset & 0x100)
+        return NULL;
+    return &bt->ch[((offset >> 9) & 1) * 4 + ((offset >> 6) & 3)];
+}
+
+static uint64_t fm3_bt_read(void *opaque, hwaddr offset,
+                            unsigned size)
+{
+    Fm3BtState *bt = (Fm3BtState *)opaque;
+    Fm3BtChState *s;
+    uint64_t retval = 0;
+
+    switch (offset) {
+    case FM3_BT_REG_BTSEL0123:
+        retval = bt->btsel0123;
+        break;
+    case FM3_BT_REG_BTSEL4567:
+        retval = bt->btsel4567;
+        break;
+    case FM3_BT_REG_BTSSSR:
+        break;
+    default:
+        s = fm3_bt_get_ch(bt, offset);
+        if (!s || 0x400 <= offset)
+            break;
+        offset &= 0x3f;
+        retval = fm3_bt_ch_read(s, offset);
+        /* STC and TMCR2 share a half word */
+        if (offset == FM3_BT_REG_STC && 1 < size)
+            retval |= fm3_bt_ch_read(s, FM3_BT_REG_TMCR2) << 8;
+        break;
+    }
+
+    DPRINTF("%s : 0x%08x ---> 0x%08x\n", __func__, offset, (uint32_t)retval);
+    return retval;
+}
+
+static void fm3_bt_write(void *opaque, hwaddr offset,
+                         uint64_t value, unsigned size)
+{
+    Fm3BtState *bt = (Fm3BtState *)opaque;
+    Fm3BtChState *s;
+    int i;
+
+    DPRINTF("%s: 0x%08x <--- 0x%08x\n", __func__, offset, (uint32_t)value);
+
+    switch (offset) {
+    case FM3_BT_REG_BTSEL0123:
+        bt->btsel0123 = value & 0xff;
+        break;
+    case FM3_BT_REG_BTSEL4567:
+        bt->btsel4567 = value & 0xff;
+        break;
+    case FM3_BT_REG_BTSSSR:
+        /* simultaneous software start */
+        for (i = 0; i < FM3_BT_NUM; i++) {
+            if ((value >> i) & 1)
+                fm3_bt_trigger(&bt->ch[i]);
+        }
+        break;
+    default:
+        s = fm3_bt_get_ch(bt, offset);
+        if (!s || 0x400 <= offset)
+            break;
+        offset &= 0x3f;
+        fm3_bt_ch_write(s, offset, value);
+        if (offset == FM3_BT_REG_STC && 1 < size)
+            fm3_bt_ch_write(s, FM3_BT_REG_TMCR2, value >> 8);
+        break;
+    }
+}
+
+static const MemoryRegionOps fm3_bt_mem_ops = {
+    .read = fm3_bt_read,
+    .write = fm3_bt_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+};
+
+static void fm3_bt_reset(DeviceState *d)
+{
+    Fm3BtState *bt = FM3_BT(d);
+    Fm3BtChState *s;
+    int i;
+
+    for (i = 0; i < FM3_BT_NUM; i++) {
+        s = &bt->ch[i];
+        fm3_bt_stop(s);
+        s->pcsr = 0;
+        s->pdut = 0;
+        s->dtbf = 0;
+        s->tmr = 0;
+        s->tmcr = 0;
+        s->stc = 0;
+        s->tmcr2 = 0;
+        s->limit = 0;
+        s->tiob = 0;
+        fm3_bt_set_out(s, 0);
+    }
+    bt->btsel0123 = 0;
+    bt->btsel4567 = 0;
+    fm3_bt_update_irq(bt);
+}
+
+static int fm3_bt_init(SysBusDevice *dev)
+{
+    DeviceState *devs = DEVICE(dev);
+    Fm3BtState *bt = FM3_BT(devs);
+    Fm3BtChState *s;
+    int i;
+
+    for (i = 0; i < FM3_BT_NUM; i++) {
+        s = &bt->ch[i];
+        s->bt = bt;
+        s->ch_no = i;
+        s->timer = ptimer_init(qemu_bh_new(fm3_bt_timer_cb, s));
+        s->edge = ptimer_init(qemu_bh_new(fm3_bt_edge_cb, s));
+    }
+    qdev_init_gpio_in(devs, fm3_bt_set_input, FM3_BT_NUM);
+    qdev_init_gpio_out(devs, bt->out, FM3_BT_NUM);
+    sysbus_init_irq(dev, &bt->irq);
+    bt->clk_notifier.notify = fm3_bt_clk_changed;
+    fm3_clk_add_notifier(FM3_CLK_PCLK1, &bt->clk_notifier);
+
+    memory_region_init_io(&bt->mmio, OBJECT(bt), &fm3_bt_mem_ops, bt,
+                          TYPE_FM3_BT, 0x1000);
+    sysbus_init_mmio(dev, &bt->mmio);
+    return 0;
+}
+
+static const VMStateDescription vmstate_fm3_bt_ch = {
+    .name = "fm3.bt/ch",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(pcsr, Fm3BtChState),
+        VMSTATE_UINT32(pdut, Fm3BtChState),
+        VMSTATE_UINT32(dtbf, Fm3BtChState),
+        VMSTATE_UINT32(tmr, Fm3BtChState),
+        VMSTATE_UINT32(tmcr, Fm3BtChState),
+        VMSTATE_UINT32(stc, Fm3BtChState),
+        VMSTATE_UINT32(tmcr2, Fm3BtChState),
+        VMSTATE_BOOL(running, Fm3BtChState),
+        VMSTATE_BOOL(measuring, Fm3BtChState),
+        VMSTATE_UINT64(limit, Fm3BtChState),
+        VMSTATE_INT32(tioa, Fm3BtChState),
+        VMSTATE_INT32(tiob, Fm3BtChState),
+        VMSTATE_PTIMER(timer, Fm3BtChState),
+        VMSTATE_PTIMER(edge, Fm3BtChState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_fm3_bt = {
+    .name = TYPE_FM3_BT,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_STRUCT_ARRAY(ch, Fm3BtState, FM3_BT_NUM, 1,
+                             vmstate_fm3_bt_ch, Fm3BtChState),
+        VMSTATE_UINT32(btsel0123, Fm3BtState),
+        VMSTATE_UINT32(btsel4567, Fm3BtState),
+        VMSTATE_UINT32(irq_stat, Fm3BtState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void fm3_bt_class_init(ObjectClass *klass, void *data)
+{
+	DeviceClass			*dc	= DEVICE_CLASS(klass);
+	SysBusDeviceClass	*k	= SYS_BUS_DEVICE_CLASS(klass);
+
+	k->init		= fm3_bt_init;
+	dc->desc	= TYPE_FM3_BT;
+	dc->reset	= fm3_bt_reset;
+	dc->vmsd	= &vmstate_fm3_bt;
+}
+
+static const TypeInfo fm3_bt_info = {
+	.name			= TYPE_FM3_BT,
+	.parent			= TYPE_SYS_BUS_DEVICE,
+	.instance_size	= sizeof(Fm3BtState),
+	.class_init		= fm3_bt_class_init,
+};
+
+static void fm3_register_devices(void)
+{
+    type_register_static(&fm3_bt_info);
+}
+
+type_init(fm3_register_devices)
@@ -0,0 +1,827 @@
+/*
+ * Fujitsu FM3 CAN Controller
+ *
+ * This code is licensed under the GNU GPL v2.
+ *
+ * The 32 message objects of the controller with the two interface
+ * register sets, acceptance filtering, remote frames, FIFO buffers (EoB)
+ * and the error counters.  Frames are exchanged with the other nodes of
+ * the in-process bus named by "canbus" (see fm3_canbus.c).
+ */
+
+#include "hw/sysbus.h"
+#include "hw/arm/arm.h"
+#include "qemu/host-utils.h"
+#include "fm3.h"
+#include "fm3_canbus.h"
+
+//#define FM3_DEBUG_CAN
+#define TYPE_FM3_CAN    "fm3.can"
+
+#ifdef FM3_DEBUG_CAN
+#define DPRINTF(fmt, ...)                                       \
+    do { printf(fmt, ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) do { } while (0)
+#endif
+
+#define FM3_CAN_REG_CTRLR           (0x00)
+#define FM3_CAN_REG_CTRLR_INIT      (1 << 0)
+#define FM3_CAN_REG_CTRLR_IE        (1 << 1)
+#define FM3_CAN_REG_CTRLR_SIE       (1 << 2)
+#define FM3_CAN_REG_CTRLR_EIE       (1 << 3)
+#define FM3_CAN_REG_CTRLR_DAR       (1 << 5)
+#define FM3_CAN_REG_CTRLR_CCE       (1 << 6)
+#define FM3_CAN_REG_CTRLR_TEST      (1 << 7)
+#define FM3_CAN_REG_STATR           (0x02)
+#define FM3_CAN_REG_STATR_LEC       (7 << 0)
+#define FM3_CAN_REG_STATR_TXOK      (1 << 3)
+#define FM3_CAN_REG_STATR_RXOK      (1 << 4)
+#define FM3_CAN_REG_STATR_EPASS     (1 << 5)
+#define FM3_CAN_REG_STATR_EWARN     (1 << 6)
+#define FM3_CAN_REG_STATR_BOFF      (1 << 7)
+#define FM3_CAN_REG_ERRCNT          (0x04)
+#define FM3_CAN_REG_BTR             (0x06)
+#define FM3_CAN_REG_INTR            (0x08)
+#define FM3_CAN_REG_TESTR           (0x0A)
+#define FM3_CAN_REG_TESTR_BASIC     (1 << 2)
+#define FM3_CAN_REG_TESTR_SILENT    (1 << 3)
+#define FM3_CAN_REG_TESTR_LBACK     (1 << 4)
+#define FM3_CAN_REG_BRPER           (0x0C)
+
+/* interface registers: IF1 at 0x10, IF2 at 0x40 */
+#define FM3_CAN_REG_IF1             (0x10)
+#define FM3_CAN_REG_IF2             (0x40)
+#define FM3_CAN_REG_IF_CREQ         (0x00)
+#define FM3_CAN_REG_IF_CMSK         (0x02)
+#define FM3_CAN_REG_IF_CMSK_DATAB   (1 << 0)
+#define FM3_CAN_REG_IF_CMSK_DATAA   (1 << 1)
+#define FM3_CAN_REG_IF_CMSK_TXREQ   (1 << 2)    /* read: NewDat */
+#define FM3_CAN_REG_IF_CMSK_CIP     (1 << 3)
+#define FM3_CAN_REG_IF_CMSK_CONTROL (1 << 4)
+#define FM3_CAN_REG_IF_CMSK_ARB     (1 << 5)
+#define FM3_CAN_REG_IF_CMSK_MASK    (1 << 6)
+#define FM3_CAN_REG_IF_CMSK_WRRD    (1 << 7)
+#define FM3_CAN_REG_IF_MSK          (0x04)      /* MSK1, MSK2 */
+#define FM3_CAN_REG_IF_ARB          (0x08)      /* ARB1, ARB2 */
+#define FM3_CAN_REG_IF_MCTR         (0x0C)
+#define FM3_CAN_REG_IF_DTA          (0x10)      /* DTA1, DTA2, DTB1, DTB2 */
+
+#define FM3_CAN_REG_TREQR           (0x80)
+#define FM3_CAN_REG_NEWDT           (0x90)
+#define FM3_CAN_REG_INTPND          (0xA0)
+#define FM3_CAN_REG_MSGVAL          (0xB0)
+
+/* message object: MSK2/ARB2 in the upper half words */
+#define FM3_CAN_MSK_MXTD            (1U << 31)
+#define FM3_CAN_MSK_MDIR            (1U << 30)
+#define FM3_CAN_ARB_MSGVAL          (1U << 31)
+#define FM3_CAN_ARB_XTD             (1U << 30)
+#define FM3_CAN_ARB_DIR             (1U << 29)
+#define FM3_CAN_ID_MASK             0x1FFFFFFFU
+#define FM3_CAN_MCTR_NEWDAT         (1 << 15)
+#define FM3_CAN_MCTR_MSGLST         (1 << 14)
+#define FM3_CAN_MCTR_INTPND         (1 << 13)
+#define FM3_CAN_MCTR_UMASK          (1 << 12)
+#define FM3_CAN_MCTR_TXIE           (1 << 11)
+#define FM3_CAN_MCTR_RXIE           (1 << 10)
+#define FM3_CAN_MCTR_RMTEN          (1 << 9)
+#define FM3_CAN_MCTR_TXRQST         (1 << 8)
+#define FM3_CAN_MCTR_EOB            (1 << 7)
+#define FM3_CAN_MCTR_DLC            (0xf)
+
+/* LEC */
+enum {
+    FM3_CAN_LEC_NONE = 0,
+    FM3_CAN_LEC_STUFF,
+    FM3_CAN_LEC_FORM,
+    FM3_CAN_LEC_ACK,
+    FM3_CAN_LEC_BIT1,
+    FM3_CAN_LEC_BIT0,
+    FM3_CAN_LEC_CRC,
+    FM3_CAN_LEC_UNUSED,
+};
+
+#define FM3_CAN_MSG_NUM             32
+#define FM3_CAN_IF_NUM              2
+#define FM3_CAN_INT_STATUS          0x8000
+
+typedef struct {
+    uint32_t msk;
+    uint32_t arb;
+    uint32_t mctr;
+    uint8_t data[8];
+} Fm3CanMsgObj;
+
+typedef struct {
+    uint32_t creq;
+    uint32_t cmsk;
+    uint32_t msk;
+    uint32_t arb;
+    uint32_t mctr;
+    uint8_t data[8];
+} Fm3CanIf;
+
+typedef struct {
+    SysBusDevice busdev;
+    MemoryRegion mmio;
+    qemu_irq irq;
+    uint32_t ch_no;
+    char *bus_name;
+    Fm3CanNode node;
+    Notifier clk_notifier;
+
+    uint32_t ctrlr;
+    uint32_t statr;
+    uint32_t tec;
+    uint32_t rec;
+    uint32_t btr;
+    uint32_t testr;
+    uint32_t brper;
+    bool status_int;
+    Fm3CanIf ifr[FM3_CAN_IF_NUM];
+    Fm3CanMsgObj obj[FM3_CAN_MSG_NUM];
+    uint32_t treq;          /* TxRqst bit of the objects, bit n: object n+1 */
+
+    Fm3CanFrame *tx_frame;  /* built from object tx_obj for the bus */
+    int32_t tx_obj;
+    bool tx_stale;          /* rebuild tx_frame once it is off the wire */
+} Fm3CanState;
+#define FM3_CAN(obj) \
+    OBJECT_CHECK(Fm3CanState, (obj), TYPE_FM3_CAN)
+
+/*
+ * status and interrupts
+ */
+
+static uint32_t fm3_can_get_intid(Fm3CanState *s)
+{
+    uint32_t n;
+
+    if (s->status_int)
+        return FM3_CAN_INT_STATUS;
+    for (n = 0; n < FM3_CAN_MSG_NUM; n++) {
+        if (s->obj[n].mctr & FM3_CAN_MCTR_INTPND)
+            return n + 1;
+    }
+    return 0;
+}
+
+static void fm3_can_update_irq(Fm3CanState *s)
+{
+    int level = (s->ctrlr & FM3_CAN_REG_CTRLR_IE) && fm3_can_get_intid(s);
+
+    fm3_int_set_mon(FM3_IRQ_CAN(s->ch_no), 1, level);
+    qemu_set_irq(s->irq, level);
+}
+
+/* TxOk/RxOk and the last error code of a frame */
+static void fm3_can_set_status(Fm3CanState *s, uint32_t set, uint32_t lec)
+{
+    s->statr = (s->statr & ~FM3_CAN_REG_STATR_LEC) | set | lec;
+    if (s->ctrlr & FM3_CAN_REG_CTRLR_SIE)
+        s->status_int = true;
+}
+
+/* error warning/passive and bus-off from the error counters */
+static void fm3_can_update_errstate(Fm3CanState *s)
+{
+    uint32_t old = s->statr;
+    uint32_t st = 0;
+
+    if (96 <= s->tec || 96 <= s->rec)
+        st |= FM3_CAN_REG_STATR_EWARN;
+    if (128 <= s->tec || 128 <= s->rec)
+        st |= FM3_CAN_REG_STATR_EPASS;
+    if (256 <= s->tec) {
+        /* bus-off: the controller leaves the bus until INIT is cleared */
+        st |= FM3_CAN_REG_STATR_BOFF;
+        s->ctrlr |= FM3_CAN_REG_CTRLR_INIT;
+    }
+    s->statr = (s->statr & ~(FM3_CAN_REG_STATR_EPASS |
+                             FM3_CAN_REG_STATR_EWARN |
+                             FM3_CAN_REG_STATR_BOFF)) | st;
+    if ((s->ctrlr & FM3_CAN_REG_CTRLR_EIE) && old != s->statr)
+        s->status_int = true;
+}
+
+/*
+ * bus node
+ */
+
+static uint32_t fm3_can_get_bitrate(Fm3CanState *s)
+{
+    uint32_t brp = (((s->brper & 0xf) << 6) | (s->btr & 0x3f)) + 1;
+    uint32_t tq = ((s->btr >> 8) & 0xf) + 1 + ((s->btr >> 12) & 7) + 1 + 1;
+
+    return fm3_clk_get_hz(FM3_CLK_PCLK2) / (brp * tq);
+}
+
+static void fm3_can_update_node(Fm3CanState *s)
+{
+    bool test = s->ctrlr & FM3_CAN_REG_CTRLR_TEST;
+
+    s->node.bitrate = (s->ctrlr & FM3_CAN_REG_CTRLR_INIT) ? 0 :
+                      fm3_can_get_bitrate(s);
+    s->node.silent = test && (s->testr & FM3_CAN_REG_TESTR_SILENT);
+    s->node.loopback = test && (s->testr & FM3_CAN_REG_TESTR_LBACK);
+    fm3_canbus_kick(s->node.bus);
+}
+
+/* PCLK2 has changed: a frame on the wire ends at its old bit rate */
+static void fm3_can_clk_changed(Notifier *n, void *data)
+{
+    Fm3CanState *s = container_of(n, Fm3CanState, clk_notifier);
+
+    fm3_can_update_node(s);
+}
+
+static void fm3_can_drop_tx_frame(Fm3CanState *s)
+{
+    fm3_can_frame_unref(s->tx_frame);
+    s->tx_frame = NULL;
+    s->tx_obj = -1;
+    s->tx_stale = false;
+}
+
+/* The frame offered to the bus may no longer be the one to send.  While
+ * the bus holds it, it is on the wire and is finished first. */
+static void fm3_can_invalidate_tx(Fm3CanState *s)
+{
+    if (s->tx_frame && s->tx_frame->ref > 1)
+        s->tx_stale = true;
+    else
+        fm3_can_drop_tx_frame(s);
+}
+
+static void fm3_can_set_txrqst(Fm3CanState *s, uint32_t n, bool set)
+{
+    if (set && (s->obj[n].arb & FM3_CAN_ARB_MSGVAL)) {
+        s->obj[n].mctr |= FM3_CAN_MCTR_TXRQST;
+        s->treq |= 1U << n;
+    } else {
+        s->obj[n].mctr &= ~FM3_CAN_MCTR_TXRQST;
+        s->treq &= ~(1U << n);
+    }
+}
+
+static Fm3CanFrame *fm3_can_peek(Fm3CanNode *node)
+{
+    Fm3CanState *s = node->opaque;
+    Fm3CanMsgObj *o;
+    Fm3CanFrame *frame;
+    uint32_t n;
+
+    if (s->tx_stale)
+        fm3_can_drop_tx_frame(s);
+    if (s->tx_frame)
+        return s->tx_frame;
+    if (!s->treq)
+        return NULL;
+
+    /* the lowest numbered object goes first */
+    n = ctz32(s->treq);
+    o = &s->obj[n];
+    frame = fm3_can_frame_new();
+    if (o->arb & FM3_CAN_ARB_XTD)
+        frame->can_id = (o->arb & FM3_CAN_ID_MASK) | FM3_CAN_EFF_FLAG;
+    else
+        frame->can_id = (o->arb >> 18) & FM3_CAN_SFF_MASK;
+    /* a receive object with TxRqst sends a remote frame */
+    if (!(o->arb & FM3_CAN_ARB_DIR))
+        frame->can_id |= FM3_CAN_RTR_FLAG;
+    frame->can_dlc = MIN(o->mctr & FM3_CAN_MCTR_DLC, 8);
+    memcpy(frame->data, o->data, sizeof(frame->data));
+
+    s->tx_frame = frame;
+    s->tx_obj = n;
+    return frame;
+}
+
+static void fm3_can_sent(Fm3CanNode *node, Fm3CanFrame *frame, bool acked)
+{
+    Fm3CanState *s = node->opaque;
+    Fm3CanMsgObj *o;
+
+    if (frame != s->tx_frame)
+        return;
+    o = &s->obj[s->tx_obj];
+
+    if (!acked) {
+        /* acknowledgement error; an error passive transmitter does not
+         * count it */
+        if (s->tec < 128)
+            s->tec += 8;
+        fm3_can_set_status(s, 0, FM3_CAN_LEC_ACK);
+        fm3_can_update_errstate(s);
+        if (s->ctrlr & FM3_CAN_REG_CTRLR_DAR) {
+            /* no automatic retransmission */
+            fm3_can_set_txrqst(s, s->tx_obj, false);
+            fm3_can_drop_tx_frame(s);
+        }
+    } else {
+        if (s->tec)
+            s->tec--;
+        fm3_can_set_status(s, FM3_CAN_REG_STATR_TXOK, FM3_CAN_LEC_NONE);
+        fm3_can_update_errstate(s);
+        fm3_can_set_txrqst(s, s->tx_obj, false);
+        o->mctr &= ~FM3_CAN_MCTR_NEWDAT;
+        if (o->mctr & FM3_CAN_MCTR_TXIE)
+            o->mctr |= FM3_CAN_MCTR_INTPND;
+        fm3_can_drop_tx_frame(s);
+    }
+    /* the bus asks again for the next frame right after this one */
+    fm3_can_update_irq(s);
+    fm3_can_update_node(s);
+}
+
+static bool fm3_can_match(Fm3CanMsgObj *o, Fm3CanFrame *frame)
+{
+    bool xtd = frame->can_id & FM3_CAN_EFF_FLAG;
+    uint32_t id, mask;
+
+    if (xtd) {
+        id = frame->can_id & FM3_CAN_ID_MASK;
+    } else {
+        id = (frame->can_id & FM3_CAN_SFF_MASK) << 18;
+    }
+    mask = FM3_CAN_ID_MASK;
+    if (o->mctr & FM3_CAN_MCTR_UMASK) {
+        mask = o->msk & FM3_CAN_ID_MASK;
+        if ((o->msk & FM3_CAN_MSK_MXTD) && xtd != !!(o->arb & FM3_CAN_ARB_XTD))
+            return false;
+    } else if (xtd != !!(o->arb & FM3_CAN_ARB_XTD)) {
+        return false;
+    }
+    if (!xtd)
+        mask &= FM3_CAN_SFF_MASK << 18;
+    return !((id ^ o->arb) & mask);
+}
+
+static bool fm3_can_receive(Fm3CanNode *node, Fm3CanFrame *frame)
+{
+    Fm3CanState *s = node->opaque;
+    bool remote = frame->can_id & FM3_CAN_RTR_FLAG;
+    Fm3CanMsgObj *o;
+    uint32_t n, dir;
+
+    if (s->rec) {
+        s->rec = (s->rec > 127) ? 120 : s->rec - 1;
+        fm3_can_update_errstate(s);
+    }
+
+    /* a data frame goes to a receive object, a remote frame triggers a
+     * transmit object */
+    dir = remote ? FM3_CAN_ARB_DIR : 0;
+    for (n = 0; n < FM3_CAN_MSG_NUM; n++) {
+        o = &s->obj[n];
+        if (!(o->arb & FM3_CAN_ARB_MSGVAL) ||
+            (o->arb & FM3_CAN_ARB_DIR) != dir ||
+            !fm3_can_match(o, frame))
+            continue;
+
+        if (remote) {
+            if (o->mctr & FM3_CAN_MCTR_RMTEN) {
+                fm3_can_set_txrqst(s, n, true);
+                fm3_can_invalidate_tx(s);
+            }
+            break;
+        }
+
+        /* FIFO buffer: a full object passes the frame on, up to EoB */
+        if ((o->mctr & FM3_CAN_MCTR_NEWDAT) && !(o->mctr & FM3_CAN_MCTR_EOB))
+            continue;
+        if (o->mctr & FM3_CAN_MCTR_NEWDAT)
+            o->mctr |= FM3_CAN_MCTR_MSGLST;
+        memcpy(o->data, frame->data, sizeof(o->data));
+        o->mctr = (o->mctr & ~FM3_CAN_MCTR_DLC) | MIN(frame->can_dlc, 8) |
+                  FM3_CAN_MCTR_NEWDAT;
+        if (o->mctr & FM3_CAN_MCTR_RXIE)
+            o->mctr |= FM3_CAN_MCTR_INTPND;
+        break;
+    }
+
+    fm3_can_set_status(s, FM3_CAN_REG_STATR_RXOK, FM3_CAN_LEC_NONE);
+    fm3_can_update_irq(s);
+    if (s->treq && !s->tx_frame)
+        fm3_canbus_kick(s->node.bus);
+    return true;
+}
+
+/*
+ * interface registers
+ */
+
+static void fm3_can_if_transfer(Fm3CanState *s, Fm3CanIf *ifr)
+{
+    uint32_t n = (ifr->creq & 0x3f) - 1;
+    uint32_t cmsk = ifr->cmsk;
+    Fm3CanMsgObj *o;
+
+    if (FM3_CAN_MSG_NUM <= n)
+        return;
+    o = &s->obj[n];
+
+    if (cmsk & FM3_CAN_REG_IF_CMSK_WRRD) {
+        /* IF to message object */
+        if (cmsk & FM3_CAN_REG_IF_CMSK_MASK)
+            o->msk = ifr->msk;
+        if (cmsk & FM3_CAN_REG_IF_CMSK_ARB)
+            o->arb = ifr->arb;
+        if (cmsk & FM3_CAN_REG_IF_CMSK_CONTROL)
+            o->mctr = ifr->mctr;
+        if (cmsk & FM3_CAN_REG_IF_CMSK_DATAA)
+            memcpy(&o->data[0], &ifr->data[0], 4);
+        if (cmsk & FM3_CAN_REG_IF_CMSK_DATAB)
+            memcpy(&o->data[4], &ifr->data[4], 4);
+        fm3_can_set_txrqst(s, n, (o->mctr & FM3_CAN_MCTR_TXRQST) ||
+                                 (cmsk & FM3_CAN_REG_IF_CMSK_TXREQ));
+        fm3_can_invalidate_tx(s);
+        fm3_canbus_kick(s->node.bus);
+    } else {
+        /* message object to IF */
+        if (cmsk & FM3_CAN_REG_IF_CMSK_MASK)
+            ifr->msk = o->msk;
+        if (cmsk & FM3_CAN_REG_IF_CMSK_ARB)
+            ifr->arb = o->arb;
+        if (cmsk & FM3_CAN_REG_IF_CMSK_CONTROL)
+            ifr->mctr = o->mctr;
+        if (cmsk & FM3_CAN_REG_IF_CMSK_DATAA)
+            memcpy(&ifr->data[0], &o->data[0], 4);
+        if (cmsk & FM3_CAN_REG_IF_CMSK_DATAB)
+            memcpy(&ifr->data[4], &o->data[4], 4);
+        if (cmsk & FM3_CAN_REG_IF_CMSK_CIP)
+            o->mctr &= ~FM3_CAN_MCTR_INTPND;
+        if (cmsk & FM3_CAN_REG_IF_CMSK_TXREQ)
+            o->mctr &= ~FM3_CAN_MCTR_NEWDAT;
+    }
+    fm3_can_update_irq(s);
+}
+
+static uint32_t fm3_can_if_read(Fm3CanIf *ifr, hwaddr offset)
+{
+    switch (offset) {
+    case FM3_CAN_REG_IF_CREQ:
+        return ifr->creq & 0x3f;            /* never busy */
+    case FM3_CAN_REG_IF_CMSK:
+        return ifr->cmsk;
+    case FM3_CAN_REG_IF_MSK:
+        return ifr->msk & 0xffff;
+    case FM3_CAN_REG_IF_MSK + 2:
+        return ifr->msk >> 16;
+    case FM3_CAN_REG_IF_ARB:
+        return ifr->arb & 0xffff;
+    case FM3_CAN_REG_IF_ARB + 2:
+        return ifr->arb >> 16;
+    case FM3_CAN_REG_IF_MCTR:
+        return ifr->mctr;
+    case FM3_CAN_REG_IF_DTA:
+    case FM3_CAN_REG_IF_DTA + 2:
+    case FM3_CAN_REG_IF_DTA + 4:
+    case FM3_CAN_REG_IF_DTA + 6:
+        offset -= FM3_CAN_REG_IF_DTA;
+        return ifr->data[offset] | (ifr->data[offset + 1] << 8);
+    }
+    return 0;
+}
+
+static void fm3_can_if_write(Fm3CanState *s, Fm3CanIf *ifr, hwaddr offset,
+                             uint32_t value)
+{
+    switch (offset) {
+    case FM3_CAN_REG_IF_CREQ:
+        ifr->creq = value & 0x3f;
+        fm3_can_if_transfer(s, ifr);
+        break;
+    case FM3_CAN_REG_IF_CMSK:
+        ifr->cmsk = value & 0xff;
+        break;
+    case FM3_CAN_REG_IF_MSK:
+        ifr->msk = (ifr->msk & 0xffff0000) | value;
+        break;
+    case FM3_CAN_REG_IF_MSK + 2:
+        ifr->msk = (ifr->msk & 0xffff) | ((value & 0xdfff) << 16);
+        break;
+    case FM3_CAN_REG_IF_ARB:
+        ifr->arb = (ifr->arb & 0xffff0000) | value;
+        break;
+    case FM3_CAN_REG_IF_ARB + 2:
+        ifr->arb = (ifr->arb & 0xffff) | (value << 16);
+        break;
+    case FM3_CAN_REG_IF_MCTR:
+        ifr->mctr = value & 0xff8f;
+        break;
+    case FM3_CAN_REG_IF_DTA:
+    case FM3_CAN_REG_IF_DTA + 2:
+    case FM3_CAN_REG_IF_DTA + 4:
+    case FM3_CAN_REG_IF_DTA + 6:
+        offset -= FM3_CAN_REG_IF_DTA;
+        ifr->data[offset] = value;
+        ifr->data[offset + 1] = value >> 8;
+        break;
+    }
+}
+
+/* bitmap registers: bit n of the 32-bit view is object n+1 */
+static uint32_t fm3_can_get_bitmap(Fm3CanState *s, hwaddr reg)
+{
+    uint32_t map = 0;
+    uint32_t n;
+
+    if (reg == FM3_CAN_REG_TREQR)
+        return s->treq;
+    for (n = 0; n < FM3_CAN_MSG_NUM; n++) {
+        switch (reg) {
+        case FM3_CAN_REG_NEWDT:
+            map |= !!(s->obj[n].mctr & FM3_CAN_MCTR_NEWDAT) << n;
+            break;
+        case FM3_CAN_REG_INTPND:
+            map |= !!(s->obj[n].mctr & FM3_CAN_MCTR_INTPND) << n;
+            break;
+        case FM3_CAN_REG_MSGVAL:
+            map |= !!(s->obj[n].arb & FM3_CAN_ARB_MSGVAL) << n;
+            break;
+        }
+    }
+    return map;
+}
+
+static uint32_t fm3_can_read_half(Fm3CanState *s, hwaddr offset)
+{
+    uint32_t value;
+
+    if (FM3_CAN_REG_IF1 <= offset && offset < FM3_CAN_REG_IF1 + 0x20)
+        return fm3_can_if_read(&s->ifr[0], offset - FM3_CAN_REG_IF1);
+    if (FM3_CAN_REG_IF2 <= offset && offset < FM3_CAN_REG_IF2 + 0x20)
+        return fm3_can_if_read(&s->ifr[1], offset - FM3_CAN_REG_IF2);
+    if (FM3_CAN_REG_TREQR <= offset && offset < FM3_CAN_REG_MSGVAL + 4) {
+        value = fm3_can_get_bitmap(s, offset & ~0xf);
+        return (offset & 2) ? value >> 16 : value & 0xffff;
+    }
+
+    switch (offset) {
+    case FM3_CAN_REG_CTRLR:
+        return s->ctrlr;
+    case FM3_CAN_REG_STATR:
+        /* reading STATR clears the status interrupt */
+        value = s->statr;
+        s->status_int = false;
+        fm3_can_update_irq(s);
+        return value;
+    case FM3_CAN_REG_ERRCNT:
+        return (s->rec > 127 ? 0x8000 | (127 << 8) : s->rec << 8) |
+               MIN(s->tec, 255);
+    case FM3_CAN_REG_BTR:
+        return s->btr;
+    case FM3_CAN_REG_INTR:
+        return fm3_can_get_intid(s);
+    case FM3_CAN_REG_TESTR:
+        /* Rx: the bus is recessive */
+        return s->testr | (1 << 7);
+    case FM3_CAN_REG_BRPER:
+        return s->brper;
+    }
+    return 0;
+}
+
+static void fm3_can_write_half(Fm3CanState *s, hwaddr offset, uint32_t value)
+{
+    if (FM3_CAN_REG_IF1 <= offset && offset < FM3_CAN_REG_IF1 + 0x20) {
+        fm3_can_if_write(s, &s->ifr[0], offset - FM3_CAN_REG_IF1, value);
+        return;
+    }
+    if (FM3_CAN_REG_IF2 <= offset && offset < FM3_CAN_REG_IF2 + 0x20) {
+        fm3_can_if_write(s, &s->ifr[1], offset - FM3_CAN_REG_IF2, value);
+        return;
+    }
+
+    switch (offset) {
+    case FM3_CAN_REG_CTRLR:
+        if ((s->ctrlr & FM3_CAN_REG_CTRLR_INIT) &&
+            !(value & FM3_CAN_REG_CTRLR_INIT) &&
+            (s->statr & FM3_CAN_REG_STATR_BOFF)) {
+            /* bus-off recovery */
+            s->tec = 0;
+            s->rec = 0;
+            fm3_can_update_errstate(s);
+        }
+        s->ctrlr = value & 0xef;
+        fm3_can_update_node(s);
+        fm3_can_update_irq(s);
+        break;
+    case FM3_CAN_REG_STATR:
+        /* TxOk and RxOk are cleared by writing 0, LEC is writable */
+        s->statr = (s->statr & ~(FM3_CAN_REG_STATR_TXOK |
+                                 FM3_CAN_REG_STATR_RXOK |
+                                 FM3_CAN_REG_STATR_LEC)) |
+                   (s->statr & value & (FM3_CAN_REG_STATR_TXOK |
+                                        FM3_CAN_REG_STATR_RXOK)) |
+                   (value & FM3_CAN_REG_STATR_LEC);
+        break;
+    case FM3_CAN_REG_BTR:
+        if ((s->ctrlr & FM3_CAN_REG_CTRLR_INIT) &&
+            (s->ctrlr & FM3_CAN_REG_CTRLR_CCE))
+            s->btr = value & 0x7fff;
+        break;
+    case FM3_CAN_REG_TESTR:
+        if (s->ctrlr & FM3_CAN_REG_CTRLR_TEST) {
+            if (value & FM3_CAN_REG_TESTR_BASIC)
+                printf("FM3_CAN: ch%d basic mode is not supported\n",
+                       s->ch_no);
+            s->testr = value & 0x7c;
+            fm3_can_update_node(s);
+        }
+        break;
+    case FM3_CAN_REG_BRPER:
+        if ((s->ctrlr & FM3_CAN_REG_CTRLR_INIT) &&
+            (s->ctrlr & FM3_CAN_REG_CTRLR_CCE))
+            s->brper = value & 0xf;
+        break;
+    }
+}
+
+static uint64_t fm3_can_read(void *opaque, hwaddr offset, unsigned size)
+{
+    Fm3CanState *s = (Fm3CanState *)opaque;
+    uint64_t retval;
+
+    retval = fm3_can_read_half(s, offset & ~1);
+    if (size == 4)
+        retval |= (uint64_t)fm3_can_read_half(s, offset + 2) << 16;
+    else if (size == 1)
+        retval = (retval >> ((offset & 1) * 8)) & 0xff;
+
+    DPRINTF("%s : 0x%02x ---> 0x%08x\n", __func__, (uint32_t)offset,
+            (uint32_t)retval);
+    return retval;
+}
+
+static void fm3_can_write(void *opaque, hwaddr offset,
+                          uint64_t value, unsigned size)
+{
+    Fm3CanState *s = (Fm3CanState *)opaque;
+    uint32_t half;
+
+    DPRINTF("%s : 0x%02x <--- 0x%08x\n", __func__, (uint32_t)offset,
+            (uint32_t)value);
+
+    if (size == 1) {
+        half = fm3_can_read_half(s, offset & ~1);
+        if (offset & 1)
+            half = (half & 0x00ff) | ((value & 0xff) << 8);
+        else
+            half = (half & 0xff00) | (value & 0xff);
+        fm3_can_write_half(s, offset & ~1, half);
+        return;
+    }
+    /* in a word access the lower half word (CREQ) goes last */
+    if (size == 4)
+        fm3_can_write_half(s, offset + 2, value >> 16);
+    fm3_can_write_half(s, offset, value & 0xffff);
+}
+
+static const MemoryRegionOps fm3_can_mem_ops = {
+    .read = fm3_can_read,
+    .write = fm3_can_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+};
+
+static void fm3_can_reset(DeviceState *d)
+{
+    Fm3CanState *s = FM3_CAN(d);
+    int i;
+
+    s->ctrlr = FM3_CAN_REG_CTRLR_INIT;
+    s->statr = 0;
+    s->tec = 0;
+    s->rec = 0;
+    s->btr = 0x2301;
+    s->testr = 0;
+    s->brper = 0;
+    s->status_int = false;
+    s->treq = 0;
+    for (i = 0; i < FM3_CAN_IF_NUM; i++) {
+        memset(&s->ifr[i], 0, sizeof(s->ifr[i]));
+        s->ifr[i].creq = 1;
+    }
+    memset(s->obj, 0, sizeof(s->obj));
+    fm3_can_drop_tx_frame(s);
+    fm3_can_update_node(s);
+    fm3_can_update_irq(s);
+}
+
+static int fm3_can_init(SysBusDevice *dev)
+{
+    Fm3CanState *s = FM3_CAN(dev);
+
+    s->tx_obj = -1;
+    s->node.peek = fm3_can_peek;
+    s->node.receive = fm3_can_receive;
+    s->node.sent = fm3_can_sent;
+    s->node.opaque = s;
+    fm3_canbus_attach(fm3_canbus_get(s->bus_name ? s->bus_name : "can"),
+                      &s->node);
+    s->clk_notifier.notify = fm3_can_clk_changed;
+    fm3_clk_add_notifier(FM3_CLK_PCLK2, &s->clk_notifier);
+
+    sysbus_init_irq(dev, &s->irq);
+    memory_region_init_io(&s->mmio, OBJECT(s), &fm3_can_mem_ops, s,
+                          TYPE_FM3_CAN, 0x1000);
+    sysbus_init_mmio(dev, &s->mmio);
+    return 0;
+}
+
+static int fm3_can_post_load(void *opaque, int version_id)
+{
+    Fm3CanState *s = (Fm3CanState *)opaque;
+
+    fm3_can_drop_tx_frame(s);
+    fm3_can_update_node(s);
+    return 0;
+}
+
+static const VMStateDescription vmstate_fm3_can_msg = {
+    .name = "fm3.can/msg",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(msk, Fm3CanMsgObj),
+        VMSTATE_UINT32(arb, Fm3CanMsgObj),
+        VMSTATE_UINT32(mctr, Fm3CanMsgObj),
+        VMSTATE_UINT8_ARRAY(data, Fm3CanMsgObj, 8),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_fm3_can_if = {
+    .name = "fm3.can/if",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(creq, Fm3CanIf),
+        VMSTATE_UINT32(cmsk, Fm3CanIf),
+        VMSTATE_UINT32(msk, Fm3CanIf),
+        VMSTATE_UINT32(arb, Fm3CanIf),
+        VMSTATE_UINT32(mctr, Fm3CanIf),
+        VMSTATE_UINT8_ARRAY(data, Fm3CanIf, 8),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_fm3_can = {
+    .name = TYPE_FM3_CAN,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .post_load = fm3_can_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(ctrlr, Fm3CanState),
+        VMSTATE_UINT32(statr, Fm3CanState),
+        VMSTATE_UINT32(tec, Fm3CanState),
+        VMSTATE_UINT32(rec, Fm3CanState),
+        VMSTATE_UINT32(btr, Fm3CanState),
+        VMSTATE_UINT32(testr, Fm3CanState),
+        VMSTATE_UINT32(brper, Fm3CanState),
+        VMSTATE_BOOL(status_int, Fm3CanState),
+        VMSTATE_STRUCT_ARRAY(ifr, Fm3CanState, FM3_CAN_IF_NUM, 1,
+                             vmstate_fm3_can_if, Fm3CanIf),
+        VMSTATE_STRUCT_ARRAY(obj, Fm3CanState, FM3_CAN_MSG_NUM, 1,
+                             vmstate_fm3_can_msg, Fm3CanMsgObj),
+        VMSTATE_UINT32(treq, Fm3CanState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property fm3_can_properties[] = {
+    DEFINE_PROP_UINT32("ch", Fm3CanState, ch_no, 0),
+    DEFINE_PROP_STRING("canbus", Fm3CanState, bus_name),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void fm3_can_class_init(ObjectClass *klass, void *data)
+{
+	DeviceClass			*dc	= DEVICE_CLASS(klass);
+	SysBusDeviceClass	*k	= SYS_BUS_DEVICE_CLASS(klass);
+
+	k->init		= fm3_can_init;
+	dc->desc	= TYPE_FM3_CAN;
+	dc->reset	= fm3_can_reset;
+	dc->vmsd	= &vmstate_fm3_can;
+	dc->props	= fm3_can_properties;
+}
+
+static const TypeInfo fm3_can_info = {
+	.name			= TYPE_FM3_CAN,
+	.parent			= TYPE_SYS_BUS_DEVICE,
+	.instance_size	= sizeof(Fm3CanState),
+	.class_init		= fm3_can_class_init,
+};
+
+static void fm3_register_devices(void)
+{
+    type_register_static(&fm3_can_info);
+}
+
+type_init(fm3_register_devices)
@@ -0,0 +1,391 @@
+/*
+ * Fujitsu FM3 MCU emulator - in-process CAN bus
+ *
+ * This code is licensed under the GNU GPL v2.
+ *
+ * Nodes attached to a named bus (the CAN controllers and bus ports) offer
+ * one frame each; the bus arbitrates them on the identifier bits, keeps
+ * the winner on the wire for its frame time at the sender's bit rate and
+ * then hands the same frame buffer to every other node.  The bus runs on
+ * virtual time with one timer event per frame, and frames that ended
+ * while the timer was late are delivered back-to-back in one callback.
+ *
+ * A bus port (-device fm3-canbus-port,canbus=NAME,chardev=ID) connects an
+ * external node simulator through a chardev.  Frames cross it as
+ * SocketCAN struct can_frame records of 16 bytes.
+ */
+
+#include "hw/sysbus.h"
+#include "qemu/timer.h"
+#include "sysemu/char.h"
+#include "qapi/qmp/qerror.h"
+#include "fm3_canbus.h"
+
+//#define FM3_DEBUG_CANBUS
+#define TYPE_FM3_CANBUS_PORT    "fm3-canbus-port"
+
+#ifdef FM3_DEBUG_CANBUS
+#define DPRINTF(fmt, ...)                                       \
+    do { printf(fmt, ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) do { } while (0)
+#endif
+
+struct Fm3CanBus {
+    char *name;
+    QTAILQ_HEAD(, Fm3CanNode) nodes;
+    QLIST_ENTRY(Fm3CanBus) next;
+    QEMUTimer *timer;
+    bool busy;
+    Fm3CanNode *sender;     /* node whose frame is on the wire */
+    Fm3CanFrame *frame;
+    int64_t end;            /* end of the frame on the wire, or the time
+                               the bus got idle */
+};
+
+static QLIST_HEAD(, Fm3CanBus) fm3_canbuses =
+    QLIST_HEAD_INITIALIZER(fm3_canbuses);
+
+Fm3CanFrame *fm3_can_frame_new(void)
+{
+    Fm3CanFrame *frame = g_new0(Fm3CanFrame, 1);
+
+    frame->ref = 1;
+    return frame;
+}
+
+Fm3CanFrame *fm3_can_frame_ref(Fm3CanFrame *frame)
+{
+    frame->ref++;
+    return frame;
+}
+
+void fm3_can_frame_unref(Fm3CanFrame *frame)
+{
+    if (frame && !--frame->ref)
+        g_free(frame);
+}
+
+/* The arbitration field as sent, MSB first: the lowest value wins as
+ * dominant bits are 0. */
+static uint64_t fm3_canbus_get_arb_key(Fm3CanFrame *frame)
+{
+    uint32_t rtr = !!(frame->can_id & FM3_CAN_RTR_FLAG);
+    uint32_t id;
+
+    if (frame->can_id & FM3_CAN_EFF_FLAG) {
+        id = frame->can_id & FM3_CAN_EFF_MASK;
+        /* ID28-18, SRR, IDE, ID17-0, RTR */
+        return ((uint64_t)(id >> 18) << 21) | (1 << 20) | (1 << 19) |
+               ((id & 0x3ffff) << 1) | rtr;
+    }
+    id = frame->can_id & FM3_CAN_SFF_MASK;
+    /* ID10-0, RTR, IDE */
+    return ((uint64_t)id << 21) | (rtr << 20);
+}
+
+/* bits from SOF to the end of the interframe space, without stuffing */
+static uint32_t fm3_canbus_get_frame_bits(Fm3CanFrame *frame)
+{
+    uint32_t len = MIN(frame->can_dlc, 8);
+
+    if (frame->can_id & FM3_CAN_RTR_FLAG)
+        len = 0;
+    if (frame->can_id & FM3_CAN_EFF_FLAG)
+        return 67 + len * 8;
+    return 47 + len * 8;
+}
+
+static void fm3_canbus_arbitrate(Fm3CanBus *bus, int64_t start)
+{
+    Fm3CanNode *node, *winner = NULL;
+    Fm3CanFrame *frame, *best = NULL;
+    uint64_t key, best_key = 0;
+
+    QTAILQ_FOREACH(node, &bus->nodes, next) {
+        if (!node->bitrate || node->silent)
+            continue;
+        frame = node->peek(node);
+        if (!frame)
+            continue;
+        key = fm3_canbus_get_arb_key(frame);
+        if (!best || key < best_key) {
+            winner = node;
+            best = frame;
+            best_key = key;
+        }
+    }
+
+    if (!best) {
+        bus->busy = false;
+        bus->end = start;
+        return;
+    }
+
+    bus->busy = true;
+    bus->sender = winner;
+    bus->frame = fm3_can_frame_ref(best);
+    bus->end = start + muldiv64(fm3_canbus_get_frame_bits(best),
+                                get_ticks_per_sec(), winner->bitrate);
+    timer_mod(bus->timer, bus->end);
+}
+
+static void fm3_canbus_deliver(Fm3CanBus *bus)
+{
+    Fm3CanNode *sender = bus->sender;
+    Fm3CanFrame *frame = bus->frame;
+    Fm3CanNode *node;
+    bool acked = false;
+
+    bus->frame = NULL;
+    if (sender->loopback) {
+        sender->receive(sender, frame);
+        acked = true;
+    } else {
+        QTAILQ_FOREACH(node, &bus->nodes, next) {
+            if (node == sender || !node->bitrate)
+                continue;
+            if (node->receive(node, frame) && !node->silent)
+                acked = true;
+        }
+    }
+    DPRINTF("%s: %s 0x%08x %s\n", __func__, bus->name, frame->can_id,
+            acked ? "acked" : "no ack");
+    sender->sent(sender, frame, acked);
+    fm3_can_frame_unref(frame);
+}
+
+static void fm3_canbus_timer_cb(void *opaque)
+{
+    Fm3CanBus *bus = (Fm3CanBus *)opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    while (bus->busy && bus->end <= now) {
+        fm3_canbus_deliver(bus);
+        /* the next frame starts right after the interframe space */
+        fm3_canbus_arbitrate(bus, bus->end);
+    }
+}
+
+void fm3_canbus_kick(Fm3CanBus *bus)
+{
+    if (!bus || bus->busy)
+        return;
+    fm3_canbus_arbitrate(bus, MAX(qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL),
+                                  bus->end));
+}
+
+Fm3CanBus *fm3_canbus_get(const char *name)
+{
+    Fm3CanBus *bus;
+
+    QLIST_FOREACH(bus, &fm3_canbuses, next) {
+        if (!strcmp(bus->name, name))
+            return bus;
+    }
+
+    bus = g_new0(Fm3CanBus, 1);
+    bus->name = g_strdup(name);
+    QTAILQ_INIT(&bus->nodes);
+    bus->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, fm3_canbus_timer_cb, bus);
+    QLIST_INSERT_HEAD(&fm3_canbuses, bus, next);
+    return bus;
+}
+
+void fm3_canbus_attach(Fm3CanBus *bus, Fm3CanNode *node)
+{
+    node->bus = bus;
+    QTAILQ_INSERT_TAIL(&bus->nodes, node, next);
+}
+
+/*
+ * bus port
+ */
+
+#define FM3_CANBUS_PORT_QUEUE       64
+
+typedef struct {
+    SysBusDevice busdev;
+    CharDriverState *chr;
+    char *bus_name;
+    uint32_t bitrate;
+    Fm3CanNode node;
+
+    /* from the chardev */
+    Fm3CanFrame *rx;
+    uint32_t rx_len;
+    Fm3CanFrame *in[FM3_CANBUS_PORT_QUEUE];
+    uint32_t in_get;
+    uint32_t in_count;
+
+    /* to the chardev, referenced until written */
+    Fm3CanFrame *out[FM3_CANBUS_PORT_QUEUE];
+    uint32_t out_get;
+    uint32_t out_count;
+    uint32_t out_off;
+    bool out_watch;
+    uint64_t dropped;
+} Fm3CanBusPortState;
+#define FM3_CANBUS_PORT(obj) \
+    OBJECT_CHECK(Fm3CanBusPortState, (obj), TYPE_FM3_CANBUS_PORT)
+
+static void fm3_canbus_port_flush(Fm3CanBusPortState *s);
+
+static gboolean fm3_canbus_port_watch_cb(GIOChannel *chan, GIOCondition cond,
+                                         void *opaque)
+{
+    Fm3CanBusPortState *s = opaque;
+
+    s->out_watch = false;
+    fm3_canbus_port_flush(s);
+    return FALSE;
+}
+
+static void fm3_canbus_port_flush(Fm3CanBusPortState *s)
+{
+    Fm3CanFrame *frame;
+    int ret;
+
+    while (s->out_count) {
+        frame = s->out[s->out_get];
+        ret = qemu_chr_fe_write(s->chr, (uint8_t *)frame + s->out_off,
+                                FM3_CAN_FRAME_WIRE_SIZE - s->out_off);
+        if (ret <= 0)
+            break;
+        s->out_off += ret;
+        if (s->out_off < FM3_CAN_FRAME_WIRE_SIZE)
+            continue;
+        fm3_can_frame_unref(frame);
+        s->out_get = (s->out_get + 1) % FM3_CANBUS_PORT_QUEUE;
+        s->out_count--;
+        s->out_off = 0;
+    }
+
+    if (s->out_count && !s->out_watch) {
+        if (qemu_chr_fe_add_watch(s->chr, G_IO_OUT | G_IO_HUP,
+                                  fm3_canbus_port_watch_cb, s) > 0)
+            s->out_watch = true;
+    }
+}
+
+static Fm3CanFrame *fm3_canbus_port_peek(Fm3CanNode *node)
+{
+    Fm3CanBusPortState *s = node->opaque;
+
+    return s->in_count ? s->in[s->in_get] : NULL;
+}
+
+static bool fm3_canbus_port_receive(Fm3CanNode *node, Fm3CanFrame *frame)
+{
+    Fm3CanBusPortState *s = node->opaque;
+
+    if (s->out_count == FM3_CANBUS_PORT_QUEUE) {
+        s->dropped++;
+    } else {
+        s->out[(s->out_get + s->out_count) % FM3_CANBUS_PORT_QUEUE] =
+            fm3_can_frame_ref(frame);
+        s->out_count++;
+        fm3_canbus_port_flush(s);
+    }
+    /* the node simulator acknowledges everything */
+    return true;
+}
+
+static void fm3_canbus_port_sent(Fm3CanNode *node, Fm3CanFrame *frame,
+                                 bool acked)
+{
+    Fm3CanBusPortState *s = node->opaque;
+
+    /* the external node does not retry */
+    fm3_can_frame_unref(s->in[s->in_get]);
+    s->in_get = (s->in_get + 1) % FM3_CANBUS_PORT_QUEUE;
+    s->in_count--;
+    qemu_chr_accept_input(s->chr);
+}
+
+static int fm3_canbus_port_can_read(void *opaque)
+{
+    Fm3CanBusPortState *s = opaque;
+
+    if (s->in_count == FM3_CANBUS_PORT_QUEUE)
+        return 0;
+    return FM3_CAN_FRAME_WIRE_SIZE - s->rx_len;
+}
+
+static void fm3_canbus_port_read(void *opaque, const uint8_t *buf, int size)
+{
+    Fm3CanBusPortState *s = opaque;
+    uint32_t len;
+
+    while (size && s->in_count < FM3_CANBUS_PORT_QUEUE) {
+        if (!s->rx)
+            s->rx = fm3_can_frame_new();
+        len = MIN(size, FM3_CAN_FRAME_WIRE_SIZE - s->rx_len);
+        memcpy((uint8_t *)s->rx + s->rx_len, buf, len);
+        s->rx_len += len;
+        buf += len;
+        size -= len;
+        if (s->rx_len < FM3_CAN_FRAME_WIRE_SIZE)
+            break;
+
+        s->in[(s->in_get + s->in_count) % FM3_CANBUS_PORT_QUEUE] = s->rx;
+        s->in_count++;
+        s->rx = NULL;
+        s->rx_len = 0;
+    }
+    fm3_canbus_kick(s->node.bus);
+}
+
+static int fm3_canbus_port_init(SysBusDevice *dev)
+{
+    Fm3CanBusPortState *s = FM3_CANBUS_PORT(dev);
+
+    if (s->chr == NULL) {
+        qerror_report(QERR_MISSING_PARAMETER, "chardev");
+        return -1;
+    }
+
+    s->node.bitrate = s->bitrate;
+    s->node.peek = fm3_canbus_port_peek;
+    s->node.receive = fm3_canbus_port_receive;
+    s->node.sent = fm3_canbus_port_sent;
+    s->node.opaque = s;
+    fm3_canbus_attach(fm3_canbus_get(s->bus_name ? s->bus_name : "can"),
+                      &s->node);
+
+    qemu_chr_add_handlers(s->chr, fm3_canbus_port_can_read,
+                          fm3_canbus_port_read, NULL, s);
+    return 0;
+}
+
+static Property fm3_canbus_port_properties[] = {
+    DEFINE_PROP_CHR("chardev", Fm3CanBusPortState, chr),
+    DEFINE_PROP_STRING("canbus", Fm3CanBusPortState, bus_name),
+    DEFINE_PROP_UINT32("bitrate", Fm3CanBusPortState, bitrate, 500000),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void fm3_canbus_port_class_init(ObjectClass *klass, void *data)
+{
+	DeviceClass			*dc	= DEVICE_CLASS(klass);
+	SysBusDeviceClass	*k	= SYS_BUS_DEVICE_CLASS(klass);
+
+	k->init		= fm3_canbus_port_init;
+	dc->desc	= TYPE_FM3_CANBUS_PORT;
+	dc->props	= fm3_canbus_port_properties;
+	dc->cannot_instantiate_with_device_add_yet = false;
+}
+
+static const TypeInfo fm3_canbus_port_info = {
+	.name			= TYPE_FM3_CANBUS_PORT,
+	.parent			= TYPE_SYS_BUS_DEVICE,
+	.instance_size	= sizeof(Fm3CanBusPortState),
+	.class_init		= fm3_canbus_port_class_init,
+};
+
+static void fm3_register_devices(void)
+{
+    type_register_static(&fm3_canbus_port_info);
+}
+
+type_init(fm3_register_devices)
@@ -0,0 +1,60 @@
+#ifndef FM3_CANBUS_H
+#define FM3_CANBUS_H
+/*
+ * Fujitsu FM3 MCU emulator - in-process CAN bus
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+
+#include "qemu/queue.h"
+
+#define FM3_CAN_EFF_FLAG            0x80000000U     /* extended frame */
+#define FM3_CAN_RTR_FLAG            0x40000000U     /* remote frame */
+#define FM3_CAN_SFF_MASK            0x000007FFU
+#define FM3_CAN_EFF_MASK            0x1FFFFFFFU
+
+/* bytes of a frame on a bus port */
+#define FM3_CAN_FRAME_WIRE_SIZE     16
+
+/*
+ * One frame on the bus.  It is allocated once by the sender and the same
+ * buffer is handed to every receiver, which takes a reference if it keeps
+ * the frame.  The first 16 bytes are laid out as SocketCAN's struct
+ * can_frame (host byte order), which is what a bus port reads and writes.
+ */
+typedef struct {
+    uint32_t can_id;
+    uint8_t can_dlc;
+    uint8_t pad[3];
+    uint8_t data[8];
+    uint32_t ref;
+} Fm3CanFrame;
+
+typedef struct Fm3CanBus Fm3CanBus;
+typedef struct Fm3CanNode Fm3CanNode;
+
+struct Fm3CanNode {
+    Fm3CanBus *bus;
+    uint32_t bitrate;       /* 0 while the node is off the bus */
+    bool silent;            /* listens, never transmits nor acknowledges */
+    bool loopback;          /* frames go back to the node only */
+    /* frame to arbitrate for, or NULL; the node keeps its reference */
+    Fm3CanFrame *(*peek)(Fm3CanNode *node);
+    /* a frame of another node, returns true to acknowledge it */
+    bool (*receive)(Fm3CanNode *node, Fm3CanFrame *frame);
+    /* the frame returned by peek() has been on the bus */
+    void (*sent)(Fm3CanNode *node, Fm3CanFrame *frame, bool acked);
+    void *opaque;
+    QTAILQ_ENTRY(Fm3CanNode) next;
+};
+
+Fm3CanFrame *fm3_can_frame_new(void);
+Fm3CanFrame *fm3_can_frame_ref(Fm3CanFrame *frame);
+void fm3_can_frame_unref(Fm3CanFrame *frame);
+
+Fm3CanBus *fm3_canbus_get(const char *name);
+void fm3_canbus_attach(Fm3CanBus *bus, Fm3CanNode *node);
+/* a node has a new frame to send, or came onto the bus */
+void fm3_canbus_kick(Fm3CanBus *bus);
+
+#endif
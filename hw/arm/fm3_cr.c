@@ -9,6 +9,8 @@
 #include "hw/sysbus.h"
 #include "hw/devices.h"
 #include "hw/arm/arm.h"
+#include "qemu/log.h"
+#include "fm3.h"
 
 
 #define FM3_CR(obj) \
@@ -62,8 +64,24 @@ typedef struct {
     uint32_t main_clk_hz;
     uint32_t sub_clk_hz;
     uint32_t master_clk_hz;
+    uint32_t apbc0;
+    uint32_t apbc1;
+    uint32_t apbc2;
+    uint32_t clk_hz[FM3_CLK_NUM];
 } Fm3CrState;
 
+static Fm3CrState *fm3_cr_state;
+
+static NotifierList fm3_clk_notifiers[FM3_CLK_NUM] = {
+    NOTIFIER_LIST_INITIALIZER(fm3_clk_notifiers[FM3_CLK_HCLK]),
+    NOTIFIER_LIST_INITIALIZER(fm3_clk_notifiers[FM3_CLK_PCLK0]),
+    NOTIFIER_LIST_INITIALIZER(fm3_clk_notifiers[FM3_CLK_PCLK1]),
+    NOTIFIER_LIST_INITIALIZER(fm3_clk_notifiers[FM3_CLK_PCLK2]),
+};
+
+/* BSC_PSR: divisor of the base clock (HCLK) */
+static const uint32_t fm3_cr_bsc_div[8] = { 1, 2, 3, 4, 6, 8, 16, 0 };
+
 /* ֐ */
 static uint32_t fm3_cr_get_pll(Fm3CrState *s)
 {
@@ -72,9 +90,17 @@ static uint32_t fm3_cr_get_pll(Fm3CrState *s)
     return s->main_clk_hz / k * n;
 }
 
-static void fm3_cr_update_system_clock(Fm3CrState *s)
+/*
+ * Recomputes HCLK and PCLK0-2.  The notifiers of a domain are called once
+ * for a change of its rate, after all domains have been updated.
+ */
+static void fm3_cr_update_system_clock(Fm3CrState *s, bool notify)
 {
     int tmp = system_clock_scale;
+    uint32_t hz[FM3_CLK_NUM];
+    Fm3ClkChange change[FM3_CLK_NUM];
+    int i;
+
     switch ((s->scm >> 5) & 3) {
     case 0:
         s->master_clk_hz = FM3_CR_HI_OSC_HZ;
@@ -101,39 +127,50 @@ static void fm3_cr_update_system_clock(Fm3CrState *s)
             s->master_clk_hz = 0;
         break;
     default:
-        printf("FM3_CR: Invalid selection for the master clock: SCM_CTL=0x%x\n", s->scm);
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "FM3_CR: Invalid selection for the master clock: "
+                      "SCM_CTL=0x%x\n", s->scm);
         return;
 
     }
-    switch (s->bsc) {
-    case 0:
-        system_clock_scale = s->master_clk_hz;
-        break;
-    case 1:
-        system_clock_scale = s->master_clk_hz >> 1;
-        break;
-    case 2:
-        system_clock_scale = s->master_clk_hz / 3;
-        break;
-    case 3:
-        system_clock_scale = s->master_clk_hz >> 2;
-        break;
-    case 4:
-        system_clock_scale = s->master_clk_hz / 6;
-        break;
-    case 5:
-        system_clock_scale = s->master_clk_hz >> 3;
-        break;
-    case 6:
-        system_clock_scale = s->master_clk_hz >> 4;
-        break;
-    default:
-        printf("FM3_CR: Invalid divisor setting for the base clock: BSC_PSR=0x%x\n", s->bsc);
+    if (!s->master_clk_hz) {
+        /* the switch waits for the oscillation to be stable */
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "FM3_CR: The selected master clock is not enabled: "
+                      "SCM_CTL=0x%x\n", s->scm);
+        return;
+    }
+    if (!fm3_cr_bsc_div[s->bsc]) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "FM3_CR: Invalid divisor setting for the base clock: "
+                      "BSC_PSR=0x%x\n", s->bsc);
         return;
     }
 
+    /* APBCxEN is kept but does not gate the bus clock */
+    hz[FM3_CLK_HCLK] = s->master_clk_hz / fm3_cr_bsc_div[s->bsc];
+    hz[FM3_CLK_PCLK0] = hz[FM3_CLK_HCLK] >> (s->apbc0 & 3);
+    hz[FM3_CLK_PCLK1] = hz[FM3_CLK_HCLK] >> (s->apbc1 & 3);
+    hz[FM3_CLK_PCLK2] = hz[FM3_CLK_HCLK] >> (s->apbc2 & 3);
+
+    /* SysTick */
+    system_clock_scale = hz[FM3_CLK_HCLK];
     if (tmp != system_clock_scale)
         printf("FM3_CR: Base clock at %d Hz\n", system_clock_scale);
+
+    /* every domain has its new rate before the first notifier runs */
+    for (i = 0; i < FM3_CLK_NUM; i++) {
+        change[i].clk = i;
+        change[i].old_hz = s->clk_hz[i];
+        change[i].hz = hz[i];
+        s->clk_hz[i] = hz[i];
+    }
+    if (!notify)
+        return;
+    for (i = 0; i < FM3_CLK_NUM; i++) {
+        if (change[i].old_hz && change[i].old_hz != change[i].hz)
+            notifier_list_notify(&fm3_clk_notifiers[i], &change[i]);
+    }
 }
 
 /*
@@ -157,6 +194,15 @@ static uint64_t fm3_cr_read(void *opaque, hwaddr offset,
     case FM3_CR_BSC_PSR_OFFSET:
         retval = s->bsc;
         break;
+    case FM3_CR_APBC0_PSR_OFFSET:
+        retval = s->apbc0;
+        break;
+    case FM3_CR_APBC1_PSR_OFFSET:
+        retval = s->apbc1;
+        break;
+    case FM3_CR_APBC2_PSR_OFFSET:
+        retval = s->apbc2;
+        break;
     case FM3_CR_PLL_CTL1_OFFSET:
         retval = s->pll1;
         break;
@@ -185,7 +231,16 @@ static void fm3_cr_write(void *opaque, hwaddr offset,
         s->scm = value & 0xff;
         break;
     case FM3_CR_BSC_PSR_OFFSET:
-        s->bsc = value & 3;
+        s->bsc = value & 7;
+        break;
+    case FM3_CR_APBC0_PSR_OFFSET:
+        s->apbc0 = value & 3;
+        break;
+    case FM3_CR_APBC1_PSR_OFFSET:
+        s->apbc1 = value & 0x83;
+        break;
+    case FM3_CR_APBC2_PSR_OFFSET:
+        s->apbc2 = value & 0x83;
         break;
     case FM3_CR_PLL_CTL1_OFFSET:
         s->pll1 = value;
@@ -193,14 +248,16 @@ static void fm3_cr_write(void *opaque, hwaddr offset,
     case FM3_CR_PLL_CTL2_OFFSET:
         s->pll2 = value & 0x3f;
         if (49 < s->pll2) {
-            printf("FM3_CR: Invalid pll feedback divisor: PLLN=%d\n", s->pll2);
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "FM3_CR: Invalid pll feedback divisor: PLLN=%d\n",
+                          s->pll2);
             return;
         }
         break;
     default:
         return;
     }
-    fm3_cr_update_system_clock(s);
+    fm3_cr_update_system_clock(s, true);
 }
 
 /* Œ`ꂽ֐QEMUCPUĂ΂B */
@@ -214,7 +271,29 @@ static const MemoryRegionOps fm3_cr_mem_ops = {
 static void fm3_cr_reset(DeviceState *d)
 {
     Fm3CrState *s = FM3_CR(d);
+
+    /* the CPU runs on the high-speed CR oscillator after a reset */
+    s->scm = 0x00;
+    s->bsc = 0x00;
+    s->pll1 = 0x00;
+    s->pll2 = 0x00;
     s->master_clk_hz = FM3_CR_HI_OSC_HZ;
+    s->apbc0 = 0x01;
+    s->apbc1 = 0x81;
+    s->apbc2 = 0x81;
+    fm3_cr_update_system_clock(s, true);
+}
+
+uint32_t fm3_clk_get_hz(int clk)
+{
+    if (!fm3_cr_state)
+        return system_clock_scale;
+    return fm3_cr_state->clk_hz[clk];
+}
+
+void fm3_clk_add_notifier(int clk, Notifier *notifier)
+{
+    notifier_list_add(&fm3_clk_notifiers[clk], notifier);
 }
 
 /* Bn[hEFAꂽƂɌĂ΂B */
@@ -226,11 +305,45 @@ static int fm3_cr_init(SysBusDevice *dev)
     memory_region_init_io(&s->mmio, OBJECT(s), &fm3_cr_mem_ops, s, TYPE_FM3_CLK_RST, 0x1000);
     sysbus_init_mmio(dev, &s->mmio);
 
-    system_clock_scale = s->main_clk_hz;
+    s->apbc0 = 0x01;
+    s->apbc1 = 0x81;
+    s->apbc2 = 0x81;
+    fm3_cr_update_system_clock(s, false);
+    fm3_cr_state = s;
     return 0;
 }
 
 /*  */
+static int fm3_cr_post_load(void *opaque, int version_id)
+{
+    Fm3CrState *s = opaque;
+
+    /* the timers of the devices are restored with their own state */
+    fm3_cr_update_system_clock(s, false);
+    return 0;
+}
+
+static const VMStateDescription vmstate_fm3_cr = {
+    .name = TYPE_FM3_CLK_RST,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .post_load = fm3_cr_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(scm, Fm3CrState),
+        VMSTATE_UINT32(bsc, Fm3CrState),
+        VMSTATE_UINT32(pll1, Fm3CrState),
+        VMSTATE_UINT32(pll2, Fm3CrState),
+        VMSTATE_UINT32(main_clk_hz, Fm3CrState),
+        VMSTATE_UINT32(sub_clk_hz, Fm3CrState),
+        VMSTATE_UINT32(master_clk_hz, Fm3CrState),
+        VMSTATE_UINT32(apbc0, Fm3CrState),
+        VMSTATE_UINT32(apbc1, Fm3CrState),
+        VMSTATE_UINT32(apbc2, Fm3CrState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property fm3_cr_properties[] = {
     DEFINE_PROP_UINT32("pll1"			, Fm3CrState	, pll1			, 0),
     DEFINE_PROP_UINT32("pll2"			, Fm3CrState	, pll2			, 0),
@@ -249,6 +362,7 @@ static void fm3_cr_class_init(ObjectClass *klass, void *data)
 	k->init		= fm3_cr_init;			/* ֐o^		*/
 	dc->desc	= TYPE_FM3_CLK_RST;		/* n[hEFA		*/
 	dc->reset	= fm3_cr_reset;			/* ZbgɌĂ΂ */
+	dc->vmsd	= &vmstate_fm3_cr;
 	dc->props	= fm3_cr_properties;	/* 				*/
 }
 
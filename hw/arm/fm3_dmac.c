@@ -0,0 +1,632 @@
+/*
+ * Fujitsu FM3 DMA Controller
+ *
+ * This code is licensed under the GNU GPL v2.
+ *
+ * Block, burst and demand transfers of the 8 DMAC channels.  Whenever a
+ * side of the transfer is incrementing RAM it is reached through
+ * address_space_map(), so RAM-to-RAM moves are a memmove() per mapped
+ * chunk and RAM-to-peripheral moves touch only the peripheral per beat.
+ * Each beat goes through the MMIO dispatch only on the peripheral side.
+ * A software or burst transfer from RAM to RAM maps all its remaining
+ * blocks at once and is a single memmove().
+ */
+
+#include "hw/sysbus.h"
+#include "qemu/main-loop.h"
+#include "exec/address-spaces.h"
+#include "fm3.h"
+
+//#define FM3_DEBUG_DMAC
+#define TYPE_FM3_DMAC   "fm3.dmac"
+
+#ifdef FM3_DEBUG_DMAC
+#define DPRINTF(fmt, ...)                                       \
+    do { printf(fmt, ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) do { } while (0)
+#endif
+
+#define FM3_DMAC_REG_DMACR          (0x000)
+#define FM3_DMAC_REG_DMACR_DMAE     (1 << 31)
+#define FM3_DMAC_REG_DMACR_PR       (1 << 28)
+#define FM3_DMAC_REG_DMACR_DH       (0xf << 24)
+#define FM3_DMAC_REG_DMACR_MASK     (FM3_DMAC_REG_DMACR_DMAE | \
+                                     FM3_DMAC_REG_DMACR_PR | \
+                                     FM3_DMAC_REG_DMACR_DH)
+
+/* channel registers: 0x010 + ch * 0x10 */
+#define FM3_DMAC_REG_CH_BASE        (0x010)
+#define FM3_DMAC_REG_DMACA          (0x00)
+#define FM3_DMAC_REG_DMACA_EB       (1 << 31)
+#define FM3_DMAC_REG_DMACA_PB       (1 << 30)
+#define FM3_DMAC_REG_DMACA_ST       (1 << 29)
+#define FM3_DMAC_REG_DMACB          (0x04)
+#define FM3_DMAC_REG_DMACB_FS       (1 << 25)
+#define FM3_DMAC_REG_DMACB_FD       (1 << 24)
+#define FM3_DMAC_REG_DMACB_RC       (1 << 23)
+#define FM3_DMAC_REG_DMACB_RS       (1 << 22)
+#define FM3_DMAC_REG_DMACB_RD       (1 << 21)
+#define FM3_DMAC_REG_DMACB_EI       (1 << 20)
+#define FM3_DMAC_REG_DMACB_CI       (1 << 19)
+#define FM3_DMAC_REG_DMACB_SS       (7 << 16)
+#define FM3_DMAC_REG_DMACB_EM       (1 << 0)
+#define FM3_DMAC_REG_DMASA          (0x08)
+#define FM3_DMAC_REG_DMADA          (0x0C)
+
+#define get_is(dmaca)               (((dmaca) >> 23) & 0x3f)
+#define get_bc(dmaca)               (((dmaca) >> 16) & 0xf)
+#define get_tc(dmaca)               ((dmaca) & 0xffff)
+#define get_ms(dmacb)               (((dmacb) >> 28) & 3)
+#define get_tw(dmacb)               (((dmacb) >> 26) & 3)
+#define get_ss(dmacb)               (((dmacb) >> 16) & 7)
+
+/* MS1-0 */
+enum {
+    FM3_DMAC_MS_BLOCK = 0,
+    FM3_DMAC_MS_BURST,
+    FM3_DMAC_MS_DEMAND,
+};
+
+/* SS2-0 */
+enum {
+    FM3_DMAC_SS_NONE = 0,
+    FM3_DMAC_SS_ADDR_OVERFLOW,
+    FM3_DMAC_SS_STOP,
+    FM3_DMAC_SS_SRC_ERROR,
+    FM3_DMAC_SS_DST_ERROR,
+    FM3_DMAC_SS_COMPLETE,
+};
+
+#define FM3_DMAC_NUM                8
+/* IS5-0 of a software request */
+#define FM3_DMAC_IS_SOFTWARE        0x00
+/* blocks per channel and bottom half, so that a request held high with
+ * RC=1 cannot lock up the main loop */
+#define FM3_DMAC_BLOCK_QUOTA        4096
+
+typedef struct Fm3DmacState Fm3DmacState;
+
+typedef struct {
+    Fm3DmacState *dmac;
+    uint32_t ch_no;
+    uint32_t dmaca;
+    uint32_t dmacb;
+    uint32_t dmasa;
+    uint32_t dmada;
+    uint32_t tc_reload;     /* TC/DMASA/DMADA at enable, for RC/RS/RD */
+    uint32_t sa_reload;
+    uint32_t da_reload;
+    int32_t request;        /* level of the peripheral request */
+} Fm3DmacChState;
+
+struct Fm3DmacState {
+    SysBusDevice busdev;
+    MemoryRegion mmio;
+    AddressSpace *as;
+    QEMUBH *bh;
+    uint32_t dmacr;
+    Fm3DmacChState ch[FM3_DMAC_NUM];
+    qemu_irq irq[FM3_DMAC_NUM];
+};
+#define FM3_DMAC(obj) \
+    OBJECT_CHECK(Fm3DmacState, (obj), TYPE_FM3_DMAC)
+
+static Fm3DmacState *fm3_dmac_state;
+
+static void fm3_dmac_update_irq(Fm3DmacChState *s)
+{
+    uint32_t ss = get_ss(s->dmacb);
+    int level = 0;
+
+    if (ss == FM3_DMAC_SS_COMPLETE)
+        level = !!(s->dmacb & FM3_DMAC_REG_DMACB_CI);
+    else if (ss != FM3_DMAC_SS_NONE)
+        level = !!(s->dmacb & FM3_DMAC_REG_DMACB_EI);
+
+    fm3_int_set_mon(FM3_IRQ_DMAC(s->ch_no), 1, level);
+    qemu_set_irq(s->dmac->irq[s->ch_no], level);
+}
+
+static void fm3_dmac_set_ss(Fm3DmacChState *s, uint32_t ss)
+{
+    s->dmacb = (s->dmacb & ~FM3_DMAC_REG_DMACB_SS) | (ss << 16);
+    fm3_dmac_update_irq(s);
+}
+
+/* same test as address_space_map() uses to decide on a bounce buffer */
+static bool fm3_dmac_is_direct(Fm3DmacState *dmac, hwaddr addr, bool is_write)
+{
+    MemoryRegion *mr;
+    hwaddr xlat, len = 1;
+
+    mr = address_space_translate(dmac->as, addr, &xlat, &len, is_write);
+    if (memory_region_is_ram(mr))
+        return !(is_write && mr->readonly);
+    if (memory_region_is_romd(mr))
+        return !is_write;
+    return false;
+}
+
+/* One beat through the MMIO dispatch; false on a bus error of the side
+ * given in *ss. */
+static bool fm3_dmac_beat(Fm3DmacState *dmac, hwaddr src, hwaddr dst,
+                          uint8_t *buf, uint32_t width, uint32_t *ss)
+{
+    if (address_space_rw(dmac->as, src, buf, width, false)) {
+        *ss = FM3_DMAC_SS_SRC_ERROR;
+        return false;
+    }
+    if (address_space_rw(dmac->as, dst, buf, width, true)) {
+        *ss = FM3_DMAC_SS_DST_ERROR;
+        return false;
+    }
+    return true;
+}
+
+/* Moves beats * width bytes, mapping whichever incrementing side is RAM.
+ * Returns the number of beats done; *ss is set on an error. */
+static uint32_t fm3_dmac_copy(Fm3DmacState *dmac, hwaddr src, bool src_inc,
+                              hwaddr dst, bool dst_inc, uint32_t width,
+                              uint32_t beats, uint32_t *ss)
+{
+    uint8_t buf[4];
+    uint8_t *sp, *dp;
+    hwaddr slen, dlen, len;
+    uint32_t done = 0;
+    uint32_t n, i;
+    bool src_ram, dst_ram;
+
+    while (done < beats) {
+        len = (hwaddr)(beats - done) * width;
+        src_ram = src_inc && fm3_dmac_is_direct(dmac, src, false);
+        dst_ram = dst_inc && fm3_dmac_is_direct(dmac, dst, true);
+
+        sp = dp = NULL;
+        slen = dlen = len;
+        if (src_ram)
+            sp = address_space_map(dmac->as, src, &slen, false);
+        if (dst_ram)
+            dp = address_space_map(dmac->as, dst, &dlen, true);
+
+        if (sp && dp) {
+            /* RAM to RAM */
+            len = MIN(slen, dlen);
+        } else if (sp) {
+            /* RAM to peripheral */
+            len = slen;
+        } else if (dp) {
+            /* peripheral to RAM */
+            len = dlen;
+        } else {
+            len = 0;
+        }
+        n = len / width;
+
+        if (!n) {
+            /* unmapped, or less than a beat left in the mapping */
+            if (sp)
+                address_space_unmap(dmac->as, sp, slen, false, 0);
+            if (dp)
+                address_space_unmap(dmac->as, dp, dlen, true, 0);
+            if (!fm3_dmac_beat(dmac, src, dst, buf, width, ss))
+                break;
+            n = 1;
+        } else if (sp && dp) {
+            memmove(dp, sp, n * width);
+            address_space_unmap(dmac->as, dp, dlen, true, n * width);
+            address_space_unmap(dmac->as, sp, slen, false, n * width);
+        } else if (sp) {
+            for (i = 0; i < n; i++) {
+                if (address_space_rw(dmac->as, dst + (dst_inc ? i * width : 0),
+                                     sp + i * width, width, true)) {
+                    *ss = FM3_DMAC_SS_DST_ERROR;
+                    break;
+                }
+            }
+            address_space_unmap(dmac->as, sp, slen, false, i * width);
+            n = i;
+        } else {
+            for (i = 0; i < n; i++) {
+                if (address_space_rw(dmac->as, src + (src_inc ? i * width : 0),
+                                     dp + i * width, width, false)) {
+                    *ss = FM3_DMAC_SS_SRC_ERROR;
+                    break;
+                }
+            }
+            address_space_unmap(dmac->as, dp, dlen, true, i * width);
+            n = i;
+        }
+
+        done += n;
+        if (src_inc)
+            src += n * width;
+        if (dst_inc)
+            dst += n * width;
+        if (*ss != FM3_DMAC_SS_NONE)
+            break;
+    }
+    return done;
+}
+
+/* the ADC does not drop its request on a FIFO read, the DMAC clears
+ * the interrupt flag that made it */
+static void fm3_dmac_ack(Fm3DmacChState *s)
+{
+    uint32_t is = get_is(s->dmaca);
+
+    if (FM3_DRQ_TO_IS(FM3_DRQ_ADC(0)) <= is &&
+        is <= FM3_DRQ_TO_IS(FM3_DRQ_ADC(2)))
+        fm3_adc_dma_ack(is - FM3_DRQ_TO_IS(FM3_DRQ_ADC(0)));
+}
+
+/* All TC+1 blocks are done */
+static void fm3_dmac_complete(Fm3DmacChState *s)
+{
+    if (s->dmacb & FM3_DMAC_REG_DMACB_RS)
+        s->dmasa = s->sa_reload;
+    if (s->dmacb & FM3_DMAC_REG_DMACB_RD)
+        s->dmada = s->da_reload;
+    if (s->dmacb & FM3_DMAC_REG_DMACB_RC) {
+        s->dmaca = (s->dmaca & ~0xffff) | s->tc_reload;
+    } else {
+        s->dmaca &= ~FM3_DMAC_REG_DMACA_EB;
+    }
+    s->dmaca &= ~FM3_DMAC_REG_DMACA_ST;
+    fm3_dmac_set_ss(s, FM3_DMAC_SS_COMPLETE);
+}
+
+/* Transfers one block of BC+1 beats and counts TC down. */
+static bool fm3_dmac_do_block(Fm3DmacChState *s)
+{
+    Fm3DmacState *dmac = s->dmac;
+    uint32_t width = 1 << get_tw(s->dmacb);
+    uint32_t beats = get_bc(s->dmaca) + 1;
+    bool src_inc = !(s->dmacb & FM3_DMAC_REG_DMACB_FS);
+    bool dst_inc = !(s->dmacb & FM3_DMAC_REG_DMACB_FD);
+    uint32_t ss = FM3_DMAC_SS_NONE;
+    uint32_t done, tc;
+
+    if (width > 4) {
+        s->dmaca &= ~(FM3_DMAC_REG_DMACA_EB | FM3_DMAC_REG_DMACA_ST);
+        fm3_dmac_set_ss(s, FM3_DMAC_SS_SRC_ERROR);
+        return false;
+    }
+
+    done = fm3_dmac_copy(dmac, s->dmasa, src_inc, s->dmada, dst_inc, width,
+                         beats, &ss);
+    if (src_inc)
+        s->dmasa += done * width;
+    if (dst_inc)
+        s->dmada += done * width;
+
+    if (ss != FM3_DMAC_SS_NONE) {
+        DPRINTF("%s: ch%d bus error %d\n", __func__, s->ch_no, ss);
+        s->dmaca &= ~(FM3_DMAC_REG_DMACA_EB | FM3_DMAC_REG_DMACA_ST);
+        fm3_dmac_set_ss(s, ss);
+        return false;
+    }
+
+    fm3_dmac_ack(s);
+
+    tc = get_tc(s->dmaca);
+    if (tc) {
+        s->dmaca = (s->dmaca & ~0xffff) | (tc - 1);
+        return true;
+    }
+
+    fm3_dmac_complete(s);
+    return false;
+}
+
+/* Transfers all the blocks left at once when both sides are incrementing
+ * RAM; false, with nothing done, if they are not. */
+static bool fm3_dmac_do_all(Fm3DmacChState *s)
+{
+    Fm3DmacState *dmac = s->dmac;
+    uint32_t width = 1 << get_tw(s->dmacb);
+    hwaddr len = (hwaddr)(get_tc(s->dmaca) + 1) * (get_bc(s->dmaca) + 1) *
+                 width;
+    hwaddr slen = len, dlen = len;
+    uint8_t *sp, *dp = NULL;
+
+    if (width > 4 || (s->dmacb & (FM3_DMAC_REG_DMACB_FS |
+                                  FM3_DMAC_REG_DMACB_FD)))
+        return false;
+    if (!fm3_dmac_is_direct(dmac, s->dmasa, false) ||
+        !fm3_dmac_is_direct(dmac, s->dmada, true))
+        return false;
+
+    sp = address_space_map(dmac->as, s->dmasa, &slen, false);
+    if (sp)
+        dp = address_space_map(dmac->as, s->dmada, &dlen, true);
+    if (!sp || !dp || slen < len || dlen < len) {
+        /* crosses out of RAM: block by block */
+        if (dp)
+            address_space_unmap(dmac->as, dp, dlen, true, 0);
+        if (sp)
+            address_space_unmap(dmac->as, sp, slen, false, 0);
+        return false;
+    }
+
+    memmove(dp, sp, len);
+    address_space_unmap(dmac->as, dp, dlen, true, len);
+    address_space_unmap(dmac->as, sp, slen, false, len);
+    s->dmasa += len;
+    s->dmada += len;
+
+    fm3_dmac_ack(s);
+    s->dmaca &= ~0xffff;
+    fm3_dmac_complete(s);
+    return true;
+}
+
+static bool fm3_dmac_is_active(Fm3DmacChState *s)
+{
+    return (s->dmac->dmacr & FM3_DMAC_REG_DMACR_DMAE) &&
+           !(s->dmac->dmacr & FM3_DMAC_REG_DMACR_DH) &&
+           (s->dmaca & FM3_DMAC_REG_DMACA_EB) &&
+           !(s->dmaca & FM3_DMAC_REG_DMACA_PB);
+}
+
+static bool fm3_dmac_is_requested(Fm3DmacChState *s)
+{
+    if (get_is(s->dmaca) == FM3_DMAC_IS_SOFTWARE)
+        return !!(s->dmaca & FM3_DMAC_REG_DMACA_ST);
+    return s->request;
+}
+
+/* Returns true if the channel has blocks left after spending its quota. */
+static bool fm3_dmac_run_ch(Fm3DmacChState *s)
+{
+    uint32_t quota = FM3_DMAC_BLOCK_QUOTA;
+    bool all;
+
+    while (fm3_dmac_is_active(s) && fm3_dmac_is_requested(s)) {
+        if (!quota--)
+            return true;
+        /* A software request and a burst run through all blocks, a
+         * block or demand request gets one block per request.  The
+         * peripheral drops its request line synchronously when the
+         * block has served it, which ends the loop here. */
+        all = get_is(s->dmaca) == FM3_DMAC_IS_SOFTWARE ||
+              get_ms(s->dmacb) == FM3_DMAC_MS_BURST;
+        if (all && get_ms(s->dmacb) != FM3_DMAC_MS_DEMAND &&
+            fm3_dmac_do_all(s))
+            continue;
+        while (fm3_dmac_do_block(s) && all)
+            ;
+    }
+    return false;
+}
+
+static void fm3_dmac_run(void *opaque)
+{
+    Fm3DmacState *dmac = (Fm3DmacState *)opaque;
+    bool pending = false;
+    int i;
+
+    /* PR=0: fixed priority, ch0 first */
+    for (i = 0; i < FM3_DMAC_NUM; i++) {
+        pending |= fm3_dmac_run_ch(&dmac->ch[i]);
+    }
+    if (pending)
+        qemu_bh_schedule(dmac->bh);
+}
+
+/* Called by fm3.int for the interrupt sources routed by DRQSEL. */
+void fm3_dmac_request(int is, int level)
+{
+    Fm3DmacState *dmac = fm3_dmac_state;
+    Fm3DmacChState *s;
+    bool run = false;
+    int i;
+
+    if (!dmac)
+        return;
+
+    for (i = 0; i < FM3_DMAC_NUM; i++) {
+        s = &dmac->ch[i];
+        if (get_is(s->dmaca) != is)
+            continue;
+        s->request = level;
+        run |= level && fm3_dmac_is_active(s);
+    }
+    if (run)
+        qemu_bh_schedule(dmac->bh);
+}
+
+static uint64_t fm3_dmac_read(void *opaque, hwaddr offset, unsigned size)
+{
+    Fm3DmacState *dmac = (Fm3DmacState *)opaque;
+    Fm3DmacChState *s;
+    uint64_t retval = 0;
+
+    if (offset == FM3_DMAC_REG_DMACR) {
+        retval = dmac->dmacr;
+    } else if (FM3_DMAC_REG_CH_BASE <= offset &&
+               offset < FM3_DMAC_REG_CH_BASE + FM3_DMAC_NUM * 0x10) {
+        s = &dmac->ch[(offset - FM3_DMAC_REG_CH_BASE) >> 4];
+        switch (offset & 0xc) {
+        case FM3_DMAC_REG_DMACA:
+            retval = s->dmaca;
+            break;
+        case FM3_DMAC_REG_DMACB:
+            retval = s->dmacb;
+            break;
+        case FM3_DMAC_REG_DMASA:
+            retval = s->dmasa;
+            break;
+        case FM3_DMAC_REG_DMADA:
+            retval = s->dmada;
+            break;
+        }
+    }
+
+    DPRINTF("%s : 0x%08x ---> 0x%08x\n", __func__, (uint32_t)offset,
+            (uint32_t)retval);
+    return retval;
+}
+
+static void fm3_dmac_write(void *opaque, hwaddr offset,
+                           uint64_t value, unsigned size)
+{
+    Fm3DmacState *dmac = (Fm3DmacState *)opaque;
+    Fm3DmacChState *s;
+
+    DPRINTF("%s : 0x%08x <--- 0x%08x\n", __func__, (uint32_t)offset,
+            (uint32_t)value);
+
+    if (offset == FM3_DMAC_REG_DMACR) {
+        dmac->dmacr = value & FM3_DMAC_REG_DMACR_MASK;
+        qemu_bh_schedule(dmac->bh);
+        return;
+    }
+    if (offset < FM3_DMAC_REG_CH_BASE ||
+        FM3_DMAC_REG_CH_BASE + FM3_DMAC_NUM * 0x10 <= offset)
+        return;
+
+    s = &dmac->ch[(offset - FM3_DMAC_REG_CH_BASE) >> 4];
+    switch (offset & 0xc) {
+    case FM3_DMAC_REG_DMACA:
+        if ((value & FM3_DMAC_REG_DMACA_EB) &&
+            !(s->dmaca & FM3_DMAC_REG_DMACA_EB)) {
+            s->tc_reload = get_tc(value);
+            s->sa_reload = s->dmasa;
+            s->da_reload = s->dmada;
+        }
+        if (get_is(value) != get_is(s->dmaca))
+            s->request = 0;
+        s->dmaca = value;
+        if (fm3_dmac_is_active(s) && fm3_dmac_is_requested(s))
+            qemu_bh_schedule(dmac->bh);
+        break;
+    case FM3_DMAC_REG_DMACB:
+        /* SS is cleared by writing 000, other values are ignored */
+        if (get_ss(value) != FM3_DMAC_SS_NONE)
+            value = (value & ~FM3_DMAC_REG_DMACB_SS) |
+                    (s->dmacb & FM3_DMAC_REG_DMACB_SS);
+        s->dmacb = value;
+        fm3_dmac_update_irq(s);
+        break;
+    case FM3_DMAC_REG_DMASA:
+        s->dmasa = value;
+        break;
+    case FM3_DMAC_REG_DMADA:
+        s->dmada = value;
+        break;
+    }
+}
+
+static const MemoryRegionOps fm3_dmac_mem_ops = {
+    .read = fm3_dmac_read,
+    .write = fm3_dmac_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+};
+
+static void fm3_dmac_reset(DeviceState *d)
+{
+    Fm3DmacState *dmac = FM3_DMAC(d);
+    Fm3DmacChState *s;
+    int i;
+
+    dmac->dmacr = 0;
+    for (i = 0; i < FM3_DMAC_NUM; i++) {
+        s = &dmac->ch[i];
+        s->dmaca = 0;
+        s->dmacb = 0;
+        s->dmasa = 0;
+        s->dmada = 0;
+        s->tc_reload = 0;
+        s->sa_reload = 0;
+        s->da_reload = 0;
+        s->request = 0;
+        fm3_dmac_update_irq(s);
+    }
+}
+
+static int fm3_dmac_init(SysBusDevice *dev)
+{
+    DeviceState *devs = DEVICE(dev);
+    Fm3DmacState *dmac = FM3_DMAC(devs);
+    int i;
+
+    for (i = 0; i < FM3_DMAC_NUM; i++) {
+        dmac->ch[i].dmac = dmac;
+        dmac->ch[i].ch_no = i;
+        sysbus_init_irq(dev, &dmac->irq[i]);
+    }
+    dmac->as = &address_space_memory;
+    dmac->bh = qemu_bh_new(fm3_dmac_run, dmac);
+
+    memory_region_init_io(&dmac->mmio, OBJECT(dmac), &fm3_dmac_mem_ops, dmac,
+                          TYPE_FM3_DMAC, 0x1000);
+    sysbus_init_mmio(dev, &dmac->mmio);
+    fm3_dmac_state = dmac;
+    return 0;
+}
+
+static int fm3_dmac_post_load(void *opaque, int version_id)
+{
+    Fm3DmacState *dmac = (Fm3DmacState *)opaque;
+
+    qemu_bh_schedule(dmac->bh);
+    return 0;
+}
+
+static const VMStateDescription vmstate_fm3_dmac_ch = {
+    .name = "fm3.dmac/ch",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(dmaca, Fm3DmacChState),
+        VMSTATE_UINT32(dmacb, Fm3DmacChState),
+        VMSTATE_UINT32(dmasa, Fm3DmacChState),
+        VMSTATE_UINT32(dmada, Fm3DmacChState),
+        VMSTATE_UINT32(tc_reload, Fm3DmacChState),
+        VMSTATE_UINT32(sa_reload, Fm3DmacChState),
+        VMSTATE_UINT32(da_reload, Fm3DmacChState),
+        VMSTATE_INT32(request, Fm3DmacChState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_fm3_dmac = {
+    .name = TYPE_FM3_DMAC,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .post_load = fm3_dmac_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(dmacr, Fm3DmacState),
+        VMSTATE_STRUCT_ARRAY(ch, Fm3DmacState, FM3_DMAC_NUM, 1,
+                             vmstate_fm3_dmac_ch, Fm3DmacChState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void fm3_dmac_class_init(ObjectClass *klass, void *data)
+{
+	DeviceClass			*dc	= DEVICE_CLASS(klass);
+	SysBusDeviceClass	*k	= SYS_BUS_DEVICE_CLASS(klass);
+
+	k->init		= fm3_dmac_init;
+	dc->desc	= TYPE_FM3_DMAC;
+	dc->reset	= fm3_dmac_reset;
+	dc->vmsd	= &vmstate_fm3_dmac;
+}
+
+static const TypeInfo fm3_dmac_info = {
+	.name			= TYPE_FM3_DMAC,
+	.parent			= TYPE_SYS_BUS_DEVICE,
+	.instance_size	= sizeof(Fm3DmacState),
+	.class_init		= fm3_dmac_class_init,
+};
+
+static void fm3_register_devices(void)
+{
+    type_register_static(&fm3_dmac_info);
+}
+
+type_init(fm3_register_devices)
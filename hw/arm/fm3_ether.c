@@ -0,0 +1,853 @@
+/*
+ * Fujitsu FM3 Ethernet MAC
+ *
+ * This code is licensed under the GNU GPL v2.
+ *
+ * The MAC and its DMA with enhanced (alternate) descriptors in ring or
+ * chain mode, and a 10/100 PHY on the MII management interface.
+ *
+ * A transmit poll demand walks the descriptor ring in a bottom half and
+ * sends up to FM3_ETHER_TX_BATCH frames at a time.  The buffers of a frame
+ * are mapped and given to the net layer as one iovec, so nothing is copied
+ * unless the peer has to queue the frame.  When it does, transmission is
+ * suspended until the sent callback, as flow control.  Reception stops
+ * taking frames while the guest owns the current descriptor, which
+ * leaves them queued in the net layer.  The queue is flushed in one batch
+ * when the guest hands descriptors back with a receive poll demand.
+ */
+
+#include "hw/sysbus.h"
+#include "net/net.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "exec/address-spaces.h"
+#include "fm3.h"
+
+//#define FM3_DEBUG_ETHER
+#define TYPE_FM3_ETHER  "fm3.ether"
+
+#ifdef FM3_DEBUG_ETHER
+#define DPRINTF(fmt, ...)                                       \
+    do { printf(fmt, ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) do { } while (0)
+#endif
+
+/* MAC registers */
+#define FM3_ETHER_REG_MCR           (0x0000)
+#define FM3_ETHER_REG_MCR_RE        (1 << 2)
+#define FM3_ETHER_REG_MCR_TE        (1 << 3)
+#define FM3_ETHER_REG_MFFR          (0x0004)
+#define FM3_ETHER_REG_MFFR_PR       (1 << 0)
+#define FM3_ETHER_REG_MFFR_HMC      (1 << 2)
+#define FM3_ETHER_REG_MFFR_PM       (1 << 4)
+#define FM3_ETHER_REG_MFFR_DB       (1 << 5)
+#define FM3_ETHER_REG_MFFR_RA       (1U << 31)
+#define FM3_ETHER_REG_MHTRH         (0x0008)
+#define FM3_ETHER_REG_MHTRL         (0x000C)
+#define FM3_ETHER_REG_GAR           (0x0010)
+#define FM3_ETHER_REG_GAR_GB        (1 << 0)
+#define FM3_ETHER_REG_GAR_GW        (1 << 1)
+#define FM3_ETHER_REG_GDR           (0x0014)
+#define FM3_ETHER_REG_FCR           (0x0018)
+#define FM3_ETHER_REG_VTR           (0x001C)
+#define FM3_ETHER_REG_ISR           (0x0038)
+#define FM3_ETHER_REG_IMR           (0x003C)
+#define FM3_ETHER_REG_MAR0H         (0x0040)
+#define FM3_ETHER_REG_MAR0L         (0x0044)
+
+/* DMA registers */
+#define FM3_ETHER_REG_BMR           (0x1000)
+#define FM3_ETHER_REG_BMR_SWR       (1 << 0)
+#define FM3_ETHER_REG_BMR_ATDS      (1 << 7)
+#define FM3_ETHER_REG_TPDR          (0x1004)
+#define FM3_ETHER_REG_RPDR          (0x1008)
+#define FM3_ETHER_REG_RDLAR         (0x100C)
+#define FM3_ETHER_REG_TDLAR         (0x1010)
+#define FM3_ETHER_REG_SR            (0x1014)
+#define FM3_ETHER_REG_OMR           (0x1018)
+#define FM3_ETHER_REG_OMR_SR        (1 << 1)
+#define FM3_ETHER_REG_OMR_ST        (1 << 13)
+#define FM3_ETHER_REG_IER           (0x101C)
+#define FM3_ETHER_REG_MFBOCR        (0x1020)
+#define FM3_ETHER_REG_CHTDR         (0x1048)
+#define FM3_ETHER_REG_CHRDR         (0x104C)
+#define FM3_ETHER_REG_CHTBAR        (0x1050)
+#define FM3_ETHER_REG_CHRBAR        (0x1054)
+
+/* SR and IER */
+#define FM3_ETHER_SR_TI             (1 << 0)
+#define FM3_ETHER_SR_TPS            (1 << 1)
+#define FM3_ETHER_SR_TU             (1 << 2)
+#define FM3_ETHER_SR_UNF            (1 << 5)
+#define FM3_ETHER_SR_RI             (1 << 6)
+#define FM3_ETHER_SR_RU             (1 << 7)
+#define FM3_ETHER_SR_RPS            (1 << 8)
+#define FM3_ETHER_SR_ERI            (1 << 14)
+#define FM3_ETHER_SR_AIS            (1 << 15)
+#define FM3_ETHER_SR_NIS            (1 << 16)
+#define FM3_ETHER_SR_NORMAL         (FM3_ETHER_SR_TI | FM3_ETHER_SR_TU | \
+                                     FM3_ETHER_SR_RI | FM3_ETHER_SR_ERI)
+#define FM3_ETHER_SR_ABNORMAL       (0x7fff & ~FM3_ETHER_SR_NORMAL)
+#define FM3_ETHER_SR_RS_SHIFT       17
+#define FM3_ETHER_SR_TS_SHIFT       20
+
+/* RS2-0/TS2-0 */
+#define FM3_ETHER_PS_STOPPED        0
+#define FM3_ETHER_PS_RX_WAITING     3
+#define FM3_ETHER_PS_RX_SUSPENDED   4
+#define FM3_ETHER_PS_TX_SUSPENDED   6
+
+/* TDES0 */
+#define FM3_ETHER_TDES0_OWN         (1U << 31)
+#define FM3_ETHER_TDES0_IC          (1 << 30)
+#define FM3_ETHER_TDES0_LS          (1 << 29)
+#define FM3_ETHER_TDES0_FS          (1 << 28)
+#define FM3_ETHER_TDES0_TER         (1 << 21)
+#define FM3_ETHER_TDES0_TCH         (1 << 20)
+#define FM3_ETHER_TDES0_ES          (1 << 15)
+#define FM3_ETHER_TDES0_UF          (1 << 1)
+/* RDES0 */
+#define FM3_ETHER_RDES0_OWN         (1U << 31)
+#define FM3_ETHER_RDES0_ES          (1 << 15)
+#define FM3_ETHER_RDES0_DE          (1 << 14)
+#define FM3_ETHER_RDES0_FS          (1 << 9)
+#define FM3_ETHER_RDES0_LS          (1 << 8)
+#define FM3_ETHER_RDES0_FL_SHIFT    16
+/* RDES1 */
+#define FM3_ETHER_RDES1_DIC         (1U << 31)
+#define FM3_ETHER_RDES1_RER         (1 << 15)
+#define FM3_ETHER_RDES1_RCH         (1 << 14)
+
+#define get_bs1(des1)               ((des1) & 0x1fff)
+#define get_bs2(des1)               (((des1) >> 16) & 0x1fff)
+#define get_dsl(bmr)                (((bmr) >> 2) & 0x1f)
+
+/* frames sent per bottom half */
+#define FM3_ETHER_TX_BATCH          64
+/* descriptors (two buffers each) per frame */
+#define FM3_ETHER_TX_DESC_MAX       16
+#define FM3_ETHER_TX_IOV_MAX        (FM3_ETHER_TX_DESC_MAX * 2 * 2)
+#define FM3_ETHER_FRAME_MAX         2048
+#define FM3_ETHER_CRC_LEN           4
+
+#define FM3_ETHER_PHY_REGS          32
+
+typedef struct {
+    SysBusDevice busdev;
+    MemoryRegion mmio;
+    qemu_irq irq;
+    NICState *nic;
+    NICConf conf;
+    AddressSpace *as;
+    QEMUBH *tx_bh;
+
+    uint32_t mcr;
+    uint32_t mffr;
+    uint32_t mhtrh;
+    uint32_t mhtrl;
+    uint32_t gar;
+    uint32_t gdr;
+    uint32_t fcr;
+    uint32_t vtr;
+    uint32_t imr;
+    uint32_t mar0h;
+    uint32_t mar0l;
+    uint32_t bmr;
+    uint32_t rdlar;
+    uint32_t tdlar;
+    uint32_t sr;
+    uint32_t omr;
+    uint32_t ier;
+    uint32_t mfbocr;
+    uint32_t cur_tx;        /* CHTDR */
+    uint32_t cur_rx;        /* CHRDR */
+    uint32_t cur_tx_buf;    /* CHTBAR */
+    uint32_t cur_rx_buf;    /* CHRBAR */
+    uint16_t phy[FM3_ETHER_PHY_REGS];
+
+    bool tx_pending;        /* a frame waits in the peer's queue */
+} Fm3EtherState;
+#define FM3_ETHER(obj) \
+    OBJECT_CHECK(Fm3EtherState, (obj), TYPE_FM3_ETHER)
+
+/*
+ * status and interrupts
+ */
+
+static void fm3_ether_update_irq(Fm3EtherState *s)
+{
+    uint32_t sr = s->sr & ~(FM3_ETHER_SR_NIS | FM3_ETHER_SR_AIS);
+    uint32_t active = sr & s->ier;
+
+    if (active & FM3_ETHER_SR_NORMAL)
+        sr |= FM3_ETHER_SR_NIS;
+    if (active & FM3_ETHER_SR_ABNORMAL)
+        sr |= FM3_ETHER_SR_AIS;
+    s->sr = sr;
+
+    qemu_set_irq(s->irq, !!(sr & s->ier & (FM3_ETHER_SR_NIS |
+                                            FM3_ETHER_SR_AIS)));
+}
+
+static void fm3_ether_set_ps(Fm3EtherState *s, uint32_t shift, uint32_t ps)
+{
+    s->sr = (s->sr & ~(7 << shift)) | (ps << shift);
+}
+
+/*
+ * descriptors
+ */
+
+static void fm3_ether_read_desc(Fm3EtherState *s, hwaddr addr, uint32_t *d)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        d[i] = ldl_le_phys(s->as, addr + i * 4);
+    }
+}
+
+static void fm3_ether_write_des0(Fm3EtherState *s, hwaddr addr, uint32_t d0)
+{
+    stl_le_phys(s->as, addr, d0);
+}
+
+/* next descriptor in ring (end of ring flag given) or chain mode */
+static uint32_t fm3_ether_next_desc(Fm3EtherState *s, uint32_t addr,
+                                    uint32_t *d, bool end, bool chain,
+                                    uint32_t base)
+{
+    uint32_t size = (s->bmr & FM3_ETHER_REG_BMR_ATDS) ? 32 : 16;
+
+    if (end)
+        return base;
+    if (chain)
+        return d[3];
+    return addr + size + get_dsl(s->bmr) * 4;
+}
+
+/*
+ * transmission
+ */
+
+static void fm3_ether_tx(Fm3EtherState *s);
+
+static void fm3_ether_tx_sent(NetClientState *nc, ssize_t len)
+{
+    Fm3EtherState *s = qemu_get_nic_opaque(nc);
+
+    s->tx_pending = false;
+    qemu_bh_schedule(s->tx_bh);
+}
+
+/* maps [addr, addr + len) into iov from *niov on, false if not all of it */
+static bool fm3_ether_map_buf(Fm3EtherState *s, uint32_t addr, uint32_t len,
+                              struct iovec *iov, int *niov)
+{
+    hwaddr l;
+    void *p;
+
+    while (len) {
+        if (*niov == FM3_ETHER_TX_IOV_MAX)
+            return false;
+        l = len;
+        p = address_space_map(s->as, addr, &l, false);
+        if (!p || !l)
+            return false;
+        iov[*niov].iov_base = p;
+        iov[*niov].iov_len = l;
+        (*niov)++;
+        addr += l;
+        len -= l;
+    }
+    return true;
+}
+
+static void fm3_ether_unmap_iov(Fm3EtherState *s, struct iovec *iov, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        address_space_unmap(s->as, iov[i].iov_base, iov[i].iov_len, false,
+                            iov[i].iov_len);
+    }
+}
+
+/* Sends the frame at cur_tx; false if the guest does not own one. */
+static bool fm3_ether_tx_frame(Fm3EtherState *s)
+{
+    struct iovec iov[FM3_ETHER_TX_IOV_MAX];
+    uint32_t desc[FM3_ETHER_TX_DESC_MAX];
+    uint32_t d0[FM3_ETHER_TX_DESC_MAX];
+    uint32_t d[4];
+    uint32_t addr = s->cur_tx;
+    int niov = 0;
+    int ndesc = 0;
+    bool chain;
+    bool broken = false;
+    ssize_t ret;
+    int i;
+
+    for (;;) {
+        fm3_ether_read_desc(s, addr, d);
+        if (!(d[0] & FM3_ETHER_TDES0_OWN)) {
+            /* the frame is not complete yet */
+            fm3_ether_unmap_iov(s, iov, niov);
+            return false;
+        }
+        chain = d[0] & FM3_ETHER_TDES0_TCH;
+        s->cur_tx_buf = d[2];
+        if (!fm3_ether_map_buf(s, d[2], get_bs1(d[1]), iov, &niov))
+            broken = true;
+        if (!chain && !fm3_ether_map_buf(s, d[3], get_bs2(d[1]), iov, &niov))
+            broken = true;
+        desc[ndesc] = addr;
+        d0[ndesc] = d[0];
+        ndesc++;
+        addr = fm3_ether_next_desc(s, addr, d, d[0] & FM3_ETHER_TDES0_TER,
+                                   chain, s->tdlar);
+        if (d[0] & FM3_ETHER_TDES0_LS)
+            break;
+        if (ndesc == FM3_ETHER_TX_DESC_MAX) {
+            broken = true;
+            break;
+        }
+    }
+
+    if (broken) {
+        /* the DMA could not fetch the whole frame: abort it as underflow */
+        fm3_ether_unmap_iov(s, iov, niov);
+        d0[ndesc - 1] |= FM3_ETHER_TDES0_ES | FM3_ETHER_TDES0_UF;
+        s->sr |= FM3_ETHER_SR_UNF;
+    } else {
+        ret = qemu_sendv_packet_async(qemu_get_queue(s->nic), iov, niov,
+                                      fm3_ether_tx_sent);
+        /* the net layer has copied the frame if it had to queue it */
+        fm3_ether_unmap_iov(s, iov, niov);
+        if (!ret)
+            s->tx_pending = true;
+    }
+
+    for (i = 0; i < ndesc; i++) {
+        fm3_ether_write_des0(s, desc[i], d0[i] & ~FM3_ETHER_TDES0_OWN);
+    }
+    if (d0[ndesc - 1] & FM3_ETHER_TDES0_IC)
+        s->sr |= FM3_ETHER_SR_TI;
+    s->cur_tx = addr;
+    return true;
+}
+
+static void fm3_ether_tx(Fm3EtherState *s)
+{
+    int budget = FM3_ETHER_TX_BATCH;
+
+    if (!(s->omr & FM3_ETHER_REG_OMR_ST) || !(s->mcr & FM3_ETHER_REG_MCR_TE)) {
+        fm3_ether_set_ps(s, FM3_ETHER_SR_TS_SHIFT, FM3_ETHER_PS_STOPPED);
+        return;
+    }
+
+    while (!s->tx_pending) {
+        if (!budget--) {
+            /* let the main loop run, go on in the next bottom half */
+            qemu_bh_schedule(s->tx_bh);
+            break;
+        }
+        if (!fm3_ether_tx_frame(s)) {
+            s->sr |= FM3_ETHER_SR_TU;
+            fm3_ether_set_ps(s, FM3_ETHER_SR_TS_SHIFT,
+                             FM3_ETHER_PS_TX_SUSPENDED);
+            break;
+        }
+    }
+    fm3_ether_update_irq(s);
+}
+
+static void fm3_ether_tx_bh(void *opaque)
+{
+    fm3_ether_tx((Fm3EtherState *)opaque);
+}
+
+/*
+ * reception
+ */
+
+static bool fm3_ether_rx_running(Fm3EtherState *s)
+{
+    return (s->omr & FM3_ETHER_REG_OMR_SR) && (s->mcr & FM3_ETHER_REG_MCR_RE);
+}
+
+static int fm3_ether_can_receive(NetClientState *nc)
+{
+    Fm3EtherState *s = qemu_get_nic_opaque(nc);
+
+    return fm3_ether_rx_running(s);
+}
+
+static bool fm3_ether_rx_filter(Fm3EtherState *s, const uint8_t *da)
+{
+    uint8_t mac[6];
+
+    if (s->mffr & (FM3_ETHER_REG_MFFR_PR | FM3_ETHER_REG_MFFR_RA))
+        return true;
+    if (!memcmp(da, "\xff\xff\xff\xff\xff\xff", 6))
+        return !(s->mffr & FM3_ETHER_REG_MFFR_DB);
+    if (da[0] & 1)
+        return !!(s->mffr & (FM3_ETHER_REG_MFFR_PM | FM3_ETHER_REG_MFFR_HMC));
+
+    mac[0] = s->mar0l;
+    mac[1] = s->mar0l >> 8;
+    mac[2] = s->mar0l >> 16;
+    mac[3] = s->mar0l >> 24;
+    mac[4] = s->mar0h;
+    mac[5] = s->mar0h >> 8;
+    return !memcmp(da, mac, 6);
+}
+
+static ssize_t fm3_ether_receive_iov(NetClientState *nc,
+                                     const struct iovec *iov, int iovcnt)
+{
+    Fm3EtherState *s = qemu_get_nic_opaque(nc);
+    uint8_t buf[FM3_ETHER_FRAME_MAX];
+    size_t size = iov_size(iov, iovcnt);
+    size_t len, off = 0;
+    uint32_t addr = s->cur_rx;
+    uint32_t d[4];
+    uint32_t bs[2], ba[2];
+    uint32_t d0 = FM3_ETHER_RDES0_FS;
+    bool chain;
+    int i;
+
+    if (!fm3_ether_rx_running(s))
+        return 0;
+    if (!(ldl_le_phys(s->as, s->cur_rx) & FM3_ETHER_RDES0_OWN)) {
+        /* frames wait in the net queue until the next poll demand */
+        if (!(s->sr & FM3_ETHER_SR_RU)) {
+            s->sr |= FM3_ETHER_SR_RU;
+            fm3_ether_set_ps(s, FM3_ETHER_SR_RS_SHIFT,
+                             FM3_ETHER_PS_RX_SUSPENDED);
+            fm3_ether_update_irq(s);
+        }
+        return 0;
+    }
+    if (size < 6 || FM3_ETHER_FRAME_MAX - FM3_ETHER_CRC_LEN < size)
+        return size;
+
+    iov_to_buf(iov, iovcnt, 0, buf, size);
+    if (!fm3_ether_rx_filter(s, buf))
+        return size;
+    /* FL counts the CRC, which is not stored */
+    memset(&buf[size], 0, FM3_ETHER_CRC_LEN);
+    size += FM3_ETHER_CRC_LEN;
+
+    for (;;) {
+        fm3_ether_read_desc(s, addr, d);
+        if (!(d[0] & FM3_ETHER_RDES0_OWN)) {
+            /* out of descriptors in the middle of the frame */
+            s->sr |= FM3_ETHER_SR_RU;
+            break;
+        }
+        chain = d[1] & FM3_ETHER_RDES1_RCH;
+        bs[0] = get_bs1(d[1]);
+        bs[1] = chain ? 0 : get_bs2(d[1]);
+        ba[0] = d[2];
+        ba[1] = d[3];
+        for (i = 0; i < 2 && off < size; i++) {
+            len = MIN(bs[i], size - off);
+            address_space_write(s->as, ba[i], &buf[off], len);
+            off += len;
+        }
+        s->cur_rx_buf = ba[0];
+
+        if (off == size) {
+            d0 |= FM3_ETHER_RDES0_LS | (size << FM3_ETHER_RDES0_FL_SHIFT);
+            fm3_ether_write_des0(s, addr, d0);
+            if (!(d[1] & FM3_ETHER_RDES1_DIC))
+                s->sr |= FM3_ETHER_SR_RI;
+            s->cur_rx = fm3_ether_next_desc(s, addr, d,
+                                            d[1] & FM3_ETHER_RDES1_RER,
+                                            chain, s->rdlar);
+            fm3_ether_update_irq(s);
+            return size - FM3_ETHER_CRC_LEN;
+        }
+        fm3_ether_write_des0(s, addr, d0);
+        d0 = 0;
+        s->cur_rx = fm3_ether_next_desc(s, addr, d,
+                                        d[1] & FM3_ETHER_RDES1_RER,
+                                        chain, s->rdlar);
+        addr = s->cur_rx;
+    }
+
+    /* the frame is dropped; the part received is lost too */
+    s->mfbocr++;
+    fm3_ether_update_irq(s);
+    return size - FM3_ETHER_CRC_LEN;
+}
+
+static void fm3_ether_rx_poll(Fm3EtherState *s)
+{
+    if (!fm3_ether_rx_running(s)) {
+        fm3_ether_set_ps(s, FM3_ETHER_SR_RS_SHIFT, FM3_ETHER_PS_STOPPED);
+        return;
+    }
+    fm3_ether_set_ps(s, FM3_ETHER_SR_RS_SHIFT, FM3_ETHER_PS_RX_WAITING);
+    qemu_flush_queued_packets(qemu_get_queue(s->nic));
+}
+
+/*
+ * registers
+ */
+
+static uint16_t fm3_ether_phy_read(Fm3EtherState *s, uint32_t reg)
+{
+    return s->phy[reg];
+}
+
+static void fm3_ether_phy_write(Fm3EtherState *s, uint32_t reg, uint16_t value)
+{
+    switch (reg) {
+    case 0:     /* BMCR */
+        /* reset and restart of auto-negotiation complete at once */
+        s->phy[0] = value & ~((1 << 15) | (1 << 9));
+        break;
+    case 4:     /* ANAR */
+        s->phy[4] = value;
+        break;
+    }
+}
+
+static void fm3_ether_phy_reset(Fm3EtherState *s)
+{
+    memset(s->phy, 0, sizeof(s->phy));
+    s->phy[0] = 0x3100;         /* 100 Mbps, auto-negotiation, full duplex */
+    s->phy[1] = 0x782d;         /* link up, auto-negotiation complete */
+    s->phy[2] = 0x0007;
+    s->phy[3] = 0xc0f1;
+    s->phy[4] = 0x01e1;
+    s->phy[5] = 0x45e1;         /* link partner: 10/100 full/half duplex */
+    s->phy[31] = 0x0058;        /* 100BASE-TX full duplex */
+}
+
+static void fm3_ether_reset_regs(Fm3EtherState *s)
+{
+    uint8_t *mac = s->conf.macaddr.a;
+
+    s->mcr = 0x8000;
+    s->mffr = 0;
+    s->mhtrh = 0;
+    s->mhtrl = 0;
+    s->gar = 0;
+    s->gdr = 0;
+    s->fcr = 0;
+    s->vtr = 0;
+    s->imr = 0;
+    s->mar0h = 0x80000000 | mac[4] | (mac[5] << 8);
+    s->mar0l = mac[0] | (mac[1] << 8) | (mac[2] << 16) | (mac[3] << 24);
+    s->bmr = 0x00020101 & ~FM3_ETHER_REG_BMR_SWR;
+    s->rdlar = 0;
+    s->tdlar = 0;
+    s->sr = 0;
+    s->omr = 0;
+    s->ier = 0;
+    s->mfbocr = 0;
+    s->cur_tx = 0;
+    s->cur_rx = 0;
+    s->cur_tx_buf = 0;
+    s->cur_rx_buf = 0;
+    s->tx_pending = false;
+    fm3_ether_phy_reset(s);
+    fm3_ether_update_irq(s);
+}
+
+static uint64_t fm3_ether_read(void *opaque, hwaddr offset, unsigned size)
+{
+    Fm3EtherState *s = (Fm3EtherState *)opaque;
+    uint64_t retval = 0;
+
+    switch (offset) {
+    case FM3_ETHER_REG_MCR:
+        retval = s->mcr;
+        break;
+    case FM3_ETHER_REG_MFFR:
+        retval = s->mffr;
+        break;
+    case FM3_ETHER_REG_MHTRH:
+        retval = s->mhtrh;
+        break;
+    case FM3_ETHER_REG_MHTRL:
+        retval = s->mhtrl;
+        break;
+    case FM3_ETHER_REG_GAR:
+        retval = s->gar;
+        break;
+    case FM3_ETHER_REG_GDR:
+        retval = s->gdr;
+        break;
+    case FM3_ETHER_REG_FCR:
+        retval = s->fcr;
+        break;
+    case FM3_ETHER_REG_VTR:
+        retval = s->vtr;
+        break;
+    case FM3_ETHER_REG_IMR:
+        retval = s->imr;
+        break;
+    case FM3_ETHER_REG_MAR0H:
+        retval = s->mar0h;
+        break;
+    case FM3_ETHER_REG_MAR0L:
+        retval = s->mar0l;
+        break;
+    case FM3_ETHER_REG_BMR:
+        retval = s->bmr;
+        break;
+    case FM3_ETHER_REG_RDLAR:
+        retval = s->rdlar;
+        break;
+    case FM3_ETHER_REG_TDLAR:
+        retval = s->tdlar;
+        break;
+    case FM3_ETHER_REG_SR:
+        retval = s->sr;
+        break;
+    case FM3_ETHER_REG_OMR:
+        retval = s->omr;
+        break;
+    case FM3_ETHER_REG_IER:
+        retval = s->ier;
+        break;
+    case FM3_ETHER_REG_MFBOCR:
+        /* cleared on read */
+        retval = MIN(s->mfbocr, 0xffff);
+        s->mfbocr = 0;
+        break;
+    case FM3_ETHER_REG_CHTDR:
+        retval = s->cur_tx;
+        break;
+    case FM3_ETHER_REG_CHRDR:
+        retval = s->cur_rx;
+        break;
+    case FM3_ETHER_REG_CHTBAR:
+        retval = s->cur_tx_buf;
+        break;
+    case FM3_ETHER_REG_CHRBAR:
+        retval = s->cur_rx_buf;
+        break;
+    }
+
+    DPRINTF("%s : 0x%04x ---> 0x%08x\n", __func__, (uint32_t)offset,
+            (uint32_t)retval);
+    return retval;
+}
+
+static void fm3_ether_write(void *opaque, hwaddr offset,
+                            uint64_t value, unsigned size)
+{
+    Fm3EtherState *s = (Fm3EtherState *)opaque;
+    uint32_t reg;
+
+    DPRINTF("%s : 0x%04x <--- 0x%08x\n", __func__, (uint32_t)offset,
+            (uint32_t)value);
+
+    switch (offset) {
+    case FM3_ETHER_REG_MCR:
+        s->mcr = value;
+        qemu_bh_schedule(s->tx_bh);
+        fm3_ether_rx_poll(s);
+        break;
+    case FM3_ETHER_REG_MFFR:
+        s->mffr = value;
+        break;
+    case FM3_ETHER_REG_MHTRH:
+        s->mhtrh = value;
+        break;
+    case FM3_ETHER_REG_MHTRL:
+        s->mhtrl = value;
+        break;
+    case FM3_ETHER_REG_GAR:
+        /* MII management frames complete at once */
+        reg = (value >> 6) & 0x1f;
+        if (value & FM3_ETHER_REG_GAR_GB) {
+            if (value & FM3_ETHER_REG_GAR_GW)
+                fm3_ether_phy_write(s, reg, s->gdr);
+            else
+                s->gdr = fm3_ether_phy_read(s, reg);
+        }
+        s->gar = value & ~FM3_ETHER_REG_GAR_GB;
+        break;
+    case FM3_ETHER_REG_GDR:
+        s->gdr = value & 0xffff;
+        break;
+    case FM3_ETHER_REG_FCR:
+        s->fcr = value;
+        break;
+    case FM3_ETHER_REG_VTR:
+        s->vtr = value;
+        break;
+    case FM3_ETHER_REG_IMR:
+        s->imr = value;
+        break;
+    case FM3_ETHER_REG_MAR0H:
+        s->mar0h = 0x80000000 | (value & 0xffff);
+        break;
+    case FM3_ETHER_REG_MAR0L:
+        s->mar0l = value;
+        break;
+    case FM3_ETHER_REG_BMR:
+        if (value & FM3_ETHER_REG_BMR_SWR) {
+            fm3_ether_reset_regs(s);
+            break;
+        }
+        s->bmr = value;
+        break;
+    case FM3_ETHER_REG_TPDR:
+        s->sr &= ~FM3_ETHER_SR_TU;
+        qemu_bh_schedule(s->tx_bh);
+        break;
+    case FM3_ETHER_REG_RPDR:
+        s->sr &= ~FM3_ETHER_SR_RU;
+        fm3_ether_rx_poll(s);
+        break;
+    case FM3_ETHER_REG_RDLAR:
+        s->rdlar = value & ~3;
+        s->cur_rx = s->rdlar;
+        break;
+    case FM3_ETHER_REG_TDLAR:
+        s->tdlar = value & ~3;
+        s->cur_tx = s->tdlar;
+        break;
+    case FM3_ETHER_REG_SR:
+        /* status bits are cleared by writing 1 */
+        s->sr &= ~(value & (FM3_ETHER_SR_NORMAL | FM3_ETHER_SR_ABNORMAL));
+        fm3_ether_update_irq(s);
+        break;
+    case FM3_ETHER_REG_OMR:
+        s->omr = value;
+        qemu_bh_schedule(s->tx_bh);
+        fm3_ether_rx_poll(s);
+        break;
+    case FM3_ETHER_REG_IER:
+        s->ier = value;
+        fm3_ether_update_irq(s);
+        break;
+    }
+}
+
+static const MemoryRegionOps fm3_ether_mem_ops = {
+    .read = fm3_ether_read,
+    .write = fm3_ether_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+};
+
+static void fm3_ether_cleanup(NetClientState *nc)
+{
+    Fm3EtherState *s = qemu_get_nic_opaque(nc);
+
+    s->nic = NULL;
+}
+
+static NetClientInfo net_fm3_ether_info = {
+    .type = NET_CLIENT_OPTIONS_KIND_NIC,
+    .size = sizeof(NICState),
+    .can_receive = fm3_ether_can_receive,
+    .receive_iov = fm3_ether_receive_iov,
+    .cleanup = fm3_ether_cleanup,
+};
+
+static void fm3_ether_reset(DeviceState *d)
+{
+    fm3_ether_reset_regs(FM3_ETHER(d));
+}
+
+static int fm3_ether_init(SysBusDevice *dev)
+{
+    DeviceState *devs = DEVICE(dev);
+    Fm3EtherState *s = FM3_ETHER(devs);
+
+    s->as = &address_space_memory;
+    s->tx_bh = qemu_bh_new(fm3_ether_tx_bh, s);
+    sysbus_init_irq(dev, &s->irq);
+    memory_region_init_io(&s->mmio, OBJECT(s), &fm3_ether_mem_ops, s,
+                          TYPE_FM3_ETHER, 0x2000);
+    sysbus_init_mmio(dev, &s->mmio);
+
+    qemu_macaddr_default_if_unset(&s->conf.macaddr);
+    s->nic = qemu_new_nic(&net_fm3_ether_info, &s->conf,
+                          object_get_typename(OBJECT(dev)), devs->id, s);
+    qemu_format_nic_info_str(qemu_get_queue(s->nic), s->conf.macaddr.a);
+    return 0;
+}
+
+static int fm3_ether_post_load(void *opaque, int version_id)
+{
+    Fm3EtherState *s = (Fm3EtherState *)opaque;
+
+    qemu_bh_schedule(s->tx_bh);
+    fm3_ether_rx_poll(s);
+    return 0;
+}
+
+static const VMStateDescription vmstate_fm3_ether = {
+    .name = TYPE_FM3_ETHER,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .post_load = fm3_ether_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(mcr, Fm3EtherState),
+        VMSTATE_UINT32(mffr, Fm3EtherState),
+        VMSTATE_UINT32(mhtrh, Fm3EtherState),
+        VMSTATE_UINT32(mhtrl, Fm3EtherState),
+        VMSTATE_UINT32(gar, Fm3EtherState),
+        VMSTATE_UINT32(gdr, Fm3EtherState),
+        VMSTATE_UINT32(fcr, Fm3EtherState),
+        VMSTATE_UINT32(vtr, Fm3EtherState),
+        VMSTATE_UINT32(imr, Fm3EtherState),
+        VMSTATE_UINT32(mar0h, Fm3EtherState),
+        VMSTATE_UINT32(mar0l, Fm3EtherState),
+        VMSTATE_UINT32(bmr, Fm3EtherState),
+        VMSTATE_UINT32(rdlar, Fm3EtherState),
+        VMSTATE_UINT32(tdlar, Fm3EtherState),
+        VMSTATE_UINT32(sr, Fm3EtherState),
+        VMSTATE_UINT32(omr, Fm3EtherState),
+        VMSTATE_UINT32(ier, Fm3EtherState),
+        VMSTATE_UINT32(mfbocr, Fm3EtherState),
+        VMSTATE_UINT32(cur_tx, Fm3EtherState),
+        VMSTATE_UINT32(cur_rx, Fm3EtherState),
+        VMSTATE_UINT32(cur_tx_buf, Fm3EtherState),
+        VMSTATE_UINT32(cur_rx_buf, Fm3EtherState),
+        VMSTATE_UINT16_ARRAY(phy, Fm3EtherState, FM3_ETHER_PHY_REGS),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property fm3_ether_properties[] = {
+    DEFINE_NIC_PROPERTIES(Fm3EtherState, conf),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void fm3_ether_class_init(ObjectClass *klass, void *data)
+{
+	DeviceClass			*dc	= DEVICE_CLASS(klass);
+	SysBusDeviceClass	*k	= SYS_BUS_DEVICE_CLASS(klass);
+
+	k->init		= fm3_ether_init;
+	dc->desc	= TYPE_FM3_ETHER;
+	dc->reset	= fm3_ether_reset;
+	dc->vmsd	= &vmstate_fm3_ether;
+	dc->props	= fm3_ether_properties;
+}
+
+static const TypeInfo fm3_ether_info = {
+	.name			= TYPE_FM3_ETHER,
+	.parent			= TYPE_SYS_BUS_DEVICE,
+	.instance_size	= sizeof(Fm3EtherState),
+	.class_init		= fm3_ether_class_init,
+};
+
+static void fm3_register_devices(void)
+{
+    type_register_static(&fm3_ether_info);
+}
+
+type_init(fm3_register_devices)
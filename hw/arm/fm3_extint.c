@@ -30,11 +30,17 @@ typedef struct {
     MemoryRegion mmio;
     qemu_irq irq[FM3_EXTI_IRQ_NUM];
     uint32_t enable;
-    uint8_t signal[FM3_EXTI_NUM];
+    uint32_t input;         /* bit per ch: input level */
+    uint32_t input_valid;   /* bit per ch: input has been driven */
     uint32_t request_latch;
     uint32_t mode_0;
     uint32_t mode_1;
-    int port_no[FM3_EXTI_NUM];
+    uint32_t route;     /* bit per ch: INTxx pin is routed (by fm3_gpio) */
+    /* ELVR/ELVR1 decoded, bit per ch */
+    uint32_t level_low;
+    uint32_t level_high;
+    uint32_t edge_rising;
+    uint32_t edge_falling;
     int irq_flag[FM3_EXTI_IRQ_NUM];
 } Fm3ExtiState;
 #define FM3_EXTI(obj) \
@@ -49,10 +55,6 @@ typedef struct {
 #define FM3_EXTI_NMIRR          (0x14)
 #define FM3_EXTI_NMICL          (0x18)
 
-static Fm3ExtiState *fm3_exti_state;
-
-static int fm3_exti_get_mode(Fm3ExtiState *s, int exti_no);
-static void fm3_exti_request_latch(Fm3ExtiState *s, int exti_no, int request);
 static void fm3_exti_update_irq(Fm3ExtiState *s);
 
 enum {
@@ -67,87 +69,99 @@ enum {
     FM3_EXTI_ELVR_EDGE_FALLING,
 };
 
-uint32_t fm3_exti_get_irq_stat(int ch)
-{
-    Fm3ExtiState *s = fm3_exti_state;
-    if (ch < 0 || FM3_EXTI_NUM <= ch)
-        return 0;
 
-    return ((s->request_latch >> ch) & (s->enable >> ch )) & 1;
+/* pick up the even bits of v: ELVR has 2 bits per ch */
+static inline uint32_t fm3_exti_even_bits(uint32_t v)
+{
+    v &= 0x55555555;
+    v = (v | (v >> 1)) & 0x33333333;
+    v = (v | (v >> 2)) & 0x0f0f0f0f;
+    v = (v | (v >> 4)) & 0x00ff00ff;
+    v = (v | (v >> 8)) & 0x0000ffff;
+    return v;
 }
 
-static int fm3_exti_get_mode(Fm3ExtiState *s, int exti_no)
+static void fm3_exti_decode_mode(Fm3ExtiState *s)
 {
-    int mode;
-
-    if (exti_no < 16)
-       mode = s->mode_0;
-    else 
-       mode = s->mode_1;
+    uint32_t la, lb;
+
+    /* LBx:LAx = 00: "L" level, 01: "H" level, 10: rising, 11: falling */
+    la = fm3_exti_even_bits(s->mode_0) | 
+         (fm3_exti_even_bits(s->mode_1) << 16);
+    lb = fm3_exti_even_bits(s->mode_0 >> 1) | 
+         (fm3_exti_even_bits(s->mode_1 >> 1) << 16);
+
+    s->level_low = ~lb & ~la;
+    s->level_high = ~lb & la;
+    s->edge_rising = lb & ~la;
+    s->edge_falling = lb & la;
+}
 
-    return (mode >> exti_no * 2) & 3;
+/* bit per ch: a level detected channel sees its active level */
+static inline uint32_t fm3_exti_level_active(Fm3ExtiState *s)
+{
+    return ((s->input & s->level_high) | (~s->input & s->level_low)) & 
+           s->input_valid;
 }
 
-static int fm3_exti_get_signal(Fm3ExtiState *s, int exti_no, int request)
+/* ELVR/ELVR1 have changed: level detected channels follow their input */
+static void fm3_exti_update_mode(Fm3ExtiState *s)
 {
-    int mode = fm3_exti_get_mode(s, exti_no);
-
-    switch (mode) {
-    case FM3_EXTI_ELVR_LEVEL_LOW:
-    case FM3_EXTI_ELVR_LEVEL_HIGH:
-        return request? FM3_EXTI_ELVR_LEVEL_HIGH:
-                        FM3_EXTI_ELVR_LEVEL_LOW;
-    case FM3_EXTI_ELVR_EDGE_FALLING:
-    case FM3_EXTI_ELVR_EDGE_RISING:
-        return request? FM3_EXTI_ELVR_EDGE_RISING:
-                        FM3_EXTI_ELVR_EDGE_FALLING;
-    default:
-        printf("%s: Unknown level mode = %d\n", __func__, mode);
-        return -1;
-    }
+    uint32_t old_level = s->level_low | s->level_high;
+
+    fm3_exti_decode_mode(s);
+    s->request_latch = (s->request_latch & ~old_level) | 
+                       fm3_exti_level_active(s);
+    fm3_exti_update_irq(s);
 }
 
-static void fm3_exti_request_latch(Fm3ExtiState *s, int exti_no, int signal)
+static void fm3_exti_set_route(Fm3ExtiState *s, int exti_no, bool routed)
 {
-    if (fm3_exti_get_mode(s, exti_no) == signal) {
-        s->request_latch |= (1 << exti_no);
-    } else {
-        s->request_latch &= ~(1 << exti_no);
-    }
+    DPRINTF("FM3_EXTI: INT%02d is %s\n", exti_no, 
+            routed ? "routed" : "not routed");
+    if (routed)
+        s->route |= (1U << exti_no);
+    else
+        s->route &= ~(1U << exti_no);
 }
 
-static int fm3_exti_check_port(int exti_no, int port_no)
+static void fm3_exti_set_input(Fm3ExtiState *s, int exti_no, int level)
 {
-    int export, export_setting;
-    int port_type = fm3_board_get_port_info(port_no);
-    int port_setting = fm3_gpio_get_port_setting(port_no);
-
-    if (port_type != port_setting) {
-        DPRINTF("FM3_EXTI: [P%02X] port_type = %d, port_setting=%d\n", 
-                port_no, port_type, port_setting);
-        return false;
+    uint32_t bit = 1U << exti_no;
+    uint32_t old = s->input;
+    uint32_t rise, fall, level_mask;
+
+    if (!(s->route & bit)) {
+        DPRINTF("FM3_EXTI: INT%02d=%d Ignored\n", exti_no, level);
+        return;
     }
 
-    export = (exti_no < 16)? FM3_PORT_EPFR06_EINT0:
-                             FM3_PORT_EPFR15_EINT1;
-    export_setting = fm3_gpio_get_extport_setting(export);
-    return fm3_board_check_extport_exti(exti_no, export_setting);
+    if (level)
+        s->input |= bit;
+    else
+        s->input &= ~bit;
+    s->input_valid |= bit;
+
+    rise = ~old & s->input;
+    fall = old & ~s->input;
+    level_mask = s->level_low | s->level_high;
+
+    /* edges latch until EICL, levels follow the input */
+    s->request_latch |= (rise & s->edge_rising) | (fall & s->edge_falling);
+    s->request_latch = (s->request_latch & ~level_mask) | 
+                       fm3_exti_level_active(s);
+    fm3_exti_update_irq(s); 
 }
 
-void fm3_exti_set_request(int exti_no, int port_val)
+/* input lines from fm3_gpio: INTxx levels, then the INTxx routing */
+static void fm3_exti_set_line(void *opaque, int n, int level)
 {
-    Fm3ExtiState *s = fm3_exti_state;
-
-    if (exti_no < 0 || FM3_EXTI_NUM <= exti_no)
-        return;
+    Fm3ExtiState *s = (Fm3ExtiState *)opaque;
 
-    if (fm3_exti_check_port(exti_no, s->port_no[exti_no])) {
-        s->signal[exti_no] = fm3_exti_get_signal(s, exti_no, port_val);
-        fm3_exti_request_latch(s, exti_no, s->signal[exti_no]);
-        fm3_exti_update_irq(s); 
-    } else {
-        DPRINTF("FM3_EXTI: INT%02d=%d Ignored\n", exti_no, port_val);
-    }
+    if (n < FM3_EXTI_NUM)
+        fm3_exti_set_input(s, n, level);
+    else
+        fm3_exti_set_route(s, n - FM3_EXTI_NUM, level);
 }
 
 static inline void fm3_exti_set_irq(Fm3ExtiState *s, int irq_no, int irq_flag)
@@ -167,9 +181,11 @@ static void fm3_exti_update_irq(Fm3ExtiState *s)
     int irq_0 = 0, irq_1 = 0;
 
     request = s->request_latch & s->enable;
-    irq_0 = (request & 0x7f) != 0;  /* EINT#0 - 7 */
-    irq_1 = (request & ~0x7f) != 0; /* EINT#8 - 31 */
+    irq_0 = (request & 0xff) != 0;  /* EINT#0 - 7 */
+    irq_1 = (request & ~0xff) != 0; /* EINT#8 - 31 */
 
+    fm3_int_set_mon(FM3_IRQ_EXTI_0_7, 0xff, request);
+    fm3_int_set_mon(FM3_IRQ_EXTI_8_31, 0xffffff, request >> 8);
     fm3_exti_set_irq(s, 0, irq_0);
     fm3_exti_set_irq(s, 1, irq_1);
 }
@@ -217,8 +233,6 @@ static void fm3_exti_write(void *opaque, hwaddr offset,
                            uint64_t value, unsigned size)
 {
     Fm3ExtiState *s = (Fm3ExtiState *)opaque;
-    int i;
-    uint32_t mode, re_request;
 
     DPRINTF("%s: 0x%08x <--- 0x%08x \n", __func__, offset, value);
 
@@ -230,28 +244,18 @@ static void fm3_exti_write(void *opaque, hwaddr offset,
     case FM3_EXTI_EIRR:
         break;
     case FM3_EXTI_EICL:
+        /* requests of level detected channels are kept while active */
         s->request_latch &= value;
-
-        re_request = 0;
-        for (i = 0; i < FM3_EXTI_NUM; i++) {
-            mode = fm3_exti_get_mode(s, i);
-            if ((s->signal[i] == mode) &&
-                (mode == FM3_EXTI_ELVR_LEVEL_LOW ||
-                 mode == FM3_EXTI_ELVR_LEVEL_HIGH)) {
-                re_request |= (1 << i);
-            }
-        }
-
-        if (re_request)
-            s->request_latch |= re_request;
-        
+        s->request_latch |= fm3_exti_level_active(s);
         fm3_exti_update_irq(s); 
         break;
     case FM3_EXTI_ELVR:
         s->mode_0 = value;
+        fm3_exti_update_mode(s);
         break;
     case FM3_EXTI_ELVR1:
         s->mode_1 = value;
+        fm3_exti_update_mode(s);
         break;
     default:
         break;
@@ -264,45 +268,56 @@ static const MemoryRegionOps fm3_exti_mem_ops = {
     .endianness = DEVICE_NATIVE_ENDIAN,
 };
 
-static int fm3_exti_get_port_no(int exti_no,  enum FM3_PINPACKAGE pkg)
-{
-    int pin_no;
-    pin_no = fm3_board_get_exti_pin(exti_no);
-    return fm3_gpio_get_port_from_pin(pin_no, pkg);
-}
-
 static int fm3_exti_init(SysBusDevice *dev)
 {
 	DeviceState		*devs	= DEVICE(dev);
     Fm3ExtiState	*s		= FM3_EXTI(devs);
-    enum FM3_PINPACKAGE pkg = FM3_PINPACKAGE_LQFP176;
-    int i;
-    
+
+    qdev_init_gpio_in(devs, fm3_exti_set_line, FM3_EXTI_LINE_NUM);
     sysbus_init_irq(dev, &s->irq[0]);		/* 荞݂o^ */
     sysbus_init_irq(dev, &s->irq[1]);		/* 荞݂o^ */
 
     memory_region_init_io(&s->mmio, OBJECT(s), &fm3_exti_mem_ops, s, TYPE_FM3_EXTI, 0x1000);
     sysbus_init_mmio(dev, &s->mmio);
 
-    fm3_exti_state = s;
     s->enable = 0;
+    s->input = 0;
+    s->input_valid = 0;
     s->request_latch = 0;
-    s->mode_0 = 0;
-    s->mode_1 = 0;
+    s->route = 0;
     s->irq_flag[0] = 0;
     s->irq_flag[1] = 0;
-    for (i = 0; i < FM3_EXTI_NUM; i++)
-        s->signal[i] = -1;
-
-    s->port_no[12] = fm3_exti_get_port_no(12, pkg);
-    s->port_no[13] = fm3_exti_get_port_no(13, pkg);
-    s->port_no[14] = fm3_exti_get_port_no(14, pkg);
-    s->port_no[15] = fm3_exti_get_port_no(15, pkg);
+    fm3_exti_decode_mode(s);
 
     return 0;
 }
 
 /* --- QEMUւ̓o^֘A --- */
+static int fm3_exti_post_load(void *opaque, int version_id)
+{
+    fm3_exti_decode_mode(opaque);
+    return 0;
+}
+
+static const VMStateDescription vmstate_fm3_exti = {
+    .name = TYPE_FM3_EXTI,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .post_load = fm3_exti_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(enable, Fm3ExtiState),
+        VMSTATE_UINT32(input, Fm3ExtiState),
+        VMSTATE_UINT32(input_valid, Fm3ExtiState),
+        VMSTATE_UINT32(request_latch, Fm3ExtiState),
+        VMSTATE_UINT32(mode_0, Fm3ExtiState),
+        VMSTATE_UINT32(mode_1, Fm3ExtiState),
+        VMSTATE_UINT32(route, Fm3ExtiState),
+        VMSTATE_INT32_ARRAY(irq_flag, Fm3ExtiState, FM3_EXTI_IRQ_NUM),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property fm3_exti_properties[] = {
     DEFINE_PROP_UINT32("mode_0"			, Fm3ExtiState	, mode_0			, 0),
     DEFINE_PROP_UINT32("mode_1"			, Fm3ExtiState	, mode_1			, 0),
@@ -316,6 +331,7 @@ static void fm3_exti_class_init(ObjectClass *klass, void *data)
 
 	k->init		= fm3_exti_init;			/* ֐o^		*/
 	dc->desc	= TYPE_FM3_EXTI;	/* n[hEFA		*/
+	dc->vmsd	= &vmstate_fm3_exti;
 	dc->props	= fm3_exti_properties;	/* 				*/
 }
 
@@ -0,0 +1,615 @@
+/*
+ * Fujitsu FM3 flash memory and flash interface
+ *
+ * This code is licensed under the GNU GPL v2.
+ *
+ * The flash array is a ROM device: reads go straight to memory, writes
+ * go through the command sequencer.  Program and erase take the time the
+ * data sheet gives.  Until they finish, reads of the array return the
+ * hardware sequence flags (data polling, toggle bit) and FSTR.RDY is 0.
+ *
+ * With the "image" property the array is a shared mapping of the file.
+ * An image of any size maps at once and its pages are read in on demand.
+ * Sectors written by the firmware are synced back to the file in batches,
+ * a second after the last change and at exit.  Without an image the array
+ * is a private mapping of a small erased (0xFF) template, repeated over its
+ * size: it reads as erased like a new part, and only the pages the firmware
+ * writes get memory of their own.
+ */
+
+#include <sys/mman.h>
+#include "hw/sysbus.h"
+#include "qemu/timer.h"
+#include "qemu/bitmap.h"
+#include "qemu/error-report.h"
+#include "sysemu/sysemu.h"
+#include "exec/exec-all.h"
+#include "exec/ram_addr.h"
+#include "fm3.h"
+
+//#define FM3_DEBUG_FLASH
+#define TYPE_FM3_FLASH  "fm3.flash"
+
+#ifdef FM3_DEBUG_FLASH
+#define DPRINTF(fmt, ...)                                       \
+    do { printf(fmt, ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) do { } while (0)
+#endif
+
+#define FM3_FLASH_REG_FASZR         (0x000)
+#define FM3_FLASH_REG_FASZR_ASZ     (3 << 0)
+#define FM3_FLASH_REG_FASZR_16BIT   (1 << 0)
+#define FM3_FLASH_REG_FRWTR         (0x004)
+#define FM3_FLASH_REG_FSTR          (0x008)
+#define FM3_FLASH_REG_FSTR_HNG      (1 << 1)
+#define FM3_FLASH_REG_FSTR_RDY      (1 << 0)
+#define FM3_FLASH_REG_FSYNDN        (0x010)
+#define FM3_FLASH_REG_CRTRMM        (0x100)
+
+/* hardware sequence flags */
+#define FM3_FLASH_DQ7               (1 << 7)    /* data polling */
+#define FM3_FLASH_DQ6               (1 << 6)    /* toggle bit */
+#define FM3_FLASH_DQ5               (1 << 5)    /* timing limit exceeded */
+#define FM3_FLASH_DQ3               (1 << 3)    /* sector erase timer */
+
+/* command addresses (lower 16 bits) in 16-bit access mode */
+#define FM3_FLASH_CMD_ADDR1         (0x1550)
+#define FM3_FLASH_CMD_ADDR2         (0x0AA8)
+
+enum {
+    FM3_FLASH_READ = 0,
+    FM3_FLASH_UNLOCK1,          /* AA written */
+    FM3_FLASH_UNLOCK2,          /* 55 written */
+    FM3_FLASH_PROGRAM,          /* A0 written */
+    FM3_FLASH_ERASE,            /* 80 written */
+    FM3_FLASH_ERASE_UNLOCK1,
+    FM3_FLASH_ERASE_UNLOCK2,
+    FM3_FLASH_HANG,             /* after a failed program, until F0 */
+};
+
+#define FM3_FLASH_T_PROGRAM         (25 * SCALE_US)     /* per half word */
+#define FM3_FLASH_T_ERASE_SMALL     (300 * SCALE_MS)    /* 8 KB sector */
+#define FM3_FLASH_T_ERASE_LARGE     (900 * SCALE_MS)    /* 32/64 KB sector */
+
+/* granularity of the write-back */
+#define FM3_FLASH_CHUNK_BITS        13
+#define FM3_FLASH_CHUNK_SIZE        (1 << FM3_FLASH_CHUNK_BITS)
+#define FM3_FLASH_SYNC_DELAY        1000    /* ms */
+
+/* size of the erased template, a multiple of the largest sector */
+#define FM3_FLASH_ERASED_SIZE       (1024 * 1024)
+
+typedef struct {
+    SysBusDevice busdev;
+    MemoryRegion flash;
+    MemoryRegion mmio;
+    uint32_t size;
+    char *image;
+    bool timing;
+    uint8_t *storage;
+    QEMUTimer *busy_timer;
+    QEMUTimer *sync_timer;
+    unsigned long *dirty;
+    Notifier exit_notifier;
+    int erased_fd;          /* erased template, -1 with an image */
+
+    uint32_t faszr;
+    uint32_t frwtr;
+    uint32_t fstr;
+    uint32_t fsyndn;
+    uint32_t cmd;
+    uint32_t status;        /* DQ7/DQ5/DQ3 while busy */
+    uint32_t toggle;
+    bool busy;
+} Fm3FlashState;
+#define FM3_FLASH(obj) \
+    OBJECT_CHECK(Fm3FlashState, (obj), TYPE_FM3_FLASH)
+
+/* 4 x 8 KB, 1 x 32 KB, then 64 KB sectors */
+static uint32_t fm3_flash_get_sector(uint32_t addr, uint32_t *size)
+{
+    if (addr < 0x8000)
+        *size = 0x2000;
+    else if (addr < 0x10000)
+        *size = 0x8000;
+    else
+        *size = 0x10000;
+    return addr & ~(*size - 1);
+}
+
+/*
+ * write-back to the image
+ */
+
+static void fm3_flash_sync(Fm3FlashState *s)
+{
+    long chunks = DIV_ROUND_UP(s->size, FM3_FLASH_CHUNK_SIZE);
+    long start, end;
+    uintptr_t page = getpagesize();
+    uintptr_t addr, len;
+
+    if (!s->image)
+        return;
+
+    for (start = find_first_bit(s->dirty, chunks); start < chunks;
+         start = find_next_bit(s->dirty, chunks, end)) {
+        end = find_next_zero_bit(s->dirty, chunks, start);
+        bitmap_clear(s->dirty, start, end - start);
+        addr = (uintptr_t)s->storage + (start << FM3_FLASH_CHUNK_BITS);
+        len = MIN((uintptr_t)(end - start) << FM3_FLASH_CHUNK_BITS,
+                  s->size - (start << FM3_FLASH_CHUNK_BITS));
+        len += addr & (page - 1);
+        addr &= ~(page - 1);
+        if (msync((void *)addr, len, MS_SYNC) < 0)
+            error_report("fm3 flash: cannot write back to %s: %s",
+                         s->image, strerror(errno));
+    }
+}
+
+static void fm3_flash_sync_timer_cb(void *opaque)
+{
+    fm3_flash_sync((Fm3FlashState *)opaque);
+}
+
+static void fm3_flash_exit_notify(Notifier *n, void *data)
+{
+    Fm3FlashState *s = container_of(n, Fm3FlashState, exit_notifier);
+
+    fm3_flash_sync(s);
+}
+
+/* [offset, offset + len) of the array has been programmed or erased */
+static void fm3_flash_modified(Fm3FlashState *s, uint32_t offset, uint32_t len)
+{
+    ram_addr_t addr = memory_region_get_ram_addr(&s->flash) + offset;
+
+    tb_invalidate_phys_range(addr, addr + len, 0);
+    cpu_physical_memory_set_dirty_range(addr, len);
+
+    if (!s->image)
+        return;
+    bitmap_set(s->dirty, offset >> FM3_FLASH_CHUNK_BITS,
+               ((offset + len - 1) >> FM3_FLASH_CHUNK_BITS) -
+               (offset >> FM3_FLASH_CHUNK_BITS) + 1);
+    if (!timer_pending(s->sync_timer))
+        timer_mod(s->sync_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                                 FM3_FLASH_SYNC_DELAY);
+}
+
+/*
+ * command sequencer
+ */
+
+static void fm3_flash_set_busy(Fm3FlashState *s, uint32_t status, int64_t t)
+{
+    s->status = status;
+    s->toggle = 0;
+    if (!s->timing) {
+        if (status & FM3_FLASH_DQ5) {
+            s->fstr |= FM3_FLASH_REG_FSTR_HNG;
+            s->cmd = FM3_FLASH_HANG;
+            memory_region_rom_device_set_romd(&s->flash, false);
+        }
+        return;
+    }
+
+    s->busy = true;
+    s->fstr &= ~FM3_FLASH_REG_FSTR_RDY;
+    memory_region_rom_device_set_romd(&s->flash, false);
+    timer_mod(s->busy_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + t);
+}
+
+static void fm3_flash_busy_timer_cb(void *opaque)
+{
+    Fm3FlashState *s = (Fm3FlashState *)opaque;
+
+    s->busy = false;
+    s->fstr |= FM3_FLASH_REG_FSTR_RDY;
+    if (s->status & FM3_FLASH_DQ5) {
+        /* reads return the flags until the reset command */
+        s->fstr |= FM3_FLASH_REG_FSTR_HNG;
+        s->cmd = FM3_FLASH_HANG;
+        return;
+    }
+    memory_region_rom_device_set_romd(&s->flash, true);
+}
+
+static void fm3_flash_program(Fm3FlashState *s, uint32_t offset, uint16_t data)
+{
+    uint8_t *p = &s->storage[offset & ~1];
+    uint16_t old = lduw_le_p(p);
+    uint32_t status = ~data & FM3_FLASH_DQ7;
+
+    /* programming only clears bits */
+    stw_le_p(p, old & data);
+    fm3_flash_modified(s, offset & ~1, 2);
+    if ((old & data) != data)
+        status |= FM3_FLASH_DQ5;
+    fm3_flash_set_busy(s, status, FM3_FLASH_T_PROGRAM);
+}
+
+/* Maps the erased template over [offset, offset + len) of the array */
+static int fm3_flash_map_erased(Fm3FlashState *s, uint32_t offset,
+                                uint32_t len)
+{
+    uint32_t pos, n;
+    void *p;
+
+    for (pos = offset; pos < offset + len; pos += n) {
+        n = MIN(FM3_FLASH_ERASED_SIZE - pos % FM3_FLASH_ERASED_SIZE,
+                offset + len - pos);
+        p = mmap(&s->storage[pos], n, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_FIXED, s->erased_fd,
+                 pos % FM3_FLASH_ERASED_SIZE);
+        if (p == MAP_FAILED)
+            return -1;
+    }
+    return 0;
+}
+
+static void fm3_flash_erase(Fm3FlashState *s, uint32_t offset, uint32_t len)
+{
+    /* without an image, drop the programmed pages instead of filling them */
+    if (s->erased_fd < 0 || fm3_flash_map_erased(s, offset, len) < 0)
+        memset(&s->storage[offset], 0xff, len);
+    fm3_flash_modified(s, offset, len);
+}
+
+static void fm3_flash_sector_erase(Fm3FlashState *s, uint32_t offset)
+{
+    uint32_t size;
+    uint32_t start = fm3_flash_get_sector(offset, &size);
+
+    fm3_flash_erase(s, start, size);
+    fm3_flash_set_busy(s, FM3_FLASH_DQ3, (size == 0x2000) ?
+                       FM3_FLASH_T_ERASE_SMALL : FM3_FLASH_T_ERASE_LARGE);
+}
+
+static void fm3_flash_chip_erase(Fm3FlashState *s)
+{
+    uint32_t offset, size;
+    int64_t t = 0;
+
+    for (offset = 0; offset < s->size; offset += size) {
+        fm3_flash_get_sector(offset, &size);
+        t += (size == 0x2000) ? FM3_FLASH_T_ERASE_SMALL :
+                                FM3_FLASH_T_ERASE_LARGE;
+    }
+    fm3_flash_erase(s, 0, s->size);
+    fm3_flash_set_busy(s, FM3_FLASH_DQ3, t);
+}
+
+/* reads of the array while it is not in ROMD mode */
+static uint64_t fm3_flash_array_read(void *opaque, hwaddr offset,
+                                     unsigned size)
+{
+    Fm3FlashState *s = (Fm3FlashState *)opaque;
+    uint32_t retval;
+
+    s->toggle ^= FM3_FLASH_DQ6;
+    retval = s->status | s->toggle;
+    DPRINTF("%s : 0x%08x ---> 0x%02x\n", __func__, (uint32_t)offset, retval);
+    return (size == 4) ? (retval | (retval << 16)) : retval;
+}
+
+static void fm3_flash_array_write(void *opaque, hwaddr offset,
+                                  uint64_t value, unsigned size)
+{
+    Fm3FlashState *s = (Fm3FlashState *)opaque;
+    uint32_t addr = offset & 0xffff;
+    uint8_t cmd = value;
+
+    DPRINTF("%s : 0x%08x <--- 0x%04x\n", __func__, (uint32_t)offset,
+            (uint32_t)value);
+
+    if ((s->faszr & FM3_FLASH_REG_FASZR_ASZ) != FM3_FLASH_REG_FASZR_16BIT) {
+        /* commands are accepted in 16-bit access mode only */
+        return;
+    }
+    if (s->busy) {
+        if (cmd == 0xb0)
+            printf("FM3_FLASH: erase suspend is not supported\n");
+        return;
+    }
+    if (cmd == 0xf0 && s->cmd != FM3_FLASH_PROGRAM) {
+        if (s->cmd == FM3_FLASH_HANG) {
+            s->fstr &= ~FM3_FLASH_REG_FSTR_HNG;
+            memory_region_rom_device_set_romd(&s->flash, true);
+        }
+        s->cmd = FM3_FLASH_READ;
+        return;
+    }
+
+    switch (s->cmd) {
+    case FM3_FLASH_READ:
+    case FM3_FLASH_ERASE:
+        if (addr == FM3_FLASH_CMD_ADDR1 && cmd == 0xaa)
+            s->cmd = (s->cmd == FM3_FLASH_READ) ? FM3_FLASH_UNLOCK1 :
+                                                  FM3_FLASH_ERASE_UNLOCK1;
+        else
+            s->cmd = FM3_FLASH_READ;
+        break;
+    case FM3_FLASH_UNLOCK1:
+    case FM3_FLASH_ERASE_UNLOCK1:
+        if (addr == FM3_FLASH_CMD_ADDR2 && cmd == 0x55)
+            s->cmd++;
+        else
+            s->cmd = FM3_FLASH_READ;
+        break;
+    case FM3_FLASH_UNLOCK2:
+        if (addr == FM3_FLASH_CMD_ADDR1 && cmd == 0xa0)
+            s->cmd = FM3_FLASH_PROGRAM;
+        else if (addr == FM3_FLASH_CMD_ADDR1 && cmd == 0x80)
+            s->cmd = FM3_FLASH_ERASE;
+        else
+            s->cmd = FM3_FLASH_READ;
+        break;
+    case FM3_FLASH_PROGRAM:
+        s->cmd = FM3_FLASH_READ;
+        fm3_flash_program(s, offset, value);
+        break;
+    case FM3_FLASH_ERASE_UNLOCK2:
+        s->cmd = FM3_FLASH_READ;
+        if (addr == FM3_FLASH_CMD_ADDR1 && cmd == 0x10)
+            fm3_flash_chip_erase(s);
+        else if (cmd == 0x30)
+            fm3_flash_sector_erase(s, offset);
+        break;
+    case FM3_FLASH_HANG:
+        break;
+    }
+}
+
+static const MemoryRegionOps fm3_flash_array_ops = {
+    .read = fm3_flash_array_read,
+    .write = fm3_flash_array_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+};
+
+/*
+ * flash interface registers
+ */
+
+static uint64_t fm3_flash_read(void *opaque, hwaddr offset, unsigned size)
+{
+    Fm3FlashState *s = (Fm3FlashState *)opaque;
+    uint64_t retval = 0;
+
+    switch (offset) {
+    case FM3_FLASH_REG_FASZR:
+        retval = s->faszr;
+        break;
+    case FM3_FLASH_REG_FRWTR:
+        retval = s->frwtr;
+        break;
+    case FM3_FLASH_REG_FSTR:
+        retval = s->fstr;
+        break;
+    case FM3_FLASH_REG_FSYNDN:
+        retval = s->fsyndn;
+        break;
+    case FM3_FLASH_REG_CRTRMM:
+        break;
+    default:
+        printf("FM3_FLASH: Unknown register (offset: 0x%x)\n",
+               (uint32_t)offset);
+        break;
+    }
+    return retval;
+}
+
+static void fm3_flash_write(void *opaque, hwaddr offset,
+                            uint64_t value, unsigned size)
+{
+    Fm3FlashState *s = (Fm3FlashState *)opaque;
+
+    switch (offset) {
+    case FM3_FLASH_REG_FASZR:
+        s->faszr = value & FM3_FLASH_REG_FASZR_ASZ;
+        break;
+    case FM3_FLASH_REG_FRWTR:
+        s->frwtr = value & 3;
+        break;
+    case FM3_FLASH_REG_FSYNDN:
+        s->fsyndn = value & 7;
+        break;
+    default:
+        break;
+    }
+}
+
+static const MemoryRegionOps fm3_flash_mem_ops = {
+    .read = fm3_flash_read,
+    .write = fm3_flash_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+};
+
+/* Maps the image, extending it with erased sectors up to the flash size */
+static int fm3_flash_map_image(Fm3FlashState *s)
+{
+    struct stat st;
+    off_t old_size;
+    void *p;
+    int fd;
+
+    fd = qemu_open(s->image, O_RDWR | O_CREAT | O_BINARY, 0644);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        error_report("fm3 flash: cannot open %s: %s", s->image,
+                     strerror(errno));
+        return -1;
+    }
+    old_size = st.st_size;
+    if (old_size < s->size && ftruncate(fd, s->size) < 0) {
+        error_report("fm3 flash: cannot extend %s: %s", s->image,
+                     strerror(errno));
+        qemu_close(fd);
+        return -1;
+    }
+
+    p = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    qemu_close(fd);
+    if (p == MAP_FAILED) {
+        error_report("fm3 flash: cannot map %s: %s", s->image,
+                     strerror(errno));
+        return -1;
+    }
+    s->storage = p;
+    if (old_size < s->size)
+        memset(s->storage + old_size, 0xff, s->size - old_size);
+    return 0;
+}
+
+/* Opens an unlinked, erased template for a flash without an image */
+static int fm3_flash_open_erased(Fm3FlashState *s)
+{
+    uint8_t buf[4096];
+    char *filename;
+    uint32_t pos;
+    int fd;
+
+    filename = g_strdup_printf("%s/fm3-flash.XXXXXX", g_get_tmp_dir());
+    fd = mkstemp(filename);
+    if (fd < 0) {
+        error_report("fm3 flash: cannot create %s: %s", filename,
+                     strerror(errno));
+        g_free(filename);
+        return -1;
+    }
+    unlink(filename);
+    g_free(filename);
+
+    memset(buf, 0xff, sizeof(buf));
+    for (pos = 0; pos < FM3_FLASH_ERASED_SIZE; pos += sizeof(buf)) {
+        if (qemu_write_full(fd, buf, sizeof(buf)) != sizeof(buf)) {
+            error_report("fm3 flash: cannot write the erased template: %s",
+                         strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    s->erased_fd = fd;
+    return 0;
+}
+
+static void fm3_flash_reset(DeviceState *d)
+{
+    Fm3FlashState *s = FM3_FLASH(d);
+
+    timer_del(s->busy_timer);
+    s->faszr = 0x02;    /* 32-bit read */
+    s->frwtr = 0;
+    s->fstr = FM3_FLASH_REG_FSTR_RDY;
+    s->fsyndn = 0;
+    s->cmd = FM3_FLASH_READ;
+    s->status = 0;
+    s->toggle = 0;
+    s->busy = false;
+    memory_region_rom_device_set_romd(&s->flash, true);
+}
+
+static int fm3_flash_init(SysBusDevice *dev)
+{
+    DeviceState *devs = DEVICE(dev);
+    Fm3FlashState *s = FM3_FLASH(devs);
+
+    s->erased_fd = -1;
+    if (s->image) {
+        if (fm3_flash_map_image(s) < 0)
+            return -1;
+        memory_region_init_rom_device_ptr(&s->flash, OBJECT(s),
+                                          &fm3_flash_array_ops, s,
+                                          "fm3.flash", s->size, s->storage);
+        s->dirty = bitmap_new(DIV_ROUND_UP(s->size, FM3_FLASH_CHUNK_SIZE));
+        s->sync_timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                     fm3_flash_sync_timer_cb, s);
+        s->exit_notifier.notify = fm3_flash_exit_notify;
+        qemu_add_exit_notifier(&s->exit_notifier);
+    } else {
+        s->storage = fm3_alloc_sparse(s->size);
+        if (!s->storage) {
+            error_report("fm3 flash: cannot allocate %u bytes", s->size);
+            return -1;
+        }
+        if (fm3_flash_open_erased(s) < 0 ||
+            fm3_flash_map_erased(s, 0, s->size) < 0) {
+            error_report("fm3 flash: cannot map the erased template");
+            return -1;
+        }
+        memory_region_init_rom_device_ptr(&s->flash, OBJECT(s),
+                                          &fm3_flash_array_ops, s,
+                                          "fm3.flash", s->size, s->storage);
+    }
+    vmstate_register_ram(&s->flash, devs);
+    sysbus_init_mmio(dev, &s->flash);
+
+    memory_region_init_io(&s->mmio, OBJECT(s), &fm3_flash_mem_ops, s,
+                          "fm3.flash-if", 0x1000);
+    sysbus_init_mmio(dev, &s->mmio);
+
+    s->busy_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                 fm3_flash_busy_timer_cb, s);
+    return 0;
+}
+
+static int fm3_flash_post_load(void *opaque, int version_id)
+{
+    Fm3FlashState *s = (Fm3FlashState *)opaque;
+
+    memory_region_rom_device_set_romd(&s->flash,
+                                      !s->busy && s->cmd != FM3_FLASH_HANG);
+    return 0;
+}
+
+static const VMStateDescription vmstate_fm3_flash = {
+    .name = TYPE_FM3_FLASH,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .post_load = fm3_flash_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(faszr, Fm3FlashState),
+        VMSTATE_UINT32(frwtr, Fm3FlashState),
+        VMSTATE_UINT32(fstr, Fm3FlashState),
+        VMSTATE_UINT32(fsyndn, Fm3FlashState),
+        VMSTATE_UINT32(cmd, Fm3FlashState),
+        VMSTATE_UINT32(status, Fm3FlashState),
+        VMSTATE_UINT32(toggle, Fm3FlashState),
+        VMSTATE_BOOL(busy, Fm3FlashState),
+        VMSTATE_TIMER(busy_timer, Fm3FlashState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property fm3_flash_properties[] = {
+    DEFINE_PROP_UINT32("size", Fm3FlashState, size, 1024 * 1024),
+    DEFINE_PROP_STRING("image", Fm3FlashState, image),
+    DEFINE_PROP_BOOL("timing", Fm3FlashState, timing, true),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void fm3_flash_class_init(ObjectClass *klass, void *data)
+{
+	DeviceClass			*dc	= DEVICE_CLASS(klass);
+	SysBusDeviceClass	*k	= SYS_BUS_DEVICE_CLASS(klass);
+
+	k->init		= fm3_flash_init;
+	dc->desc	= TYPE_FM3_FLASH;
+	dc->reset	= fm3_flash_reset;
+	dc->vmsd	= &vmstate_fm3_flash;
+	dc->props	= fm3_flash_properties;
+}
+
+static const TypeInfo fm3_flash_info = {
+	.name			= TYPE_FM3_FLASH,
+	.parent			= TYPE_SYS_BUS_DEVICE,
+	.instance_size	= sizeof(Fm3FlashState),
+	.class_init		= fm3_flash_class_init,
+};
+
+static void fm3_register_devices(void)
+{
+    type_register_static(&fm3_flash_info);
+}
+
+type_init(fm3_register_devices)
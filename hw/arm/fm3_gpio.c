@@ -8,6 +8,7 @@
  */
 
 #include <ctype.h>
+#include <sys/mman.h>
 #include "hw/sysbus.h"
 #include "sysemu/sysemu.h"
 #include "qapi/qmp/qerror.h"
@@ -15,6 +16,13 @@
 #include "fm3.h"
 #include "fm3_board_config.h"
 #include "exec/gdbstub.h"
+#include "qemu/timer.h"
+#include "qemu/host-utils.h"
+#include "qemu/main-loop.h"
+#include "qemu/event_notifier.h"
+#include "qemu/error-report.h"
+#include "fm3_gpio_shm.h"
+#include "fm3_vcd.h"
 
 //#define FM3_DEBUG_GPIO
 #define TYPE_FM3_GPIO		"fm3.gpio"
@@ -28,6 +36,8 @@
 #endif
 
 #define FM3_GPIO_BLOCK_NUM 16
+#define FM3_GPIO_ALL_BLOCKS ((1 << FM3_GPIO_BLOCK_NUM) - 1)
+#define FM3_GPIO_REPLAY_LOOKAHEAD   (64)
 
 typedef struct {
     SysBusDevice busdev;
@@ -37,13 +47,72 @@ typedef struct {
     uint32_t dir[FM3_GPIO_BLOCK_NUM];
     uint32_t in[FM3_GPIO_BLOCK_NUM];
     uint32_t out[FM3_GPIO_BLOCK_NUM];
+    /* pin-mux routing table (rebuilt only when PFR/EPFR are changed) */
+    int uart_port[FM3_MFS_NUM][2];
+    int exti_port[FM3_EXTI_NUM];
+    uint32_t uart_route[2];     /* bit per ch: [0] = SIN, [1] = SOT */
+    uint32_t exti_route;        /* bit per ch: INTxx */
+    /* INTxx input lines of fm3.exti, then the level driven on each pin */
+    qemu_irq lines[FM3_GPIO_LINE_NUM];
+    /* shared-memory pin-state window */
+    char *shm_path;
+    int32_t shm_eventfd;
+    Fm3GpioShm *shm;
+    EventNotifier shm_notifier;
+    /* input waveform replay */
+    char *replay_path;
+    Fm3VcdReader *replay;
+    QEMUTimer *replay_timer;
+    Fm3VcdEvent replay_buf[FM3_GPIO_REPLAY_LOOKAHEAD];
+    uint32_t replay_get;
+    uint32_t replay_count;
+    Fm3VcdPos replay_pos;       /* past the last event applied */
+    /* output/interrupt recorder */
+    char *record_path;
 } Fm3GpioState;
 #define FM3_GPIO(obj) \
     OBJECT_CHECK(Fm3GpioState, (obj), TYPE_FM3_GPIO)
 
+/*
+ * Binary control protocol (fm3-gpio-control,binary=on)
+ *
+ * Every frame is  [len:16][cmd:8][payload:len-1]  (little endian),
+ * "len" counts the bytes following the length field.
+ *
+ * host -> qemu
+ *   READ      [mask:16]                    reply: STATE
+ *   SET       [mask:16] {[bits:16][val:16]} for each block in mask
+ *                                          reply: ACK
+ *   SUBSCRIBE [mask:16]                    reply: ACK
+ *   CONT                                   reply: ACK
+ * qemu -> host
+ *   ACK       [cmd:8][status:8]            status: 0 = OK, 1 = NG
+ *   STATE     [mask:16] {[pfr:16][ddr:16][pdir:16][pdor:16]} for each
+ *             block in mask
+ *   NOTIFY    same as STATE, sent when PDOR/DDR of subscribed blocks
+ *             are changed
+ */
+#define FM3_GPIO_BIN_READ           (0x01)
+#define FM3_GPIO_BIN_SET            (0x02)
+#define FM3_GPIO_BIN_SUBSCRIBE      (0x03)
+#define FM3_GPIO_BIN_CONT           (0x04)
+#define FM3_GPIO_BIN_ACK            (0x80)
+#define FM3_GPIO_BIN_STATE          (0x81)
+#define FM3_GPIO_BIN_NOTIFY         (0x82)
+#define FM3_GPIO_BIN_FRAME_MAX      (2 + 1 + 2 + FM3_GPIO_BLOCK_NUM * 8)
+
 typedef struct {
     SysBusDevice busdev;
     CharDriverState *chr;
+    bool binary;
+    uint32_t notify_mask;
+    uint8_t rx_buf[FM3_GPIO_BIN_FRAME_MAX];
+    uint32_t rx_len;
+    /* coalesced change notifications (quantum != 0) */
+    uint32_t quantum;           /* in us of virtual time, 0: every edge */
+    uint32_t dirty;
+    QEMUTimer *notify_timer;
+    Notifier exit_notifier;
 } Fm3GpioControlState;
 #define FM3_GPIO_CTRL(obj) \
     OBJECT_CHECK(Fm3GpioControlState, (obj), TYPE_FM3_GPIO_CTRL)
@@ -343,33 +412,118 @@ int fm3_gpio_get_port_from_pin(int pin_no, enum FM3_PINPACKAGE pkg)
     return -1;
 }
 
-uint32_t fm3_gpio_get_port_setting(uint32_t port_no)
+static bool fm3_gpio_check_port_setting(Fm3GpioState *s, int port_no)
 {
-    Fm3GpioState *s = fm3_gpio_state;
-    uint32_t retval = 0;
     uint32_t block_no = FM3_PORT_TO_BLOCKNO(port_no);
     uint32_t bit_pos = FM3_PORT_TO_BITPOS(port_no);
-    assert(block_no < FM3_GPIO_BLOCK_NUM);
 
-    if (s) {
-        retval = (s->mode[block_no] >> bit_pos) & 1;
+    if (port_no < 0)
+        return false;
+
+    return fm3_board_get_port_info(port_no) == 
+                            ((s->mode[block_no] >> bit_pos) & 1);
+}
+
+static bool fm3_gpio_check_route_uart(Fm3GpioState *s, int ch, int tx)
+{
+    int export = (ch < 4)? FM3_PORT_EPFR07_MFS0:
+                           FM3_PORT_EPFR08_MFS1;
+
+    if (!fm3_gpio_check_port_setting(s, s->uart_port[ch][tx]))
+        return false;
+
+    return fm3_board_check_extport_uart(ch, tx, s->ext_mode[export]);
+}
+
+static bool fm3_gpio_check_route_exti(Fm3GpioState *s, int ch)
+{
+    int export = (ch < 16)? FM3_PORT_EPFR06_EINT0:
+                            FM3_PORT_EPFR15_EINT1;
+
+    if (!fm3_gpio_check_port_setting(s, s->exti_port[ch]))
+        return false;
+
+    return fm3_board_check_extport_exti(ch, s->ext_mode[export]);
+}
+
+/* Rebuild the routing table and notify the peripherals whose bit changed */
+static void fm3_gpio_update_route(Fm3GpioState *s)
+{
+    uint32_t route, changed;
+    int ch, tx;
+
+    for (tx = 0; tx < 2; tx++) {
+        route = 0;
+        for (ch = 0; ch < FM3_MFS_NUM; ch++) {
+            if (fm3_gpio_check_route_uart(s, ch, tx))
+                route |= (1 << ch);
+        }
+        changed = route ^ s->uart_route[tx];
+        s->uart_route[tx] = route;
+        for (ch = 0; ch < FM3_MFS_NUM; ch++) {
+            if ((changed >> ch) & 1)
+                fm3_uart_set_route(ch, tx, (route >> ch) & 1);
+        }
     }
 
-    return retval;
+    route = 0;
+    for (ch = 0; ch < FM3_EXTI_NUM; ch++) {
+        if (fm3_gpio_check_route_exti(s, ch))
+            route |= (1 << ch);
+    }
+    changed = route ^ s->exti_route;
+    s->exti_route = route;
+    for (; changed; changed &= changed - 1) {
+        ch = ctz32(changed);
+        qemu_set_irq(s->lines[FM3_GPIO_LINE_EXTI_ROUTE(ch)],
+                     (route >> ch) & 1);
+    }
 }
 
-uint32_t fm3_gpio_get_extport_setting(uint32_t block_no)
+static int fm3_gpio_get_port_from_board_pin(int pin_no)
 {
-    Fm3GpioState *s = fm3_gpio_state;
-    uint32_t retval = 0;
+    if (pin_no < 0)
+        return -1;
+    return fm3_gpio_get_port_from_pin(pin_no, FM3_PINPACKAGE_LQFP176);
+}
 
-    assert(block_no < FM3_GPIO_BLOCK_NUM);
+static void fm3_gpio_init_route(Fm3GpioState *s)
+{
+    int ch;
 
-    if (s) {
-        retval = s->ext_mode[block_no];
+    for (ch = 0; ch < FM3_MFS_NUM; ch++) {
+        s->uart_port[ch][0] = 
+            fm3_gpio_get_port_from_board_pin(fm3_board_get_uart_rx_pin(ch));
+        s->uart_port[ch][1] = 
+            fm3_gpio_get_port_from_board_pin(fm3_board_get_uart_tx_pin(ch));
     }
 
-    return retval;
+    for (ch = 0; ch < FM3_EXTI_NUM; ch++) {
+        s->exti_port[ch] = 
+            fm3_gpio_get_port_from_board_pin(fm3_board_get_exti_pin(ch));
+    }
+
+    s->uart_route[0] = 0;
+    s->uart_route[1] = 0;
+    s->exti_route = 0;
+}
+
+/* Publish the pin state to the shared-memory window */
+static void fm3_gpio_shm_update(Fm3GpioState *s)
+{
+    Fm3GpioShm *shm = s->shm;
+
+    if (!shm)
+        return;
+
+    shm->seq++;
+    smp_wmb();
+    memcpy(shm->mode, s->mode, sizeof(shm->mode));
+    memcpy(shm->dir, s->dir, sizeof(shm->dir));
+    memcpy(shm->in, s->in, sizeof(shm->in));
+    memcpy(shm->out, s->out, sizeof(shm->out));
+    smp_wmb();
+    shm->seq++;
 }
 
 static inline uint32_t fm3_gpio_make_port_no(uint32_t block_no, uint32_t bit_pos)
@@ -519,6 +673,122 @@ static char* fm3_gpio_make_port_bit_msg(char *p, uint32_t block_no,
 }
 
 
+static uint8_t *fm3_gpio_bin_put_blocks(Fm3GpioState *s, uint8_t *p, 
+                                        uint32_t mask)
+{
+    uint32_t block_no;
+
+    stw_le_p(p, mask);
+    p += 2;
+    for (block_no = 0; block_no < FM3_GPIO_BLOCK_NUM; block_no++) {
+        if (!((mask >> block_no) & 1))
+            continue;
+        stw_le_p(p + 0, s->mode[block_no]);
+        stw_le_p(p + 2, s->dir[block_no]);
+        stw_le_p(p + 4, s->in[block_no]);
+        stw_le_p(p + 6, s->out[block_no]);
+        p += 8;
+    }
+    return p;
+}
+
+static void fm3_gpio_bin_send(Fm3GpioControlState *s, uint8_t cmd,
+                              const uint8_t *payload, uint32_t len)
+{
+    uint8_t frame[FM3_GPIO_BIN_FRAME_MAX];
+
+    assert(len + 3 <= sizeof(frame));
+    stw_le_p(frame, len + 1);
+    frame[2] = cmd;
+    memcpy(&frame[3], payload, len);
+    qemu_chr_fe_write(s->chr, frame, len + 3);
+}
+
+static void fm3_gpio_bin_send_blocks(Fm3GpioControlState *s, uint8_t cmd,
+                                     uint32_t mask)
+{
+    uint8_t payload[FM3_GPIO_BIN_FRAME_MAX];
+    uint8_t *p = fm3_gpio_bin_put_blocks(fm3_gpio_state, payload, mask);
+
+    fm3_gpio_bin_send(s, cmd, payload, p - payload);
+}
+
+static void fm3_gpio_notify_send(Fm3GpioControlState *c, uint32_t mask)
+{
+    uint32_t block_no;
+    char msg[32];
+
+    if (c->binary) {
+        mask &= c->notify_mask;
+        if (mask)
+            fm3_gpio_bin_send_blocks(c, FM3_GPIO_BIN_NOTIFY, mask);
+        return;
+    }
+
+    for (block_no = 0; block_no < FM3_GPIO_BLOCK_NUM; block_no++) {
+        if ((mask >> block_no) & 1) {
+            fm3_gpio_make_port_block_msg(msg, block_no);
+            fm3_gpio_send_msg(c, msg, strlen(msg));
+        }
+    }
+}
+
+/* Send one combined notification for the blocks changed so far */
+static void fm3_gpio_notify_flush(void *opaque)
+{
+    Fm3GpioControlState *c = opaque;
+    uint32_t mask = c->dirty;
+
+    c->dirty = 0;
+    timer_del(c->notify_timer);
+    if (mask)
+        fm3_gpio_notify_send(c, mask);
+}
+
+/* Inform the controller that the port blocks in mask are changed */
+static void fm3_gpio_notify(Fm3GpioState *s, uint32_t mask)
+{
+    Fm3GpioControlState *c = fm3_gpio_ctrl_state;
+
+    if (!c)
+        return;
+
+    if (c->quantum == 0) {
+        fm3_gpio_notify_send(c, mask);
+        return;
+    }
+
+    c->dirty |= mask;
+    if (!timer_pending(c->notify_timer)) {
+        timer_mod(c->notify_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                                   (int64_t)c->quantum * SCALE_US);
+    }
+}
+
+static void fm3_gpio_notify_exit(Notifier *n, void *data)
+{
+    Fm3GpioControlState *c = container_of(n, Fm3GpioControlState,
+                                          exit_notifier);
+
+    fm3_gpio_notify_flush(c);
+}
+
+/* Drive the lines of the output pins in a block whose level changed */
+static void fm3_gpio_update_lines(Fm3GpioState *s, uint32_t block_no,
+                                  uint32_t old_level)
+{
+    uint32_t level = s->in[block_no] & s->dir[block_no];
+    uint32_t changed = level ^ old_level;
+    uint32_t bit_pos;
+
+    for (bit_pos = 0; changed; bit_pos++, changed >>= 1) {
+        if (changed & 1)
+            qemu_set_irq(s->lines[FM3_GPIO_LINE_PORT(
+                             fm3_gpio_make_port_no(block_no, bit_pos))],
+                         (level >> bit_pos) & 1);
+    }
+}
+
 static void fm3_gpio_write(void *opaque, hwaddr offset,
                            uint64_t value, unsigned size)
 {
@@ -529,7 +799,8 @@ static void fm3_gpio_write(void *opaque, hwaddr offset,
     uint32_t out = s->out[block_no];
     uint32_t dir = s->dir[block_no];
     uint32_t reg = offset & ~0xff;
-    char msg[32];
+    uint32_t level = s->in[block_no] & s->dir[block_no];
+    uint32_t old;
 
     DPRINTF("%s: 0x%08x <--- 0x%08x (block_no=%d)\n", __func__, offset, value, block_no);
 #if 0
@@ -554,6 +825,7 @@ static void fm3_gpio_write(void *opaque, hwaddr offset,
         return;
     }
 
+    old = *p;
     switch (size) {
     case 1:
         tmp = *p;
@@ -578,15 +850,26 @@ static void fm3_gpio_write(void *opaque, hwaddr offset,
         return;
     }
 
+    if ((reg == FM3_GPIO_REG_PFR_BASE || reg == FM3_GPIO_REG_EPFR_BASE) &&
+        old != *p) {
+        fm3_gpio_update_route(s);
+    }
+
+    if (out != s->out[block_no])
+        fm3_vcd_record_port(block_no, s->out[block_no]);
+
     if (out != s->out[block_no] || dir != s->dir[block_no]) {
         /* update the input data reg when the port direction is output */
         s->in[block_no] = (s->in[block_no] & ~s->dir[block_no]) | 
                           (s->out[block_no] & s->dir[block_no]);
+        fm3_gpio_update_lines(s, block_no, level);
 
         /* send the message which informs that the port is changed */
-        fm3_gpio_make_port_block_msg(msg, block_no);
-        fm3_gpio_send_msg(NULL, msg, strlen(msg));
+        fm3_gpio_notify(s, 1 << block_no);
     }
+
+    if (old != *p)
+        fm3_gpio_shm_update(s);
 }
 
 static const MemoryRegionOps fm3_gpio_mem_ops = {
@@ -595,6 +878,9 @@ static const MemoryRegionOps fm3_gpio_mem_ops = {
     .endianness = DEVICE_NATIVE_ENDIAN,
 };
 
+static int fm3_gpio_shm_init(Fm3GpioState *s);
+static int fm3_gpio_replay_init(Fm3GpioState *s);
+
 static int fm3_gpio_init(SysBusDevice *dev)
 {
 	DeviceState		*devs	= DEVICE(dev);
@@ -602,6 +888,15 @@ static int fm3_gpio_init(SysBusDevice *dev)
 
     memory_region_init_io(&s->mmio, OBJECT(s), &fm3_gpio_mem_ops, s, TYPE_FM3_GPIO, 0x1000);
     sysbus_init_mmio(dev, &s->mmio);
+    qdev_init_gpio_out(devs, s->lines, FM3_GPIO_LINE_NUM);
+
+    fm3_gpio_init_route(s);
+    if (s->shm_path && fm3_gpio_shm_init(s) < 0)
+        return -1;
+    if (s->replay_path && fm3_gpio_replay_init(s) < 0)
+        return -1;
+    if (s->record_path && fm3_vcd_recorder_open(s->record_path) < 0)
+        return -1;
 
     fm3_gpio_state = s;
     return 0;
@@ -613,12 +908,14 @@ static int fm3_gpio_init(SysBusDevice *dev)
 
 static int fm3_gpio_chardev_can_read(void *opaque)
 {
-    //Fm3GpioState *s = opaque;
+    Fm3GpioControlState *s = opaque;
 
-    if (fm3_gpio_state)
-        return 32;
-    else
+    if (!fm3_gpio_state)
         return 0;
+    else if (s->binary)
+        return sizeof(s->rx_buf) - s->rx_len;
+    else
+        return 32;
 }
 
 static bool fm3_gpio_check_port(Fm3GpioState *s, uint32_t block_no, uint32_t bit_pos, int dir)
@@ -653,12 +950,15 @@ static void fm3_gpio_ctrl_port_exti(Fm3GpioState *s, int set, int port_no)
     int exti_no;
 
     exti_no = fm3_board_port_to_extint(port_no);
+    if (exti_no < 0)
+        return;
+
     switch (set) {
     case 'H':
-        fm3_exti_set_request(exti_no, 1);
+        qemu_irq_raise(s->lines[FM3_GPIO_LINE_EXTI(exti_no)]);
         break;
     case 'L':
-        fm3_exti_set_request(exti_no, 0);
+        qemu_irq_lower(s->lines[FM3_GPIO_LINE_EXTI(exti_no)]);
         break;
     default:
         break;
@@ -684,6 +984,199 @@ static void fm3_gpio_ctrl_port(int set, uint32_t block_no, uint32_t bit_pos)
     fm3_gpio_ctrl_port_exti(s, set, port_no);
 }
 
+static void fm3_gpio_shm_event(EventNotifier *e)
+{
+    Fm3GpioState *s = container_of(e, Fm3GpioState, shm_notifier);
+    Fm3GpioShm *shm = s->shm;
+    uint32_t block_no, bit_pos, mask, val;
+
+    event_notifier_test_and_clear(e);
+    for (block_no = 0; block_no < FM3_GPIO_BLOCK_NUM; block_no++) {
+        mask = atomic_xchg(&shm->req_mask[block_no], 0);
+        if (!mask)
+            continue;
+        smp_rmb();
+        val = shm->req_val[block_no];
+        for (bit_pos = 0; bit_pos < 16; bit_pos++) {
+            if ((mask >> bit_pos) & 1)
+                fm3_gpio_ctrl_port(((val >> bit_pos) & 1) ? 'H' : 'L',
+                                   block_no, bit_pos);
+        }
+    }
+    /* one publish for all the requests of this event */
+    fm3_gpio_shm_update(s);
+}
+
+static int fm3_gpio_shm_init(Fm3GpioState *s)
+{
+    Fm3GpioShm *shm;
+    int fd;
+
+    fd = qemu_open(s->shm_path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        error_report("fm3.gpio: cannot open %s: %s", s->shm_path, 
+                     strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(Fm3GpioShm)) < 0) {
+        error_report("fm3.gpio: cannot resize %s: %s", s->shm_path,
+                     strerror(errno));
+        close(fd);
+        return -1;
+    }
+    shm = mmap(NULL, sizeof(Fm3GpioShm), PROT_READ | PROT_WRITE, 
+               MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        error_report("fm3.gpio: cannot map %s: %s", s->shm_path,
+                     strerror(errno));
+        return -1;
+    }
+
+    if (0 <= s->shm_eventfd) {
+        event_notifier_init_fd(&s->shm_notifier, s->shm_eventfd);
+    } else if (event_notifier_init(&s->shm_notifier, 0) < 0) {
+        error_report("fm3.gpio: cannot create the eventfd");
+        munmap(shm, sizeof(Fm3GpioShm));
+        return -1;
+    }
+
+    memset(shm, 0, sizeof(Fm3GpioShm));
+    shm->magic = FM3_GPIO_SHM_MAGIC;
+    shm->version = FM3_GPIO_SHM_VERSION;
+    shm->pid = getpid();
+    shm->eventfd = event_notifier_get_fd(&s->shm_notifier);
+    s->shm = shm;
+
+    event_notifier_set_handler(&s->shm_notifier, fm3_gpio_shm_event);
+    fm3_gpio_shm_update(s);
+    return 0;
+}
+
+/*
+ * Input waveform replay: the file is streamed through a small lookahead
+ * buffer and each change is applied at its time on the virtual clock.
+ */
+static void fm3_gpio_replay_fill(Fm3GpioState *s)
+{
+    Fm3VcdEvent *ev;
+
+    while (s->replay && s->replay_count < FM3_GPIO_REPLAY_LOOKAHEAD) {
+        ev = &s->replay_buf[(s->replay_get + s->replay_count) % 
+                            FM3_GPIO_REPLAY_LOOKAHEAD];
+        if (fm3_vcd_reader_next(s->replay, ev) <= 0) {
+            fm3_vcd_reader_close(s->replay);
+            s->replay = NULL;
+            break;
+        }
+        s->replay_count++;
+    }
+}
+
+/* Pins of a block that take a level from outside: neither MFS pins nor
+ * GPIO outputs.  A recorded waveform also holds the PDOR outputs, which
+ * are skipped without a word. */
+static uint32_t fm3_gpio_input_mask(Fm3GpioState *s, uint32_t block_no)
+{
+    uint32_t mask = 0;
+    uint32_t bit_pos;
+
+    for (bit_pos = 0; bit_pos < 16; bit_pos++) {
+        if (fm3_board_port_to_uart(fm3_gpio_make_port_no(block_no,
+                                                         bit_pos)) < 0 &&
+            !fm3_gpio_check_port(s, block_no, bit_pos, FM3_GPIO_REG_DDR_OUT))
+            mask |= 1 << bit_pos;
+    }
+    return mask;
+}
+
+static void fm3_gpio_replay_apply(Fm3GpioState *s, Fm3VcdEvent *ev)
+{
+    uint32_t mask, bit_pos;
+    int set;
+
+    if (ev->block == FM3_VCD_BLOCK_EXTI) {
+        for (mask = ev->mask; mask; mask &= mask - 1) {
+            bit_pos = ctz32(mask);
+            qemu_set_irq(s->lines[FM3_GPIO_LINE_EXTI(bit_pos)],
+                         (ev->value >> bit_pos) & 1);
+        }
+        return;
+    }
+    if (FM3_GPIO_BLOCK_NUM <= ev->block)
+        return;
+
+    mask = ev->mask & fm3_gpio_input_mask(s, ev->block);
+    if (!mask)
+        return;
+    for (; mask; mask &= mask - 1) {
+        bit_pos = ctz32(mask);
+        set = ((ev->value >> bit_pos) & 1) ? 'H' : 'L';
+        fm3_gpio_ctrl_port_gpio(s, set, ev->block, bit_pos);
+        fm3_gpio_ctrl_port_exti(s, set,
+                                fm3_gpio_make_port_no(ev->block, bit_pos));
+    }
+    fm3_gpio_shm_update(s);
+}
+
+static void fm3_gpio_replay_tick(void *opaque)
+{
+    Fm3GpioState *s = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    Fm3VcdEvent *ev;
+
+    for (;;) {
+        if (s->replay_count == 0) {
+            fm3_gpio_replay_fill(s);
+            if (s->replay_count == 0)
+                return;
+        }
+
+        ev = &s->replay_buf[s->replay_get];
+        if (now < ev->time)
+            break;
+
+        fm3_gpio_replay_apply(s, ev);
+        s->replay_get = (s->replay_get + 1) % FM3_GPIO_REPLAY_LOOKAHEAD;
+        s->replay_count--;
+        s->replay_pos = ev->next;
+    }
+
+    if (s->replay_count < FM3_GPIO_REPLAY_LOOKAHEAD / 2)
+        fm3_gpio_replay_fill(s);
+    timer_mod(s->replay_timer, ev->time);
+}
+
+/* Reopen the waveform at replay_pos, or at its start if nothing was applied */
+static int fm3_gpio_replay_seek(Fm3GpioState *s)
+{
+    if (s->replay)
+        fm3_vcd_reader_close(s->replay);
+    s->replay = fm3_vcd_reader_open(s->replay_path);
+    if (!s->replay)
+        return -1;
+
+    if (s->replay_pos.offset)
+        fm3_vcd_reader_seek(s->replay, &s->replay_pos);
+    s->replay_get = 0;
+    s->replay_count = 0;
+    fm3_gpio_replay_fill(s);
+    if (s->replay_count)
+        timer_mod(s->replay_timer, s->replay_buf[s->replay_get].time);
+    else
+        timer_del(s->replay_timer);
+    return 0;
+}
+
+static int fm3_gpio_replay_init(Fm3GpioState *s)
+{
+    s->replay_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, 
+                                   fm3_gpio_replay_tick, s);
+    s->replay_pos.offset = 0;
+    s->replay_pos.stamp = 0;
+    return fm3_gpio_replay_seek(s);
+}
+
 #if 0
 static int fm3_gpio_read_port(uint32_t block_no, uint32_t bit_pos)
 {
@@ -747,6 +1240,98 @@ static int fm3_gpio_misc_cmd(char *cmd)
     return ret;
 }
 
+static void fm3_gpio_bin_ack(Fm3GpioControlState *s, uint8_t cmd, int ng)
+{
+    uint8_t payload[2] = { cmd, (ng != 0) };
+
+    fm3_gpio_bin_send(s, FM3_GPIO_BIN_ACK, payload, sizeof(payload));
+}
+
+static void fm3_gpio_bin_ctrl_block(uint32_t block_no, uint32_t bits,
+                                    uint32_t val)
+{
+    uint32_t bit_pos;
+
+    for (bit_pos = 0; bit_pos < 16; bit_pos++) {
+        if ((bits >> bit_pos) & 1)
+            fm3_gpio_ctrl_port(((val >> bit_pos) & 1) ? 'H' : 'L', 
+                               block_no, bit_pos);
+    }
+}
+
+static void fm3_gpio_bin_command(Fm3GpioControlState *s, const uint8_t *p,
+                                 uint32_t len)
+{
+    uint8_t cmd = p[0];
+    uint32_t mask = FM3_GPIO_ALL_BLOCKS;
+    uint32_t block_no;
+
+    p++;
+    len--;
+    if (2 <= len) {
+        mask = lduw_le_p(p);
+        p += 2;
+        len -= 2;
+    }
+
+    switch (cmd) {
+    case FM3_GPIO_BIN_READ:
+        /* pending changes go out before the state they led to */
+        fm3_gpio_notify_flush(s);
+        fm3_gpio_bin_send_blocks(s, FM3_GPIO_BIN_STATE, mask);
+        return;
+    case FM3_GPIO_BIN_SET:
+        if (len < ctpop32(mask) * 4)
+            break;
+        for (block_no = 0; block_no < FM3_GPIO_BLOCK_NUM; block_no++) {
+            if ((mask >> block_no) & 1) {
+                fm3_gpio_bin_ctrl_block(block_no, lduw_le_p(p), 
+                                        lduw_le_p(p + 2));
+                p += 4;
+            }
+        }
+        fm3_gpio_shm_update(fm3_gpio_state);
+        fm3_gpio_bin_ack(s, cmd, 0);
+        return;
+    case FM3_GPIO_BIN_SUBSCRIBE:
+        s->notify_mask = mask;
+        fm3_gpio_bin_ack(s, cmd, 0);
+        return;
+    case FM3_GPIO_BIN_CONT:
+        vm_start();
+        fm3_gpio_bin_ack(s, cmd, 0);
+        return;
+    default:
+        break;
+    }
+    fm3_gpio_bin_ack(s, cmd, 1);
+}
+
+static void fm3_gpio_bin_receive(Fm3GpioControlState *s, const uint8_t *buf,
+                                 int size)
+{
+    uint32_t len;
+
+    memcpy(&s->rx_buf[s->rx_len], buf, size);
+    s->rx_len += size;
+
+    while (2 <= s->rx_len) {
+        len = lduw_le_p(s->rx_buf);
+        if (len == 0 || sizeof(s->rx_buf) - 2 < len) {
+            /* out of sync: drop everything received so far */
+            s->rx_len = 0;
+            fm3_gpio_bin_ack(s, 0, 1);
+            break;
+        }
+        if (s->rx_len < len + 2)
+            break;
+
+        fm3_gpio_bin_command(s, &s->rx_buf[2], len);
+        s->rx_len -= len + 2;
+        memmove(s->rx_buf, &s->rx_buf[len + 2], s->rx_len);
+    }
+}
+
 /* --- CharDev֘A --- */
 static void fm3_gpio_chardev_read(void *opaque, const uint8_t *buf, int size)
 {
@@ -760,6 +1345,11 @@ static void fm3_gpio_chardev_read(void *opaque, const uint8_t *buf, int size)
     char val[32];
     char res_str[512] = {0};
 
+    if (s->binary) {
+        fm3_gpio_bin_receive(s, buf, size);
+        return;
+    }
+
     *(p+size) = 0;
     scaned = sscanf(p, "%2[^\r\n]=%s", port, val);
     if (scaned <= 0)
@@ -786,6 +1376,7 @@ static void fm3_gpio_chardev_read(void *opaque, const uint8_t *buf, int size)
     if (scaned < 2) {
         /* read */
         char *tmp = res_str;
+        fm3_gpio_notify_flush(s);
         if (16 <= block_no) {
             /* read the all ports */
             for (i = 0; i < 16; i++)
@@ -812,6 +1403,7 @@ static void fm3_gpio_chardev_read(void *opaque, const uint8_t *buf, int size)
         } else {
             fm3_gpio_ctrl_port(toupper(val[0]), block_no, bit_pos);
         }
+        fm3_gpio_shm_update(fm3_gpio_state);
     }
 out:
     pstrcat(res_str, sizeof(res_str), "OK\r\n");
@@ -840,6 +1432,13 @@ static int fm3_gpio_chardev_init(SysBusDevice *dev)
         return -1;
     }
 
+    s->notify_mask = FM3_GPIO_ALL_BLOCKS;
+    s->rx_len = 0;
+    s->dirty = 0;
+    s->notify_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, 
+                                   fm3_gpio_notify_flush, s);
+    s->exit_notifier.notify = fm3_gpio_notify_exit;
+    qemu_add_exit_notifier(&s->exit_notifier);
     qemu_chr_add_handlers(s->chr, fm3_gpio_chardev_can_read,
                           fm3_gpio_chardev_read, fm3_gpio_chardev_event, s);
 
@@ -848,7 +1447,42 @@ static int fm3_gpio_chardev_init(SysBusDevice *dev)
 }
 
 /* ʏŒ` */
+static int fm3_gpio_post_load(void *opaque, int version_id)
+{
+    Fm3GpioState *s = opaque;
+
+    /* the waveform goes on from the event it had reached */
+    if (s->replay_path && fm3_gpio_replay_seek(s) < 0)
+        return -EINVAL;
+    fm3_gpio_shm_update(s);
+    return 0;
+}
+
+static const VMStateDescription vmstate_fm3_gpio = {
+    .name = TYPE_FM3_GPIO,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .post_load = fm3_gpio_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(mode, Fm3GpioState, FM3_GPIO_BLOCK_NUM),
+        VMSTATE_UINT32_ARRAY(ext_mode, Fm3GpioState, FM3_GPIO_BLOCK_NUM),
+        VMSTATE_UINT32_ARRAY(dir, Fm3GpioState, FM3_GPIO_BLOCK_NUM),
+        VMSTATE_UINT32_ARRAY(in, Fm3GpioState, FM3_GPIO_BLOCK_NUM),
+        VMSTATE_UINT32_ARRAY(out, Fm3GpioState, FM3_GPIO_BLOCK_NUM),
+        VMSTATE_UINT32_ARRAY(uart_route, Fm3GpioState, 2),
+        VMSTATE_UINT32(exti_route, Fm3GpioState),
+        VMSTATE_INT64(replay_pos.offset, Fm3GpioState),
+        VMSTATE_INT64(replay_pos.stamp, Fm3GpioState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property fm3_gpio_properties[] = {
+    DEFINE_PROP_STRING("shm", Fm3GpioState, shm_path),
+    DEFINE_PROP_INT32("shm-eventfd", Fm3GpioState, shm_eventfd, -1),
+    DEFINE_PROP_STRING("replay", Fm3GpioState, replay_path),
+    DEFINE_PROP_STRING("record", Fm3GpioState, record_path),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -859,6 +1493,7 @@ static void fm3_gpio_class_init(ObjectClass *klass, void *data)
 
 	k->init		= fm3_gpio_init;			/* ֐o^		*/
 	dc->desc	= TYPE_FM3_GPIO;			/* n[hEFA		*/
+	dc->vmsd	= &vmstate_fm3_gpio;
 	dc->props	= fm3_gpio_properties;		/* 				*/
 }
 
@@ -873,6 +1508,8 @@ static const TypeInfo fm3_gpio_info = {
 /* CharDev` */
 static Property fm3_gpio_ctrl_properties[] = {
     DEFINE_PROP_CHR("chardev"			, Fm3GpioControlState	, chr),
+    DEFINE_PROP_BOOL("binary", Fm3GpioControlState, binary, false),
+    DEFINE_PROP_UINT32("quantum", Fm3GpioControlState, quantum, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
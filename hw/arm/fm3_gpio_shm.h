@@ -0,0 +1,45 @@
+#ifndef FM3_GPIO_SHM_H
+#define FM3_GPIO_SHM_H
+/*
+ * Fujitsu FM3 GPIO shared-memory pin-state window
+ *
+ * This code is licensed under the GNU GPL v2.
+ *
+ * Layout of the file given with -global fm3.gpio.shm=<path>.
+ *
+ * QEMU publishes PFR/DDR/PDIR/PDOR of all port blocks.  A reader takes a
+ * consistent snapshot by reading "seq" before and after copying the
+ * arrays, retrying while it is odd or has changed.
+ *
+ * To drive input pins, the host writes the levels to req_val[block],
+ * then ORs the bits to be driven into req_mask[block] atomically and
+ * writes a 64-bit 1 to the eventfd (open /proc/<pid>/fd/<eventfd>).
+ * QEMU clears req_mask when it has consumed the request; the levels are
+ * applied like those from the fm3-gpio-control chardev, so EXTI inputs
+ * are latched as well.
+ */
+
+#define FM3_GPIO_SHM_MAGIC          (0x47334d46)    /* "FM3G" */
+#define FM3_GPIO_SHM_VERSION        (1)
+#define FM3_GPIO_SHM_BLOCK_NUM      (16)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;           /* odd while QEMU is updating the arrays */
+    int32_t pid;
+    int32_t eventfd;
+    uint32_t reserved[3];
+
+    /* written by QEMU */
+    uint32_t mode[FM3_GPIO_SHM_BLOCK_NUM];
+    uint32_t dir[FM3_GPIO_SHM_BLOCK_NUM];
+    uint32_t in[FM3_GPIO_SHM_BLOCK_NUM];
+    uint32_t out[FM3_GPIO_SHM_BLOCK_NUM];
+
+    /* written by the host */
+    uint32_t req_val[FM3_GPIO_SHM_BLOCK_NUM];
+    uint32_t req_mask[FM3_GPIO_SHM_BLOCK_NUM];
+} Fm3GpioShm;
+
+#endif
@@ -11,6 +11,7 @@
 #include "sysemu/sysemu.h"
 #include "qapi/qmp/qerror.h"
 #include "fm3.h"
+#include "fm3_vcd.h"
 
 //#define FM3_DEBUG_INT
 #define TYPE_FM3_INT		"fm3.int"
@@ -26,15 +27,18 @@ typedef struct {
     SysBusDevice busdev;
     MemoryRegion mmio;
     qemu_irq parent[FM3_IRQ_NUM];
-    uint32_t extint_0_7;
-    uint32_t extint_8_31;
-    uint32_t mfs_rx[8];
-    uint32_t mfs_tx_status[8];
+    qemu_irq nmi;
+    uint64_t level;             /* input levels of the sources */
+    uint32_t drqsel;
+    uint32_t exc02mon;
+    uint32_t mon[FM3_IRQ_NUM];  /* IRQxxMON */
 } Fm3IntState;
 #define FM3_INT(obj) \
     OBJECT_CHECK(Fm3IntState, (obj), TYPE_FM3_INT)
     
+#define FM3_INT_DRQSEL              (0x00)
 #define FM3_INT_EXC02MON            (0x10) 
+#define FM3_INT_EXC02MON_HWINT      (1 << 1)
 #define FM3_INT_IRQ00MON            (0x14) 
 #define FM3_INT_IRQ01MON            (0x18) 
 #define FM3_INT_IRQ02MON            (0x1C) 
@@ -67,65 +71,78 @@ typedef struct {
 #define FM3_INT_IRQ29MON            (0x88) 
 #define FM3_INT_IRQ30MON            (0x8C) 
 #define FM3_INT_IRQ31MON            (0x90) 
+#define FM3_INT_IRQMON(n)           (FM3_INT_IRQ00MON + (n) * 4)
 
 static Fm3IntState *fm3_int_state;
 
+/* DRQSEL bit of a source that can request DMA transfers, or -1 */
+static int fm3_int_get_drq(int irq)
+{
+    if (FM3_IRQ_MFS_RX(0) <= irq && irq <= FM3_IRQ_MFS_TX(FM3_MFS_NUM - 1)) {
+        if ((irq - FM3_IRQ_MFS_RX(0)) & 1)
+            return FM3_DRQ_MFS_TX((irq - FM3_IRQ_MFS_TX(0)) / 2);
+        return FM3_DRQ_MFS_RX((irq - FM3_IRQ_MFS_RX(0)) / 2);
+    }
+    if (FM3_IRQ_ADC(0) <= irq && irq <= FM3_IRQ_ADC(2))
+        return FM3_DRQ_ADC(irq - FM3_IRQ_ADC(0));
+    return -1;
+}
+
+/* a source selected by DRQSEL requests the DMAC instead of the CPU */
+static void fm3_int_route(Fm3IntState *s, int irq)
+{
+    int level = (s->level >> irq) & 1;
+    int drq = fm3_int_get_drq(irq);
+    bool dma = drq >= 0 && (s->drqsel & (1 << drq));
+
+    if (drq >= 0)
+        fm3_dmac_request(FM3_DRQ_TO_IS(drq), dma && level);
+    qemu_set_irq(s->parent[irq], !dma && level);
+}
+
 static void fm3_int_set_irq(void *opaque, int irq, int level)
 {
     Fm3IntState *s = (Fm3IntState *)opaque;
     DPRINTF("%s : IRQ#%02d = %d\n", __func__, irq, level);
-    qemu_set_irq(s->parent[irq], level);
+    if (irq == FM3_IRQ_NMI) {
+        if (level)
+            s->exc02mon |= FM3_INT_EXC02MON_HWINT;
+        else
+            s->exc02mon &= ~FM3_INT_EXC02MON_HWINT;
+        qemu_set_irq(s->nmi, level);
+        return;
+    }
+    fm3_vcd_record_irq(irq, level);
+    if (level)
+        s->level |= 1ULL << irq;
+    else
+        s->level &= ~(1ULL << irq);
+    fm3_int_route(s, irq);
+}
+
+void fm3_int_set_mon(int irq, uint32_t mask, uint32_t value)
+{
+    Fm3IntState *s = fm3_int_state;
+
+    if (!s || irq < 0 || FM3_IRQ_NUM <= irq)
+        return;
+
+    s->mon[irq] = (s->mon[irq] & ~mask) | (value & mask);
 }
 
 static uint64_t fm3_int_read(void *opaque, hwaddr offset,
                              unsigned size)
 {
-    //Fm3IntState *s = (Fm3IntState *)opaque;
+    Fm3IntState *s = (Fm3IntState *)opaque;
     uint64_t retval = 0;
-    int i;
 
-    switch (offset & 0xff) {
-
-    /* extint ch0-7 */
-    case FM3_INT_IRQ04MON:
-        for (i = 0; i < 8; i++) {
-            retval |= fm3_exti_get_irq_stat(i) << i;
-        }
-        break;
-
-    /* extint ch8-31 */
-    case FM3_INT_IRQ05MON: 
-        for (i = 8; i < 32; i++) {
-            retval |= fm3_exti_get_irq_stat(i) << (i - 8);
-        }
-        break;
-
-    /* MFS rx int. */
-    case FM3_INT_IRQ07MON:
-    case FM3_INT_IRQ09MON:
-    case FM3_INT_IRQ11MON:
-    case FM3_INT_IRQ13MON:
-    case FM3_INT_IRQ15MON:
-    case FM3_INT_IRQ17MON:
-    case FM3_INT_IRQ19MON:
-    case FM3_INT_IRQ21MON:
-        i = ((offset - FM3_INT_IRQ07MON) >> 3);
-        retval = fm3_uart_get_rx_irq_stat(i);
-        break;
-
-    /* MFS tx/status int. */
-    case FM3_INT_IRQ08MON:
-    case FM3_INT_IRQ10MON:
-    case FM3_INT_IRQ12MON:
-    case FM3_INT_IRQ14MON:
-    case FM3_INT_IRQ16MON:
-    case FM3_INT_IRQ18MON:
-    case FM3_INT_IRQ20MON:
-    case FM3_INT_IRQ22MON:
-        i = ((offset - FM3_INT_IRQ08MON) >> 3);
-        retval = fm3_uart_get_tx_irq_stat(i) | 
-                (fm3_uart_get_stat_irq_stat(i) << 1);
-        break;
+    if (offset == FM3_INT_DRQSEL) {
+        retval = s->drqsel;
+    } else if (offset == FM3_INT_EXC02MON) {
+        retval = s->exc02mon;
+    } else if (FM3_INT_IRQ00MON <= offset && 
+               offset < FM3_INT_IRQMON(FM3_IRQ_NUM)) {
+        retval = s->mon[(offset - FM3_INT_IRQ00MON) >> 2];
     }
 
     DPRINTF("%s : 0x%08x ---> 0x%08x\n", __func__, offset, retval);
@@ -135,7 +152,22 @@ static uint64_t fm3_int_read(void *opaque, hwaddr offset,
 static void fm3_int_write(void *opaque, hwaddr offset,
                           uint64_t value, unsigned size)
 {
-    DPRINTF("%s: Interrupt registers are read-only \n", __func__);
+    Fm3IntState *s = (Fm3IntState *)opaque;
+    uint32_t changed;
+    int irq, drq;
+
+    if (offset != FM3_INT_DRQSEL) {
+        DPRINTF("%s: Interrupt registers are read-only \n", __func__);
+        return;
+    }
+
+    changed = s->drqsel ^ value;
+    s->drqsel = value;
+    for (irq = 0; irq < FM3_IRQ_NUM; irq++) {
+        drq = fm3_int_get_drq(irq);
+        if (drq >= 0 && (changed & (1 << drq)))
+            fm3_int_route(s, irq);
+    }
 }
 
 static const MemoryRegionOps fm3_int_mem_ops = {
@@ -150,10 +182,11 @@ static int fm3_int_init(SysBusDevice *dev)
     Fm3IntState *s = FM3_INT(devs);
     int i;
 
-    qdev_init_gpio_in(devs, fm3_int_set_irq, FM3_IRQ_NUM);
+    qdev_init_gpio_in(devs, fm3_int_set_irq, FM3_IRQ_NUM + 1);
     for (i = 0; i < FM3_IRQ_NUM; i++) {
         sysbus_init_irq(dev, &s->parent[i]);
     }
+    sysbus_init_irq(dev, &s->nmi);
 
     memory_region_init_io(&s->mmio, OBJECT(s), &fm3_int_mem_ops, s, TYPE_FM3_INT, 0x1000);
 
@@ -162,6 +195,27 @@ static int fm3_int_init(SysBusDevice *dev)
     return 0;
 }
 
+static void fm3_int_reset(DeviceState *d)
+{
+    Fm3IntState *s = FM3_INT(d);
+
+    fm3_int_write(s, FM3_INT_DRQSEL, 0, 4);
+}
+
+
+static const VMStateDescription vmstate_fm3_int = {
+    .name = TYPE_FM3_INT,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT64(level, Fm3IntState),
+        VMSTATE_UINT32(drqsel, Fm3IntState),
+        VMSTATE_UINT32(exc02mon, Fm3IntState),
+        VMSTATE_UINT32_ARRAY(mon, Fm3IntState, FM3_IRQ_NUM),
+        VMSTATE_END_OF_LIST()
+    }
+};
 
 static Property fm3_int_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
@@ -174,6 +228,8 @@ static void fm3_int_class_init(ObjectClass *klass, void *data)
 
 	k->init		= fm3_int_init;				/* ֐o^		*/
 	dc->desc	= TYPE_FM3_INT;				/* n[hEFA		*/
+	dc->reset	= fm3_int_reset;
+	dc->vmsd	= &vmstate_fm3_int;
 	dc->props	= fm3_int_properties;		/* 				*/
 }
 
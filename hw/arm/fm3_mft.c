@@ -0,0 +1,1253 @@
+/*
+ * Fujitsu FM3 Multi-Function Timer
+ *
+ * This code is licensed under the GNU GPL v2.
+ *
+ * Free-run timers (FRT), output compare units (OCU), input capture units
+ * (ICU) and the waveform generator (WFG, through mode) of one MFT unit.
+ *
+ * The FRT counters are not ticked: a running FRT is described by the
+ * virtual time of its count origin, and counts, OCU match times and RT
+ * output levels are derived from it when they are needed.  Host timers
+ * are only armed for enabled interrupts and buffer transfers.
+ *
+ * The RT outputs are also GPIO output lines 0-5.  An OCU whose line is
+ * connected is timed on each match, like one with its interrupt enabled.
+ *
+ * With the "waveform" property, each RT output is exported as runs of
+ * identical FRT cycles rather than as individual edges.  The file starts
+ * with the magic "FM3MFTW1" followed by 56-byte little-endian records:
+ *
+ *   start_ns:64  end_ns:64     the run covers [start, end)
+ *   origin_ns:64               a time where the FRT phase is 0
+ *   period_ps:64               FRT cycle, 0 for a constant level
+ *   toggle_ps[2]:64            output toggles at these phases of the
+ *                              cycle (-1 = none)
+ *   rt:32                      unit * 6 + OCU ch
+ *   level:32                   output level at start_ns
+ */
+
+#include "hw/sysbus.h"
+#include "hw/arm/arm.h"
+#include "qemu/timer.h"
+#include "qemu/bswap.h"
+#include "qemu/error-report.h"
+#include "sysemu/sysemu.h"
+#include "fm3.h"
+
+//#define FM3_DEBUG_MFT
+#define TYPE_FM3_MFT    "fm3.mft"
+
+#ifdef FM3_DEBUG_MFT
+#define DPRINTF(fmt, ...)                                       \
+    do { printf(fmt, ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) do { } while (0)
+#endif
+
+#define FM3_MFT_FRT_NUM             3
+#define FM3_MFT_OCU_NUM             6
+#define FM3_MFT_ICU_NUM             4
+#define FM3_MFT_WFG_NUM             3
+
+/* OCU */
+#define FM3_MFT_REG_OCCP(n)         (0x00 + (n) * 4)
+#define FM3_MFT_REG_OCSA10          (0x18)
+#define FM3_MFT_REG_OCSB10          (0x19)
+#define FM3_MFT_REG_OCSA32          (0x1C)
+#define FM3_MFT_REG_OCSB32          (0x1D)
+#define FM3_MFT_REG_OCSA54          (0x20)
+#define FM3_MFT_REG_OCSB54          (0x21)
+#define FM3_MFT_REG_OCSC            (0x25)
+#define FM3_MFT_REG_OCSA_CST(n)     (1 << (n))
+#define FM3_MFT_REG_OCSA_BDIS(n)    (1 << (2 + (n)))
+#define FM3_MFT_REG_OCSA_IOE(n)     (1 << (4 + (n)))
+#define FM3_MFT_REG_OCSA_IOP(n)     (1 << (6 + (n)))
+#define FM3_MFT_REG_OCSB_OTD(n)     (1 << (n))
+#define FM3_MFT_REG_OCSB_CMOD       (1 << 4)
+#define FM3_MFT_REG_OCSB_BTS(n)     (1 << (5 + (n)))
+#define FM3_MFT_REG_OCFS10          (0x58)
+#define FM3_MFT_REG_OCFS32          (0x59)
+#define FM3_MFT_REG_OCFS54          (0x5C)
+
+/* FRT */
+#define FM3_MFT_REG_TCCP(n)         (0x28 + (n) * 0x10)
+#define FM3_MFT_REG_TCDT(n)         (0x2C + (n) * 0x10)
+#define FM3_MFT_REG_TCSA(n)         (0x30 + (n) * 0x10)
+#define FM3_MFT_REG_TCSB(n)         (0x34 + (n) * 0x10)
+#define FM3_MFT_REG_TCSA_CLK        (0xf)
+#define FM3_MFT_REG_TCSA_SCLR       (1 << 4)
+#define FM3_MFT_REG_TCSA_MODE       (1 << 5)    /* up/down count */
+#define FM3_MFT_REG_TCSA_STOP       (1 << 6)
+#define FM3_MFT_REG_TCSA_BFE        (1 << 7)
+#define FM3_MFT_REG_TCSA_ICRE       (1 << 8)
+#define FM3_MFT_REG_TCSA_ICLR       (1 << 9)
+#define FM3_MFT_REG_TCSA_IRQZE      (1 << 13)
+#define FM3_MFT_REG_TCSA_IRQZF      (1 << 14)
+#define FM3_MFT_REG_TCSA_ECKE       (1 << 15)
+
+/* ICU */
+#define FM3_MFT_REG_ICFS10          (0x60)
+#define FM3_MFT_REG_ICFS32          (0x61)
+#define FM3_MFT_REG_ICCP(n)         (0x68 + (n) * 4)
+#define FM3_MFT_REG_ICSA10          (0x78)
+#define FM3_MFT_REG_ICSB10          (0x79)
+#define FM3_MFT_REG_ICSA32          (0x7C)
+#define FM3_MFT_REG_ICSB32          (0x7D)
+#define FM3_MFT_REG_ICSA_EG(n)      (3 << ((n) * 2))
+#define FM3_MFT_REG_ICSA_ICE(n)     (1 << (4 + (n)))
+#define FM3_MFT_REG_ICSA_ICP(n)     (1 << (6 + (n)))
+
+/* WFG */
+#define FM3_MFT_REG_WFTM(n)         (0x80 + (n) * 4)
+#define FM3_MFT_REG_WFSA(n)         (0x8C + (n) * 4)
+#define FM3_MFT_REG_WFIR            (0x98)
+#define FM3_MFT_REG_NZCL            (0x9C)
+
+#define FM3_MFT_WAVE_MAGIC          "FM3MFTW1"
+#define FM3_MFT_WAVE_RECORD_SIZE    (56)
+
+typedef struct Fm3MftState Fm3MftState;
+
+typedef struct {
+    Fm3MftState *mft;
+    uint32_t ch_no;
+    uint32_t tccp;
+    uint32_t tccp_buf;
+    bool tccp_pending;      /* tccp_buf is transferred at the next zero */
+    uint32_t tcdt;          /* count while stopped */
+    uint32_t tcsa;
+    uint32_t tcsb;
+    bool running;
+    int64_t origin;         /* virtual time of phase 0 of the count */
+    uint32_t freq;
+    int64_t next_event;
+    QEMUTimer *timer;       /* zero/peak: interrupts and buffer transfer */
+} Fm3MftFrt;
+
+typedef struct {
+    Fm3MftState *mft;
+    uint32_t ch_no;
+    uint32_t occp;
+    uint32_t occp_buf;
+    bool occp_pending;      /* occp_buf is transferred at zero or peak */
+    /* output segment: level is seg_level ^ (matches after seg_index) */
+    int32_t seg_level;
+    int64_t seg_start;
+    uint64_t seg_index;
+    int64_t next_event;
+    QEMUTimer *timer;       /* match interrupt */
+} Fm3MftOcu;
+
+struct Fm3MftState {
+    SysBusDevice busdev;
+    MemoryRegion mmio;
+    uint32_t unit;
+    char *wave_path;
+    FILE *wave;
+    Notifier wave_exit;
+    Notifier clk_notifier;
+    Fm3MftFrt frt[FM3_MFT_FRT_NUM];
+    Fm3MftOcu ocu[FM3_MFT_OCU_NUM];
+    uint32_t ocsa[FM3_MFT_OCU_NUM / 2];
+    uint32_t ocsb[FM3_MFT_OCU_NUM / 2];
+    uint32_t ocsc;
+    uint32_t ocfs[FM3_MFT_OCU_NUM / 2];
+    uint32_t iccp[FM3_MFT_ICU_NUM];
+    uint32_t icsa[FM3_MFT_ICU_NUM / 2];
+    uint32_t icsb[FM3_MFT_ICU_NUM / 2];
+    uint32_t icfs[FM3_MFT_ICU_NUM / 2];
+    int32_t icu_in[FM3_MFT_ICU_NUM];
+    uint32_t wftm[FM3_MFT_WFG_NUM];
+    uint32_t wfsa[FM3_MFT_WFG_NUM];
+    uint32_t wfir;
+    uint32_t nzcl;
+    qemu_irq irq_frt;
+    qemu_irq irq_icu;
+    qemu_irq irq_ocu;
+    qemu_irq rt_out[FM3_MFT_OCU_NUM];
+    uint32_t frt_stat;      /* IRQ28MON: peak ch0-2, zero ch0-2 */
+    uint32_t icu_stat;      /* IRQ29MON */
+    uint32_t ocu_stat;      /* IRQ30MON */
+};
+#define FM3_MFT(obj) \
+    OBJECT_CHECK(Fm3MftState, (obj), TYPE_FM3_MFT)
+
+/*
+ * FRT
+ */
+static inline uint64_t fm3_mft_frt_period(Fm3MftFrt *f)
+{
+    if (f->tcsa & FM3_MFT_REG_TCSA_MODE)
+        return f->tccp ? (uint64_t)f->tccp * 2 : 1;
+    return (uint64_t)f->tccp + 1;
+}
+
+static inline uint32_t fm3_mft_frt_count_at(Fm3MftFrt *f, uint64_t index)
+{
+    uint64_t period = fm3_mft_frt_period(f);
+    uint64_t phase = index % period;
+
+    if ((f->tcsa & FM3_MFT_REG_TCSA_MODE) && f->tccp < phase)
+        return period - phase;
+    return phase;
+}
+
+/* virtual time taken by "ticks" counts, rounded up */
+static int64_t fm3_mft_frt_ticks_to_ns(Fm3MftFrt *f, uint64_t ticks)
+{
+    uint64_t ns = muldiv64(ticks, get_ticks_per_sec(), f->freq);
+
+    if (muldiv64(ns, f->freq, get_ticks_per_sec()) < ticks)
+        ns++;
+    return ns;
+}
+
+static inline uint64_t fm3_mft_frt_ticks_to_ps(Fm3MftFrt *f, uint64_t ticks)
+{
+    return muldiv64(ticks * 1000, 1000000000, f->freq);
+}
+
+/* index of the count at time t */
+static uint64_t fm3_mft_frt_index(Fm3MftFrt *f, int64_t t)
+{
+    if (t <= f->origin)
+        return 0;
+    return muldiv64(t - f->origin, f->freq, get_ticks_per_sec());
+}
+
+/* virtual time when the count index is reached */
+static int64_t fm3_mft_frt_time(Fm3MftFrt *f, uint64_t index)
+{
+    return f->origin + fm3_mft_frt_ticks_to_ns(f, index);
+}
+
+static uint32_t fm3_mft_frt_get_count(Fm3MftFrt *f, int64_t now)
+{
+    if (!f->running)
+        return f->tcdt;
+    return fm3_mft_frt_count_at(f, fm3_mft_frt_index(f, now));
+}
+
+/* first index after "index" whose phase is "phase" */
+static uint64_t fm3_mft_next_phase(uint64_t index, uint64_t period,
+                                   uint64_t phase)
+{
+    uint64_t base = index - index % period;
+
+    if (base + phase <= index)
+        base += period;
+    return base + phase;
+}
+
+static uint32_t fm3_mft_get_freq(Fm3MftFrt *f)
+{
+    uint32_t clk = f->tcsa & FM3_MFT_REG_TCSA_CLK;
+
+    if (f->tcsa & FM3_MFT_REG_TCSA_ECKE) {
+        printf("FM3_MFT: FRT%d external clock is not supported\n", f->ch_no);
+        return 0;
+    }
+    if (8 < clk) {
+        printf("FM3_MFT: FRT%d invalid clock (CLK=%d)\n", f->ch_no, clk);
+        return 0;
+    }
+    return fm3_clk_get_hz(FM3_CLK_PCLK1) >> clk;
+}
+
+/*
+ * OCU
+ */
+static inline uint32_t fm3_mft_ocsa(Fm3MftOcu *o)
+{
+    return o->mft->ocsa[o->ch_no / 2];
+}
+
+static inline uint32_t fm3_mft_ocsb(Fm3MftOcu *o)
+{
+    return o->mft->ocsb[o->ch_no / 2];
+}
+
+static Fm3MftFrt *fm3_mft_ocu_get_frt(Fm3MftOcu *o)
+{
+    uint32_t fso = (o->mft->ocfs[o->ch_no / 2] >> ((o->ch_no & 1) * 4)) & 0xf;
+
+    if (FM3_MFT_FRT_NUM <= fso)
+        return NULL;    /* FRT of the other unit: not supported */
+    return &o->mft->frt[fso];
+}
+
+/* the OCU output toggles on its matches: CST set and its FRT running */
+static Fm3MftFrt *fm3_mft_ocu_active(Fm3MftOcu *o)
+{
+    Fm3MftFrt *f = fm3_mft_ocu_get_frt(o);
+
+    if (!f || !f->running || !f->freq)
+        return NULL;
+    if (!(fm3_mft_ocsa(o) & FM3_MFT_REG_OCSA_CST(o->ch_no & 1)))
+        return NULL;
+    return f;
+}
+
+/* phases of the FRT cycle where the count matches OCCP (-1: none) */
+static void fm3_mft_ocu_phases(Fm3MftOcu *o, Fm3MftFrt *f, int64_t ph[2])
+{
+    uint64_t period = fm3_mft_frt_period(f);
+
+    ph[0] = ph[1] = -1;
+    if (f->tccp < o->occp)
+        return;
+    ph[0] = o->occp;
+    if ((f->tcsa & FM3_MFT_REG_TCSA_MODE) && o->occp != 0 &&
+        o->occp != f->tccp) {
+        ph[1] = period - o->occp;
+    }
+}
+
+/* number of matches in the count indexes [0, index) */
+static uint64_t fm3_mft_ocu_matches(Fm3MftOcu *o, Fm3MftFrt *f,
+                                    uint64_t index)
+{
+    uint64_t period = fm3_mft_frt_period(f);
+    uint64_t n = 0;
+    int64_t ph[2];
+    int i;
+
+    fm3_mft_ocu_phases(o, f, ph);
+    for (i = 0; i < 2; i++) {
+        if (ph[i] < 0 || index <= ph[i])
+            continue;
+        n += (index - ph[i] - 1) / period + 1;
+    }
+    return n;
+}
+
+static int fm3_mft_ocu_get_level(Fm3MftOcu *o, int64_t now)
+{
+    Fm3MftFrt *f = fm3_mft_ocu_active(o);
+    uint64_t index, n;
+
+    if (!f)
+        return o->seg_level;
+
+    index = fm3_mft_frt_index(f, now) + 1;
+    if (index <= o->seg_index)
+        return o->seg_level;
+    n = fm3_mft_ocu_matches(o, f, index) -
+        fm3_mft_ocu_matches(o, f, o->seg_index);
+    return o->seg_level ^ (n & 1);
+}
+
+static void fm3_mft_wave_put(Fm3MftOcu *o, int64_t end)
+{
+    Fm3MftState *s = o->mft;
+    Fm3MftFrt *f = fm3_mft_ocu_active(o);
+    uint8_t rec[FM3_MFT_WAVE_RECORD_SIZE];
+    uint64_t period_ps = 0;
+    int64_t ph[2] = { -1, -1 };
+    int i;
+
+    if (!s->wave || end <= o->seg_start)
+        return;
+
+    if (f) {
+        fm3_mft_ocu_phases(o, f, ph);
+        period_ps = fm3_mft_frt_ticks_to_ps(f, fm3_mft_frt_period(f));
+        for (i = 0; i < 2; i++) {
+            if (0 <= ph[i])
+                ph[i] = fm3_mft_frt_ticks_to_ps(f, ph[i]);
+        }
+    }
+
+    stq_le_p(&rec[0], o->seg_start);
+    stq_le_p(&rec[8], end);
+    stq_le_p(&rec[16], f ? f->origin : 0);
+    stq_le_p(&rec[24], period_ps);
+    stq_le_p(&rec[32], ph[0]);
+    stq_le_p(&rec[40], ph[1]);
+    stl_le_p(&rec[48], s->unit * FM3_MFT_OCU_NUM + o->ch_no);
+    stl_le_p(&rec[52], o->seg_level);
+    if (fwrite(rec, sizeof(rec), 1, s->wave) != 1) {
+        error_report("fm3 mft: failed to write the waveform");
+        fclose(s->wave);
+        s->wave = NULL;
+    }
+}
+
+/* close the current output segment at "now" */
+static void fm3_mft_ocu_freeze(Fm3MftOcu *o, int64_t now)
+{
+    int level = fm3_mft_ocu_get_level(o, now);
+
+    fm3_mft_wave_put(o, now);
+    o->seg_level = level;
+    o->seg_start = now;
+}
+
+static void fm3_mft_ocu_schedule(Fm3MftOcu *o, int64_t now);
+
+/* open a new output segment at "now" with the current parameters */
+static void fm3_mft_ocu_resume(Fm3MftOcu *o, int64_t now)
+{
+    Fm3MftFrt *f = fm3_mft_ocu_active(o);
+
+    o->seg_start = now;
+    if (f)
+        o->seg_index = fm3_mft_frt_index(f, now) + 1;
+    qemu_set_irq(o->mft->rt_out[o->ch_no], o->seg_level);
+    fm3_mft_ocu_schedule(o, now);
+}
+
+static void fm3_mft_ocu_schedule(Fm3MftOcu *o, int64_t now)
+{
+    Fm3MftFrt *f = fm3_mft_ocu_active(o);
+    uint64_t index, next = UINT64_MAX;
+    int64_t ph[2];
+    int i;
+
+    timer_del(o->timer);
+    if (!f)
+        return;
+    if (!(fm3_mft_ocsa(o) & FM3_MFT_REG_OCSA_IOE(o->ch_no & 1)) &&
+        !o->mft->rt_out[o->ch_no])
+        return;
+
+    /* the match interrupt and the RT line are the only per-match events */
+    index = fm3_mft_frt_index(f, now);
+    fm3_mft_ocu_phases(o, f, ph);
+    for (i = 0; i < 2; i++) {
+        if (0 <= ph[i])
+            next = MIN(next, fm3_mft_next_phase(index,
+                                                fm3_mft_frt_period(f), ph[i]));
+    }
+    if (next == UINT64_MAX)
+        return;
+
+    o->next_event = fm3_mft_frt_time(f, next);
+    timer_mod(o->timer, o->next_event);
+}
+
+static void fm3_mft_update_irq(Fm3MftState *s)
+{
+    uint32_t frt = 0, icu = 0, ocu = 0;
+    uint32_t reg;
+    int i;
+
+    for (i = 0; i < FM3_MFT_FRT_NUM; i++) {
+        reg = s->frt[i].tcsa;
+        if ((reg & FM3_MFT_REG_TCSA_ICRE) && (reg & FM3_MFT_REG_TCSA_ICLR))
+            frt |= 1 << i;
+        if ((reg & FM3_MFT_REG_TCSA_IRQZE) && (reg & FM3_MFT_REG_TCSA_IRQZF))
+            frt |= 1 << (i + 3);
+    }
+    for (i = 0; i < FM3_MFT_ICU_NUM; i++) {
+        reg = s->icsa[i / 2];
+        if ((reg & FM3_MFT_REG_ICSA_ICE(i & 1)) &&
+            (reg & FM3_MFT_REG_ICSA_ICP(i & 1)))
+            icu |= 1 << i;
+    }
+    for (i = 0; i < FM3_MFT_OCU_NUM; i++) {
+        reg = s->ocsa[i / 2];
+        if ((reg & FM3_MFT_REG_OCSA_IOE(i & 1)) &&
+            (reg & FM3_MFT_REG_OCSA_IOP(i & 1)))
+            ocu |= 1 << i;
+    }
+
+    if (frt != s->frt_stat) {
+        s->frt_stat = frt;
+        fm3_int_set_mon(FM3_IRQ_MFT_FRT, 0x3f << (s->unit * 6),
+                        frt << (s->unit * 6));
+        qemu_set_irq(s->irq_frt, frt != 0);
+    }
+    if (icu != s->icu_stat) {
+        s->icu_stat = icu;
+        fm3_int_set_mon(FM3_IRQ_MFT_ICU, 0xf << (s->unit * 4),
+                        icu << (s->unit * 4));
+        qemu_set_irq(s->irq_icu, icu != 0);
+    }
+    if (ocu != s->ocu_stat) {
+        s->ocu_stat = ocu;
+        fm3_int_set_mon(FM3_IRQ_MFT_OCU, 0x3f << (s->unit * 6),
+                        ocu << (s->unit * 6));
+        qemu_set_irq(s->irq_ocu, ocu != 0);
+    }
+}
+
+static void fm3_mft_ocu_timer_cb(void *opaque)
+{
+    Fm3MftOcu *o = opaque;
+
+    qemu_set_irq(o->mft->rt_out[o->ch_no],
+                 fm3_mft_ocu_get_level(o, o->next_event));
+    if (fm3_mft_ocsa(o) & FM3_MFT_REG_OCSA_IOE(o->ch_no & 1)) {
+        o->mft->ocsa[o->ch_no / 2] |= FM3_MFT_REG_OCSA_IOP(o->ch_no & 1);
+        fm3_mft_update_irq(o->mft);
+    }
+    fm3_mft_ocu_schedule(o, o->next_event);
+}
+
+/* freeze/resume every OCU counting on the FRT around a change of it */
+static void fm3_mft_frt_freeze(Fm3MftFrt *f, int64_t now)
+{
+    int i;
+
+    for (i = 0; i < FM3_MFT_OCU_NUM; i++) {
+        if (fm3_mft_ocu_get_frt(&f->mft->ocu[i]) == f)
+            fm3_mft_ocu_freeze(&f->mft->ocu[i], now);
+    }
+}
+
+static void fm3_mft_frt_schedule(Fm3MftFrt *f, int64_t now);
+
+static void fm3_mft_frt_resume(Fm3MftFrt *f, int64_t now)
+{
+    int i;
+
+    for (i = 0; i < FM3_MFT_OCU_NUM; i++) {
+        if (fm3_mft_ocu_get_frt(&f->mft->ocu[i]) == f)
+            fm3_mft_ocu_resume(&f->mft->ocu[i], now);
+    }
+    fm3_mft_frt_schedule(f, now);
+}
+
+/* does an OCU on this FRT wait for a buffer transfer at zero/peak */
+static bool fm3_mft_frt_buffer_pending(Fm3MftFrt *f, bool peak)
+{
+    Fm3MftOcu *o;
+    bool bts;
+    int i;
+
+    for (i = 0; i < FM3_MFT_OCU_NUM; i++) {
+        o = &f->mft->ocu[i];
+        if (!o->occp_pending || fm3_mft_ocu_get_frt(o) != f)
+            continue;
+        bts = !!(fm3_mft_ocsb(o) & FM3_MFT_REG_OCSB_BTS(i & 1));
+        if (bts == peak)
+            return true;
+    }
+    return false;
+}
+
+static void fm3_mft_frt_schedule(Fm3MftFrt *f, int64_t now)
+{
+    uint64_t index, period, next = UINT64_MAX;
+
+    timer_del(f->timer);
+    if (!f->running || !f->freq)
+        return;
+
+    index = fm3_mft_frt_index(f, now);
+    period = fm3_mft_frt_period(f);
+    if ((f->tcsa & FM3_MFT_REG_TCSA_IRQZE) || f->tccp_pending ||
+        fm3_mft_frt_buffer_pending(f, false)) {
+        next = fm3_mft_next_phase(index, period, 0);
+    }
+    if ((f->tcsa & FM3_MFT_REG_TCSA_ICRE) ||
+        fm3_mft_frt_buffer_pending(f, true)) {
+        next = MIN(next, fm3_mft_next_phase(index, period,
+                                            MIN(f->tccp, period - 1)));
+    }
+    if (next == UINT64_MAX)
+        return;
+
+    f->next_event = fm3_mft_frt_time(f, next);
+    timer_mod(f->timer, f->next_event);
+}
+
+/* restart the count origin so that the count at "now" is kept */
+static void fm3_mft_frt_rebase(Fm3MftFrt *f, int64_t now, uint32_t count,
+                               bool down)
+{
+    uint64_t phase = count;
+
+    if (down)
+        phase = fm3_mft_frt_period(f) - count;
+    f->origin = now - fm3_mft_frt_ticks_to_ns(f, phase);
+}
+
+static void fm3_mft_frt_timer_cb(void *opaque)
+{
+    Fm3MftFrt *f = opaque;
+    int64_t now = f->next_event;
+    uint32_t count = fm3_mft_frt_get_count(f, now);
+    bool zero = (count == 0);
+    bool peak = (count == f->tccp);
+    bool rebased = false;
+    Fm3MftOcu *o;
+    bool bts;
+    int i;
+
+    if (zero)
+        f->tcsa |= FM3_MFT_REG_TCSA_IRQZF;
+    if (peak)
+        f->tcsa |= FM3_MFT_REG_TCSA_ICLR;
+
+    /*
+     * Buffer transfer: only the OCUs whose cycle actually changes start a
+     * new run, an unchanged value leaves the current one open.
+     */
+    if (zero && f->tccp_pending) {
+        f->tccp_pending = false;
+        if (f->tccp_buf != f->tccp) {
+            fm3_mft_frt_freeze(f, now);
+            f->tccp = f->tccp_buf;
+            fm3_mft_frt_rebase(f, now, 0, false);
+            rebased = true;
+        }
+    }
+    for (i = 0; i < FM3_MFT_OCU_NUM; i++) {
+        o = &f->mft->ocu[i];
+        if (!o->occp_pending || fm3_mft_ocu_get_frt(o) != f)
+            continue;
+        bts = !!(fm3_mft_ocsb(o) & FM3_MFT_REG_OCSB_BTS(i & 1));
+        if (!((bts && peak) || (!bts && zero)))
+            continue;
+        o->occp_pending = false;
+        if (o->occp_buf == o->occp)
+            continue;
+        if (rebased) {
+            o->occp = o->occp_buf;
+        } else {
+            fm3_mft_ocu_freeze(o, now);
+            o->occp = o->occp_buf;
+            fm3_mft_ocu_resume(o, now);
+        }
+    }
+    if (rebased)
+        fm3_mft_frt_resume(f, now);
+    else
+        fm3_mft_frt_schedule(f, now);
+    fm3_mft_update_irq(f->mft);
+}
+
+static void fm3_mft_frt_write_tcsa(Fm3MftFrt *f, uint32_t value, int64_t now)
+{
+    uint32_t old = f->tcsa;
+    uint32_t count = fm3_mft_frt_get_count(f, now);
+    bool down = false;
+    uint64_t index;
+
+    if (f->running && (old & FM3_MFT_REG_TCSA_MODE)) {
+        index = fm3_mft_frt_index(f, now) % fm3_mft_frt_period(f);
+        down = (f->tccp < index);
+    }
+
+    fm3_mft_frt_freeze(f, now);
+
+    /* ICLR/IRQZF are cleared by writing 0 */
+    f->tcsa = (value & ~(FM3_MFT_REG_TCSA_ICLR | FM3_MFT_REG_TCSA_IRQZF |
+                         FM3_MFT_REG_TCSA_SCLR)) |
+              (old & value & (FM3_MFT_REG_TCSA_ICLR |
+                              FM3_MFT_REG_TCSA_IRQZF));
+    if (value & FM3_MFT_REG_TCSA_SCLR) {
+        count = 0;
+        down = false;
+    }
+    if ((old ^ f->tcsa) & FM3_MFT_REG_TCSA_MODE)
+        down = false;
+
+    f->running = !(f->tcsa & FM3_MFT_REG_TCSA_STOP);
+    if (f->running) {
+        f->freq = fm3_mft_get_freq(f);
+        if (f->freq)
+            fm3_mft_frt_rebase(f, now, count, down);
+        else
+            f->running = false;
+    }
+    if (!f->running)
+        f->tcdt = count;
+
+    fm3_mft_frt_resume(f, now);
+    fm3_mft_update_irq(f->mft);
+}
+
+/* PCLK1 has changed: each running FRT goes on from its current count */
+static void fm3_mft_clk_changed(Notifier *n, void *data)
+{
+    Fm3MftState *s = container_of(n, Fm3MftState, clk_notifier);
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    Fm3MftFrt *f;
+    uint32_t count, freq;
+    bool down;
+    int i;
+
+    for (i = 0; i < FM3_MFT_FRT_NUM; i++) {
+        f = &s->frt[i];
+        if (!f->running)
+            continue;
+        freq = fm3_mft_get_freq(f);
+        if (!freq)
+            continue;
+        count = fm3_mft_frt_get_count(f, now);
+        down = (f->tcsa & FM3_MFT_REG_TCSA_MODE) &&
+               f->tccp < fm3_mft_frt_index(f, now) % fm3_mft_frt_period(f);
+        fm3_mft_frt_freeze(f, now);
+        f->freq = freq;
+        fm3_mft_frt_rebase(f, now, count, down);
+        fm3_mft_frt_resume(f, now);
+    }
+}
+
+static void fm3_mft_frt_write_tccp(Fm3MftFrt *f, uint32_t value, int64_t now)
+{
+    uint32_t count;
+
+    value &= 0xffff;
+    if (f->running && (f->tcsa & FM3_MFT_REG_TCSA_BFE)) {
+        f->tccp_buf = value;
+        f->tccp_pending = true;
+        fm3_mft_frt_schedule(f, now);
+        return;
+    }
+
+    count = fm3_mft_frt_get_count(f, now);
+    fm3_mft_frt_freeze(f, now);
+    f->tccp = value;
+    if (f->running)
+        fm3_mft_frt_rebase(f, now, MIN(count, value), false);
+    fm3_mft_frt_resume(f, now);
+}
+
+static void fm3_mft_frt_write_tcdt(Fm3MftFrt *f, uint32_t value, int64_t now)
+{
+    /* the count can only be written while the FRT is stopped */
+    if (f->running)
+        return;
+    f->tcdt = value & 0xffff;
+}
+
+/*
+ * OCU registers
+ */
+static void fm3_mft_ocu_write_occp(Fm3MftOcu *o, uint32_t value, int64_t now)
+{
+    value &= 0xffff;
+    if (fm3_mft_ocu_active(o) &&
+        !(fm3_mft_ocsa(o) & FM3_MFT_REG_OCSA_BDIS(o->ch_no & 1))) {
+        o->occp_buf = value;
+        o->occp_pending = true;
+        fm3_mft_frt_schedule(fm3_mft_ocu_get_frt(o), now);
+        return;
+    }
+
+    fm3_mft_ocu_freeze(o, now);
+    o->occp = value;
+    fm3_mft_ocu_resume(o, now);
+}
+
+/* a change of a pair register: re-segment both channels around it */
+static void fm3_mft_ocu_pair_freeze(Fm3MftState *s, int pair, int64_t now)
+{
+    fm3_mft_ocu_freeze(&s->ocu[pair * 2], now);
+    fm3_mft_ocu_freeze(&s->ocu[pair * 2 + 1], now);
+}
+
+static void fm3_mft_ocu_pair_resume(Fm3MftState *s, int pair, int64_t now)
+{
+    fm3_mft_ocu_resume(&s->ocu[pair * 2], now);
+    fm3_mft_ocu_resume(&s->ocu[pair * 2 + 1], now);
+}
+
+static void fm3_mft_write_ocsa(Fm3MftState *s, int pair, uint32_t value,
+                               int64_t now)
+{
+    uint32_t iop = FM3_MFT_REG_OCSA_IOP(0) | FM3_MFT_REG_OCSA_IOP(1);
+    uint32_t old = s->ocsa[pair];
+
+    fm3_mft_ocu_pair_freeze(s, pair, now);
+    s->ocsa[pair] = (value & ~iop & 0xff) | (old & value & iop);
+    fm3_mft_ocu_pair_resume(s, pair, now);
+    fm3_mft_update_irq(s);
+}
+
+static uint32_t fm3_mft_read_ocsb(Fm3MftState *s, int pair, int64_t now)
+{
+    uint32_t value = s->ocsb[pair] & ~(FM3_MFT_REG_OCSB_OTD(0) |
+                                       FM3_MFT_REG_OCSB_OTD(1));
+
+    value |= fm3_mft_ocu_get_level(&s->ocu[pair * 2], now);
+    value |= fm3_mft_ocu_get_level(&s->ocu[pair * 2 + 1], now) << 1;
+    return value;
+}
+
+static void fm3_mft_write_ocsb(Fm3MftState *s, int pair, uint32_t value,
+                               int64_t now)
+{
+    Fm3MftOcu *o;
+    int i;
+
+    if (value & FM3_MFT_REG_OCSB_CMOD)
+        printf("FM3_MFT: OCSB CMOD=1 is not supported\n");
+
+    fm3_mft_ocu_pair_freeze(s, pair, now);
+    for (i = 0; i < 2; i++) {
+        /* OTD sets the output level while the channel is stopped */
+        o = &s->ocu[pair * 2 + i];
+        if (!fm3_mft_ocu_active(o))
+            o->seg_level = (value >> i) & 1;
+    }
+    s->ocsb[pair] = value & 0xff;
+    fm3_mft_ocu_pair_resume(s, pair, now);
+}
+
+static void fm3_mft_write_ocfs(Fm3MftState *s, int pair, uint32_t value,
+                               int64_t now)
+{
+    fm3_mft_ocu_pair_freeze(s, pair, now);
+    s->ocfs[pair] = value & 0xff;
+    fm3_mft_ocu_pair_resume(s, pair, now);
+}
+
+/*
+ * ICU
+ */
+static void fm3_mft_icu_set_input(void *opaque, int n, int level)
+{
+    Fm3MftState *s = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    uint32_t eg = (s->icsa[n / 2] >> ((n & 1) * 2)) & 3;
+    uint32_t fsi = (s->icfs[n / 2] >> ((n & 1) * 4)) & 0xf;
+    bool rising;
+
+    level = (level != 0);
+    if (s->icu_in[n] == level)
+        return;
+    s->icu_in[n] = level;
+    rising = level;
+
+    /* EG: 0 disabled, 1 rising, 2 falling, 3 both edges */
+    if (!(eg & (rising ? 1 : 2)) || FM3_MFT_FRT_NUM <= fsi)
+        return;
+
+    s->iccp[n] = fm3_mft_frt_get_count(&s->frt[fsi], now);
+    s->icsa[n / 2] |= FM3_MFT_REG_ICSA_ICP(n & 1);
+    if (rising)
+        s->icsb[n / 2] |= 1 << (n & 1);
+    else
+        s->icsb[n / 2] &= ~(1 << (n & 1));
+    fm3_mft_update_irq(s);
+}
+
+/*
+ * register access
+ */
+static uint64_t fm3_mft_read(void *opaque, hwaddr offset,
+                             unsigned size)
+{
+    Fm3MftState *s = (Fm3MftState *)opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    uint64_t retval = 0;
+    int n;
+
+    switch (offset) {
+    case FM3_MFT_REG_OCCP(0) ... FM3_MFT_REG_OCCP(5):
+        if (offset & 3)
+            break;
+        retval = s->ocu[offset / 4].occp;
+        break;
+    case FM3_MFT_REG_OCSA10:
+    case FM3_MFT_REG_OCSA32:
+    case FM3_MFT_REG_OCSA54:
+        n = (offset - FM3_MFT_REG_OCSA10) / 4;
+        retval = s->ocsa[n];
+        if (1 < size)
+            retval |= fm3_mft_read_ocsb(s, n, now) << 8;
+        break;
+    case FM3_MFT_REG_OCSB10:
+    case FM3_MFT_REG_OCSB32:
+    case FM3_MFT_REG_OCSB54:
+        retval = fm3_mft_read_ocsb(s, (offset - FM3_MFT_REG_OCSB10) / 4, now);
+        break;
+    case FM3_MFT_REG_OCSC:
+        retval = s->ocsc;
+        break;
+    case FM3_MFT_REG_TCCP(0) ... FM3_MFT_REG_TCSB(2):
+        n = (offset - FM3_MFT_REG_TCCP(0)) / 0x10;
+        switch ((offset - FM3_MFT_REG_TCCP(0)) & 0xf) {
+        case 0x0:
+            retval = s->frt[n].tccp_pending ? s->frt[n].tccp_buf :
+                                              s->frt[n].tccp;
+            break;
+        case 0x4:
+            retval = fm3_mft_frt_get_count(&s->frt[n], now);
+            break;
+        case 0x8:
+            retval = s->frt[n].tcsa;
+            break;
+        case 0xC:
+            retval = s->frt[n].tcsb;
+            break;
+        }
+        break;
+    case FM3_MFT_REG_OCFS10:
+        retval = s->ocfs[0];
+        if (1 < size)
+            retval |= s->ocfs[1] << 8;
+        break;
+    case FM3_MFT_REG_OCFS32:
+        retval = s->ocfs[1];
+        break;
+    case FM3_MFT_REG_OCFS54:
+        retval = s->ocfs[2];
+        break;
+    case FM3_MFT_REG_ICFS10:
+        retval = s->icfs[0];
+        if (1 < size)
+            retval |= s->icfs[1] << 8;
+        break;
+    case FM3_MFT_REG_ICFS32:
+        retval = s->icfs[1];
+        break;
+    case FM3_MFT_REG_ICCP(0) ... FM3_MFT_REG_ICCP(3):
+        if (offset & 3)
+            break;
+        retval = s->iccp[(offset - FM3_MFT_REG_ICCP(0)) / 4];
+        break;
+    case FM3_MFT_REG_ICSA10:
+    case FM3_MFT_REG_ICSA32:
+        n = (offset - FM3_MFT_REG_ICSA10) / 4;
+        retval = s->icsa[n];
+        if (1 < size)
+            retval |= s->icsb[n] << 8;
+        break;
+    case FM3_MFT_REG_ICSB10:
+    case FM3_MFT_REG_ICSB32:
+        retval = s->icsb[(offset - FM3_MFT_REG_ICSB10) / 4];
+        break;
+    case FM3_MFT_REG_WFTM(0):
+    case FM3_MFT_REG_WFTM(1):
+    case FM3_MFT_REG_WFTM(2):
+        retval = s->wftm[(offset - FM3_MFT_REG_WFTM(0)) / 4];
+        break;
+    case FM3_MFT_REG_WFSA(0):
+    case FM3_MFT_REG_WFSA(1):
+    case FM3_MFT_REG_WFSA(2):
+        retval = s->wfsa[(offset - FM3_MFT_REG_WFSA(0)) / 4];
+        break;
+    case FM3_MFT_REG_WFIR:
+        retval = s->wfir;
+        break;
+    case FM3_MFT_REG_NZCL:
+        retval = s->nzcl;
+        break;
+    default:
+        break;
+    }
+
+    DPRINTF("%s : 0x%08x ---> 0x%08x\n", __func__, (uint32_t)offset,
+            (uint32_t)retval);
+    return retval;
+}
+
+static void fm3_mft_write(void *opaque, hwaddr offset,
+                          uint64_t value, unsigned size)
+{
+    Fm3MftState *s = (Fm3MftState *)opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    int n;
+
+    DPRINTF("%s: 0x%08x <--- 0x%08x\n", __func__, (uint32_t)offset,
+            (uint32_t)value);
+
+    switch (offset) {
+    case FM3_MFT_REG_OCCP(0) ... FM3_MFT_REG_OCCP(5):
+        if (offset & 3)
+            break;
+        fm3_mft_ocu_write_occp(&s->ocu[offset / 4], value, now);
+        break;
+    case FM3_MFT_REG_OCSA10:
+    case FM3_MFT_REG_OCSA32:
+    case FM3_MFT_REG_OCSA54:
+        n = (offset - FM3_MFT_REG_OCSA10) / 4;
+        fm3_mft_write_ocsa(s, n, value, now);
+        if (1 < size)
+            fm3_mft_write_ocsb(s, n, value >> 8, now);
+        break;
+    case FM3_MFT_REG_OCSB10:
+    case FM3_MFT_REG_OCSB32:
+    case FM3_MFT_REG_OCSB54:
+        fm3_mft_write_ocsb(s, (offset - FM3_MFT_REG_OCSB10) / 4, value, now);
+        break;
+    case FM3_MFT_REG_OCSC:
+        s->ocsc = value & 0xff;
+        break;
+    case FM3_MFT_REG_TCCP(0) ... FM3_MFT_REG_TCSB(2):
+        n = (offset - FM3_MFT_REG_TCCP(0)) / 0x10;
+        switch ((offset - FM3_MFT_REG_TCCP(0)) & 0xf) {
+        case 0x0:
+            fm3_mft_frt_write_tccp(&s->frt[n], value, now);
+            break;
+        case 0x4:
+            fm3_mft_frt_write_tcdt(&s->frt[n], value, now);
+            break;
+        case 0x8:
+            fm3_mft_frt_write_tcsa(&s->frt[n], value & 0xffff, now);
+            break;
+        case 0xC:
+            s->frt[n].tcsb = value & 0xffff;
+            break;
+        }
+        break;
+    case FM3_MFT_REG_OCFS10:
+        fm3_mft_write_ocfs(s, 0, value, now);
+        if (1 < size)
+            fm3_mft_write_ocfs(s, 1, value >> 8, now);
+        break;
+    case FM3_MFT_REG_OCFS32:
+        fm3_mft_write_ocfs(s, 1, value, now);
+        break;
+    case FM3_MFT_REG_OCFS54:
+        fm3_mft_write_ocfs(s, 2, value, now);
+        break;
+    case FM3_MFT_REG_ICFS10:
+        s->icfs[0] = value & 0xff;
+        if (1 < size)
+            s->icfs[1] = (value >> 8) & 0xff;
+        break;
+    case FM3_MFT_REG_ICFS32:
+        s->icfs[1] = value & 0xff;
+        break;
+    case FM3_MFT_REG_ICSA10:
+    case FM3_MFT_REG_ICSA32:
+        n = (offset - FM3_MFT_REG_ICSA10) / 4;
+        /* ICP is cleared by writing 0 */
+        s->icsa[n] = (value & 0x3f) |
+                     (s->icsa[n] & value & (FM3_MFT_REG_ICSA_ICP(0) |
+                                            FM3_MFT_REG_ICSA_ICP(1)));
+        fm3_mft_update_irq(s);
+        break;
+    case FM3_MFT_REG_ICSB10:
+    case FM3_MFT_REG_ICSB32:
+        /* read only */
+        break;
+    case FM3_MFT_REG_WFTM(0):
+    case FM3_MFT_REG_WFTM(1):
+    case FM3_MFT_REG_WFTM(2):
+        s->wftm[(offset - FM3_MFT_REG_WFTM(0)) / 4] = value & 0xffff;
+        break;
+    case FM3_MFT_REG_WFSA(0):
+    case FM3_MFT_REG_WFSA(1):
+    case FM3_MFT_REG_WFSA(2):
+        if (value & 0x7)
+            printf("FM3_MFT: WFG modes other than through are not supported\n");
+        s->wfsa[(offset - FM3_MFT_REG_WFSA(0)) / 4] = value & 0xffff;
+        break;
+    case FM3_MFT_REG_WFIR:
+        s->wfir = value & 0xffff;
+        break;
+    case FM3_MFT_REG_NZCL:
+        s->nzcl = value & 0xffff;
+        break;
+    default:
+        break;
+    }
+}
+
+static const MemoryRegionOps fm3_mft_mem_ops = {
+    .read = fm3_mft_read,
+    .write = fm3_mft_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+};
+
+static void fm3_mft_reset(DeviceState *d)
+{
+    Fm3MftState *s = FM3_MFT(d);
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    Fm3MftFrt *f;
+    Fm3MftOcu *o;
+    int i;
+
+    for (i = 0; i < FM3_MFT_OCU_NUM; i++) {
+        o = &s->ocu[i];
+        fm3_mft_ocu_freeze(o, now);
+        timer_del(o->timer);
+        o->occp = 0;
+        o->occp_pending = false;
+        o->seg_level = 0;
+    }
+    for (i = 0; i < FM3_MFT_FRT_NUM; i++) {
+        f = &s->frt[i];
+        timer_del(f->timer);
+        f->tccp = 0xffff;
+        f->tccp_pending = false;
+        f->tcdt = 0;
+        f->tcsa = FM3_MFT_REG_TCSA_STOP;
+        f->tcsb = 0;
+        f->running = false;
+    }
+    memset(s->ocsa, 0, sizeof(s->ocsa));
+    memset(s->ocsb, 0, sizeof(s->ocsb));
+    memset(s->ocfs, 0, sizeof(s->ocfs));
+    memset(s->iccp, 0, sizeof(s->iccp));
+    memset(s->icsa, 0, sizeof(s->icsa));
+    memset(s->icsb, 0, sizeof(s->icsb));
+    memset(s->icfs, 0, sizeof(s->icfs));
+    memset(s->wftm, 0, sizeof(s->wftm));
+    memset(s->wfsa, 0, sizeof(s->wfsa));
+    s->ocsc = 0;
+    s->wfir = 0;
+    s->nzcl = 0;
+    for (i = 0; i < FM3_MFT_OCU_NUM; i++)
+        fm3_mft_ocu_resume(&s->ocu[i], now);
+    fm3_mft_update_irq(s);
+}
+
+/* flush the open runs when QEMU exits */
+static void fm3_mft_wave_close(Notifier *n, void *data)
+{
+    Fm3MftState *s = container_of(n, Fm3MftState, wave_exit);
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    int i;
+
+    for (i = 0; i < FM3_MFT_OCU_NUM; i++)
+        fm3_mft_ocu_freeze(&s->ocu[i], now);
+    if (s->wave) {
+        fclose(s->wave);
+        s->wave = NULL;
+    }
+}
+
+static int fm3_mft_init(SysBusDevice *dev)
+{
+    DeviceState *devs = DEVICE(dev);
+    Fm3MftState *s = FM3_MFT(devs);
+    int i;
+
+    for (i = 0; i < FM3_MFT_FRT_NUM; i++) {
+        s->frt[i].mft = s;
+        s->frt[i].ch_no = i;
+        s->frt[i].timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                       fm3_mft_frt_timer_cb, &s->frt[i]);
+    }
+    for (i = 0; i < FM3_MFT_OCU_NUM; i++) {
+        s->ocu[i].mft = s;
+        s->ocu[i].ch_no = i;
+        s->ocu[i].timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                       fm3_mft_ocu_timer_cb, &s->ocu[i]);
+    }
+    qdev_init_gpio_in(devs, fm3_mft_icu_set_input, FM3_MFT_ICU_NUM);
+    qdev_init_gpio_out(devs, s->rt_out, FM3_MFT_OCU_NUM);
+    sysbus_init_irq(dev, &s->irq_frt);
+    sysbus_init_irq(dev, &s->irq_icu);
+    sysbus_init_irq(dev, &s->irq_ocu);
+    s->clk_notifier.notify = fm3_mft_clk_changed;
+    fm3_clk_add_notifier(FM3_CLK_PCLK1, &s->clk_notifier);
+
+    memory_region_init_io(&s->mmio, OBJECT(s), &fm3_mft_mem_ops, s,
+                          TYPE_FM3_MFT, 0x1000);
+    sysbus_init_mmio(dev, &s->mmio);
+
+    if (s->wave_path) {
+        s->wave = fopen(s->wave_path, "wb");
+        if (!s->wave) {
+            error_report("fm3 mft: cannot create %s: %s", s->wave_path,
+                         strerror(errno));
+            return -1;
+        }
+        fwrite(FM3_MFT_WAVE_MAGIC, 8, 1, s->wave);
+        s->wave_exit.notify = fm3_mft_wave_close;
+        qemu_add_exit_notifier(&s->wave_exit);
+    }
+    return 0;
+}
+
+static const VMStateDescription vmstate_fm3_mft_frt = {
+    .name = "fm3.mft/frt",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(tccp, Fm3MftFrt),
+        VMSTATE_UINT32(tccp_buf, Fm3MftFrt),
+        VMSTATE_BOOL(tccp_pending, Fm3MftFrt),
+        VMSTATE_UINT32(tcdt, Fm3MftFrt),
+        VMSTATE_UINT32(tcsa, Fm3MftFrt),
+        VMSTATE_UINT32(tcsb, Fm3MftFrt),
+        VMSTATE_BOOL(running, Fm3MftFrt),
+        VMSTATE_INT64(origin, Fm3MftFrt),
+        VMSTATE_UINT32(freq, Fm3MftFrt),
+        VMSTATE_INT64(next_event, Fm3MftFrt),
+        VMSTATE_TIMER(timer, Fm3MftFrt),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_fm3_mft_ocu = {
+    .name = "fm3.mft/ocu",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(occp, Fm3MftOcu),
+        VMSTATE_UINT32(occp_buf, Fm3MftOcu),
+        VMSTATE_BOOL(occp_pending, Fm3MftOcu),
+        VMSTATE_INT32(seg_level, Fm3MftOcu),
+        VMSTATE_INT64(seg_start, Fm3MftOcu),
+        VMSTATE_UINT64(seg_index, Fm3MftOcu),
+        VMSTATE_INT64(next_event, Fm3MftOcu),
+        VMSTATE_TIMER(timer, Fm3MftOcu),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_fm3_mft = {
+    .name = TYPE_FM3_MFT,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_STRUCT_ARRAY(frt, Fm3MftState, FM3_MFT_FRT_NUM, 1,
+                             vmstate_fm3_mft_frt, Fm3MftFrt),
+        VMSTATE_STRUCT_ARRAY(ocu, Fm3MftState, FM3_MFT_OCU_NUM, 1,
+                             vmstate_fm3_mft_ocu, Fm3MftOcu),
+        VMSTATE_UINT32_ARRAY(ocsa, Fm3MftState, FM3_MFT_OCU_NUM / 2),
+        VMSTATE_UINT32_ARRAY(ocsb, Fm3MftState, FM3_MFT_OCU_NUM / 2),
+        VMSTATE_UINT32(ocsc, Fm3MftState),
+        VMSTATE_UINT32_ARRAY(ocfs, Fm3MftState, FM3_MFT_OCU_NUM / 2),
+        VMSTATE_UINT32_ARRAY(iccp, Fm3MftState, FM3_MFT_ICU_NUM),
+        VMSTATE_UINT32_ARRAY(icsa, Fm3MftState, FM3_MFT_ICU_NUM / 2),
+        VMSTATE_UINT32_ARRAY(icsb, Fm3MftState, FM3_MFT_ICU_NUM / 2),
+        VMSTATE_UINT32_ARRAY(icfs, Fm3MftState, FM3_MFT_ICU_NUM / 2),
+        VMSTATE_INT32_ARRAY(icu_in, Fm3MftState, FM3_MFT_ICU_NUM),
+        VMSTATE_UINT32_ARRAY(wftm, Fm3MftState, FM3_MFT_WFG_NUM),
+        VMSTATE_UINT32_ARRAY(wfsa, Fm3MftState, FM3_MFT_WFG_NUM),
+        VMSTATE_UINT32(wfir, Fm3MftState),
+        VMSTATE_UINT32(nzcl, Fm3MftState),
+        VMSTATE_UINT32(frt_stat, Fm3MftState),
+        VMSTATE_UINT32(icu_stat, Fm3MftState),
+        VMSTATE_UINT32(ocu_stat, Fm3MftState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property fm3_mft_properties[] = {
+    DEFINE_PROP_UINT32("unit", Fm3MftState, unit, 0),
+    DEFINE_PROP_STRING("waveform", Fm3MftState, wave_path),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void fm3_mft_class_init(ObjectClass *klass, void *data)
+{
+	DeviceClass			*dc	= DEVICE_CLASS(klass);
+	SysBusDeviceClass	*k	= SYS_BUS_DEVICE_CLASS(klass);
+
+	k->init		= fm3_mft_init;
+	dc->desc	= TYPE_FM3_MFT;
+	dc->props	= fm3_mft_properties;
+	dc->reset	= fm3_mft_reset;
+	dc->vmsd	= &vmstate_fm3_mft;
+}
+
+static const TypeInfo fm3_mft_info = {
+	.name			= TYPE_FM3_MFT,
+	.parent			= TYPE_SYS_BUS_DEVICE,
+	.instance_size	= sizeof(Fm3MftState),
+	.class_init		= fm3_mft_class_init,
+};
+
+static void fm3_register_devices(void)
+{
+    type_register_static(&fm3_mft_info);
+}
+
+type_init(fm3_register_devices)
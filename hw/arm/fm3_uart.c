@@ -9,7 +9,12 @@
 
 #include "hw/sysbus.h"
 #include "hw/devices.h"
+#include "hw/arm/arm.h"
+#include "hw/ssi.h"
+#include "hw/i2c/i2c.h"
 #include "sysemu/char.h"
+#include "qemu/timer.h"
+#include "qemu/main-loop.h"
 #include "fm3.h"
 #include "fm3_board_config.h"
 
@@ -31,8 +36,11 @@
 #define FM3_UART_REG_SMR_SBL        (1 << 3)
 #define FM3_UART_REG_SMR_BDS        (1 << 2)
 #define FM3_UART_REG_SMR_SOE        (1 << 0)
+#define FM3_UART_REG_SMR_RIE        (1 << 3)    /* I2C */
+#define FM3_UART_REG_SMR_TIE        (1 << 2)    /* I2C */
 #define FM3_UART_REG_SCR_OFFSET     (0x001)
 #define FM3_UART_REG_SCR_UPCL       (1 << 7)
+#define FM3_UART_REG_SCR_MS         (1 << 6)    /* CSIO */
 #define FM3_UART_REG_SCR_RIE        (1 << 4)
 #define FM3_UART_REG_SCR_TIE        (1 << 3)
 #define FM3_UART_REG_SCR_TBIE       (1 << 2)
@@ -49,6 +57,7 @@
 #define FM3_UART_REG_ESCR_L0        (1 << 0)
 #define FM3_UART_REG_SSR_OFFSET     (0x005)
 #define FM3_UART_REG_SSR_REC        (1 << 7)
+#define FM3_UART_REG_SSR_TBIE       (1 << 4)    /* I2C */
 #define FM3_UART_REG_SSR_PE         (1 << 5)
 #define FM3_UART_REG_SSR_FRE        (1 << 4)
 #define FM3_UART_REG_SSR_ORE        (1 << 3)
@@ -60,8 +69,26 @@
 #define FM3_UART_REG_BGR0_OFFSET    (0x00C)
 #define FM3_UART_REG_BGR1_OFFSET    (0x00D)
 #define FM3_UART_REG_BGR1_EXT       (1 << 7)
+#define FM3_UART_REG_BGR1_BGR       (0x7f)
 #define FM3_UART_REG_ISBA_OFFSET    (0x010)
 #define FM3_UART_REG_ISMK_OFFSET    (0x011)
+/* I2C mode: IBCR and IBSR take the place of SCR and ESCR */
+#define FM3_UART_REG_IBCR_OFFSET    (0x001)
+#define FM3_UART_REG_IBCR_MSS       (1 << 7)
+#define FM3_UART_REG_IBCR_SCC       (1 << 6)    /* ACT on read */
+#define FM3_UART_REG_IBCR_ACKE      (1 << 5)
+#define FM3_UART_REG_IBCR_WSEL      (1 << 4)
+#define FM3_UART_REG_IBCR_CNDE      (1 << 3)
+#define FM3_UART_REG_IBCR_INTE      (1 << 2)
+#define FM3_UART_REG_IBCR_BER       (1 << 1)
+#define FM3_UART_REG_IBCR_INT       (1 << 0)
+#define FM3_UART_REG_IBSR_OFFSET    (0x004)
+#define FM3_UART_REG_IBSR_FBT       (1 << 7)
+#define FM3_UART_REG_IBSR_RACK      (1 << 6)
+#define FM3_UART_REG_IBSR_TRX       (1 << 4)
+#define FM3_UART_REG_IBSR_RSC       (1 << 2)
+#define FM3_UART_REG_IBSR_SPC       (1 << 1)
+#define FM3_UART_REG_IBSR_BB        (1 << 0)
 #define FM3_UART_REG_FCR0_OFFSET    (0x014)
 #define FM3_UART_REG_FCR0_FLST      (1 << 6)
 #define FM3_UART_REG_FCR0_FLD       (1 << 5)
@@ -82,15 +109,23 @@
 enum {
     FM3_UART_MODE_NORMAL = 0,
     FM3_UART_MODE_MULTI,
+    FM3_UART_MODE_CSIO,
+    FM3_UART_MODE_LIN,
+    FM3_UART_MODE_I2C,
 };
 
 #define unsupported(reg)            DPRINTF("FM3_UART: *WARNING* %s is not supported\n", reg)
 #define get_ch_no(addr)             ((offset >> 8) & 0xf)
 #define get_smr_mode(value)         ((value >> 5) & 7)
 #define get_escr_len(value)         (value & 7)
+#define is_uart(s)                  (get_smr_mode(s->smr) <= FM3_UART_MODE_MULTI)
+#define is_csio(s)                  (get_smr_mode(s->smr) == FM3_UART_MODE_CSIO)
+#define is_i2c(s)                   (get_smr_mode(s->smr) == FM3_UART_MODE_I2C)
 #define is_error(s)                 ((s->ssr & (FM3_UART_REG_SSR_PE|FM3_UART_REG_SSR_FRE|FM3_UART_REG_SSR_ORE)) != 0)
 #define is_fifo(s)                  ((s->fcr0 & (FM3_UART_REG_FCR0_FE2|FM3_UART_REG_FCR0_FE1)) != 0)
 
+#define FM3_UART_TX_RING_SIZE       (256)
+
 typedef struct {
     uint8_t data[FM3_UART_FIFO_MAX_LENGTH];
     uint32_t size;
@@ -120,13 +155,41 @@ typedef struct {
     qemu_irq irq_tx;
     int irq_rx_level;
     int irq_tx_level;
-    int tx_port;
-    int rx_port;
+    bool tx_routed;     /* SOT pin is routed to this channel */
+    bool rx_routed;     /* SIN pin is routed to this channel */
+
+    /* baud-rate paced delivery ("paced" property) */
+    bool paced;
+    QEMUTimer *tx_timer;    /* expires when the burst in the shifter is out */
+    QEMUTimer *rx_timer;    /* expires when rx_burst bytes have arrived */
+    uint8_t tdr;            /* TDR held while the shifter is busy (no FIFO) */
+    uint8_t rx_buf[FM3_UART_FIFO_MAX_LENGTH];
+    uint32_t rx_buf_count;
+    uint32_t rx_burst;
+
+    /* staging ring flushed to the chardev in bulk */
+    uint8_t tx_ring[FM3_UART_TX_RING_SIZE];
+    uint32_t tx_ring_get;
+    uint32_t tx_ring_count;
+    QEMUBH *tx_bh;
+    bool tx_watch;      /* waiting for the chardev to become writable */
+    bool tx_stalled;    /* TDRE/TBI held until the ring has room */
+
+    /* CSIO and I2C modes */
+    SSIBus *ssi;
+    I2CBus *i2c;
+    QEMUBH *xfer_bh;    /* shifts out what the Tx FIFO holds in one burst */
+    uint32_t ibcr;
+    uint32_t ibsr;
+    uint32_t isba;
+    uint32_t ismk;
 } Fm3UartChState;
 typedef struct {
     SysBusDevice busdev;
     MemoryRegion mmio;
     Fm3UartChState ch[FM3_MFS_NUM];
+    bool paced;
+    Notifier clk_notifier;
 } Fm3UartState;
 #define FM3_UART(obj) \
     OBJECT_CHECK(Fm3UartState, (obj), TYPE_FM3_UART)
@@ -177,30 +240,22 @@ static inline uint32_t fm3_uart_get_max_trigger(int ch, uint32_t req_size)
 }
 #endif
 
-static inline uint32_t fm3_uart_get_irq_stat(int level, int current_ch, 
-                                                                int ch)
-{
-    if (ch < 0 || FM3_MFS_NUM <= ch || ch != current_ch)
-        return 0;
-
-    return (level != 0);
-}
 
-uint32_t fm3_uart_get_rx_irq_stat(int ch)
+void fm3_uart_set_route(int ch, int tx, bool routed)
 {
-    Fm3UartChState *s = &fm3_uart_state->ch[ch];
-    return fm3_uart_get_irq_stat(s->irq_rx_level, s->ch_no, ch);
-}
+    Fm3UartChState *s;
 
-uint32_t fm3_uart_get_tx_irq_stat(int ch)
-{
-    Fm3UartChState *s = &fm3_uart_state->ch[ch];
-    return fm3_uart_get_irq_stat(s->irq_tx_level, s->ch_no, ch);
-}
+    if (!fm3_uart_state || ch < 0 || FM3_MFS_NUM <= ch)
+        return;
 
-uint32_t fm3_uart_get_stat_irq_stat(int ch)
-{
-    return 0; /* not supported */
+    s = &fm3_uart_state->ch[ch];
+    if (tx) {
+        s->tx_routed = routed;
+    } else {
+        s->rx_routed = routed;
+        if (routed && s->chr)
+            qemu_chr_accept_input(s->chr);
+    }
 }
 
 static inline void fm3_uart_clear_tx_irq_flags(Fm3UartChState *s)
@@ -246,39 +301,422 @@ static inline Fm3UartFifo * fm3_uart_get_online_rx_fifo(Fm3UartChState *s)
 }
 
 
-static int fm3_uart_check_port(int ch, int tx, int port_no)
+static void fm3_uart_update_tx_irq(Fm3UartChState *s);
+static void fm3_uart_tx_flush(Fm3UartChState *s);
+static void fm3_uart_tx_next(Fm3UartChState *s);
+
+static gboolean fm3_uart_tx_watch_cb(GIOChannel *chan, GIOCondition cond,
+                                     void *opaque)
 {
-    int export, export_setting;
-    int port_type = fm3_board_get_port_info(port_no);
-    int port_setting = fm3_gpio_get_port_setting(port_no);
+    Fm3UartChState *s = opaque;
 
-    if (port_type != port_setting)
-        return false;
+    s->tx_watch = false;
+    fm3_uart_tx_flush(s);
+    return FALSE;
+}
 
-    export = (ch < 4)? FM3_PORT_EPFR07_MFS0:
-                       FM3_PORT_EPFR08_MFS1;
-    export_setting = fm3_gpio_get_extport_setting(export);
-    return fm3_board_check_extport_uart(ch, tx, export_setting);
+static void fm3_uart_tx_flush(Fm3UartChState *s)
+{
+    uint32_t len;
+    int ret;
+
+    while (s->tx_ring_count) {
+        len = MIN(s->tx_ring_count, FM3_UART_TX_RING_SIZE - s->tx_ring_get);
+        ret = qemu_chr_fe_write(s->chr, &s->tx_ring[s->tx_ring_get], len);
+        if (ret <= 0)
+            break;
+        s->tx_ring_get = (s->tx_ring_get + ret) % FM3_UART_TX_RING_SIZE;
+        s->tx_ring_count -= ret;
+    }
+
+    if (s->tx_ring_count && !s->tx_watch) {
+        if (qemu_chr_fe_add_watch(s->chr, G_IO_OUT | G_IO_HUP, 
+                                  fm3_uart_tx_watch_cb, s) > 0) {
+            s->tx_watch = true;
+        } else {
+            /* the backend cannot tell us when it is writable: wait here */
+            while (s->tx_ring_count) {
+                len = MIN(s->tx_ring_count,
+                          FM3_UART_TX_RING_SIZE - s->tx_ring_get);
+                qemu_chr_fe_write_all(s->chr, &s->tx_ring[s->tx_ring_get],
+                                      len);
+                s->tx_ring_get = (s->tx_ring_get + len) % 
+                                 FM3_UART_TX_RING_SIZE;
+                s->tx_ring_count -= len;
+            }
+        }
+    }
+
+    if (s->tx_stalled && s->tx_ring_count < FM3_UART_TX_RING_SIZE) {
+        /* the data held in TDR/FIFO goes on now */
+        s->tx_stalled = false;
+        fm3_uart_tx_next(s);
+        fm3_uart_update_tx_irq(s);
+    }
+}
+
+static void fm3_uart_tx_bh(void *opaque)
+{
+    Fm3UartChState *s = opaque;
+
+    if (!s->tx_watch)
+        fm3_uart_tx_flush(s);
 }
 
 static void fm3_uart_chr_write(Fm3UartChState *s, const uint8_t *buf, int len)
 {
-    if ((s->smr & FM3_UART_REG_SMR_SOE) && 
-        fm3_uart_check_port(s->ch_no, 1, s->tx_port))
-        qemu_chr_fe_write(s->chr, buf, len); 
+    uint32_t put, n;
+
+    if (!(s->smr & FM3_UART_REG_SMR_SOE) || !s->tx_routed || !s->chr)
+        return;
+
+    if (FM3_UART_TX_RING_SIZE - s->tx_ring_count < len)
+        fm3_uart_tx_flush(s);
+
+    while (len && s->tx_ring_count < FM3_UART_TX_RING_SIZE) {
+        put = (s->tx_ring_get + s->tx_ring_count) % FM3_UART_TX_RING_SIZE;
+        n = MIN(len, FM3_UART_TX_RING_SIZE - MAX(put, s->tx_ring_count));
+        memcpy(&s->tx_ring[put], buf, n);
+        s->tx_ring_count += n;
+        buf += n;
+        len -= n;
+    }
+
+    qemu_bh_schedule(s->tx_bh);
+}
+
+static inline bool fm3_uart_tx_ring_full(Fm3UartChState *s)
+{
+    return FM3_UART_TX_RING_SIZE <= s->tx_ring_count;
+}
+
+/* The ring takes len more bytes, once drained as far as the chardev
+ * allows; true as well when nothing goes out at all */
+static bool fm3_uart_tx_room(Fm3UartChState *s, uint32_t len)
+{
+    if (!(s->smr & FM3_UART_REG_SMR_SOE) || !s->tx_routed || !s->chr)
+        return true;
+    if (FM3_UART_TX_RING_SIZE - s->tx_ring_count < len)
+        fm3_uart_tx_flush(s);
+    return len <= FM3_UART_TX_RING_SIZE - s->tx_ring_count;
+}
+
+/* back-pressure from the chardev: TDRE/TBI stay 0 until the ring has room */
+static void fm3_uart_tx_stall(Fm3UartChState *s)
+{
+    fm3_uart_clear_tx_irq_flags(s);
+    s->fcr1 &= ~FM3_UART_REG_FCR1_FDRQ;
+    s->tx_stalled = true;
+}
+
+/* data bits by ESCR L2-0 */
+static const uint32_t fm3_uart_data_bits[8] = { 8, 5, 6, 7, 9, 8, 8, 8 };
+
+/* Time on the wire of one frame in ns, or 0 if it cannot be paced */
+static int64_t fm3_uart_get_char_time(Fm3UartChState *s)
+{
+    uint32_t bgr = ((s->bgr1 & FM3_UART_REG_BGR1_BGR) << 8) | s->bgr0;
+    uint32_t hz = fm3_clk_get_hz(FM3_CLK_PCLK2);
+    uint32_t bits;
+
+    if (!s->paced || hz == 0)
+        return 0;
+
+    bits = 1 + fm3_uart_data_bits[get_escr_len(s->escr)];
+    if (s->escr & FM3_UART_REG_ESCR_PEN)
+        bits++;
+    bits += 1 + !!(s->smr & FM3_UART_REG_SMR_SBL) + 
+            (!!(s->escr & FM3_UART_REG_ESCR_ESBL) << 1);
+
+    return muldiv64((uint64_t)bits * (bgr + 1), get_ticks_per_sec(), hz);
+}
+
+/* PCLK2 has changed: the bits still to go are shifted at the new rate */
+static void fm3_uart_clk_changed(Notifier *n, void *data)
+{
+    Fm3UartState *s = container_of(n, Fm3UartState, clk_notifier);
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    Fm3UartChState *ch;
+    int i;
+
+    for (i = 0; i < FM3_MFS_NUM; i++) {
+        ch = &s->ch[i];
+        if (timer_pending(ch->tx_timer))
+            timer_mod(ch->tx_timer,
+                      fm3_clk_rescale(timer_expire_time_ns(ch->tx_timer),
+                                      now, data));
+        if (timer_pending(ch->rx_timer))
+            timer_mod(ch->rx_timer,
+                      fm3_clk_rescale(timer_expire_time_ns(ch->rx_timer),
+                                      now, data));
+    }
+}
+
+static inline bool fm3_uart_tx_busy(Fm3UartChState *s)
+{
+    return s->paced && timer_pending(s->tx_timer);
+}
+
+/* len bytes have been moved to the shifter: TDR/FIFO is empty again,
+ * the shifter stays busy until the deadline. */
+static void fm3_uart_tx_start(Fm3UartChState *s, uint32_t len)
+{
+    int64_t t = fm3_uart_get_char_time(s) * len;
+
+    if (t <= 0) {
+        if (fm3_uart_tx_ring_full(s)) {
+            fm3_uart_tx_stall(s);
+        } else {
+            fm3_uart_set_tx_irq_flags(s);
+        }
+        return;
+    }
+
+    s->ssr |= FM3_UART_REG_SSR_TDRE;
+    s->ssr &= ~FM3_UART_REG_SSR_TBI;
+    s->fcr1 |= FM3_UART_REG_FCR1_FDRQ;
+    timer_mod(s->tx_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + t);
+}
+
+static void fm3_uart_update_irq(Fm3UartChState *s);
+static void fm3_uart_rx_put(Fm3UartChState *s, const uint8_t *buf, int size);
+
+/* Takes the next byte to send from the Tx FIFO or TDR */
+static bool fm3_uart_tx_pop(Fm3UartChState *s, uint8_t *data)
+{
+    Fm3UartFifo *f = fm3_uart_get_online_tx_fifo(s);
+    uint32_t max_fifo = fm3_uart_get_max_fifo(s->ch_no);
+
+    if (f) {
+        if (!f->count)
+            return false;
+        *data = f->data[f->get++];
+        if (max_fifo <= f->get)
+            f->get = 0;
+        f->count--;
+        if (!f->count)
+            fm3_uart_set_tx_irq_flags(s);
+    } else {
+        if (s->ssr & FM3_UART_REG_SSR_TDRE)
+            return false;
+        *data = s->tdr;
+        fm3_uart_set_tx_irq_flags(s);
+    }
+    return true;
+}
+
+/* CSIO master: the SSI slaves see MSB first whatever SMR BDS says */
+static uint32_t fm3_uart_csio_order(Fm3UartChState *s, uint32_t data)
+{
+    uint32_t bits = fm3_uart_data_bits[get_escr_len(s->escr)];
+    uint32_t retval = 0;
+    uint32_t i;
+
+    if (s->smr & FM3_UART_REG_SMR_BDS)
+        return data & ((1 << bits) - 1);
+
+    for (i = 0; i < bits; i++) {
+        retval = (retval << 1) | ((data >> i) & 1);
+    }
+    return retval;
 }
 
+static void fm3_uart_csio_xfer(Fm3UartChState *s, const uint8_t *buf,
+                               uint32_t len)
+{
+    uint8_t rx[FM3_UART_FIFO_MAX_LENGTH];
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        rx[i] = fm3_uart_csio_order(s, ssi_transfer(s->ssi,
+                                    fm3_uart_csio_order(s, buf[i])));
+    }
+    if (s->scr & FM3_UART_REG_SCR_RXE)
+        fm3_uart_rx_put(s, rx, len);
+}
+
+/* Shift out everything the Tx FIFO holds as one transaction */
+static void fm3_uart_csio_flush(Fm3UartChState *s)
+{
+    uint8_t buf[FM3_UART_FIFO_MAX_LENGTH];
+    uint32_t len = 0;
+
+    while (len < sizeof(buf) && fm3_uart_tx_pop(s, &buf[len])) {
+        len++;
+    }
+    if (!len)
+        return;
+
+    fm3_uart_csio_xfer(s, buf, len);
+    fm3_uart_update_irq(s);
+}
+
+static void fm3_uart_xfer_bh(void *opaque)
+{
+    Fm3UartChState *s = opaque;
+
+    if (is_csio(s))
+        fm3_uart_csio_flush(s);
+}
+
+static void fm3_uart_i2c_start(Fm3UartChState *s)
+{
+    uint8_t addr;
+    bool recv;
+
+    if (!fm3_uart_tx_pop(s, &addr)) {
+        /* no slave address in TDR */
+        s->ibcr &= ~FM3_UART_REG_IBCR_MSS;
+        s->ibcr |= FM3_UART_REG_IBCR_BER | FM3_UART_REG_IBCR_INT;
+        return;
+    }
+
+    recv = addr & 1;
+    if (s->ibsr & FM3_UART_REG_IBSR_BB)
+        s->ibsr = FM3_UART_REG_IBSR_RSC;
+    else
+        s->ibsr = 0;
+    s->ibsr |= FM3_UART_REG_IBSR_BB | FM3_UART_REG_IBSR_FBT;
+    if (!recv)
+        s->ibsr |= FM3_UART_REG_IBSR_TRX;
+    if (i2c_start_transfer(s->i2c, addr >> 1, recv))
+        s->ibsr |= FM3_UART_REG_IBSR_RACK;
+    s->ibcr |= FM3_UART_REG_IBCR_INT;
+}
+
+static void fm3_uart_i2c_stop(Fm3UartChState *s)
+{
+    if (s->ibsr & FM3_UART_REG_IBSR_BB)
+        i2c_end_transfer(s->i2c);
+    s->ibsr = FM3_UART_REG_IBSR_SPC;
+    s->ibcr &= ~FM3_UART_REG_IBCR_INT;
+}
+
+/*
+ * INT has been cleared: send all TDR/Tx FIFO holds, or receive up to the
+ * Rx FIFO trigger level, then raise INT once for the whole chunk.
+ */
+static void fm3_uart_i2c_continue(Fm3UartChState *s)
+{
+    Fm3UartFifo *f = fm3_uart_get_online_rx_fifo(s);
+    uint8_t buf[FM3_UART_FIFO_MAX_LENGTH];
+    uint32_t max_fifo = fm3_uart_get_max_fifo(s->ch_no);
+    uint32_t len, i;
+    uint8_t data;
+
+    if (!(s->ibsr & FM3_UART_REG_IBSR_BB))
+        return;
+
+    if (s->ibsr & FM3_UART_REG_IBSR_TRX) {
+        len = 0;
+        s->ibsr &= ~FM3_UART_REG_IBSR_RACK;
+        while (fm3_uart_tx_pop(s, &data)) {
+            len++;
+            if (i2c_send(s->i2c, data)) {
+                s->ibsr |= FM3_UART_REG_IBSR_RACK;
+                break;
+            }
+        }
+        if (!len) {
+            /* SCL is held low until TDR is written */
+            return;
+        }
+    } else {
+        len = f ? MIN(MAX(f->trigger, 1), max_fifo - f->count) : 1;
+        for (i = 0; i < len; i++) {
+            buf[i] = i2c_recv(s->i2c);
+        }
+        /* all but the last byte of the chunk are acknowledged */
+        if (!(s->ibcr & FM3_UART_REG_IBCR_ACKE))
+            i2c_nack(s->i2c);
+        if (len)
+            fm3_uart_rx_put(s, buf, len);
+    }
+    s->ibsr &= ~FM3_UART_REG_IBSR_FBT;
+    s->ibcr |= FM3_UART_REG_IBCR_INT;
+}
+
+static void fm3_uart_i2c_write_ibcr(Fm3UartChState *s, uint32_t value)
+{
+    uint32_t old = s->ibcr;
+
+    /* INT and BER are cleared by writing 0, SCC is an action bit */
+    s->ibcr = (value & (FM3_UART_REG_IBCR_MSS  | FM3_UART_REG_IBCR_ACKE |
+                        FM3_UART_REG_IBCR_WSEL | FM3_UART_REG_IBCR_CNDE |
+                        FM3_UART_REG_IBCR_INTE)) |
+              (old & value & (FM3_UART_REG_IBCR_BER | FM3_UART_REG_IBCR_INT));
+
+    if (!(old & FM3_UART_REG_IBCR_MSS)) {
+        if (value & FM3_UART_REG_IBCR_MSS)
+            fm3_uart_i2c_start(s);
+        else if (s->ismk & 0x80)
+            unsupported("I2C slave mode");
+    } else if (!(value & FM3_UART_REG_IBCR_MSS)) {
+        fm3_uart_i2c_stop(s);
+    } else if (value & FM3_UART_REG_IBCR_SCC) {
+        fm3_uart_i2c_start(s);
+    } else if ((old & FM3_UART_REG_IBCR_INT) &&
+               !(value & FM3_UART_REG_IBCR_INT)) {
+        fm3_uart_i2c_continue(s);
+    }
+}
+
+static void fm3_uart_i2c_write_tdr(Fm3UartChState *s, uint8_t data)
+{
+    Fm3UartFifo *f = fm3_uart_get_online_tx_fifo(s);
+    uint32_t max_fifo = fm3_uart_get_max_fifo(s->ch_no);
+
+    if (f) {
+        if (max_fifo <= f->count)
+            return;
+        f->data[f->put++] = data;
+        if (max_fifo <= f->put)
+            f->put = 0;
+        f->count++;
+        s->fcr1 &= ~FM3_UART_REG_FCR1_FDRQ;
+    } else {
+        s->tdr = data;
+    }
+    fm3_uart_clear_tx_irq_flags(s);
+
+    /* the bus waits for data */
+    if ((s->ibcr & FM3_UART_REG_IBCR_MSS) && 
+        !(s->ibcr & FM3_UART_REG_IBCR_INT) &&
+        (s->ibsr & FM3_UART_REG_IBSR_TRX))
+        fm3_uart_i2c_continue(s);
+}
 
 static void fm3_uart_send_fifo(Fm3UartChState *s) 
 {
     Fm3UartFifo *f = fm3_uart_get_online_tx_fifo(s);
     uint8_t *p;
-    uint32_t len;
+    uint32_t len, count;
     uint32_t max_fifo = fm3_uart_get_max_fifo(s->ch_no);
 
-    if (!f)
+    if (!f || is_i2c(s))
+        return;
+
+    if (is_csio(s)) {
+        /* gathered into one transaction unless the FIFO is full */
+        if (max_fifo <= f->count)
+            fm3_uart_csio_flush(s);
+        else
+            qemu_bh_schedule(s->xfer_bh);
         return;
+    }
 
+    if (fm3_uart_tx_busy(s) || s->tx_stalled) {
+        /* sent as the next burst when the shifter gets idle */
+        s->ssr &= ~FM3_UART_REG_SSR_TDRE;
+        return;
+    }
+    if (!fm3_uart_tx_room(s, f->count)) {
+        /* kept in the FIFO until the ring has room */
+        fm3_uart_tx_stall(s);
+        return;
+    }
+
+    count = f->count;
     p = &f->data[f->get];
     len = f->put - f->get;
 
@@ -294,18 +732,28 @@ static void fm3_uart_send_fifo(Fm3UartChState *s)
         fm3_uart_chr_write(s, p, len);
 
     fm3_uart_clear_fifo(f, f->trigger);
-    fm3_uart_set_tx_irq_flags(s);
+    fm3_uart_tx_start(s, count);
 }
 
 static void fm3_uart_update_tx_irq(Fm3UartChState *s)
 {
     int level = 0;
 
-    if (s->scr & FM3_UART_REG_SCR_TIE) {
+    if (is_i2c(s)) {
+        if (s->ibcr & FM3_UART_REG_IBCR_INTE)
+            level |= !!(s->ibcr & FM3_UART_REG_IBCR_INT);
+        if (s->ibcr & FM3_UART_REG_IBCR_CNDE)
+            level |= !!(s->ibsr & (FM3_UART_REG_IBSR_RSC |
+                                   FM3_UART_REG_IBSR_SPC));
+        if (s->smr & FM3_UART_REG_SMR_TIE)
+            level |= !!(s->ssr & FM3_UART_REG_SSR_TDRE);
+        if (s->ssr & FM3_UART_REG_SSR_TBIE)
+            level |= !!(s->ssr & FM3_UART_REG_SSR_TBI);
+    } else if (s->scr & FM3_UART_REG_SCR_TIE) {
         level |= !!(s->ssr & FM3_UART_REG_SSR_TDRE);
     }
 
-    if (s->scr & FM3_UART_REG_SCR_TBIE) {
+    if (!is_i2c(s) && (s->scr & FM3_UART_REG_SCR_TBIE)) {
         level |= !!(s->ssr & FM3_UART_REG_SSR_TBI);
     }
 
@@ -313,7 +761,12 @@ static void fm3_uart_update_tx_irq(Fm3UartChState *s)
         level |= !!(s->fcr1 & FM3_UART_REG_FCR1_FDRQ);
     }
 
+    /* With the DRQSEL bit of the channel set, fm3_int hands this line to
+     * the DMAC instead: FDRQ then requests a block that refills the FIFO
+     * through TDR, and the first write drops the request again. */
     if (s->irq_tx_level != level) {
+        /* bit0: Tx, bit1: status (not supported) */
+        fm3_int_set_mon(FM3_IRQ_MFS_TX(s->ch_no), 1, level);
         qemu_set_irq(s->irq_tx, level);
         s->irq_tx_level = level;
     }
@@ -322,8 +775,10 @@ static void fm3_uart_update_tx_irq(Fm3UartChState *s)
 static void fm3_uart_update_rx_irq(Fm3UartChState *s)
 {
     int level = 0;
+    uint32_t rie = is_i2c(s) ? (s->smr & FM3_UART_REG_SMR_RIE) :
+                               (s->scr & FM3_UART_REG_SCR_RIE);
     
-    if (s->scr & FM3_UART_REG_SCR_RIE) {
+    if (rie) {
         level |= !!(s->ssr & (FM3_UART_REG_SSR_RDRF|
                               FM3_UART_REG_SSR_ORE |
                               FM3_UART_REG_SSR_FRE |
@@ -331,6 +786,7 @@ static void fm3_uart_update_rx_irq(Fm3UartChState *s)
     }
 
     if (s->irq_rx_level != level) {
+        fm3_int_set_mon(FM3_IRQ_MFS_RX(s->ch_no), 1, level);
         qemu_set_irq(s->irq_rx, level);
         s->irq_rx_level = level;
     }
@@ -342,6 +798,36 @@ static void fm3_uart_update_irq(Fm3UartChState *s)
     fm3_uart_update_rx_irq(s);
 }
 
+/* The shifter is idle: sends what waits in the FIFO or TDR */
+static void fm3_uart_tx_next(Fm3UartChState *s)
+{
+    Fm3UartFifo *f = fm3_uart_get_online_tx_fifo(s);
+
+    if (f) {
+        if (f->count && (s->scr & FM3_UART_REG_SCR_TXE))
+            fm3_uart_send_fifo(s);
+        else
+            fm3_uart_set_tx_irq_flags(s);
+    } else if (!(s->ssr & FM3_UART_REG_SSR_TDRE)) {
+        if (fm3_uart_tx_room(s, 1)) {
+            fm3_uart_chr_write(s, &s->tdr, 1);
+            fm3_uart_tx_start(s, 1);
+        } else {
+            fm3_uart_tx_stall(s);
+        }
+    } else {
+        fm3_uart_set_tx_irq_flags(s);
+    }
+}
+
+static void fm3_uart_tx_timer_cb(void *opaque)
+{
+    Fm3UartChState *s = opaque;
+
+    fm3_uart_tx_next(s);
+    fm3_uart_update_tx_irq(s);
+}
+
 #if 0
 static inline void fm3_uart_check_trigger(Fm3UartChState *s)
 {
@@ -369,9 +855,20 @@ static uint64_t fm3_uart_read(void *opaque, hwaddr offset,
     uint32_t max_fifo = fm3_uart_get_max_fifo(s->ch_no);
     uint64_t retval = 0;
 
+    /* what the firmware wrote to the FIFO goes out before it looks */
+    if (is_csio(s))
+        fm3_uart_csio_flush(s);
+
     offset &= 0xff;
     switch (offset) {
     case FM3_UART_REG_SCR_OFFSET:
+        if (is_i2c(s)) {
+            retval = s->ibcr & ~FM3_UART_REG_IBCR_SCC;
+            if ((s->ibcr & FM3_UART_REG_IBCR_MSS) &&
+                (s->ibsr & FM3_UART_REG_IBSR_BB))
+                retval |= FM3_UART_REG_IBCR_SCC;
+            break;
+        }
         retval = s->scr & ~FM3_UART_REG_SCR_UPCL;
         break;
 
@@ -384,7 +881,7 @@ static uint64_t fm3_uart_read(void *opaque, hwaddr offset,
         break;
 
     case FM3_UART_REG_ESCR_OFFSET:
-        retval = s->escr;
+        retval = is_i2c(s) ? s->ibsr : s->escr;
         break;
 
     case FM3_UART_REG_RDR_OFFSET:
@@ -415,6 +912,14 @@ static uint64_t fm3_uart_read(void *opaque, hwaddr offset,
         retval = s->bgr0;
         break;
 
+    case FM3_UART_REG_ISBA_OFFSET:
+        retval = s->isba;
+        break;
+
+    case FM3_UART_REG_ISMK_OFFSET:
+        retval = s->ismk;
+        break;
+
     case FM3_UART_REG_FCR1_OFFSET:
         retval = s->fcr1;
         break;
@@ -458,6 +963,12 @@ static void fm3_uart_write(void *opaque, hwaddr offset,
     value &= 0xff;
     switch (offset) {
     case FM3_UART_REG_SCR_OFFSET:
+        if (is_i2c(s)) {
+            fm3_uart_i2c_write_ibcr(s, value);
+            break;
+        }
+        if (is_csio(s) && (value & FM3_UART_REG_SCR_MS))
+            unsupported("SCR MS (CSIO slave mode)");
         if (value & FM3_UART_REG_SCR_UPCL) {
             fm3_uart_clear_fifo(&s->fifo1, s->fifo1.trigger);
             fm3_uart_clear_fifo(&s->fifo2, s->fifo2.trigger);
@@ -467,16 +978,23 @@ static void fm3_uart_write(void *opaque, hwaddr offset,
 
     case FM3_UART_REG_SMR_OFFSET:
         mode = get_smr_mode(value);
-        if ((FM3_UART_MODE_NORMAL != mode) &&
-                (FM3_UART_MODE_MULTI != mode)) {
+        if ((FM3_UART_MODE_LIN == mode) || (FM3_UART_MODE_I2C < mode)) {
             printf("FM3_UART: Invalid mode (MD2-0 = %d)", mode);
         }
-        if (value & FM3_UART_REG_SMR_WUCR)
-            unsupported("SMR WUCR");
-        if (value & FM3_UART_REG_SMR_SBL)
-            unsupported("SMR SBL");
-        if (value & FM3_UART_REG_SMR_BDS)
-            unsupported("SMR BDS");
+        if (mode <= FM3_UART_MODE_MULTI) {
+            if (value & FM3_UART_REG_SMR_WUCR)
+                unsupported("SMR WUCR");
+            if (value & FM3_UART_REG_SMR_SBL)
+                unsupported("SMR SBL");
+            if (value & FM3_UART_REG_SMR_BDS)
+                unsupported("SMR BDS");
+        }
+        if (is_i2c(s) && (mode != FM3_UART_MODE_I2C)) {
+            if (s->ibsr & FM3_UART_REG_IBSR_BB)
+                i2c_end_transfer(s->i2c);
+            s->ibcr = 0;
+            s->ibsr = 0;
+        }
         s->smr = value;
         break;
 
@@ -486,9 +1004,19 @@ static void fm3_uart_write(void *opaque, hwaddr offset,
                         FM3_UART_REG_SSR_FRE |
                         FM3_UART_REG_SSR_ORE);
         }
+        if (is_i2c(s)) {
+            s->ssr = (s->ssr & ~FM3_UART_REG_SSR_TBIE) |
+                     (value & FM3_UART_REG_SSR_TBIE);
+        }
         break;
 
     case FM3_UART_REG_ESCR_OFFSET:
+        if (is_i2c(s)) {
+            /* RSC and SPC are cleared by writing 0 */
+            s->ibsr &= value | ~(FM3_UART_REG_IBSR_RSC |
+                                 FM3_UART_REG_IBSR_SPC);
+            break;
+        }
         if (value & FM3_UART_REG_ESCR_FLWEN)
             unsupported("ESCR FLWEN");
         if (value & FM3_UART_REG_ESCR_ESBL)
@@ -504,7 +1032,9 @@ static void fm3_uart_write(void *opaque, hwaddr offset,
         s->escr = value;
         break;
     case FM3_UART_REG_TDR_OFFSET:
-        if (s->scr & FM3_UART_REG_SCR_TXE) {
+        if (is_i2c(s)) {
+            fm3_uart_i2c_write_tdr(s, data);
+        } else if (s->scr & FM3_UART_REG_SCR_TXE) {
             if (tx_fifo) {
                 if (tx_fifo->count < max_fifo) {
                     tx_fifo->data[tx_fifo->put++] = data;
@@ -519,12 +1049,24 @@ static void fm3_uart_write(void *opaque, hwaddr offset,
                         fm3_uart_send_fifo(s); 
                     }
                 }
+            } else if (is_csio(s)) {
+                fm3_uart_csio_xfer(s, &data, 1);
+                fm3_uart_set_tx_irq_flags(s);
             } else {
 #if 0
                 fm3_uart_clear_tx_irq_flags(s);
 #endif
-                fm3_uart_chr_write(s, &data, 1);
-                fm3_uart_set_tx_irq_flags(s);
+                if (fm3_uart_tx_busy(s) || s->tx_stalled) {
+                    s->tdr = data;
+                    s->ssr &= ~FM3_UART_REG_SSR_TDRE;
+                } else if (!fm3_uart_tx_room(s, 1)) {
+                    /* held in TDR until the ring has room */
+                    s->tdr = data;
+                    fm3_uart_tx_stall(s);
+                } else {
+                    fm3_uart_chr_write(s, &data, 1);
+                    fm3_uart_tx_start(s, 1);
+                }
             }
         }
         break;
@@ -542,6 +1084,14 @@ static void fm3_uart_write(void *opaque, hwaddr offset,
         s->bgr0 = value;
         break;
 
+    case FM3_UART_REG_ISBA_OFFSET:
+        s->isba = value;
+        break;
+
+    case FM3_UART_REG_ISMK_OFFSET:
+        s->ismk = value;
+        break;
+
     case FM3_UART_REG_FCR1_OFFSET:
         if (value & FM3_UART_REG_FCR1_FRIIE)
             unsupported("FCR1 FRIIE");
@@ -664,9 +1214,13 @@ static int fm3_uart_can_receive(void *opaque)
     Fm3UartFifo *fifo = fm3_uart_get_online_rx_fifo(s);
     int retval = 0;
 
-    if (fm3_uart_check_port(s->ch_no, 0, s->rx_port) && 
-        ((s->scr & FM3_UART_REG_SCR_RXE) != 0)) {
-        if (fifo && fm3_uart_ch_has_fifo(s->ch_no)) {
+    if (!is_uart(s))
+        return 0;
+
+    if (s->rx_routed && ((s->scr & FM3_UART_REG_SCR_RXE) != 0)) {
+        if (s->paced) {
+            retval = sizeof(s->rx_buf) - s->rx_buf_count;
+        } else if (fifo && fm3_uart_ch_has_fifo(s->ch_no)) {
             retval = FM3_UART_FIFO_MAX_LENGTH - fifo->count;
         } else {
             retval = 1;
@@ -676,9 +1230,8 @@ static int fm3_uart_can_receive(void *opaque)
     return retval;
 }
 
-static void fm3_uart_receive(void *opaque, const uint8_t *buf, int size)
+static void fm3_uart_rx_put(Fm3UartChState *s, const uint8_t *buf, int size)
 {
-    Fm3UartChState *s = opaque;
     Fm3UartFifo *fifo = fm3_uart_get_online_rx_fifo(s);
     uint32_t max_fifo = fm3_uart_get_max_fifo(s->ch_no);
     int i;
@@ -694,15 +1247,67 @@ static void fm3_uart_receive(void *opaque, const uint8_t *buf, int size)
                 if (fifo->count >= fifo->trigger) {
                     s->ssr |= FM3_UART_REG_SSR_RDRF;
                 }
-            } else
+            } else {
+                /* on real timing the firmware was too slow */
+                if (s->paced)
+                    s->ssr |= FM3_UART_REG_SSR_ORE;
                 break;
+            }
         }
+    } else if (s->paced && (s->ssr & FM3_UART_REG_SSR_RDRF)) {
+        s->ssr |= FM3_UART_REG_SSR_ORE;
     } else {
         s->rx_fifo->data[0] = buf[0];
         s->rx_fifo->count = 1;
         s->ssr |= FM3_UART_REG_SSR_RDRF;
     }
+}
+
+/* Arm one deadline for the bytes up to the Rx FIFO trigger level */
+static void fm3_uart_rx_schedule(Fm3UartChState *s)
+{
+    Fm3UartFifo *fifo = fm3_uart_get_online_rx_fifo(s);
+    uint32_t burst = fifo ? fifo->trigger : 1;
+    int64_t t;
+
+    if (timer_pending(s->rx_timer) || s->rx_buf_count == 0)
+        return;
+
+    if (burst == 0 || s->rx_buf_count < burst)
+        burst = s->rx_buf_count;
+
+    s->rx_burst = burst;
+    t = fm3_uart_get_char_time(s) * burst;
+    timer_mod(s->rx_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + t);
+}
+
+static void fm3_uart_rx_timer_cb(void *opaque)
+{
+    Fm3UartChState *s = opaque;
+    uint32_t burst = MIN(s->rx_burst, s->rx_buf_count);
+
+    fm3_uart_rx_put(s, s->rx_buf, burst);
+    s->rx_buf_count -= burst;
+    memmove(s->rx_buf, &s->rx_buf[burst], s->rx_buf_count);
+    fm3_uart_update_rx_irq(s);
+
+    fm3_uart_rx_schedule(s);
+    qemu_chr_accept_input(s->chr);
+}
+
+static void fm3_uart_receive(void *opaque, const uint8_t *buf, int size)
+{
+    Fm3UartChState *s = opaque;
+
+    if (s->paced) {
+        size = MIN(size, sizeof(s->rx_buf) - s->rx_buf_count);
+        memcpy(&s->rx_buf[s->rx_buf_count], buf, size);
+        s->rx_buf_count += size;
+        fm3_uart_rx_schedule(s);
+        return;
+    }
 
+    fm3_uart_rx_put(s, buf, size);
     fm3_uart_update_rx_irq(s);
 }
 
@@ -727,13 +1332,27 @@ static void fm3_uart_reset(DeviceState *d)
         ch->bgr0 = 0;
         ch->fcr1 = FM3_UART_REG_FCR1_FDRQ;
         ch->fcr0 = 0;
+        ch->ibcr = 0;
+        ch->ibsr = 0;
+        ch->isba = 0;
+        ch->ismk = 0;
 
         ch->irq_rx_level = 0;
         ch->irq_tx_level = 0;
+        fm3_int_set_mon(FM3_IRQ_MFS_RX(i), 1, 0);
+        fm3_int_set_mon(FM3_IRQ_MFS_TX(i), 1, 0);
         ch->tx_fifo = &ch->fifo1;
         ch->rx_fifo = &ch->fifo2;
         fm3_uart_clear_fifo(ch->tx_fifo, 1);
         fm3_uart_clear_fifo(ch->rx_fifo, 1);
+
+        ch->rx_buf_count = 0;
+        ch->rx_burst = 0;
+        ch->tx_stalled = false;
+        if (ch->tx_ring_count && !ch->tx_watch)
+            fm3_uart_tx_flush(ch);
+        timer_del(ch->tx_timer);
+        timer_del(ch->rx_timer);
     }
 }
 
@@ -741,9 +1360,6 @@ static void fm3_uart_ch_init(Fm3UartChState *ch,
                              SysBusDevice *dev,
                              uint32_t ch_no)
 {
-    int pin_no;
-
-    ch->ch_no = ch_no;
     ch->chr = qemu_char_get_next_serial();
     if (ch->chr) {
         qemu_chr_add_handlers(ch->chr, fm3_uart_can_receive, 
@@ -752,26 +1368,45 @@ static void fm3_uart_ch_init(Fm3UartChState *ch,
     } else {
         printf("FM3_UART: could not get chardev\n");
     }
-
-    pin_no = fm3_board_get_uart_rx_pin(ch->ch_no);
-    ch->rx_port = fm3_gpio_get_port_from_pin(pin_no, 
-                            FM3_PINPACKAGE_LQFP176);
-    pin_no = fm3_board_get_uart_tx_pin(ch->ch_no);
-    ch->tx_port = fm3_gpio_get_port_from_pin(pin_no, 
-                            FM3_PINPACKAGE_LQFP176);
-
-    sysbus_init_irq(dev, &ch->irq_rx); /* Rx */
-    sysbus_init_irq(dev, &ch->irq_tx); /* Tx */
 }
 
 static int fm3_uart_init(SysBusDevice *dev)
 {
 	DeviceState		*devs	= DEVICE(dev);
     Fm3UartState	*s		= FM3_UART(devs);
+    Fm3UartChState *ch;
+    char name[8];
+    int i;
+
+    for (i = 0; i < FM3_MFS_NUM; i++) {
+        ch = &s->ch[i];
+        ch->ch_no = i;
+        sysbus_init_irq(dev, &ch->irq_rx); /* Rx */
+        sysbus_init_irq(dev, &ch->irq_tx); /* Tx */
+        snprintf(name, sizeof(name), "ssi%d", i);
+        ch->ssi = ssi_create_bus(devs, name);
+        snprintf(name, sizeof(name), "i2c%d", i);
+        ch->i2c = i2c_init_bus(devs, name);
+        ch->xfer_bh = qemu_bh_new(fm3_uart_xfer_bh, ch);
+        ch->tx_routed = false;
+        ch->rx_routed = false;
+        ch->paced = s->paced;
+        ch->tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, 
+                                    fm3_uart_tx_timer_cb, ch);
+        ch->rx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, 
+                                    fm3_uart_rx_timer_cb, ch);
+        ch->tx_bh = qemu_bh_new(fm3_uart_tx_bh, ch);
+        ch->tx_ring_get = 0;
+        ch->tx_ring_count = 0;
+        ch->tx_watch = false;
+        ch->tx_stalled = false;
+    }
 
     fm3_uart_ch_init(&s->ch[0], dev, 0);
     fm3_uart_ch_init(&s->ch[3], dev, 3);
     fm3_uart_ch_init(&s->ch[4], dev, 4);
+    s->clk_notifier.notify = fm3_uart_clk_changed;
+    fm3_clk_add_notifier(FM3_CLK_PCLK2, &s->clk_notifier);
 
     memory_region_init_io(&s->mmio, OBJECT(s), &fm3_uart_mem_ops, s, 
                           TYPE_FM3_UART, 0x1000);
@@ -781,7 +1416,99 @@ static int fm3_uart_init(SysBusDevice *dev)
     return 0;
 }
 
+static int fm3_uart_ch_post_load(void *opaque, int version_id)
+{
+    Fm3UartChState *s = opaque;
+
+    if (s->fcr1 & FM3_UART_REG_FCR1_FSEL) {
+        s->tx_fifo = &s->fifo2;
+        s->rx_fifo = &s->fifo1;
+    } else {
+        s->tx_fifo = &s->fifo1;
+        s->rx_fifo = &s->fifo2;
+    }
+
+    s->tx_watch = false;
+    if (s->tx_ring_count)
+        qemu_bh_schedule(s->tx_bh);
+
+    return 0;
+}
+
+static const VMStateDescription vmstate_fm3_uart_fifo = {
+    .name = "fm3.uart/fifo",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT8_ARRAY(data, Fm3UartFifo, FM3_UART_FIFO_MAX_LENGTH),
+        VMSTATE_UINT32(size, Fm3UartFifo),
+        VMSTATE_UINT32(count, Fm3UartFifo),
+        VMSTATE_UINT32(put, Fm3UartFifo),
+        VMSTATE_UINT32(get, Fm3UartFifo),
+        VMSTATE_UINT32(saved_get, Fm3UartFifo),
+        VMSTATE_UINT32(trigger, Fm3UartFifo),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_fm3_uart_ch = {
+    .name = "fm3.uart/ch",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .post_load = fm3_uart_ch_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(scr, Fm3UartChState),
+        VMSTATE_UINT32(smr, Fm3UartChState),
+        VMSTATE_UINT32(ssr, Fm3UartChState),
+        VMSTATE_UINT32(escr, Fm3UartChState),
+        VMSTATE_UINT32(bgr1, Fm3UartChState),
+        VMSTATE_UINT32(bgr0, Fm3UartChState),
+        VMSTATE_UINT32(fcr1, Fm3UartChState),
+        VMSTATE_UINT32(fcr0, Fm3UartChState),
+        VMSTATE_STRUCT(fifo1, Fm3UartChState, 1, 
+                       vmstate_fm3_uart_fifo, Fm3UartFifo),
+        VMSTATE_STRUCT(fifo2, Fm3UartChState, 1, 
+                       vmstate_fm3_uart_fifo, Fm3UartFifo),
+        VMSTATE_INT32(irq_rx_level, Fm3UartChState),
+        VMSTATE_INT32(irq_tx_level, Fm3UartChState),
+        VMSTATE_BOOL(tx_routed, Fm3UartChState),
+        VMSTATE_BOOL(rx_routed, Fm3UartChState),
+        VMSTATE_TIMER(tx_timer, Fm3UartChState),
+        VMSTATE_TIMER(rx_timer, Fm3UartChState),
+        VMSTATE_UINT8(tdr, Fm3UartChState),
+        VMSTATE_UINT8_ARRAY(rx_buf, Fm3UartChState, 
+                            FM3_UART_FIFO_MAX_LENGTH),
+        VMSTATE_UINT32(rx_buf_count, Fm3UartChState),
+        VMSTATE_UINT32(rx_burst, Fm3UartChState),
+        VMSTATE_UINT8_ARRAY(tx_ring, Fm3UartChState, 
+                            FM3_UART_TX_RING_SIZE),
+        VMSTATE_UINT32(tx_ring_get, Fm3UartChState),
+        VMSTATE_UINT32(tx_ring_count, Fm3UartChState),
+        VMSTATE_BOOL(tx_stalled, Fm3UartChState),
+        VMSTATE_UINT32(ibcr, Fm3UartChState),
+        VMSTATE_UINT32(ibsr, Fm3UartChState),
+        VMSTATE_UINT32(isba, Fm3UartChState),
+        VMSTATE_UINT32(ismk, Fm3UartChState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_fm3_uart = {
+    .name = TYPE_FM3_UART,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_STRUCT_ARRAY(ch, Fm3UartState, FM3_MFS_NUM, 1, 
+                             vmstate_fm3_uart_ch, Fm3UartChState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property fm3_uart_properties[] = {
+    DEFINE_PROP_BOOL("paced", Fm3UartState, paced, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -794,6 +1521,7 @@ static void fm3_uart_class_init(ObjectClass *klass, void *data)
 	dc->desc	= TYPE_FM3_UART;			/* n[hEFA		*/
 	dc->props	= fm3_uart_properties;		/* 				*/
 	dc->reset	= fm3_uart_reset;
+	dc->vmsd	= &vmstate_fm3_uart;
 }
 
 static const TypeInfo fm3_uart_info = {
@@ -0,0 +1,523 @@
+/*
+ * Fujitsu FM3 MCU emulator - waveform (VCD) files
+ *
+ * This code is licensed under the GNU GPL v2.
+ *
+ * Input waveforms are either a VCD file or a compact binary file.
+ *
+ * VCD: scalar wires named "Pxy" (port block x, bit y) or "INTnn"
+ * (external interrupt input nn) and vectors named "Px" (whole port
+ * block x) are recognized, any other variable is ignored.
+ *
+ * Binary: the magic "FM3WAVE1" followed by 20-byte little-endian
+ * records {time_ns:64, block:32, mask:32, value:32} sorted by time,
+ * block 0xff stands for the external interrupt inputs.
+ *
+ * Both are read sequentially, so files of any length can be streamed.
+ *
+ * The recorder writes port outputs (PDOR) as 16-bit vectors "P0".."PF",
+ * which the reader accepts back, and the interrupt request lines as
+ * scalar wires "IRQ00".."IRQ47".  Changes are queued in a ring by the
+ * device models and written out by a dedicated thread.
+ */
+
+#include <ctype.h>
+#include "qemu-common.h"
+#include "qemu/error-report.h"
+#include "qemu/bswap.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/atomic.h"
+#include "fm3.h"
+#include "fm3_vcd.h"
+
+#define FM3_VCD_VAR_MAX             (128)
+#define FM3_VCD_TOKEN_MAX           (128)
+#define FM3_VCD_BINARY_MAGIC        "FM3WAVE1"
+#define FM3_VCD_BINARY_RECORD_SIZE  (20)
+#define FM3_VCD_BLOCK_NONE          (0xffffffff)
+
+typedef struct {
+    char id[16];
+    uint32_t block;
+    uint32_t bit;
+    uint32_t width;
+} Fm3VcdVar;
+
+struct Fm3VcdReader {
+    FILE *fp;
+    bool binary;
+    uint64_t scale_ps;      /* length of one VCD time unit */
+    int64_t time;
+    Fm3VcdVar vars[FM3_VCD_VAR_MAX];
+    int nvars;
+};
+
+static int fm3_vcd_token(Fm3VcdReader *r, char *buf)
+{
+    return (fscanf(r->fp, "%127s", buf) == 1) ? 0 : -1;
+}
+
+static int fm3_vcd_skip_to_end(Fm3VcdReader *r)
+{
+    char tok[FM3_VCD_TOKEN_MAX];
+
+    while (fm3_vcd_token(r, tok) == 0) {
+        if (strcmp(tok, "$end") == 0)
+            return 0;
+    }
+    return -1;
+}
+
+static int fm3_vcd_parse_timescale(Fm3VcdReader *r)
+{
+    static const struct {
+        const char *unit;
+        uint64_t ps;
+    } units[] = {
+        { "s",  1000000000000ULL },
+        { "ms", 1000000000ULL },
+        { "us", 1000000ULL },
+        { "ns", 1000ULL },
+        { "ps", 1ULL },
+    };
+    char tok[FM3_VCD_TOKEN_MAX];
+    char str[FM3_VCD_TOKEN_MAX] = "";
+    char *unit;
+    uint64_t num;
+    int i;
+
+    while (fm3_vcd_token(r, tok) == 0 && strcmp(tok, "$end") != 0)
+        pstrcat(str, sizeof(str), tok);
+
+    num = strtoull(str, &unit, 10);
+    for (i = 0; i < ARRAY_SIZE(units); i++) {
+        if (strcmp(unit, units[i].unit) == 0) {
+            r->scale_ps = num * units[i].ps;
+            return 0;
+        }
+    }
+    if (strcmp(unit, "fs") == 0 && num >= 1000) {
+        r->scale_ps = num / 1000;
+        return 0;
+    }
+
+    error_report("fm3 vcd: unsupported timescale '%s'", str);
+    return -1;
+}
+
+/* "Pxy" -> port, "Px" -> port block, "INTnn" -> external interrupt */
+static void fm3_vcd_map_var(Fm3VcdVar *v, const char *ref)
+{
+    char *end;
+    long ch;
+
+    v->block = FM3_VCD_BLOCK_NONE;
+    v->bit = 0;
+
+    if (toupper(ref[0]) == 'P' && qemu_isxdigit(ref[1])) {
+        if (ref[2] == 0 && v->width <= 16) {
+            v->block = strtoul(&ref[1], NULL, 16);
+        } else if (qemu_isxdigit(ref[2]) && ref[3] == 0 && v->width == 1) {
+            ch = strtoul(&ref[1], NULL, 16);
+            v->block = FM3_PORT_TO_BLOCKNO(ch);
+            v->bit = FM3_PORT_TO_BITPOS(ch);
+        }
+    } else if (strncasecmp(ref, "INT", 3) == 0 && v->width == 1) {
+        ch = strtol(&ref[3], &end, 10);
+        if (end != &ref[3] && *end == 0 && 0 <= ch && ch < FM3_EXTI_NUM) {
+            v->block = FM3_VCD_BLOCK_EXTI;
+            v->bit = ch;
+        }
+    }
+}
+
+/* $var <type> <size> <id> <reference> [<index>] $end */
+static int fm3_vcd_parse_var(Fm3VcdReader *r)
+{
+    char tok[FM3_VCD_TOKEN_MAX];
+    Fm3VcdVar *v;
+
+    if (FM3_VCD_VAR_MAX <= r->nvars) {
+        error_report("fm3 vcd: too many variables");
+        return -1;
+    }
+    v = &r->vars[r->nvars];
+
+    if (fm3_vcd_token(r, tok) < 0 || fm3_vcd_token(r, tok) < 0)
+        return -1;
+    v->width = strtoul(tok, NULL, 10);
+    if (fm3_vcd_token(r, tok) < 0)
+        return -1;
+    pstrcpy(v->id, sizeof(v->id), tok);
+    if (fm3_vcd_token(r, tok) < 0)
+        return -1;
+    fm3_vcd_map_var(v, tok);
+    if (v->block != FM3_VCD_BLOCK_NONE)
+        r->nvars++;
+
+    return fm3_vcd_skip_to_end(r);
+}
+
+static int fm3_vcd_parse_header(Fm3VcdReader *r)
+{
+    char tok[FM3_VCD_TOKEN_MAX];
+    int ret = 0;
+
+    while (ret == 0 && fm3_vcd_token(r, tok) == 0) {
+        if (strcmp(tok, "$timescale") == 0) {
+            ret = fm3_vcd_parse_timescale(r);
+        } else if (strcmp(tok, "$var") == 0) {
+            ret = fm3_vcd_parse_var(r);
+        } else if (strcmp(tok, "$enddefinitions") == 0) {
+            return fm3_vcd_skip_to_end(r);
+        } else if (tok[0] == '$') {
+            ret = fm3_vcd_skip_to_end(r);
+        }
+    }
+
+    if (ret == 0)
+        error_report("fm3 vcd: no $enddefinitions");
+    return -1;
+}
+
+static Fm3VcdVar *fm3_vcd_find_var(Fm3VcdReader *r, const char *id)
+{
+    int i;
+
+    for (i = 0; i < r->nvars; i++) {
+        if (strcmp(r->vars[i].id, id) == 0)
+            return &r->vars[i];
+    }
+    return NULL;
+}
+
+static uint32_t fm3_vcd_parse_vector(const char *str)
+{
+    uint32_t value = 0;
+
+    for (; *str; str++)
+        value = (value << 1) | (*str == '1');
+    return value;
+}
+
+static int fm3_vcd_next_binary(Fm3VcdReader *r, Fm3VcdEvent *ev)
+{
+    uint8_t rec[FM3_VCD_BINARY_RECORD_SIZE];
+
+    if (fread(rec, sizeof(rec), 1, r->fp) != 1)
+        return 0;
+
+    ev->time = ldq_le_p(&rec[0]);
+    ev->block = ldl_le_p(&rec[8]);
+    ev->mask = ldl_le_p(&rec[12]);
+    ev->value = ldl_le_p(&rec[16]);
+    ev->next.offset = ftello(r->fp);
+    ev->next.stamp = 0;
+    return 1;
+}
+
+/* Read the next input change: 1 = got one, 0 = end of file */
+int fm3_vcd_reader_next(Fm3VcdReader *r, Fm3VcdEvent *ev)
+{
+    char tok[FM3_VCD_TOKEN_MAX];
+    char id[FM3_VCD_TOKEN_MAX];
+    Fm3VcdVar *v;
+    uint32_t value, mask;
+
+    if (r->binary)
+        return fm3_vcd_next_binary(r, ev);
+
+    while (fm3_vcd_token(r, tok) == 0) {
+        switch (tok[0]) {
+        case '#':
+            r->time = strtoll(&tok[1], NULL, 10);
+            continue;
+        case '0':
+        case '1':
+        case 'x':
+        case 'X':
+        case 'z':
+        case 'Z':
+            v = fm3_vcd_find_var(r, &tok[1]);
+            if (!v)
+                continue;
+            mask = 1;
+            value = (tok[0] == '1');
+            break;
+        case 'b':
+        case 'B':
+            if (fm3_vcd_token(r, id) < 0)
+                return 0;
+            v = fm3_vcd_find_var(r, id);
+            if (!v)
+                continue;
+            mask = (v->width < 32) ? (1U << v->width) - 1 : 0xffffffff;
+            value = fm3_vcd_parse_vector(&tok[1]) & mask;
+            break;
+        case 'r':
+        case 'R':
+            /* real values are not used for pins */
+            if (fm3_vcd_token(r, id) < 0)
+                return 0;
+            continue;
+        case '$':
+            if (strcmp(tok, "$comment") == 0)
+                fm3_vcd_skip_to_end(r);
+            continue;
+        default:
+            continue;
+        }
+
+        ev->time = r->time * r->scale_ps / 1000;
+        ev->block = v->block;
+        ev->mask = mask << v->bit;
+        ev->value = value << v->bit;
+        ev->next.offset = ftello(r->fp);
+        ev->next.stamp = r->time;
+        return 1;
+    }
+
+    return 0;
+}
+
+Fm3VcdReader *fm3_vcd_reader_open(const char *path)
+{
+    Fm3VcdReader *r;
+    char magic[8];
+
+    r = g_new0(Fm3VcdReader, 1);
+    r->scale_ps = 1000;
+    r->fp = fopen(path, "rb");
+    if (!r->fp) {
+        error_report("fm3 vcd: cannot open %s: %s", path, strerror(errno));
+        g_free(r);
+        return NULL;
+    }
+
+    if (fread(magic, sizeof(magic), 1, r->fp) == 1 &&
+        memcmp(magic, FM3_VCD_BINARY_MAGIC, sizeof(magic)) == 0) {
+        r->binary = true;
+        return r;
+    }
+
+    rewind(r->fp);
+    if (fm3_vcd_parse_header(r) < 0) {
+        fm3_vcd_reader_close(r);
+        return NULL;
+    }
+    return r;
+}
+
+/* Go on from the position recorded in an event read before */
+void fm3_vcd_reader_seek(Fm3VcdReader *r, const Fm3VcdPos *pos)
+{
+    if (fseeko(r->fp, pos->offset, SEEK_SET) < 0)
+        error_report("fm3 vcd: cannot seek: %s", strerror(errno));
+    r->time = pos->stamp;
+}
+
+void fm3_vcd_reader_close(Fm3VcdReader *r)
+{
+    if (!r)
+        return;
+    fclose(r->fp);
+    g_free(r);
+}
+
+/*
+ * Recorder
+ */
+#define FM3_VCD_RING_SIZE           (8192)  /* must be a power of 2 */
+#define FM3_VCD_REC_IRQ             (0x80000000)
+
+typedef struct {
+    int64_t time;
+    uint32_t id;        /* port block No. or FM3_VCD_REC_IRQ | IRQ No. */
+    uint32_t value;
+} Fm3VcdRecord;
+
+typedef struct {
+    FILE *fp;
+    QemuThread thread;
+    QemuEvent event;
+    bool stop;
+    int64_t last_time;
+    uint64_t dropped;
+    /* single producer (device models, under the iothread lock) */
+    uint32_t head;
+    uint32_t port_last[16];
+    uint8_t irq_last[FM3_IRQ_NUM];
+    /* single consumer (writer thread) */
+    uint32_t tail;
+    Fm3VcdRecord ring[FM3_VCD_RING_SIZE];
+} Fm3VcdRecorder;
+
+static Fm3VcdRecorder *fm3_vcd_recorder;
+
+static void fm3_vcd_record(uint32_t id, uint32_t value)
+{
+    Fm3VcdRecorder *w = fm3_vcd_recorder;
+    Fm3VcdRecord *rec;
+    uint32_t head;
+
+    if (!w)
+        return;
+
+    head = w->head;
+    if (head - atomic_read(&w->tail) >= FM3_VCD_RING_SIZE) {
+        /* never stall the vCPU on a slow disk */
+        w->dropped++;
+        return;
+    }
+
+    rec = &w->ring[head & (FM3_VCD_RING_SIZE - 1)];
+    rec->time = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    rec->id = id;
+    rec->value = value;
+    smp_wmb();
+    atomic_set(&w->head, head + 1);
+    qemu_event_set(&w->event);
+}
+
+void fm3_vcd_record_port(uint32_t block_no, uint32_t value)
+{
+    Fm3VcdRecorder *w = fm3_vcd_recorder;
+
+    value &= 0xffff;
+    if (!w || 16 <= block_no || w->port_last[block_no] == value)
+        return;
+    w->port_last[block_no] = value;
+    fm3_vcd_record(block_no, value);
+}
+
+void fm3_vcd_record_irq(int irq, int level)
+{
+    Fm3VcdRecorder *w = fm3_vcd_recorder;
+
+    level = (level != 0);
+    if (!w || FM3_IRQ_NUM <= irq || w->irq_last[irq] == level)
+        return;
+    w->irq_last[irq] = level;
+    fm3_vcd_record(FM3_VCD_REC_IRQ | irq, level);
+}
+
+static void fm3_vcd_put_bits(FILE *fp, uint32_t value)
+{
+    int i;
+
+    fputc('b', fp);
+    for (i = 15; i >= 0; i--)
+        fputc('0' + ((value >> i) & 1), fp);
+}
+
+static void fm3_vcd_write_record(Fm3VcdRecorder *w, Fm3VcdRecord *rec)
+{
+    if (rec->time != w->last_time) {
+        fprintf(w->fp, "#%" PRId64 "\n", rec->time);
+        w->last_time = rec->time;
+    }
+
+    if (rec->id & FM3_VCD_REC_IRQ) {
+        fprintf(w->fp, "%u!i%02u\n", rec->value,
+                rec->id & ~FM3_VCD_REC_IRQ);
+    } else {
+        fm3_vcd_put_bits(w->fp, rec->value);
+        fprintf(w->fp, " !p%X\n", rec->id);
+    }
+}
+
+static void *fm3_vcd_writer_thread(void *opaque)
+{
+    Fm3VcdRecorder *w = opaque;
+    uint32_t head;
+
+    for (;;) {
+        qemu_event_reset(&w->event);
+        head = atomic_read(&w->head);
+        if (head == w->tail) {
+            if (atomic_read(&w->stop))
+                break;
+            fflush(w->fp);
+            qemu_event_wait(&w->event);
+            continue;
+        }
+
+        smp_rmb();
+        while (w->tail != head) {
+            fm3_vcd_write_record(w, &w->ring[w->tail & 
+                                             (FM3_VCD_RING_SIZE - 1)]);
+            atomic_set(&w->tail, w->tail + 1);
+        }
+    }
+
+    if (w->dropped)
+        fprintf(w->fp, "$comment %" PRIu64 " changes dropped $end\n",
+                w->dropped);
+    fflush(w->fp);
+    return NULL;
+}
+
+static void fm3_vcd_write_header(Fm3VcdRecorder *w)
+{
+    FILE *fp = w->fp;
+    int i;
+
+    fprintf(fp, "$version QEMU FM3 $end\n");
+    fprintf(fp, "$timescale 1ns $end\n");
+    fprintf(fp, "$scope module fm3 $end\n");
+    for (i = 0; i < 16; i++)
+        fprintf(fp, "$var wire 16 !p%X P%X $end\n", i, i);
+    for (i = 0; i < FM3_IRQ_NUM; i++)
+        fprintf(fp, "$var wire 1 !i%02d IRQ%02d $end\n", i, i);
+    fprintf(fp, "$upscope $end\n");
+    fprintf(fp, "$enddefinitions $end\n");
+
+    /* every output and request line is low after reset */
+    fprintf(fp, "#0\n$dumpvars\n");
+    for (i = 0; i < 16; i++) {
+        fm3_vcd_put_bits(fp, 0);
+        fprintf(fp, " !p%X\n", i);
+    }
+    for (i = 0; i < FM3_IRQ_NUM; i++)
+        fprintf(fp, "0!i%02d\n", i);
+    fprintf(fp, "$end\n");
+    w->last_time = 0;
+}
+
+static void fm3_vcd_recorder_exit(void)
+{
+    Fm3VcdRecorder *w = fm3_vcd_recorder;
+
+    if (!w)
+        return;
+    fm3_vcd_recorder = NULL;
+    atomic_set(&w->stop, true);
+    qemu_event_set(&w->event);
+    qemu_thread_join(&w->thread);
+    fclose(w->fp);
+}
+
+int fm3_vcd_recorder_open(const char *path)
+{
+    Fm3VcdRecorder *w;
+
+    if (fm3_vcd_recorder)
+        return 0;
+
+    w = g_new0(Fm3VcdRecorder, 1);
+    w->fp = fopen(path, "w");
+    if (!w->fp) {
+        error_report("fm3 vcd: cannot create %s: %s", path, strerror(errno));
+        g_free(w);
+        return -1;
+    }
+
+    fm3_vcd_write_header(w);
+    qemu_event_init(&w->event, false);
+    qemu_thread_create(&w->thread, "fm3.vcd", fm3_vcd_writer_thread, w,
+                       QEMU_THREAD_JOINABLE);
+    fm3_vcd_recorder = w;
+    atexit(fm3_vcd_recorder_exit);
+    return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef FM3_VCD_H
+#define FM3_VCD_H
+/*
+ * Fujitsu FM3 MCU emulator - waveform (VCD) files
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+
+/* Fm3VcdEvent.block for external interrupt inputs (mask bit = INTxx) */
+#define FM3_VCD_BLOCK_EXTI          (0xff)
+
+/* Where a reader stands: the file offset and the VCD time in effect there */
+typedef struct {
+    int64_t offset;
+    int64_t stamp;
+} Fm3VcdPos;
+
+typedef struct {
+    int64_t time;       /* ns from the start of the waveform */
+    uint32_t block;     /* port block No. or FM3_VCD_BLOCK_EXTI */
+    uint32_t mask;      /* bits which are changed */
+    uint32_t value;
+    Fm3VcdPos next;     /* position just past the event */
+} Fm3VcdEvent;
+
+typedef struct Fm3VcdReader Fm3VcdReader;
+
+Fm3VcdReader *fm3_vcd_reader_open(const char *path);
+int fm3_vcd_reader_next(Fm3VcdReader *r, Fm3VcdEvent *ev);
+void fm3_vcd_reader_seek(Fm3VcdReader *r, const Fm3VcdPos *pos);
+void fm3_vcd_reader_close(Fm3VcdReader *r);
+
+int fm3_vcd_recorder_open(const char *path);
+void fm3_vcd_record_port(uint32_t block_no, uint32_t value);
+void fm3_vcd_record_irq(int irq, int level);
+
+#endif
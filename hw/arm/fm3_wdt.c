@@ -5,13 +5,35 @@
  * Written by Masashi YOKOTA <yokota@pylone.jp>
  *
  * This code is licensed under the GNU GPL v2.
+ *
+ * Hardware watchdog (low-speed CR, NMI) and software watchdog (PCLK0,
+ * IRQ1).  The counters are not ticked: a counter is described by the
+ * virtual time of its last reload.  A feed only records that time, and
+ * the timer armed for the old deadline finds the counter fed when it
+ * expires and is re-armed from there.  The reset is done by the action
+ * of -watchdog-action (reset by default).
+ *
+ * The chip starts the HW watchdog at reset.  Firmware that never feeds or
+ * stops it would be reset every ~1.3 s, so it only runs from reset with
+ * the "hw-start" property set.
  */
 
 #include "hw/sysbus.h"
 #include "hw/devices.h"
+#include "qemu/timer.h"
+#include "sysemu/watchdog.h"
+#include "fm3.h"
 
+//#define FM3_DEBUG_WDT
 #define TYPE_FM3_WDT	"fm3.wdt"
 
+#ifdef FM3_DEBUG_WDT
+#define DPRINTF(fmt, ...)                                       \
+    do { printf(fmt, ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) do { } while (0)
+#endif
+
 /* register offsets */
 #define FM3_WDT_OFFSET_HW_LDR       (0x0000)
 #define FM3_WDT_OFFSET_HW_VLR       (0x0004)
@@ -26,10 +48,16 @@
 #define FM3_WDT_OFFSET_SW_RIS       (0x1010)
 #define FM3_WDT_OFFSET_SW_LCK       (0x1C00)
 
+#define FM3_WDT_CTL_INTEN           (1 << 0)
+#define FM3_WDT_CTL_RESEN           (1 << 1)
+
 /* unlock codes */
 #define FM3_WDT_UNLOCK              (0x1ACCE551)
 #define FM3_WDT_UNLOCK_CTL          (0xE5331AAE)
 
+/* count clock of the HW watchdog: low-speed CR */
+#define FM3_WDT_HW_CLK_HZ           (100000)
+
 /* states for unlocking */
 enum FM3_WDT_STATE {
     FM3_WDT_STATE_LOCK_ALL,
@@ -40,6 +68,14 @@ enum FM3_WDT_STATE {
 typedef struct {
     enum FM3_WDT_STATE state;
     uint32_t control;
+    uint32_t load;
+    uint32_t ris;
+    uint32_t icl;           /* HW: first word of the clear sequence */
+    bool icl_pending;
+    int64_t origin;         /* virtual time of the last reload */
+    bool hw;
+    QEMUTimer *timer;       /* at or before the next deadline */
+    qemu_irq irq;
 } Fm3WatchdogTimer;
 
 typedef struct {
@@ -47,6 +83,8 @@ typedef struct {
     MemoryRegion mmio;
     Fm3WatchdogTimer sw;
     Fm3WatchdogTimer hw;
+    bool hw_start;
+    Notifier clk_notifier;
 } Fm3WdtState;
 #define FM3_WDT(obj) \
     OBJECT_CHECK(Fm3WdtState, (obj), TYPE_FM3_WDT)
@@ -56,11 +94,11 @@ fm3_wdt_unlock_state(enum FM3_WDT_STATE state, uint32_t unlock_code)
 {
     enum FM3_WDT_STATE ret = FM3_WDT_STATE_LOCK_ALL; 
 
+    /* the first code opens all but WDG_CTL again from any state */
+    if (unlock_code == FM3_WDT_UNLOCK)
+        return FM3_WDT_STATE_LOCK_CTL;
+
     switch (state) {
-    case FM3_WDT_STATE_LOCK_ALL:
-        if (unlock_code == FM3_WDT_UNLOCK)
-            ret = FM3_WDT_STATE_LOCK_CTL; 
-        break;
     case FM3_WDT_STATE_LOCK_CTL:
         if (unlock_code == FM3_WDT_UNLOCK_CTL)
             ret = FM3_WDT_STATE_UNLOCK; 
@@ -72,56 +110,281 @@ fm3_wdt_unlock_state(enum FM3_WDT_STATE state, uint32_t unlock_code)
     return ret;
 }
 
-static uint64_t fm3_wdt_read(void *opaque, hwaddr offset,
-                             unsigned size)
+static uint32_t fm3_wdt_get_hz(Fm3WatchdogTimer *t)
 {
-    Fm3WdtState *s = (Fm3WdtState *)opaque;
-    uint64_t retval = 0;
+    if (t->hw)
+        return FM3_WDT_HW_CLK_HZ;
+    return fm3_clk_get_hz(FM3_CLK_PCLK0);
+}
+
+/* the counter goes from LDR down to 0, then reloads */
+static inline uint64_t fm3_wdt_cycle(Fm3WatchdogTimer *t)
+{
+    return (uint64_t)t->load + 1;
+}
 
+static uint64_t fm3_wdt_get_ticks(Fm3WatchdogTimer *t, int64_t now)
+{
+    if (now <= t->origin)
+        return 0;
+    return muldiv64(now - t->origin, fm3_wdt_get_hz(t), get_ticks_per_sec());
+}
+
+static uint32_t fm3_wdt_get_value(Fm3WatchdogTimer *t)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    if (!(t->control & FM3_WDT_CTL_INTEN))
+        return t->load;
+    return t->load - fm3_wdt_get_ticks(t, now) % fm3_wdt_cycle(t);
+}
+
+/* time of the next interrupt (RIS clear) or reset (RIS set), or -1 */
+static int64_t fm3_wdt_get_deadline(Fm3WatchdogTimer *t)
+{
+    if (!(t->control & FM3_WDT_CTL_INTEN))
+        return -1;
+    if (t->ris && !(t->control & FM3_WDT_CTL_RESEN))
+        return -1;
+    return t->origin + muldiv64(fm3_wdt_cycle(t), get_ticks_per_sec(),
+                                fm3_wdt_get_hz(t));
+}
+
+/* for a deadline that may have come earlier: a later one is left to
+ * the timer callback */
+static void fm3_wdt_schedule(Fm3WatchdogTimer *t)
+{
+    int64_t deadline = fm3_wdt_get_deadline(t);
+
+    if (deadline < 0) {
+        timer_del(t->timer);
+        return;
+    }
+    if (!timer_pending(t->timer) ||
+        deadline < timer_expire_time_ns(t->timer)) {
+        timer_mod(t->timer, deadline);
+    }
+}
+
+static void fm3_wdt_update_irq(Fm3WatchdogTimer *t)
+{
+    int level = t->ris && (t->control & FM3_WDT_CTL_INTEN);
+
+    if (!t->hw)
+        fm3_int_set_mon(FM3_IRQ_SWDT, 1, level);
+    qemu_set_irq(t->irq, level);
+}
+
+/* reload the counter: only the time is recorded */
+static void fm3_wdt_reload(Fm3WatchdogTimer *t)
+{
+    t->origin = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+}
+
+/* WDG_ICL: clear the interrupt and reload the counter */
+static void fm3_wdt_feed(Fm3WatchdogTimer *t)
+{
+    fm3_wdt_reload(t);
+    if (t->ris) {
+        t->ris = 0;
+        fm3_wdt_update_irq(t);
+        fm3_wdt_schedule(t);
+    }
+}
+
+static void fm3_wdt_timer_cb(void *opaque)
+{
+    Fm3WatchdogTimer *t = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    int64_t deadline = fm3_wdt_get_deadline(t);
+
+    if (deadline < 0)
+        return;
+    if (now < deadline) {
+        /* fed since the timer was armed */
+        timer_mod(t->timer, deadline);
+        return;
+    }
+
+    t->origin = deadline;
+    if (!t->ris) {
+        DPRINTF("FM3_WDT: %s watchdog interrupt\n", t->hw ? "H/W" : "S/W");
+        t->ris = 1;
+        fm3_wdt_update_irq(t);
+    } else {
+        printf("FM3_WDT: %s watchdog reset\n", t->hw ? "H/W" : "S/W");
+        watchdog_perform_action();
+    }
+    fm3_wdt_schedule(t);
+}
+
+/* the SW watchdog has the same layout from FM3_WDT_OFFSET_SW_LDR */
+static uint64_t fm3_wdt_read_timer(Fm3WatchdogTimer *t, hwaddr offset)
+{
     switch (offset) {
+    case FM3_WDT_OFFSET_HW_LDR:
+        return t->load;
+    case FM3_WDT_OFFSET_HW_VLR:
+        return fm3_wdt_get_value(t);
     case FM3_WDT_OFFSET_HW_CTL:
-        retval = s->hw.control & 3;
-        break;
+        return t->control & 3;
+    case FM3_WDT_OFFSET_HW_RIS:
+        return t->ris;
     case FM3_WDT_OFFSET_HW_LCK:
-        if (s->hw.state != FM3_WDT_STATE_UNLOCK)
-            retval = 1;
-        break;
+        return t->state != FM3_WDT_STATE_UNLOCK;
     default:
-        break;
+        return 0;
     }
+}
 
-    return retval;
+static void fm3_wdt_write_ctl(Fm3WatchdogTimer *t, uint32_t value)
+{
+    uint32_t old = t->control;
+
+    if (t->hw && ((old ^ value) & FM3_WDT_CTL_INTEN))
+        printf("FM3_WDT: H/W watchdog timer is %s\n",
+               (value & FM3_WDT_CTL_INTEN) ? "enabled" : "disabled");
+
+    t->control = value & 3;
+    if (!(old & FM3_WDT_CTL_INTEN) && (t->control & FM3_WDT_CTL_INTEN))
+        fm3_wdt_reload(t);
+    fm3_wdt_update_irq(t);
+    fm3_wdt_schedule(t);
 }
 
-static void fm3_wdt_write(void *opaque, hwaddr offset,
-                          uint64_t value, unsigned size)
+/* HW watchdog: registers are locked again after each write, WDG_CTL
+ * needs both unlock codes, WDG_ICL takes a word and then its inverse.
+ * The lock stays open between the two words of WDG_ICL, and unlocking
+ * again in between keeps the first word. */
+static void fm3_wdt_write_hw(Fm3WatchdogTimer *t, hwaddr offset,
+                             uint32_t value)
 {
-    Fm3WdtState *s = (Fm3WdtState *)opaque;
+    if (offset == FM3_WDT_OFFSET_HW_LCK) {
+        t->state = fm3_wdt_unlock_state(t->state, value);
+        return;
+    }
+    if (t->state == FM3_WDT_STATE_LOCK_ALL)
+        return;
 
     switch (offset) {
+    case FM3_WDT_OFFSET_HW_LDR:
+        t->load = value;
+        fm3_wdt_reload(t);
+        fm3_wdt_schedule(t);
+        break;
     case FM3_WDT_OFFSET_HW_CTL:
-        if (s->hw.state != FM3_WDT_STATE_UNLOCK)
+        if (t->state != FM3_WDT_STATE_UNLOCK)
             break;
+        fm3_wdt_write_ctl(t, value);
+        break;
+    case FM3_WDT_OFFSET_HW_ICL:
+        if (!t->icl_pending) {
+            t->icl = value & 0xff;
+            t->icl_pending = true;
+            return;
+        }
+        t->icl_pending = false;
+        if (((t->icl ^ value) & 0xff) == 0xff)
+            fm3_wdt_feed(t);
+        break;
+    default:
+        return;
+    }
+    t->state = FM3_WDT_STATE_LOCK_ALL;
+}
 
-        printf("FM3_WDT: H/W watchdog timer is %s\n",
-               (value & 2) ? "enabled" : "disabled");
+/* SW watchdog: one unlock code opens all registers until locked again */
+static void fm3_wdt_write_sw(Fm3WatchdogTimer *t, hwaddr offset,
+                             uint32_t value)
+{
+    if (offset == FM3_WDT_OFFSET_HW_LCK) {
+        t->state = (value == FM3_WDT_UNLOCK) ? FM3_WDT_STATE_UNLOCK :
+                                               FM3_WDT_STATE_LOCK_ALL;
+        return;
+    }
+    if (t->state != FM3_WDT_STATE_UNLOCK)
+        return;
 
-        s->hw.control = value & 3;
+    switch (offset) {
+    case FM3_WDT_OFFSET_HW_LDR:
+        t->load = value;
+        fm3_wdt_reload(t);
+        fm3_wdt_schedule(t);
         break;
-    case FM3_WDT_OFFSET_HW_LCK:
-        s->hw.state = fm3_wdt_unlock_state(s->hw.state, value);
+    case FM3_WDT_OFFSET_HW_CTL:
+        fm3_wdt_write_ctl(t, value);
+        break;
+    case FM3_WDT_OFFSET_HW_ICL:
+        fm3_wdt_feed(t);
         break;
     default:
         break;
     }
 }
 
+static uint64_t fm3_wdt_read(void *opaque, hwaddr offset,
+                             unsigned size)
+{
+    Fm3WdtState *s = (Fm3WdtState *)opaque;
+
+    if (offset < FM3_WDT_OFFSET_SW_LDR)
+        return fm3_wdt_read_timer(&s->hw, offset);
+    return fm3_wdt_read_timer(&s->sw, offset - FM3_WDT_OFFSET_SW_LDR);
+}
+
+static void fm3_wdt_write(void *opaque, hwaddr offset,
+                          uint64_t value, unsigned size)
+{
+    Fm3WdtState *s = (Fm3WdtState *)opaque;
+
+    if (offset < FM3_WDT_OFFSET_SW_LDR)
+        fm3_wdt_write_hw(&s->hw, offset, value);
+    else
+        fm3_wdt_write_sw(&s->sw, offset - FM3_WDT_OFFSET_SW_LDR, value);
+}
+
 static const MemoryRegionOps fm3_wdt_mem_ops = {
     .read = fm3_wdt_read,
     .write = fm3_wdt_write,
     .endianness = DEVICE_NATIVE_ENDIAN,
 };
 
+/* PCLK0 has changed: the SW watchdog keeps its count */
+static void fm3_wdt_clk_changed(Notifier *n, void *data)
+{
+    Fm3WdtState *s = container_of(n, Fm3WdtState, clk_notifier);
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    s->sw.origin = fm3_clk_rescale(s->sw.origin, now, data);
+    timer_del(s->sw.timer);
+    fm3_wdt_schedule(&s->sw);
+}
+
+static void fm3_wdt_timer_reset(Fm3WatchdogTimer *t, uint32_t load,
+                                uint32_t control)
+{
+    t->state = FM3_WDT_STATE_LOCK_ALL;
+    t->load = load;
+    t->control = control;
+    t->ris = 0;
+    t->icl = 0;
+    t->icl_pending = false;
+    timer_del(t->timer);
+    fm3_wdt_reload(t);
+    fm3_wdt_update_irq(t);
+    fm3_wdt_schedule(t);
+}
+
+static void fm3_wdt_reset(DeviceState *d)
+{
+    Fm3WdtState *s = FM3_WDT(d);
+
+    /* with hw-start, the HW watchdog runs until the firmware stops it */
+    fm3_wdt_timer_reset(&s->hw, 0xffff, s->hw_start ?
+                        FM3_WDT_CTL_INTEN | FM3_WDT_CTL_RESEN : 0);
+    fm3_wdt_timer_reset(&s->sw, 0xffffffff, 0);
+}
+
 static int fm3_wdt_init(SysBusDevice *dev)
 {
 	DeviceState		*devs	= DEVICE(dev);
@@ -131,13 +394,54 @@ static int fm3_wdt_init(SysBusDevice *dev)
                           TYPE_FM3_WDT, 0x2000);
     sysbus_init_mmio(dev, &s->mmio);
 
+    s->hw.hw = true;
+    s->hw.timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, fm3_wdt_timer_cb, &s->hw);
+    s->sw.timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, fm3_wdt_timer_cb, &s->sw);
+    sysbus_init_irq(dev, &s->hw.irq);   /* NMI */
+    sysbus_init_irq(dev, &s->sw.irq);   /* IRQ1 */
+    s->clk_notifier.notify = fm3_wdt_clk_changed;
+    fm3_clk_add_notifier(FM3_CLK_PCLK0, &s->clk_notifier);
+
     s->sw.state = FM3_WDT_STATE_LOCK_ALL;
     s->hw.state = FM3_WDT_STATE_LOCK_ALL;
 
     return 0;
 }
 
+static const VMStateDescription vmstate_fm3_wdt_timer = {
+    .name = "fm3.wdt/timer",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(state, Fm3WatchdogTimer),
+        VMSTATE_UINT32(control, Fm3WatchdogTimer),
+        VMSTATE_UINT32(load, Fm3WatchdogTimer),
+        VMSTATE_UINT32(ris, Fm3WatchdogTimer),
+        VMSTATE_UINT32(icl, Fm3WatchdogTimer),
+        VMSTATE_BOOL(icl_pending, Fm3WatchdogTimer),
+        VMSTATE_INT64(origin, Fm3WatchdogTimer),
+        VMSTATE_TIMER(timer, Fm3WatchdogTimer),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_fm3_wdt = {
+    .name = TYPE_FM3_WDT,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_STRUCT(sw, Fm3WdtState, 1, 
+                       vmstate_fm3_wdt_timer, Fm3WatchdogTimer),
+        VMSTATE_STRUCT(hw, Fm3WdtState, 1, 
+                       vmstate_fm3_wdt_timer, Fm3WatchdogTimer),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property fm3_wdt_properties[] = {
+    DEFINE_PROP_BOOL("hw-start", Fm3WdtState, hw_start, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -148,6 +452,8 @@ static void fm3_wdt_class_init(ObjectClass *klass, void *data)
 
 	k->init		= fm3_wdt_init;			/* ֐o^		*/
 	dc->desc	= TYPE_FM3_WDT;		/* n[hEFA		*/
+	dc->reset	= fm3_wdt_reset;
+	dc->vmsd	= &vmstate_fm3_wdt;
 	dc->props	= fm3_wdt_properties;	/* 				*/
 }
 
@@ -8,20 +8,48 @@
  *
  * The ARMv7M System controller is fairly tightly tied in with the
  * NVIC.  Much of that is also implemented here.
+ *
+ * The state of each exception (priority, enabled, pending, active and the
+ * level of its input line) is kept per vector.  Vectors that are both
+ * pending and enabled are also kept in one bitmap per priority level,
+ * and the levels that have any in another bitmap, so the highest priority
+ * pending exception is found with two bit searches whatever the number
+ * of lines.  Active exceptions are counted per priority level the same
+ * way to give the running priority.
  */
 
 #include "hw/sysbus.h"
 #include "qemu/timer.h"
+#include "qemu/bitmap.h"
 #include "hw/ptimer.h"
 #include "hw/arm/arm.h"
 #include "qemu/main-loop.h"
 #include "exec/address-spaces.h"
-#include "gic_internal.h"
 
 #define SYSTICK_USES_PTIMER
 
+/* The v7M may have anything from 0 to 496 external interrupt lines.  */
+#define NVIC_MAX_IRQ        496
+#define NVIC_MAX_VECTORS    (16 + NVIC_MAX_IRQ)
+
+/* Priority levels: Reset (-3), NMI (-2), HardFault (-1), then 0..255.  */
+#define NVIC_LEVEL_NMI      1
+#define NVIC_LEVEL_HARD     2
+#define NVIC_LEVEL_BASE     3
+#define NVIC_NUM_LEVELS     (NVIC_LEVEL_BASE + 256)
+
+typedef struct {
+    uint8_t prio;
+    uint8_t enabled;
+    uint8_t pending;
+    uint8_t active;
+    uint8_t level;          /* input line, external interrupts only */
+} VecInfo;
+
 typedef struct {
-    GICState gic;
+    SysBusDevice busdev;
+    VecInfo vectors[NVIC_MAX_VECTORS];
+    uint32_t prigroup;
     struct {
         uint32_t control;
         uint32_t reload;
@@ -32,43 +60,26 @@ typedef struct {
         QEMUTimer *timer;
 #endif
     } systick;
-    MemoryRegion sysregmem;
-    MemoryRegion gic_iomem_alias;
-    MemoryRegion container;
+    MemoryRegion iomem;
+    qemu_irq parent_irq;
     uint32_t num_irq;
+    uint32_t num_vectors;
+
+    /* Derived from vectors[], rebuilt after migration.  */
+    unsigned long *ready;   /* pending and enabled, per priority level */
+    uint32_t ready_longs;   /* size of the bitmap of one level */
+    DECLARE_BITMAP(ready_levels, NVIC_NUM_LEVELS);
+    uint16_t active_count[NVIC_NUM_LEVELS];
+    DECLARE_BITMAP(active_levels, NVIC_NUM_LEVELS);
+    uint32_t num_active;
+    int vectpending;        /* highest priority ready vector, 0 if none */
 } nvic_state;
 
-static uint32_t nvic_readb(nvic_state *s, uint32_t offset);
 static uint32_t nvic_readl(nvic_state *s, uint32_t offset);
-static void nvic_writeb(nvic_state *s, uint32_t offset, uint32_t value);
 static void nvic_writel(nvic_state *s, uint32_t offset, uint32_t value);
 
-/* Only a single "CPU" interface is present.  */
-static inline int
-gic_get_current_cpu(void)
-{
-    return 0;
-}
-
 #define TYPE_NVIC "armv7m_nvic"
-/**
- * NVICClass:
- * @parent_reset: the parent class' reset handler.
- *
- * A model of the v7M NVIC and System Controller
- */
-typedef struct NVICClass {
-    /*< private >*/
-    ARMGICClass parent_class;
-    /*< public >*/
-    DeviceRealize parent_realize;
-    void (*parent_reset)(DeviceState *dev);
-} NVICClass;
-
-#define NVIC_CLASS(klass) \
-    OBJECT_CLASS_CHECK(NVICClass, (klass), TYPE_NVIC)
-#define NVIC_GET_CLASS(obj) \
-    OBJECT_GET_CLASS(NVICClass, (obj), TYPE_NVIC)
+
 #define NVIC(obj) \
     OBJECT_CHECK(nvic_state, (obj), TYPE_NVIC)
 
@@ -137,53 +148,288 @@ static void systick_reset(nvic_state *s)
 #endif
 }
 
+/* Priority level of a vector; lower levels preempt higher ones.  */
+static inline int nvic_get_level(nvic_state *s, int vec)
+{
+    switch (vec) {
+    case ARMV7M_EXCP_NMI:
+        return NVIC_LEVEL_NMI;
+    case ARMV7M_EXCP_HARD:
+        return NVIC_LEVEL_HARD;
+    default:
+        return NVIC_LEVEL_BASE + s->vectors[vec].prio;
+    }
+}
+
+/* Group priority part of a level, which alone decides preemption.  */
+static inline int nvic_get_group(nvic_state *s, int level)
+{
+    if (level < NVIC_LEVEL_BASE) {
+        return level;
+    }
+    return NVIC_LEVEL_BASE +
+           ((level - NVIC_LEVEL_BASE) & ~((2 << s->prigroup) - 1) & 0xff);
+}
+
+static inline unsigned long *nvic_ready_map(nvic_state *s, int level)
+{
+    return s->ready + level * s->ready_longs;
+}
+
+static void nvic_ready_add(nvic_state *s, int vec, int level)
+{
+    set_bit(vec, nvic_ready_map(s, level));
+    set_bit(level, s->ready_levels);
+}
+
+static void nvic_ready_remove(nvic_state *s, int vec, int level)
+{
+    unsigned long *map = nvic_ready_map(s, level);
+
+    clear_bit(vec, map);
+    if (find_first_bit(map, s->num_vectors) >= s->num_vectors) {
+        clear_bit(level, s->ready_levels);
+    }
+}
+
+/* Bring the ready bitmaps in line with the state of one vector.  */
+static void nvic_sync_vector(nvic_state *s, int vec)
+{
+    VecInfo *v = &s->vectors[vec];
+    int level = nvic_get_level(s, vec);
+
+    if (v->pending && v->enabled) {
+        nvic_ready_add(s, vec, level);
+    } else if (test_bit(vec, nvic_ready_map(s, level))) {
+        nvic_ready_remove(s, vec, level);
+    }
+}
+
+static void nvic_activate(nvic_state *s, int vec)
+{
+    int level = nvic_get_level(s, vec);
+
+    s->vectors[vec].active = 1;
+    if (s->active_count[level]++ == 0) {
+        set_bit(level, s->active_levels);
+    }
+    s->num_active++;
+}
+
+static void nvic_deactivate(nvic_state *s, int vec)
+{
+    int level = nvic_get_level(s, vec);
+
+    if (!s->vectors[vec].active) {
+        return;
+    }
+    s->vectors[vec].active = 0;
+    if (--s->active_count[level] == 0) {
+        clear_bit(level, s->active_levels);
+    }
+    s->num_active--;
+}
+
+/* Find the highest priority ready vector and tell the CPU whether it
+ * preempts the running priority.  The lowest vector number wins among
+ * vectors of the same level.  */
+static void nvic_update(nvic_state *s)
+{
+    int level, running;
+
+    s->vectpending = 0;
+    level = find_first_bit(s->ready_levels, NVIC_NUM_LEVELS);
+    if (level < NVIC_NUM_LEVELS) {
+        s->vectpending = find_first_bit(nvic_ready_map(s, level),
+                                        s->num_vectors);
+    }
+    running = find_first_bit(s->active_levels, NVIC_NUM_LEVELS);
+    qemu_set_irq(s->parent_irq, s->vectpending &&
+                 (running == NVIC_NUM_LEVELS ||
+                  nvic_get_group(s, level) < nvic_get_group(s, running)));
+}
+
+static void nvic_set_prio(nvic_state *s, int vec, uint8_t prio)
+{
+    VecInfo *v = &s->vectors[vec];
+    int level = nvic_get_level(s, vec);
+    bool ready = test_bit(vec, nvic_ready_map(s, level));
+    bool active = v->active;
+
+    if (ready) {
+        nvic_ready_remove(s, vec, level);
+    }
+    if (active) {
+        nvic_deactivate(s, vec);
+    }
+    v->prio = prio;
+    if (ready) {
+        nvic_ready_add(s, vec, nvic_get_level(s, vec));
+    }
+    if (active) {
+        nvic_activate(s, vec);
+    }
+}
+
+static void nvic_set_pending(nvic_state *s, int vec)
+{
+    /* A fault whose handler is disabled escalates to HardFault.  */
+    if ((vec == ARMV7M_EXCP_MEM || vec == ARMV7M_EXCP_BUS ||
+         vec == ARMV7M_EXCP_USAGE) && !s->vectors[vec].enabled) {
+        vec = ARMV7M_EXCP_HARD;
+    }
+    if (s->vectors[vec].pending) {
+        return;
+    }
+    s->vectors[vec].pending = 1;
+    nvic_sync_vector(s, vec);
+    nvic_update(s);
+}
+
+static void nvic_clear_pending(nvic_state *s, int vec)
+{
+    /* A line that is still asserted makes the interrupt pending again.  */
+    if (!s->vectors[vec].pending || s->vectors[vec].level) {
+        return;
+    }
+    s->vectors[vec].pending = 0;
+    nvic_sync_vector(s, vec);
+    nvic_update(s);
+}
+
+static void nvic_set_enabled(nvic_state *s, int vec, bool enabled)
+{
+    if (s->vectors[vec].enabled == enabled) {
+        return;
+    }
+    s->vectors[vec].enabled = enabled;
+    nvic_sync_vector(s, vec);
+    nvic_update(s);
+}
+
+/* External interrupt lines: an assertion makes the interrupt pending.  */
+static void nvic_set_irq(void *opaque, int n, int level)
+{
+    nvic_state *s = (nvic_state *)opaque;
+    int vec = 16 + n;
+
+    s->vectors[vec].level = level != 0;
+    if (level) {
+        nvic_set_pending(s, vec);
+    }
+}
+
+static void nvic_rebuild(nvic_state *s)
+{
+    int vec;
+
+    memset(s->ready, 0,
+           NVIC_NUM_LEVELS * s->ready_longs * sizeof(unsigned long));
+    bitmap_zero(s->ready_levels, NVIC_NUM_LEVELS);
+    memset(s->active_count, 0, sizeof(s->active_count));
+    bitmap_zero(s->active_levels, NVIC_NUM_LEVELS);
+    s->num_active = 0;
+    for (vec = 1; vec < s->num_vectors; vec++) {
+        nvic_sync_vector(s, vec);
+        if (s->vectors[vec].active) {
+            nvic_activate(s, vec);
+        }
+    }
+    nvic_update(s);
+}
+
 /* The external routines use the hardware vector numbering, ie. the first
-   IRQ is #16.  The internal GIC routines use #32 as the first IRQ.  */
+   IRQ is #16.  */
 void armv7m_nvic_set_pending(void *opaque, int irq)
 {
     nvic_state *s = (nvic_state *)opaque;
-    if (irq >= 16)
-        irq += 16;
-    gic_set_pending_private(&s->gic, 0, irq);
+
+    nvic_set_pending(s, irq);
 }
 
 /* Make pending IRQ active.  */
 int armv7m_nvic_acknowledge_irq(void *opaque)
 {
     nvic_state *s = (nvic_state *)opaque;
-    uint32_t irq;
+    int irq = s->vectpending;
 
-    irq = gic_acknowledge_irq(&s->gic, 0);
-    if (irq == 1023)
+    if (irq == 0)
         hw_error("Interrupt but no vector\n");
-    if (irq >= 32)
-        irq -= 16;
+    s->vectors[irq].pending = 0;
+    nvic_sync_vector(s, irq);
+    nvic_activate(s, irq);
+    nvic_update(s);
     return irq;
 }
 
 void armv7m_nvic_complete_irq(void *opaque, int irq)
 {
     nvic_state *s = (nvic_state *)opaque;
-    if (irq >= 16)
-        irq += 16;
-    gic_complete_irq(&s->gic, 0, irq);
+
+    nvic_deactivate(s, irq);
+    if (irq >= 16 && s->vectors[irq].level && !s->vectors[irq].pending) {
+        /* The line is still asserted.  */
+        s->vectors[irq].pending = 1;
+        nvic_sync_vector(s, irq);
+    }
+    nvic_update(s);
 }
 
+/* Reset, NMI and HardFault have fixed negative priorities.  */
 int armv7m_nvic_get_priority(void *opaque, int irq)
 {
-    GICState *s = &((nvic_state *)opaque)->gic;
-    if (irq >= 16)
-        irq += 16;
-    return GIC_GET_PRIORITY(irq, gic_get_current_cpu());
+    nvic_state *s = (nvic_state *)opaque;
+
+    switch (irq) {
+    case ARMV7M_EXCP_RESET:
+        return -3;
+    case ARMV7M_EXCP_NMI:
+        return -2;
+    case ARMV7M_EXCP_HARD:
+        return -1;
+    default:
+        return s->vectors[irq].prio;
+    }
 }
 
 int armv7m_nvic_get_current_pending(void* opaque)
 {
-    GICState *s = &((nvic_state *)opaque)->gic;
-    int irq = s->current_pending[gic_get_current_cpu()];
-    if (irq >= 32)
-        irq -= 16;
-    return irq;
+    nvic_state *s = (nvic_state *)opaque;
+
+    return s->vectpending;
+}
+
+/* One bit per external interrupt, 32 to a register.  */
+static uint32_t nvic_get_bits(nvic_state *s, uint32_t offset, size_t field)
+{
+    int vec = 16 + (offset & 0x3c) * 8;
+    uint32_t val = 0;
+    int i;
+
+    for (i = 0; i < 32 && vec + i < s->num_vectors; i++) {
+        if (*((uint8_t *)&s->vectors[vec + i] + field))
+            val |= 1U << i;
+    }
+    return val;
+}
+
+static void nvic_set_bits(nvic_state *s, uint32_t offset, size_t field,
+                          uint32_t value, bool set)
+{
+    int vec = 16 + (offset & 0x3c) * 8;
+    VecInfo *v;
+    int i;
+
+    for (i = 0; i < 32 && vec + i < s->num_vectors; i++) {
+        if (!(value & (1U << i)))
+            continue;
+        v = &s->vectors[vec + i];
+        if (field == offsetof(VecInfo, pending) && !set && v->level)
+            continue;
+        *((uint8_t *)v + field) = set;
+        nvic_sync_vector(s, vec + i);
+    }
+    nvic_update(s);
 }
 
 static uint32_t nvic_readl(nvic_state *s, uint32_t offset)
@@ -194,7 +440,7 @@ static uint32_t nvic_readl(nvic_state *s, uint32_t offset)
 
     switch (offset) {
     case 4: /* Interrupt Control Type.  */
-        return (s->num_irq / 32) - 1;
+        return DIV_ROUND_UP(s->num_irq, 32) - 1;
     case 0x10: /* SysTick Control and Status.  */
         val = s->systick.control;
         s->systick.control &= ~SYSTICK_COUNTFLAG;
@@ -223,47 +469,49 @@ static uint32_t nvic_readl(nvic_state *s, uint32_t offset)
 #endif
     case 0x1c: /* SysTick Calibration Value.  */
         return 10000;
+    case 0x100 ... 0x13c: /* Interrupt Set Enable.  */
+    case 0x180 ... 0x1bc: /* Interrupt Clear Enable.  */
+        return nvic_get_bits(s, offset, offsetof(VecInfo, enabled));
+    case 0x200 ... 0x23c: /* Interrupt Set Pending.  */
+    case 0x280 ... 0x2bc: /* Interrupt Clear Pending.  */
+        return nvic_get_bits(s, offset, offsetof(VecInfo, pending));
+    case 0x300 ... 0x33c: /* Interrupt Active Bit.  */
+        return nvic_get_bits(s, offset, offsetof(VecInfo, active));
     case 0xd00: /* CPUID Base.  */
         cpu = ARM_CPU(current_cpu);
         return cpu->env.cp15.c0_cpuid;
     case 0xd04: /* Interrupt Control State.  */
         /* VECTACTIVE */
-        val = s->gic.running_irq[0];
-        if (val == 1023) {
-            val = 0;
-        } else if (val >= 32) {
-            val -= 16;
-        }
+        cpu = ARM_CPU(current_cpu);
+        val = cpu->env.v7m.exception;
         /* RETTOBASE */
-        if (s->gic.running_irq[0] == 1023
-                || s->gic.last_active[s->gic.running_irq[0]][0] == 1023) {
+        if (s->num_active <= 1) {
             val |= (1 << 11);
         }
         /* VECTPENDING */
-        if (s->gic.current_pending[0] != 1023)
-            val |= (s->gic.current_pending[0] << 12);
+        val |= (s->vectpending << 12);
         /* ISRPENDING */
-        for (irq = 32; irq < s->num_irq; irq++) {
-            if (s->gic.irq_state[irq].pending) {
+        for (irq = 16; irq < s->num_vectors; irq++) {
+            if (s->vectors[irq].pending) {
                 val |= (1 << 22);
                 break;
             }
         }
         /* PENDSTSET */
-        if (s->gic.irq_state[ARMV7M_EXCP_SYSTICK].pending)
+        if (s->vectors[ARMV7M_EXCP_SYSTICK].pending)
             val |= (1 << 26);
         /* PENDSVSET */
-        if (s->gic.irq_state[ARMV7M_EXCP_PENDSV].pending)
+        if (s->vectors[ARMV7M_EXCP_PENDSV].pending)
             val |= (1 << 28);
         /* NMIPENDSET */
-        if (s->gic.irq_state[ARMV7M_EXCP_NMI].pending)
+        if (s->vectors[ARMV7M_EXCP_NMI].pending)
             val |= (1 << 31);
         return val;
     case 0xd08: /* Vector Table Offset.  */
         cpu = ARM_CPU(current_cpu);
         return cpu->env.v7m.vecbase;
     case 0xd0c: /* Application Interrupt/Reset Control.  */
-        return 0xfa05000;
+        return 0xfa050000 | (s->prigroup << 8);
     case 0xd10: /* System Control.  */
         /* TODO: Implement SLEEPONEXIT.  */
         return 0;
@@ -272,20 +520,20 @@ static uint32_t nvic_readl(nvic_state *s, uint32_t offset)
         return 0;
     case 0xd24: /* System Handler Status.  */
         val = 0;
-        if (s->gic.irq_state[ARMV7M_EXCP_MEM].active) val |= (1 << 0);
-        if (s->gic.irq_state[ARMV7M_EXCP_BUS].active) val |= (1 << 1);
-        if (s->gic.irq_state[ARMV7M_EXCP_USAGE].active) val |= (1 << 3);
-        if (s->gic.irq_state[ARMV7M_EXCP_SVC].active) val |= (1 << 7);
-        if (s->gic.irq_state[ARMV7M_EXCP_DEBUG].active) val |= (1 << 8);
-        if (s->gic.irq_state[ARMV7M_EXCP_PENDSV].active) val |= (1 << 10);
-        if (s->gic.irq_state[ARMV7M_EXCP_SYSTICK].active) val |= (1 << 11);
-        if (s->gic.irq_state[ARMV7M_EXCP_USAGE].pending) val |= (1 << 12);
-        if (s->gic.irq_state[ARMV7M_EXCP_MEM].pending) val |= (1 << 13);
-        if (s->gic.irq_state[ARMV7M_EXCP_BUS].pending) val |= (1 << 14);
-        if (s->gic.irq_state[ARMV7M_EXCP_SVC].pending) val |= (1 << 15);
-        if (s->gic.irq_state[ARMV7M_EXCP_MEM].enabled) val |= (1 << 16);
-        if (s->gic.irq_state[ARMV7M_EXCP_BUS].enabled) val |= (1 << 17);
-        if (s->gic.irq_state[ARMV7M_EXCP_USAGE].enabled) val |= (1 << 18);
+        if (s->vectors[ARMV7M_EXCP_MEM].active) val |= (1 << 0);
+        if (s->vectors[ARMV7M_EXCP_BUS].active) val |= (1 << 1);
+        if (s->vectors[ARMV7M_EXCP_USAGE].active) val |= (1 << 3);
+        if (s->vectors[ARMV7M_EXCP_SVC].active) val |= (1 << 7);
+        if (s->vectors[ARMV7M_EXCP_DEBUG].active) val |= (1 << 8);
+        if (s->vectors[ARMV7M_EXCP_PENDSV].active) val |= (1 << 10);
+        if (s->vectors[ARMV7M_EXCP_SYSTICK].active) val |= (1 << 11);
+        if (s->vectors[ARMV7M_EXCP_USAGE].pending) val |= (1 << 12);
+        if (s->vectors[ARMV7M_EXCP_MEM].pending) val |= (1 << 13);
+        if (s->vectors[ARMV7M_EXCP_BUS].pending) val |= (1 << 14);
+        if (s->vectors[ARMV7M_EXCP_SVC].pending) val |= (1 << 15);
+        if (s->vectors[ARMV7M_EXCP_MEM].enabled) val |= (1 << 16);
+        if (s->vectors[ARMV7M_EXCP_BUS].enabled) val |= (1 << 17);
+        if (s->vectors[ARMV7M_EXCP_USAGE].enabled) val |= (1 << 18);
         return val;
     case 0xd28: /* Configurable Fault Status.  */
         /* TODO: Implement Fault Status.  */
@@ -379,6 +627,18 @@ static void nvic_writel(nvic_state *s, uint32_t offset, uint32_t value)
 #endif
         s->systick.control &= ~SYSTICK_COUNTFLAG;
         break;
+    case 0x100 ... 0x13c: /* Interrupt Set Enable.  */
+        nvic_set_bits(s, offset, offsetof(VecInfo, enabled), value, true);
+        break;
+    case 0x180 ... 0x1bc: /* Interrupt Clear Enable.  */
+        nvic_set_bits(s, offset, offsetof(VecInfo, enabled), value, false);
+        break;
+    case 0x200 ... 0x23c: /* Interrupt Set Pending.  */
+        nvic_set_bits(s, offset, offsetof(VecInfo, pending), value, true);
+        break;
+    case 0x280 ... 0x2bc: /* Interrupt Clear Pending.  */
+        nvic_set_bits(s, offset, offsetof(VecInfo, pending), value, false);
+        break;
     case 0xd04: /* Interrupt Control State.  */
         if (value & (1 << 31)) {
             armv7m_nvic_set_pending(s, ARMV7M_EXCP_NMI);
@@ -386,14 +646,12 @@ static void nvic_writel(nvic_state *s, uint32_t offset, uint32_t value)
         if (value & (1 << 28)) {
             armv7m_nvic_set_pending(s, ARMV7M_EXCP_PENDSV);
         } else if (value & (1 << 27)) {
-            s->gic.irq_state[ARMV7M_EXCP_PENDSV].pending = 0;
-            gic_update(&s->gic);
+            nvic_clear_pending(s, ARMV7M_EXCP_PENDSV);
         }
         if (value & (1 << 26)) {
             armv7m_nvic_set_pending(s, ARMV7M_EXCP_SYSTICK);
         } else if (value & (1 << 25)) {
-            s->gic.irq_state[ARMV7M_EXCP_SYSTICK].pending = 0;
-            gic_update(&s->gic);
+            nvic_clear_pending(s, ARMV7M_EXCP_SYSTICK);
         }
         break;
     case 0xd08: /* Vector Table Offset.  */
@@ -402,6 +660,8 @@ static void nvic_writel(nvic_state *s, uint32_t offset, uint32_t value)
         break;
     case 0xd0c: /* Application Interrupt/Reset Control.  */
         if ((value >> 16) == 0x05fa) {
+            s->prigroup = (value >> 8) & 7;
+            nvic_update(s);
             if (value & 2) {
                 qemu_log_mask(LOG_UNIMP, "VECTCLRACTIVE unimplemented\n");
             }
@@ -418,9 +678,9 @@ static void nvic_writel(nvic_state *s, uint32_t offset, uint32_t value)
     case 0xd24: /* System Handler Control.  */
         /* TODO: Real hardware allows you to set/clear the active bits
            under some circumstances.  We don't implement this.  */
-        s->gic.irq_state[ARMV7M_EXCP_MEM].enabled = (value & (1 << 16)) != 0;
-        s->gic.irq_state[ARMV7M_EXCP_BUS].enabled = (value & (1 << 17)) != 0;
-        s->gic.irq_state[ARMV7M_EXCP_USAGE].enabled = (value & (1 << 18)) != 0;
+        nvic_set_enabled(s, ARMV7M_EXCP_MEM, (value & (1 << 16)) != 0);
+        nvic_set_enabled(s, ARMV7M_EXCP_BUS, (value & (1 << 17)) != 0);
+        nvic_set_enabled(s, ARMV7M_EXCP_USAGE, (value & (1 << 18)) != 0);
         break;
     case 0xd28: /* Configurable Fault Status.  */
     case 0xd2c: /* Hard Fault Status.  */
@@ -433,7 +693,7 @@ static void nvic_writel(nvic_state *s, uint32_t offset, uint32_t value)
         break;
     case 0xf00: /* Software Triggered Interrupt Register */
         if ((value & 0x1ff) < s->num_irq) {
-            gic_set_pending_private(&s->gic, 0, value & 0x1ff);
+            nvic_set_pending(s, 16 + (value & 0x1ff));
         }
         break;
     default:
@@ -442,34 +702,19 @@ static void nvic_writel(nvic_state *s, uint32_t offset, uint32_t value)
     }
 }
 
-static uint32_t nvic_readb(nvic_state *s, uint32_t offset)
+/* Vector whose priority byte is at "offset", if it is implemented.  */
+static bool nvic_prio_vector(nvic_state *s, uint32_t offset, int *vec)
 {
-    uint32_t retval = 0;
-    uint32_t offset_base = ((offset + 4) & ~3) - 4;
-
-    if (offset < 0xd00) {
-        printf("%s: offset = %x\n", __func__, offset);
-        return 0;
-    }
-    retval = (nvic_readl(s, offset_base) >> (8 * (offset - offset_base))) & 0xff;
-    return retval;
-}
-
-static void nvic_writeb(nvic_state *s, uint32_t offset, uint32_t value)
-{
-    uint32_t offset_base = ((offset + 4) & ~3) - 4;
-    uint32_t tmp;
-    uint32_t shift;
-
-    if (offset < 0xd00) {
-        printf("%s: offset = %x\n", __func__, offset);
-        return;
+    if (offset >= 0xd18 && offset <= 0xd23) {
+        /* System Handler Priority.  */
+        *vec = offset - 0xd14;
+    } else if (offset >= 0x400 && offset < 0x5f0) {
+        /* Interrupt Priority.  */
+        *vec = 16 + offset - 0x400;
+    } else {
+        return false;
     }
-
-    shift = (8 * (offset - offset_base));
-    tmp = nvic_readl(s, offset_base) & ~(0xff << shift);
-    tmp |= (value & 0xff) << shift;
-    nvic_writel(s, offset_base, tmp);
+    return *vec < s->num_vectors;
 }
 
 static uint64_t nvic_sysreg_read(void *opaque, hwaddr addr,
@@ -477,14 +722,16 @@ static uint64_t nvic_sysreg_read(void *opaque, hwaddr addr,
 {
     nvic_state *s = (nvic_state *)opaque;
     uint32_t offset = addr;
-    int i;
+    int i, vec;
     uint32_t val;
 
     switch (offset) {
+    case 0x400 ... 0x5ef: /* Interrupt Priority.  */
     case 0xd18 ... 0xd23: /* System Handler Priority.  */
         val = 0;
         for (i = 0; i < size; i++) {
-            val |= s->gic.priority1[(offset - 0xd14) + i][0] << (i * 8);
+            if (nvic_prio_vector(s, offset + i, &vec))
+                val |= s->vectors[vec].prio << (i * 8);
         }
         return val;
     case 0xfe0 ... 0xfff: /* ID.  */
@@ -506,15 +753,16 @@ static void nvic_sysreg_write(void *opaque, hwaddr addr,
 {
     nvic_state *s = (nvic_state *)opaque;
     uint32_t offset = addr;
-    int i;
+    int i, vec;
 
     switch (offset) {
+    case 0x400 ... 0x5ef: /* Interrupt Priority.  */
     case 0xd18 ... 0xd23: /* System Handler Priority.  */
         for (i = 0; i < size; i++) {
-            s->gic.priority1[(offset - 0xd14) + i][0] =
-                (value >> (i * 8)) & 0xff;
+            if (nvic_prio_vector(s, offset + i, &vec))
+                nvic_set_prio(s, vec, (value >> (i * 8)) & 0xff);
         }
-        gic_update(&s->gic);
+        nvic_update(s);
         return;
     }
     if (size == 4) {
@@ -531,12 +779,37 @@ static const MemoryRegionOps nvic_sysreg_ops = {
     .endianness = DEVICE_NATIVE_ENDIAN,
 };
 
-static const VMStateDescription vmstate_nvic = {
-    .name = "armv7m_nvic",
+static const VMStateDescription vmstate_nvic_vec = {
+    .name = "armv7m_nvic_vec",
     .version_id = 1,
     .minimum_version_id = 1,
     .minimum_version_id_old = 1,
     .fields      = (VMStateField[]) {
+        VMSTATE_UINT8(prio, VecInfo),
+        VMSTATE_UINT8(enabled, VecInfo),
+        VMSTATE_UINT8(pending, VecInfo),
+        VMSTATE_UINT8(active, VecInfo),
+        VMSTATE_UINT8(level, VecInfo),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static int nvic_post_load(void *opaque, int version_id)
+{
+    nvic_rebuild((nvic_state *)opaque);
+    return 0;
+}
+
+static const VMStateDescription vmstate_nvic = {
+    .name = "armv7m_nvic",
+    .version_id = 2,
+    .minimum_version_id = 2,
+    .minimum_version_id_old = 2,
+    .post_load = nvic_post_load,
+    .fields      = (VMStateField[]) {
+        VMSTATE_STRUCT_ARRAY(vectors, nvic_state, NVIC_MAX_VECTORS, 1,
+                             vmstate_nvic_vec, VecInfo),
+        VMSTATE_UINT32(prigroup, nvic_state),
         VMSTATE_UINT32(systick.control, nvic_state),
         VMSTATE_UINT32(systick.reload, nvic_state),
         VMSTATE_INT64(systick.tick, nvic_state),
@@ -552,61 +825,50 @@ static const VMStateDescription vmstate_nvic = {
 static void armv7m_nvic_reset(DeviceState *dev)
 {
     nvic_state *s = NVIC(dev);
-    NVICClass *nc = NVIC_GET_CLASS(s);
-    nc->parent_reset(dev);
-    /* Common GIC reset resets to disabled; the NVIC doesn't have
-     * per-CPU interfaces so mark our non-existent CPU interface
-     * as enabled by default, and with a priority mask which allows
-     * all interrupts through.
+    int vec;
+
+    /* System exceptions are always enabled except for the configurable
+     * faults; external interrupts start disabled, and a line that is
+     * still asserted stays pending.
      */
-    s->gic.cpu_enabled[0] = true;
-    s->gic.priority_mask[0] = 0x100;
-    /* The NVIC as a whole is always enabled. */
-    s->gic.enabled = true;
+    for (vec = 0; vec < s->num_vectors; vec++) {
+        s->vectors[vec].prio = 0;
+        s->vectors[vec].enabled = vec < 16;
+        s->vectors[vec].pending = s->vectors[vec].level;
+        s->vectors[vec].active = 0;
+    }
+    s->vectors[ARMV7M_EXCP_MEM].enabled = 0;
+    s->vectors[ARMV7M_EXCP_BUS].enabled = 0;
+    s->vectors[ARMV7M_EXCP_USAGE].enabled = 0;
+    s->prigroup = 0;
+    nvic_rebuild(s);
     systick_reset(s);
 }
 
 static void armv7m_nvic_realize(DeviceState *dev, Error **errp)
 {
     nvic_state *s = NVIC(dev);
-    NVICClass *nc = NVIC_GET_CLASS(s);
-
-    /* The NVIC always has only one CPU */
-    s->gic.num_cpu = 1;
-    /* Tell the common code we're an NVIC */
-    s->gic.revision = 0xffffffff;
-    s->num_irq = s->gic.num_irq;
-    nc->parent_realize(dev, errp);
-    if (error_is_set(errp)) {
+
+    if (s->num_irq > NVIC_MAX_IRQ) {
+        error_setg(errp, "requested %u interrupt lines exceeds NVIC maximum %d",
+                   s->num_irq, NVIC_MAX_IRQ);
         return;
     }
-    gic_init_irqs_and_distributor(&s->gic, s->num_irq);
+    s->num_vectors = 16 + s->num_irq;
+    s->ready_longs = BITS_TO_LONGS(s->num_vectors);
+    s->ready = g_new0(unsigned long, NVIC_NUM_LEVELS * s->ready_longs);
+    qdev_init_gpio_in(dev, nvic_set_irq, s->num_irq);
+    sysbus_init_irq(SYS_BUS_DEVICE(dev), &s->parent_irq);
     /* The NVIC and system controller register area looks like this:
      *  0..0xff : system control registers, including systick
-     *  0x100..0xcff : GIC-like registers
+     *  0x100..0xcff : NVIC registers
      *  0xd00..0xfff : system control registers
-     * We use overlaying to put the GIC like registers
-     * over the top of the system control register region.
-     */
-    memory_region_init(&s->container, OBJECT(s), "nvic", 0x1000);
-    /* The system register region goes at the bottom of the priority
-     * stack as it covers the whole page.
-     */
-    memory_region_init_io(&s->sysregmem, OBJECT(s), &nvic_sysreg_ops, s,
-                          "nvic_sysregs", 0x1000);
-    memory_region_add_subregion(&s->container, 0, &s->sysregmem);
-    /* Alias the GIC region so we can get only the section of it
-     * we need, and layer it on top of the system register region.
-     */
-    memory_region_init_alias(&s->gic_iomem_alias, OBJECT(s),
-                             "nvic-gic", &s->gic.iomem,
-                             0x100, 0xc00);
-    memory_region_add_subregion_overlap(&s->container, 0x100,
-                                        &s->gic_iomem_alias, 1);
-    /* Map the whole thing into system memory at the location required
+     * Map the whole thing into system memory at the location required
      * by the v7M architecture.
      */
-    memory_region_add_subregion(get_system_memory(), 0xe000e000, &s->container);
+    memory_region_init_io(&s->iomem, OBJECT(s), &nvic_sysreg_ops, s,
+                          "nvic_sysregs", 0x1000);
+    memory_region_add_subregion(get_system_memory(), 0xe000e000, &s->iomem);
 #ifdef SYSTICK_USES_PTIMER
     s->systick.ptimer = ptimer_init(qemu_bh_new(systick_timer_tick, s));
 #else
@@ -614,41 +876,30 @@ static void armv7m_nvic_realize(DeviceState *dev, Error **errp)
 #endif
 }
 
-static void armv7m_nvic_instance_init(Object *obj)
-{
-    /* We have a different default value for the num-irq property
-     * than our superclass. This function runs after qdev init
-     * has set the defaults from the Property array and before
-     * any user-specified property setting, so just modify the
-     * value in the GICState struct.
-     */
-    GICState *s = ARM_GIC_COMMON(obj);
-    /* The ARM v7m may have anything from 0 to 496 external interrupt
-     * IRQ lines. We default to 64. Other boards may differ and should
-     * set the num-irq property appropriately.
-     */
-    s->num_irq = 64;
-}
+/* The ARM v7m may have anything from 0 to 496 external interrupt
+ * IRQ lines. We default to 64. Other boards may differ and should
+ * set the num-irq property appropriately.
+ */
+static Property armv7m_nvic_properties[] = {
+    DEFINE_PROP_UINT32("num-irq", nvic_state, num_irq, 64),
+    DEFINE_PROP_END_OF_LIST(),
+};
 
 static void armv7m_nvic_class_init(ObjectClass *klass, void *data)
 {
-    NVICClass *nc = NVIC_CLASS(klass);
     DeviceClass *dc = DEVICE_CLASS(klass);
 
-    nc->parent_reset = dc->reset;
-    nc->parent_realize = dc->realize;
     dc->vmsd  = &vmstate_nvic;
+    dc->props = armv7m_nvic_properties;
     dc->reset = armv7m_nvic_reset;
     dc->realize = armv7m_nvic_realize;
 }
 
 static const TypeInfo armv7m_nvic_info = {
     .name          = TYPE_NVIC,
-    .parent        = TYPE_ARM_GIC_COMMON,
-    .instance_init = armv7m_nvic_instance_init,
+    .parent        = TYPE_SYS_BUS_DEVICE,
     .instance_size = sizeof(nvic_state),
     .class_init    = armv7m_nvic_class_init,
-    .class_size    = sizeof(NVICClass),
 };
 
 static void armv7m_nvic_register_types(void)
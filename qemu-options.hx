@@ -2819,17 +2819,23 @@ re-inject them.
 ETEXI
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [N|auto]\n" \
+    "-icount [N|auto][,sleep=on|off]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
-    "                instruction\n", QEMU_ARCH_ALL)
+    "                instruction; with sleep=off, idle time is skipped\n", QEMU_ARCH_ALL)
 STEXI
-@item -icount [@var{N}|auto]
+@item -icount [@var{N}|auto][,sleep=on|off]
 @findex -icount
 Enable virtual instruction counter.  The virtual cpu will execute one
 instruction every 2^@var{N} ns of virtual time.  If @code{auto} is specified
 then the virtual cpu speed will be automatically adjusted to keep virtual
 time within a few seconds of real time.
 
+With @option{sleep=off}, a virtual cpu that is idle (e.g. halted in WFI with
+no interrupt pending) does not wait in real time: the virtual clock advances
+at once to the next timer deadline.  Long idle periods of the guest then
+finish as fast as the host can run the busy ones.  @option{sleep=off} cannot
+be combined with @code{auto}.
+
 Note that while this option can give deterministic behavior, it does not
 provide cycle accurate emulation.  Modern CPUs contain superscalar out of
 order cores with complex cache hierarchies.  The number of instructions
@@ -2803,6 +2803,73 @@ static uint32_t v7m_pop(CPUARMState *env)
     return val;
 }
 
+/* Basic exception frame: r0-r3, r12, lr, return address and xPSR.  */
+#define V7M_FRAME_WORDS 8
+
+/* Map the frame at "addr" if it is all in RAM, so that it is moved as a
+   block rather than as one physical access per word.  */
+static uint8_t *v7m_map_frame(CPUState *cs, uint32_t addr, bool is_write)
+{
+    hwaddr len = V7M_FRAME_WORDS * 4;
+    hwaddr xlat;
+    MemoryRegion *mr;
+    uint8_t *p;
+
+    mr = address_space_translate(cs->as, addr, &xlat, &len, is_write);
+    if (!memory_region_is_ram(mr) || (is_write && memory_region_is_rom(mr))
+        || len < V7M_FRAME_WORDS * 4) {
+        return NULL;
+    }
+    p = address_space_map(cs->as, addr, &len, is_write);
+    if (p && len < V7M_FRAME_WORDS * 4) {
+        address_space_unmap(cs->as, p, len, is_write, 0);
+        return NULL;
+    }
+    return p;
+}
+
+static void v7m_push_frame(CPUARMState *env, const uint32_t *frame)
+{
+    CPUState *cs = CPU(arm_env_get_cpu(env));
+    uint8_t *p;
+    int i;
+
+    p = v7m_map_frame(cs, env->regs[13] - V7M_FRAME_WORDS * 4, true);
+    if (!p) {
+        for (i = V7M_FRAME_WORDS - 1; i >= 0; i--) {
+            v7m_push(env, frame[i]);
+        }
+        return;
+    }
+    env->regs[13] -= V7M_FRAME_WORDS * 4;
+    for (i = 0; i < V7M_FRAME_WORDS; i++) {
+        stl_p(p + i * 4, frame[i]);
+    }
+    address_space_unmap(cs->as, p, V7M_FRAME_WORDS * 4, true,
+                        V7M_FRAME_WORDS * 4);
+}
+
+static void v7m_pop_frame(CPUARMState *env, uint32_t *frame)
+{
+    CPUState *cs = CPU(arm_env_get_cpu(env));
+    uint8_t *p;
+    int i;
+
+    p = v7m_map_frame(cs, env->regs[13], false);
+    if (!p) {
+        for (i = 0; i < V7M_FRAME_WORDS; i++) {
+            frame[i] = v7m_pop(env);
+        }
+        return;
+    }
+    for (i = 0; i < V7M_FRAME_WORDS; i++) {
+        frame[i] = ldl_p(p + i * 4);
+    }
+    address_space_unmap(cs->as, p, V7M_FRAME_WORDS * 4, false,
+                        V7M_FRAME_WORDS * 4);
+    env->regs[13] += V7M_FRAME_WORDS * 4;
+}
+
 /* Switch to V7M main or process stack pointer.  */
 static void switch_v7m_sp(CPUARMState *env, int process)
 {
@@ -2820,10 +2887,50 @@ static void switch_v7m_sp(CPUARMState *env, int process)
     }
 }
 
+/* Pending exception that BASEPRI lets the CPU take, or 0 if none.  */
+static int v7m_get_pending(CPUARMState *env)
+{
+    int irq = armv7m_nvic_get_current_pending(env->nvic);
+    int pri;
+
+    if (irq && env->v7m.basepri) {
+        pri = armv7m_nvic_get_priority(env->nvic, irq);
+        if (pri >= 0 && env->v7m.basepri <= pri) {
+            return 0;
+        }
+    }
+    return irq;
+}
+
+/* Tail-chaining: when an exception that preempts the context being
+   returned to is pending, enter its handler straight away.  The frame
+   on the stack is left as it is, and so is EXC_RETURN.  */
+static bool v7m_tail_chain(CPUARMState *env, uint32_t type)
+{
+    CPUState *cs = CPU(arm_env_get_cpu(env));
+    uint32_t addr;
+
+    if (!(cs->interrupt_request & CPU_INTERRUPT_HARD)
+        || (env->daif & (PSTATE_I | PSTATE_F))
+        || !v7m_get_pending(env)) {
+        return false;
+    }
+    env->v7m.exception = armv7m_nvic_acknowledge_irq(env->nvic);
+    qemu_log_mask(CPU_LOG_INT, "...tail-chained to exception %d\n",
+                  env->v7m.exception);
+    env->condexec_bits = 0;
+    env->regs[14] = type;
+    addr = ldl_phys(cs->as, env->v7m.vecbase + env->v7m.exception * 4);
+    env->regs[15] = addr & 0xfffffffe;
+    env->thumb = addr & 1;
+    return true;
+}
+
 static void do_v7m_exception_exit(CPUARMState *env)
 {
     uint32_t type;
     uint32_t xpsr;
+    uint32_t frame[V7M_FRAME_WORDS];
 
     type = env->regs[15];
 	if (env->v7m.exception != 0) {
@@ -2833,17 +2940,21 @@ static void do_v7m_exception_exit(CPUARMState *env)
             env->uncached_cpsr &= ~CPSR_F;
         }
     }
+    if (v7m_tail_chain(env, type)) {
+        return;
+    }
     /* Switch to the target stack.  */
     switch_v7m_sp(env, (type & 4) != 0);
     /* Pop registers.  */
-    env->regs[0] = v7m_pop(env);
-    env->regs[1] = v7m_pop(env);
-    env->regs[2] = v7m_pop(env);
-    env->regs[3] = v7m_pop(env);
-    env->regs[12] = v7m_pop(env);
-    env->regs[14] = v7m_pop(env);
-    env->regs[15] = v7m_pop(env) & ~1;
-    xpsr = v7m_pop(env);
+    v7m_pop_frame(env, frame);
+    env->regs[0] = frame[0];
+    env->regs[1] = frame[1];
+    env->regs[2] = frame[2];
+    env->regs[3] = frame[3];
+    env->regs[12] = frame[4];
+    env->regs[14] = frame[5];
+    env->regs[15] = frame[6] & ~1;
+    xpsr = frame[7];
     xpsr_write(env, xpsr, 0xfffffdff);
     /* Undo stack alignment.  */
     if (xpsr & 0x200)
@@ -2893,7 +3004,7 @@ void arm_v7m_cpu_do_interrupt(CPUState *cs)
     uint32_t xpsr = xpsr_read(env);
     uint32_t lr;
     uint32_t addr;
-    uint32_t tmp;
+    uint32_t frame[V7M_FRAME_WORDS];
 
     arm_log_exception(cs->exception_index);
 
@@ -2933,12 +3044,8 @@ void arm_v7m_cpu_do_interrupt(CPUState *cs)
         armv7m_nvic_set_pending(env->nvic, ARMV7M_EXCP_DEBUG);
         return;
     case EXCP_IRQ:
-        tmp = armv7m_nvic_get_current_pending(env->nvic);
-        if (env->v7m.basepri) {
-            int pri = armv7m_nvic_get_priority(env->nvic, tmp);
-            if (env->v7m.basepri <= pri) {
-                return;
-            }
+        if (!v7m_get_pending(env)) {
+            return;
         }
         env->v7m.exception = armv7m_nvic_acknowledge_irq(env->nvic);
         break;
@@ -2958,14 +3065,15 @@ void arm_v7m_cpu_do_interrupt(CPUState *cs)
         xpsr |= 0x200;
     }
     /* Switch to the handler mode.  */
-    v7m_push(env, xpsr);
-    v7m_push(env, env->regs[15]);
-    v7m_push(env, env->regs[14]);
-    v7m_push(env, env->regs[12]);
-    v7m_push(env, env->regs[3]);
-    v7m_push(env, env->regs[2]);
-    v7m_push(env, env->regs[1]);
-    v7m_push(env, env->regs[0]);
+    frame[0] = env->regs[0];
+    frame[1] = env->regs[1];
+    frame[2] = env->regs[2];
+    frame[3] = env->regs[3];
+    frame[4] = env->regs[12];
+    frame[5] = env->regs[14];
+    frame[6] = env->regs[15];
+    frame[7] = xpsr;
+    v7m_push_frame(env, frame);
     switch_v7m_sp(env, 0);
     /* Clear IT bits */
     env->condexec_bits = 0;
@@ -0,0 +1,133 @@
+/*
+ * QTest testcase for the FIFOs of the Fujitsu FM3 A/D converter
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+
+#include <glib.h>
+
+#include "libqtest.h"
+
+#define ADC_BASE        0x40027000
+#define ADC_ADSR        (ADC_BASE + 0x00)
+#define ADC_ADCR        (ADC_BASE + 0x01)
+#define ADC_SCCR        (ADC_BASE + 0x09)
+#define ADC_SCFD        (ADC_BASE + 0x0c)
+#define ADC_SCIS23      (ADC_BASE + 0x10)
+#define ADC_SCIS01      (ADC_BASE + 0x14)
+#define ADC_PCCR        (ADC_BASE + 0x19)
+#define ADC_PCFD        (ADC_BASE + 0x1c)
+#define ADC_PCIS        (ADC_BASE + 0x20)
+
+#define ADSR_SCS        (1 << 0)
+#define ADSR_ADSTP      (1 << 7)
+#define ADCR_PCIF       (1 << 6)
+#define ADCR_SCIF       (1 << 7)
+#define SCCR_SSTR       (1 << 0)
+#define SCCR_RPT        (1 << 2)
+#define SCCR_SOVR       (1 << 5)
+#define SCCR_SFUL       (1 << 6)
+#define SCCR_SEMP       (1 << 7)
+#define PCCR_PSTR       (1 << 0)
+#define PCCR_PEMP       (1 << 7)
+
+/* SCFD/PCFD: channel, software start, invalid */
+#define FD_SOFTWARE     (1 << 8)
+#define FD_INVL         (1 << 12)
+
+/* well above the conversion time of a few channels */
+#define SETTLE_NS       1000000
+
+/* Without a sample stream all results are 0: the entries are told apart
+ * by their channel numbers. */
+static void test_scan_fifo(void)
+{
+    qtest_start("-machine cq-frk-fm3");
+
+    /* channels 0, 2 and 16 */
+    writeb(ADC_SCIS01, 0x05);
+    writeb(ADC_SCIS23, 0x01);
+    writeb(ADC_SCCR, SCCR_SSTR);
+    g_assert_cmphex(readb(ADC_ADSR) & ADSR_SCS, ==, ADSR_SCS);
+
+    clock_step(SETTLE_NS);
+    g_assert_cmphex(readb(ADC_ADSR) & ADSR_SCS, ==, 0);
+    g_assert_cmphex(readb(ADC_ADCR) & ADCR_SCIF, ==, ADCR_SCIF);
+    g_assert_cmphex(readb(ADC_SCCR) & SCCR_SEMP, ==, 0);
+
+    /* SCFDL only holds status: the entry stays */
+    g_assert_cmphex(readw(ADC_SCFD), ==, FD_SOFTWARE | 0);
+    g_assert_cmphex(readw(ADC_SCFD), ==, FD_SOFTWARE | 0);
+    /* SCFDH holds the result and pops */
+    g_assert_cmphex(readw(ADC_SCFD + 2), ==, 0);
+    g_assert_cmphex(readw(ADC_SCFD), ==, FD_SOFTWARE | 2);
+    /* a word read pops */
+    g_assert_cmphex(readl(ADC_SCFD), ==, FD_SOFTWARE | 2);
+    g_assert_cmphex(readw(ADC_SCFD), ==, FD_SOFTWARE | 16);
+    /* so does a byte read in the upper half */
+    g_assert_cmphex(readb(ADC_SCFD + 3), ==, 0);
+
+    g_assert_cmphex(readb(ADC_SCCR) & SCCR_SEMP, ==, SCCR_SEMP);
+    g_assert_cmphex(readl(ADC_SCFD), ==, FD_INVL);
+
+    qtest_end();
+}
+
+/* A repeat scan fills the FIFO, then overruns */
+static void test_scan_overrun(void)
+{
+    int i;
+
+    qtest_start("-machine cq-frk-fm3");
+
+    writeb(ADC_SCIS01, 0x02);
+    writeb(ADC_SCCR, SCCR_RPT | SCCR_SSTR);
+    clock_step(20 * SETTLE_NS);
+    g_assert_cmphex(readb(ADC_SCCR) & (SCCR_SFUL | SCCR_SOVR), ==,
+                    SCCR_SFUL | SCCR_SOVR);
+
+    writeb(ADC_ADSR, ADSR_ADSTP);
+    g_assert_cmphex(readb(ADC_ADSR) & ADSR_SCS, ==, 0);
+    for (i = 0; i < 16; i++)
+        g_assert_cmphex(readl(ADC_SCFD), ==, FD_SOFTWARE | 1);
+    g_assert_cmphex(readb(ADC_SCCR) & (SCCR_SFUL | SCCR_SEMP), ==, SCCR_SEMP);
+
+    /* SOVR is cleared by writing 0 */
+    writeb(ADC_SCCR, 0);
+    g_assert_cmphex(readb(ADC_SCCR) & SCCR_SOVR, ==, 0);
+
+    qtest_end();
+}
+
+/* A software priority start converts the P2A channel */
+static void test_prio_fifo(void)
+{
+    qtest_start("-machine cq-frk-fm3");
+
+    writeb(ADC_PCIS, (5 << 3) | 2);
+    writeb(ADC_PCCR, PCCR_PSTR);
+    clock_step(SETTLE_NS);
+    g_assert_cmphex(readb(ADC_ADCR) & ADCR_PCIF, ==, ADCR_PCIF);
+    g_assert_cmphex(readb(ADC_PCCR) & PCCR_PEMP, ==, 0);
+
+    g_assert_cmphex(readw(ADC_PCFD), ==, FD_SOFTWARE | 5);
+    g_assert_cmphex(readl(ADC_PCFD), ==, FD_SOFTWARE | 5);
+    g_assert_cmphex(readb(ADC_PCCR) & PCCR_PEMP, ==, PCCR_PEMP);
+
+    qtest_end();
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/fm3-adc/scan-fifo", test_scan_fifo);
+    qtest_add_func("/fm3-adc/scan-overrun", test_scan_overrun);
+    qtest_add_func("/fm3-adc/prio-fifo", test_prio_fifo);
+
+    ret = g_test_run();
+
+    return ret;
+}
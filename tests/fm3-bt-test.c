@@ -0,0 +1,150 @@
+/*
+ * QTest testcase for the Fujitsu FM3 Base Timer
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+
+#include <glib.h>
+
+#include "libqtest.h"
+
+#define CR_APBC1_PSR    0x40010018
+
+#define BT_BASE         0x40025000
+#define BT_PCSR         (BT_BASE + 0x00)
+#define BT_PDUT         (BT_BASE + 0x04)
+#define BT_TMR          (BT_BASE + 0x08)
+#define BT_TMCR         (BT_BASE + 0x0c)
+#define BT_STC          (BT_BASE + 0x10)
+
+#define TMCR_STRG       (1 << 0)
+#define TMCR_CTEN       (1 << 1)
+#define TMCR_MDSE       (1 << 2)
+#define TMCR_FMD_PWM    (1 << 4)
+#define TMCR_FMD_PPG    (2 << 4)
+#define TMCR_FMD_RT     (3 << 4)
+
+#define STC_UDIR        (1 << 0)
+#define STC_DTIR        (1 << 1)
+
+/* PCLK1 = HCLK = 4 MHz: 250 ns per count with CKS = 0 */
+#define COUNT_NS        250
+
+static void bt_start(void)
+{
+    qtest_start("-machine cq-frk-fm3");
+    writel(CR_APBC1_PSR, 0x80);
+    writel(BT_PCSR, 99);
+}
+
+static void bt_trigger(uint32_t tmcr)
+{
+    writew(BT_TMCR, tmcr | TMCR_CTEN | TMCR_STRG);
+}
+
+/* TMR counts down from PCSR and is only computed when it is read */
+static void assert_tmr(uint32_t expected)
+{
+    uint32_t tmr = readw(BT_TMR);
+
+    g_assert_cmpuint(tmr, <=, expected);
+    g_assert_cmpuint(tmr + 1, >=, expected);
+}
+
+static void test_reload(void)
+{
+    bt_start();
+    bt_trigger(TMCR_FMD_RT);
+    assert_tmr(99);
+
+    clock_step(40 * COUNT_NS);
+    assert_tmr(59);
+    g_assert_cmphex(readb(BT_STC) & STC_UDIR, ==, 0);
+
+    /* underflow after 100 counts, then the count goes on from PCSR */
+    clock_step(70 * COUNT_NS);
+    g_assert_cmphex(readb(BT_STC) & STC_UDIR, ==, STC_UDIR);
+    assert_tmr(89);
+
+    writeb(BT_STC, 0);
+    clock_step(100 * COUNT_NS);
+    g_assert_cmphex(readb(BT_STC) & STC_UDIR, ==, STC_UDIR);
+
+    qtest_end();
+}
+
+static void test_oneshot(void)
+{
+    bt_start();
+    bt_trigger(TMCR_FMD_RT | TMCR_MDSE);
+
+    clock_step(110 * COUNT_NS);
+    g_assert_cmphex(readb(BT_STC) & STC_UDIR, ==, STC_UDIR);
+    g_assert_cmpuint(readw(BT_TMR), ==, 99);
+
+    /* stopped: no second underflow */
+    writeb(BT_STC, 0);
+    clock_step(200 * COUNT_NS);
+    g_assert_cmphex(readb(BT_STC) & STC_UDIR, ==, 0);
+    g_assert_cmpuint(readw(BT_TMR), ==, 99);
+
+    qtest_end();
+}
+
+/* PWM: "L" for PCSR - PDUT counts, then "H" until the underflow */
+static void test_pwm(void)
+{
+    bt_start();
+    writel(BT_PDUT, 24);
+    bt_trigger(TMCR_FMD_PWM);
+
+    clock_step(70 * COUNT_NS);
+    g_assert_cmphex(readb(BT_STC) & (STC_UDIR | STC_DTIR), ==, 0);
+    clock_step(10 * COUNT_NS);
+    g_assert_cmphex(readb(BT_STC) & (STC_UDIR | STC_DTIR), ==, STC_DTIR);
+    clock_step(30 * COUNT_NS);
+    g_assert_cmphex(readb(BT_STC) & (STC_UDIR | STC_DTIR), ==,
+                    STC_UDIR | STC_DTIR);
+
+    /* the next cycle matches the duty again */
+    writeb(BT_STC, 0);
+    clock_step(80 * COUNT_NS);
+    g_assert_cmphex(readb(BT_STC) & (STC_UDIR | STC_DTIR), ==, STC_DTIR);
+
+    qtest_end();
+}
+
+/* PPG: PCSR + 1 counts "L", then PDUT + 1 counts "H" */
+static void test_ppg(void)
+{
+    bt_start();
+    writel(BT_PCSR, 39);
+    writel(BT_PDUT, 39);
+    bt_trigger(TMCR_FMD_PPG);
+
+    clock_step(20 * COUNT_NS);
+    assert_tmr(19);
+    clock_step(40 * COUNT_NS);
+    assert_tmr(19);
+    g_assert_cmphex(readb(BT_STC) & STC_UDIR, ==, 0);
+    clock_step(30 * COUNT_NS);
+    g_assert_cmphex(readb(BT_STC) & STC_UDIR, ==, STC_UDIR);
+
+    qtest_end();
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/fm3-bt/reload", test_reload);
+    qtest_add_func("/fm3-bt/oneshot", test_oneshot);
+    qtest_add_func("/fm3-bt/pwm", test_pwm);
+    qtest_add_func("/fm3-bt/ppg", test_ppg);
+
+    ret = g_test_run();
+
+    return ret;
+}
@@ -0,0 +1,134 @@
+/*
+ * QTest testcase for the arbitration of the Fujitsu FM3 CAN bus
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+
+#include <glib.h>
+
+#include "libqtest.h"
+
+#define CAN0_BASE       0x40062000
+#define CAN1_BASE       0x40063000
+
+#define CAN_CTRLR       0x00
+#define CAN_STATR       0x02
+#define CAN_IF1         0x10
+#define CAN_IF2         0x40
+#define CAN_IF_CREQ     0x00
+#define CAN_IF_CMSK     0x02
+#define CAN_IF_ARB1     0x08
+#define CAN_IF_ARB2     0x0a
+#define CAN_IF_MCTR     0x0c
+#define CAN_IF_DTA1     0x10
+#define CAN_TREQR       0x80
+#define CAN_NEWDT       0x90
+
+#define STATR_TXOK      (1 << 3)
+#define STATR_RXOK      (1 << 4)
+
+#define CMSK_DATAA      (1 << 1)
+#define CMSK_TXREQ      (1 << 2)
+#define CMSK_CONTROL    (1 << 4)
+#define CMSK_ARB        (1 << 5)
+#define CMSK_WRRD       (1 << 7)
+
+#define ARB_MSGVAL      (1U << 31)
+#define ARB_DIR         (1 << 29)
+#define ARB_STD(id)     ((uint32_t)(id) << 18)
+
+/* the default BTR/BRPER give PCLK2 / 16 = 125 kbit/s: 8 us per bit */
+#define BIT_NS          8000
+/* a standard data frame of 2 bytes with the interframe space */
+#define FRAME_NS        ((47 + 2 * 8) * BIT_NS)
+
+/* writes message object n through IF1 */
+static void can_set_obj(uint32_t base, int n, uint32_t arb, uint16_t data,
+                        bool txreq)
+{
+    writew(base + CAN_IF1 + CAN_IF_CMSK, CMSK_WRRD | CMSK_ARB | CMSK_CONTROL |
+                                         CMSK_DATAA |
+                                         (txreq ? CMSK_TXREQ : 0));
+    writew(base + CAN_IF1 + CAN_IF_ARB1, arb & 0xffff);
+    writew(base + CAN_IF1 + CAN_IF_ARB2, arb >> 16);
+    writew(base + CAN_IF1 + CAN_IF_MCTR, 2);
+    writew(base + CAN_IF1 + CAN_IF_DTA1, data);
+    writew(base + CAN_IF1 + CAN_IF_CREQ, n);
+}
+
+/* reads back the data of message object n through IF2 */
+static uint16_t can_get_data(uint32_t base, int n)
+{
+    writew(base + CAN_IF2 + CAN_IF_CMSK, CMSK_DATAA);
+    writew(base + CAN_IF2 + CAN_IF_CREQ, n);
+    return readw(base + CAN_IF2 + CAN_IF_DTA1);
+}
+
+static void can_add_rx(uint32_t base, int n, uint32_t id)
+{
+    can_set_obj(base, n, ARB_MSGVAL | ARB_STD(id), 0, false);
+}
+
+static void can_add_tx(uint32_t base, int n, uint32_t id, uint16_t data)
+{
+    can_set_obj(base, n, ARB_MSGVAL | ARB_DIR | ARB_STD(id), data, true);
+}
+
+/*
+ * CAN0 sends 0x300 on an idle bus and queues 0x200 behind it; CAN1
+ * queues 0x100 while 0x300 is on the wire.  At the end of the frame the
+ * lower identifier of CAN1 wins the arbitration over CAN0.
+ */
+static void test_arbitration(void)
+{
+    qtest_start("-machine cq-frk-fm3");
+
+    writew(CAN0_BASE + CAN_CTRLR, 0);
+    writew(CAN1_BASE + CAN_CTRLR, 0);
+    can_add_rx(CAN0_BASE, 1, 0x100);
+    can_add_rx(CAN1_BASE, 1, 0x300);
+    can_add_rx(CAN1_BASE, 2, 0x200);
+
+    can_add_tx(CAN0_BASE, 2, 0x300, 0x0300);
+    can_add_tx(CAN0_BASE, 3, 0x200, 0x0200);
+    can_add_tx(CAN1_BASE, 3, 0x100, 0x0100);
+    g_assert_cmphex(readl(CAN0_BASE + CAN_TREQR), ==, 0x6);
+    g_assert_cmphex(readl(CAN1_BASE + CAN_TREQR), ==, 0x4);
+
+    /* 0x300 is through, 0x100 is on the wire */
+    clock_step(FRAME_NS);
+    g_assert_cmphex(readl(CAN1_BASE + CAN_NEWDT), ==, 0x1);
+    g_assert_cmphex(can_get_data(CAN1_BASE, 1), ==, 0x0300);
+    g_assert_cmphex(readl(CAN0_BASE + CAN_TREQR), ==, 0x4);
+    g_assert_cmphex(readl(CAN1_BASE + CAN_TREQR), ==, 0x4);
+
+    /* 0x100 is through, 0x200 is on the wire */
+    clock_step(FRAME_NS);
+    g_assert_cmphex(readl(CAN0_BASE + CAN_NEWDT), ==, 0x1);
+    g_assert_cmphex(can_get_data(CAN0_BASE, 1), ==, 0x0100);
+    g_assert_cmphex(readl(CAN1_BASE + CAN_TREQR), ==, 0);
+    g_assert_cmphex(readl(CAN0_BASE + CAN_TREQR), ==, 0x4);
+    g_assert_cmphex(readl(CAN1_BASE + CAN_NEWDT), ==, 0x1);
+
+    clock_step(FRAME_NS);
+    g_assert_cmphex(readl(CAN1_BASE + CAN_NEWDT), ==, 0x3);
+    g_assert_cmphex(can_get_data(CAN1_BASE, 2), ==, 0x0200);
+    g_assert_cmphex(readl(CAN0_BASE + CAN_TREQR), ==, 0);
+    g_assert_cmphex(readw(CAN0_BASE + CAN_STATR) & (STATR_TXOK | STATR_RXOK),
+                    ==, STATR_TXOK | STATR_RXOK);
+
+    qtest_end();
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/fm3-can/arbitration", test_arbitration);
+
+    ret = g_test_run();
+
+    return ret;
+}
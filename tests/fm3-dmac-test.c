@@ -0,0 +1,120 @@
+/*
+ * QTest testcase for the Fujitsu FM3 DMA controller
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "libqtest.h"
+
+#define SRAM_SRC        0x20000000
+#define SRAM_DST        0x20001000
+
+#define DMAC_BASE       0x40060000
+#define DMACR           (DMAC_BASE + 0x000)
+#define DMACA(ch)       (DMAC_BASE + 0x010 + (ch) * 0x10)
+#define DMACB(ch)       (DMAC_BASE + 0x014 + (ch) * 0x10)
+#define DMASA(ch)       (DMAC_BASE + 0x018 + (ch) * 0x10)
+#define DMADA(ch)       (DMAC_BASE + 0x01c + (ch) * 0x10)
+
+#define DMACR_DMAE      (1U << 31)
+#define DMACA_EB        (1U << 31)
+#define DMACA_ST        (1 << 29)
+#define DMACA_BC(n)     ((n) << 16)
+#define DMACB_MS_BURST  (1 << 28)
+#define DMACB_TW_WORD   (2 << 26)
+#define DMACB_FD        (1 << 24)
+#define DMACB_RS        (1 << 22)
+#define DMACB_RD        (1 << 21)
+#define DMACB_SS(v)     (((v) >> 16) & 7)
+#define SS_COMPLETE     5
+
+#define WORDS           64
+
+static uint32_t src[WORDS];
+
+static void fill_src(void)
+{
+    int i;
+
+    for (i = 0; i < WORDS; i++)
+        src[i] = 0x01010101 * i + 0x12345678;
+    memwrite(SRAM_SRC, src, sizeof(src));
+}
+
+/* the transfer runs in a bottom half: poll until it has completed */
+static void wait_complete(int ch)
+{
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        if (DMACB_SS(readl(DMACB(ch))) == SS_COMPLETE)
+            return;
+    }
+    g_assert_not_reached();
+}
+
+/* software block transfer, RAM to RAM: 4 blocks of 16 words */
+static void test_block(void)
+{
+    uint32_t dst[WORDS];
+
+    qtest_start("-machine cq-frk-fm3");
+    fill_src();
+
+    writel(DMACR, DMACR_DMAE);
+    writel(DMASA(0), SRAM_SRC);
+    writel(DMADA(0), SRAM_DST);
+    writel(DMACB(0), DMACB_TW_WORD);
+    writel(DMACA(0), DMACA_EB | DMACA_ST | DMACA_BC(15) | 3);
+    wait_complete(0);
+
+    memread(SRAM_DST, dst, sizeof(dst));
+    g_assert(memcmp(dst, src, sizeof(dst)) == 0);
+    g_assert_cmphex(readl(DMASA(0)), ==, SRAM_SRC + sizeof(src));
+    g_assert_cmphex(readl(DMADA(0)), ==, SRAM_DST + sizeof(src));
+    g_assert_cmphex(readl(DMACA(0)) & (DMACA_EB | DMACA_ST | 0xffff), ==, 0);
+
+    qtest_end();
+}
+
+/* burst to a fixed destination, beat by beat; DMASA/DMADA reloaded */
+static void test_burst_fixed(void)
+{
+    uint32_t dst[2];
+
+    qtest_start("-machine cq-frk-fm3");
+    fill_src();
+
+    writel(DMACR, DMACR_DMAE);
+    writel(DMASA(1), SRAM_SRC);
+    writel(DMADA(1), SRAM_DST);
+    writel(DMACB(1), DMACB_MS_BURST | DMACB_TW_WORD | DMACB_FD |
+                     DMACB_RS | DMACB_RD);
+    writel(DMACA(1), DMACA_EB | DMACA_ST | DMACA_BC(7) | 7);
+    wait_complete(1);
+
+    memread(SRAM_DST, dst, sizeof(dst));
+    g_assert_cmphex(dst[0], ==, src[WORDS - 1]);
+    g_assert_cmphex(dst[1], ==, 0);
+    g_assert_cmphex(readl(DMASA(1)), ==, SRAM_SRC);
+    g_assert_cmphex(readl(DMADA(1)), ==, SRAM_DST);
+
+    qtest_end();
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/fm3-dmac/block", test_block);
+    qtest_add_func("/fm3-dmac/burst-fixed", test_burst_fixed);
+
+    ret = g_test_run();
+
+    return ret;
+}
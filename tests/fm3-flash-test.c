@@ -0,0 +1,108 @@
+/*
+ * QTest testcase for the Fujitsu FM3 flash memory
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+
+#include <glib.h>
+#include <unistd.h>
+
+#include "libqtest.h"
+
+#define FLASH_BASE      0x00000000
+#define FLASH_IF_BASE   0x40000000
+
+#define FASZR           (FLASH_IF_BASE + 0x000)
+#define FSTR            (FLASH_IF_BASE + 0x008)
+#define FSTR_HNG        (1 << 1)
+#define FSTR_RDY        (1 << 0)
+
+#define CMD_ADDR1       (FLASH_BASE + 0x1550)
+#define CMD_ADDR2       (FLASH_BASE + 0x0aa8)
+
+#define EX_SRAM_BASE    0x60000000
+
+static void flash_program(uint32_t addr, uint16_t data)
+{
+    writel(FASZR, 0x01);        /* 16-bit access mode */
+    writew(CMD_ADDR1, 0xaa);
+    writew(CMD_ADDR2, 0x55);
+    writew(CMD_ADDR1, 0xa0);
+    writew(addr, data);
+    clock_step(100 * 1000);     /* 25 us per half word */
+    writel(FASZR, 0x02);
+}
+
+/* A new part is erased: blank flash reads 0xFF and programs without an
+ * erase first */
+static void test_program_blank(void)
+{
+    qtest_start("-machine cq-frk-fm3");
+
+    g_assert_cmphex(readl(FLASH_BASE + 0x20000), ==, 0xffffffff);
+    g_assert_cmphex(readl(FLASH_BASE + 0xffffc), ==, 0xffffffff);
+
+    flash_program(FLASH_BASE + 0x20000, 0x1234);
+    g_assert_cmphex(readl(FSTR) & (FSTR_HNG | FSTR_RDY), ==, FSTR_RDY);
+    g_assert_cmphex(readw(FLASH_BASE + 0x20000), ==, 0x1234);
+    g_assert_cmphex(readw(FLASH_BASE + 0x20002), ==, 0xffff);
+
+    /* programming only clears bits */
+    flash_program(FLASH_BASE + 0x20000, 0x0230);
+    g_assert_cmphex(readl(FSTR) & (FSTR_HNG | FSTR_RDY), ==, FSTR_RDY);
+    g_assert_cmphex(readw(FLASH_BASE + 0x20000), ==, 0x0230);
+
+    qtest_end();
+}
+
+static uint64_t qmp_get_resident(const char *name)
+{
+    QDict *response;
+    uint64_t ret;
+
+    response = qmp("{ 'execute': 'qom-get', 'arguments': { "
+                   "'path': '/machine', 'property': '%s' } }", name);
+    g_assert(qdict_haskey(response, "return"));
+    ret = qdict_get_int(response, "return");
+    QDECREF(response);
+    return ret;
+}
+
+/* Only the pages written get memory of their own */
+static void test_resident(void)
+{
+    uint64_t page = getpagesize();
+    uint64_t flash, sram;
+
+    qtest_start("-machine cq-frk-fm3-ex");
+    flash = qmp_get_resident("flash-resident");
+    sram = qmp_get_resident("ex-sram-resident");
+
+    /* blank flash is shared with the erased template */
+    g_assert_cmphex(readl(FLASH_BASE + 0x8000000), ==, 0xffffffff);
+    g_assert_cmpuint(qmp_get_resident("flash-resident"), ==, flash);
+
+    flash_program(FLASH_BASE + 0x8000000, 0x1234);
+    g_assert_cmpuint(qmp_get_resident("flash-resident"), ==, flash + page);
+
+    writel(EX_SRAM_BASE + 0x8000000, 0x12345678);
+    writel(EX_SRAM_BASE + 0x8000004, 0x9abcdef0);
+    g_assert_cmpuint(qmp_get_resident("ex-sram-resident"), ==, sram + page);
+    g_assert_cmphex(readl(EX_SRAM_BASE + 0x8000000), ==, 0x12345678);
+
+    qtest_end();
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/fm3-flash/program-blank", test_program_blank);
+    qtest_add_func("/fm3-flash/resident", test_resident);
+
+    ret = g_test_run();
+
+    return ret;
+}
@@ -0,0 +1,169 @@
+/*
+ * QTest testcase for the binary protocol of the Fujitsu FM3 GPIO control
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "libqtest.h"
+#include "qemu/bswap.h"
+
+#define GPIO_BASE       0x40033000
+#define GPIO_DDR(n)     (GPIO_BASE + 0x200 + (n) * 4)
+#define GPIO_PDIR(n)    (GPIO_BASE + 0x300 + (n) * 4)
+#define GPIO_PDOR(n)    (GPIO_BASE + 0x400 + (n) * 4)
+
+#define BIN_READ        0x01
+#define BIN_SET         0x02
+#define BIN_SUBSCRIBE   0x03
+#define BIN_ACK         0x80
+#define BIN_STATE       0x81
+#define BIN_NOTIFY      0x82
+
+#define BLOCK           3
+
+static int ctrl_fd;
+
+static void read_full(int fd, uint8_t *buf, size_t len)
+{
+    ssize_t ret;
+
+    while (len) {
+        ret = read(fd, buf, len);
+        g_assert(ret > 0);
+        buf += ret;
+        len -= ret;
+    }
+}
+
+static void bin_send(uint8_t cmd, const uint8_t *payload, size_t len)
+{
+    uint8_t frame[64];
+
+    g_assert(len + 3 <= sizeof(frame));
+    stw_le_p(frame, len + 1);
+    frame[2] = cmd;
+    memcpy(&frame[3], payload, len);
+    g_assert_cmpint(write(ctrl_fd, frame, len + 3), ==, len + 3);
+}
+
+/* receive one frame, returns the payload length */
+static size_t bin_recv(uint8_t *cmd, uint8_t *payload, size_t size)
+{
+    uint8_t hdr[3];
+    size_t len;
+
+    read_full(ctrl_fd, hdr, sizeof(hdr));
+    len = lduw_le_p(hdr) - 1;
+    g_assert_cmpuint(len, <=, size);
+    *cmd = hdr[2];
+    read_full(ctrl_fd, payload, len);
+    return len;
+}
+
+static void expect_ack(uint8_t cmd)
+{
+    uint8_t rcmd, payload[64];
+
+    g_assert_cmpuint(bin_recv(&rcmd, payload, sizeof(payload)), ==, 2);
+    g_assert_cmphex(rcmd, ==, BIN_ACK);
+    g_assert_cmphex(payload[0], ==, cmd);
+    g_assert_cmphex(payload[1], ==, 0);
+}
+
+/* a STATE or NOTIFY frame holding the port block BLOCK only */
+static void expect_block(uint8_t cmd, uint16_t ddr, uint16_t pdir,
+                         uint16_t pdor)
+{
+    uint8_t rcmd, payload[64];
+
+    g_assert_cmpuint(bin_recv(&rcmd, payload, sizeof(payload)), ==, 2 + 8);
+    g_assert_cmphex(rcmd, ==, cmd);
+    g_assert_cmphex(lduw_le_p(&payload[0]), ==, 1 << BLOCK);
+    g_assert_cmphex(lduw_le_p(&payload[2]), ==, 0);     /* PFR */
+    g_assert_cmphex(lduw_le_p(&payload[4]), ==, ddr);
+    g_assert_cmphex(lduw_le_p(&payload[6]), ==, pdir);
+    g_assert_cmphex(lduw_le_p(&payload[8]), ==, pdor);
+}
+
+static void send_mask(uint8_t cmd, uint16_t mask)
+{
+    uint8_t payload[2];
+
+    stw_le_p(payload, mask);
+    bin_send(cmd, payload, sizeof(payload));
+}
+
+static void test_protocol(void)
+{
+    gchar *path = g_strdup_printf("/tmp/fm3-gpio-%d.sock", getpid());
+    struct sockaddr_un addr;
+    gchar *args;
+    uint8_t set[6];
+    int sock;
+
+    sock = socket(PF_UNIX, SOCK_STREAM, 0);
+    g_assert(sock >= 0);
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    unlink(path);
+    g_assert(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    g_assert(listen(sock, 1) == 0);
+
+    args = g_strdup_printf("-machine cq-frk-fm3 "
+                           "-chardev socket,id=gpio,path=%s "
+                           "-device fm3-gpio-control,chardev=gpio,binary=on",
+                           path);
+    qtest_start(args);
+    g_free(args);
+    ctrl_fd = accept(sock, NULL, NULL);
+    g_assert(ctrl_fd >= 0);
+    close(sock);
+    unlink(path);
+    g_free(path);
+
+    /* every DDR/PDOR change of a subscribed block is notified */
+    writel(GPIO_DDR(BLOCK), 0x0001);
+    expect_block(BIN_NOTIFY, 0x0001, 0x0000, 0x0000);
+    writel(GPIO_PDOR(BLOCK), 0x0001);
+    expect_block(BIN_NOTIFY, 0x0001, 0x0001, 0x0001);
+
+    /* drive inputs: bit 1 high, bit 2 low */
+    stw_le_p(&set[0], 1 << BLOCK);
+    stw_le_p(&set[2], 0x0006);
+    stw_le_p(&set[4], 0x0002);
+    bin_send(BIN_SET, set, sizeof(set));
+    expect_ack(BIN_SET);
+    g_assert_cmphex(readl(GPIO_PDIR(BLOCK)), ==, 0x0003);
+
+    send_mask(BIN_READ, 1 << BLOCK);
+    expect_block(BIN_STATE, 0x0001, 0x0003, 0x0001);
+
+    /* unsubscribed changes are not notified: READ gets the next frame */
+    send_mask(BIN_SUBSCRIBE, 0);
+    expect_ack(BIN_SUBSCRIBE);
+    writel(GPIO_PDOR(BLOCK), 0x0000);
+    send_mask(BIN_READ, 1 << BLOCK);
+    expect_block(BIN_STATE, 0x0001, 0x0002, 0x0000);
+
+    close(ctrl_fd);
+    qtest_end();
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/fm3-gpio/protocol", test_protocol);
+
+    ret = g_test_run();
+
+    return ret;
+}
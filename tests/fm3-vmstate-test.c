@@ -0,0 +1,147 @@
+/*
+ * QTest testcase for the vmstate of the Fujitsu FM3 devices
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libqtest.h"
+
+#define SRAM_BASE       0x20000000
+
+#define CR_BASE         0x40010000
+#define CR_APBC1_PSR    (CR_BASE + 0x018)
+
+#define WDT_BASE        0x40011000
+#define SWWDT_LDR       (WDT_BASE + 0x1000)
+#define SWWDT_LCK       (WDT_BASE + 0x1c00)
+#define WDT_UNLOCK      0x1acce551
+
+#define EXTI_BASE       0x40030000
+#define EXTI_ENIR       (EXTI_BASE + 0x00)
+#define EXTI_ELVR       (EXTI_BASE + 0x0c)
+
+#define GPIO_BASE       0x40033000
+#define GPIO_PFR(n)     (GPIO_BASE + 0x000 + (n) * 4)
+#define GPIO_DDR(n)     (GPIO_BASE + 0x200 + (n) * 4)
+#define GPIO_PDOR(n)    (GPIO_BASE + 0x400 + (n) * 4)
+
+#define UART_BASE       0x40038000
+#define UART_BGR0(ch)   (UART_BASE + (ch) * 0x100 + 0x00c)
+
+/* send a QMP command, skipping the events queued before its reply */
+static QDict *qmp_command(QTestState *s, const char *cmd)
+{
+    QDict *response = qtest_qmp(s, "%s", cmd);
+
+    while (qdict_haskey(response, "event")) {
+        QDECREF(response);
+        response = qtest_qmp_receive(s);
+    }
+    g_assert(qdict_haskey(response, "return"));
+    return response;
+}
+
+static void wait_migrated(QTestState *s)
+{
+    QDict *response;
+    const char *status;
+    bool done;
+
+    do {
+        g_usleep(1000);
+        response = qmp_command(s, "{ 'execute': 'query-migrate' }");
+        status = qdict_get_try_str(qdict_get_qdict(response, "return"),
+                                   "status");
+        g_assert(!status || strcmp(status, "failed") != 0);
+        done = status && strcmp(status, "completed") == 0;
+        QDECREF(response);
+    } while (!done);
+}
+
+static void wait_running(QTestState *s)
+{
+    QDict *response;
+    bool running;
+
+    do {
+        g_usleep(1000);
+        response = qmp_command(s, "{ 'execute': 'query-status' }");
+        running = qdict_get_bool(qdict_get_qdict(response, "return"),
+                                 "running");
+        QDECREF(response);
+    } while (!running);
+}
+
+static void setup_state(void)
+{
+    writel(SRAM_BASE + 0x100, 0xdeadbeef);
+    writel(CR_APBC1_PSR, 0x82);
+    writel(SWWDT_LCK, WDT_UNLOCK);
+    writel(SWWDT_LDR, 0x12345);
+    writel(EXTI_ELVR, 0x0004);
+    writel(EXTI_ENIR, 0x0002);
+    writel(GPIO_PFR(3), 0x00f0);
+    writel(GPIO_DDR(3), 0x000f);
+    writel(GPIO_PDOR(3), 0x0005);
+    writeb(UART_BGR0(1), 0x67);
+}
+
+static void check_state(void)
+{
+    g_assert_cmphex(readl(SRAM_BASE + 0x100), ==, 0xdeadbeef);
+    g_assert_cmphex(readl(CR_APBC1_PSR), ==, 0x82);
+    g_assert_cmphex(readl(SWWDT_LDR), ==, 0x12345);
+    g_assert_cmphex(readl(EXTI_ELVR), ==, 0x0004);
+    g_assert_cmphex(readl(EXTI_ENIR), ==, 0x0002);
+    g_assert_cmphex(readl(GPIO_PFR(3)), ==, 0x00f0);
+    g_assert_cmphex(readl(GPIO_DDR(3)), ==, 0x000f);
+    g_assert_cmphex(readl(GPIO_PDOR(3)), ==, 0x0005);
+    g_assert_cmphex(readb(UART_BGR0(1)), ==, 0x67);
+}
+
+/* The register state survives a migration into a fresh machine */
+static void test_roundtrip(void)
+{
+    gchar *path = g_strdup_printf("/tmp/fm3-vmstate-%d", getpid());
+    gchar *cmd, *args;
+    QTestState *from, *to;
+
+    from = qtest_start("-machine cq-frk-fm3");
+    setup_state();
+    check_state();
+
+    cmd = g_strdup_printf("{ 'execute': 'migrate', "
+                          "'arguments': { 'uri': 'exec:cat > %s' } }", path);
+    QDECREF(qmp_command(from, cmd));
+    g_free(cmd);
+    wait_migrated(from);
+    qtest_quit(from);
+
+    args = g_strdup_printf("-machine cq-frk-fm3 -incoming 'exec:cat %s'",
+                           path);
+    to = qtest_start(args);
+    g_free(args);
+    wait_running(to);
+    check_state();
+    qtest_end();
+
+    unlink(path);
+    g_free(path);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/fm3-vmstate/roundtrip", test_roundtrip);
+
+    ret = g_test_run();
+
+    return ret;
+}
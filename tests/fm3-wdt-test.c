@@ -0,0 +1,148 @@
+/*
+ * QTest testcase for the Fujitsu FM3 watchdog timers
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "libqtest.h"
+
+#define WDT_BASE        0x40011000
+#define HWWDT_LDR       (WDT_BASE + 0x0000)
+#define HWWDT_CTL       (WDT_BASE + 0x0008)
+#define HWWDT_ICL       (WDT_BASE + 0x000c)
+#define HWWDT_RIS       (WDT_BASE + 0x0010)
+#define HWWDT_LCK       (WDT_BASE + 0x0c00)
+#define SWWDT_LDR       (WDT_BASE + 0x1000)
+#define SWWDT_CTL       (WDT_BASE + 0x1008)
+#define SWWDT_ICL       (WDT_BASE + 0x100c)
+#define SWWDT_RIS       (WDT_BASE + 0x1010)
+#define SWWDT_LCK       (WDT_BASE + 0x1c00)
+
+#define CTL_INTEN       (1 << 0)
+#define CTL_RESEN       (1 << 1)
+#define WDT_UNLOCK      0x1acce551
+#define WDT_UNLOCK_CTL  0xe5331aae
+
+/* both watchdogs are set up for 10 ms: PCLK0 is 2 MHz, the HW watchdog
+ * counts at 100 kHz */
+#define PERIOD_NS       10000000
+#define SWWDT_LOAD      19999
+#define HWWDT_LOAD      999
+
+/* the reset is a stop with -watchdog-action pause */
+static const char *get_status(void)
+{
+    static char status[32];
+    QDict *response = qmp("{ 'execute': 'query-status' }");
+
+    while (qdict_haskey(response, "event")) {
+        QDECREF(response);
+        response = qtest_qmp_receive(global_qtest);
+    }
+    g_assert(qdict_haskey(response, "return"));
+    snprintf(status, sizeof(status), "%s",
+             qdict_get_str(qdict_get_qdict(response, "return"), "status"));
+    QDECREF(response);
+    return status;
+}
+
+static void test_sw_feed(void)
+{
+    qtest_start("-machine cq-frk-fm3 -watchdog-action pause");
+
+    writel(SWWDT_LCK, WDT_UNLOCK);
+    writel(SWWDT_LDR, SWWDT_LOAD);
+    writel(SWWDT_CTL, CTL_INTEN | CTL_RESEN);
+
+    /* fed in time */
+    clock_step(PERIOD_NS * 3 / 4);
+    writel(SWWDT_ICL, 0);
+    clock_step(PERIOD_NS * 3 / 4);
+    g_assert_cmphex(readl(SWWDT_RIS), ==, 0);
+
+    /* the first timeout interrupts, a feed clears it */
+    clock_step(PERIOD_NS / 2);
+    g_assert_cmphex(readl(SWWDT_RIS), ==, 1);
+    writel(SWWDT_ICL, 0);
+    g_assert_cmphex(readl(SWWDT_RIS), ==, 0);
+    g_assert_cmpstr(get_status(), ==, "running");
+
+    /* locked: neither LDR nor a feed is taken */
+    writel(SWWDT_LCK, 0);
+    writel(SWWDT_LDR, 0);
+    g_assert_cmphex(readl(SWWDT_LDR), ==, SWWDT_LOAD);
+
+    /* the second timeout resets */
+    clock_step(PERIOD_NS * 3 / 2);
+    writel(SWWDT_ICL, 0);
+    g_assert_cmphex(readl(SWWDT_RIS), ==, 1);
+    g_assert_cmpstr(get_status(), ==, "running");
+    clock_step(PERIOD_NS);
+    g_assert_cmpstr(get_status(), ==, "watchdog");
+
+    qtest_end();
+}
+
+static void hw_feed(bool unlock_again, uint32_t second)
+{
+    writel(HWWDT_LCK, WDT_UNLOCK);
+    writel(HWWDT_ICL, 0x55);
+    if (unlock_again)
+        writel(HWWDT_LCK, WDT_UNLOCK);
+    writel(HWWDT_ICL, second);
+}
+
+static void test_hw_feed(void)
+{
+    qtest_start("-machine cq-frk-fm3 -watchdog-action pause");
+
+    /* off by default */
+    clock_step(PERIOD_NS * 200);
+    g_assert_cmpstr(get_status(), ==, "running");
+
+    writel(HWWDT_LCK, WDT_UNLOCK);
+    writel(HWWDT_LDR, HWWDT_LOAD);
+    writel(HWWDT_LCK, WDT_UNLOCK);
+    writel(HWWDT_LCK, WDT_UNLOCK_CTL);
+    writel(HWWDT_CTL, CTL_INTEN | CTL_RESEN);
+    g_assert_cmphex(readl(HWWDT_CTL), ==, CTL_INTEN | CTL_RESEN);
+
+    /* unlocking again between the two words keeps the first one */
+    clock_step(PERIOD_NS * 3 / 4);
+    hw_feed(true, 0xaa);
+    clock_step(PERIOD_NS * 3 / 4);
+    g_assert_cmphex(readl(HWWDT_RIS), ==, 0);
+
+    clock_step(PERIOD_NS / 2);
+    g_assert_cmphex(readl(HWWDT_RIS), ==, 1);
+    hw_feed(false, 0xaa);
+    g_assert_cmphex(readl(HWWDT_RIS), ==, 0);
+
+    /* a second word that is not the inverse does not feed */
+    clock_step(PERIOD_NS * 3 / 4);
+    hw_feed(false, 0x55);
+    clock_step(PERIOD_NS / 2);
+    g_assert_cmphex(readl(HWWDT_RIS), ==, 1);
+    g_assert_cmpstr(get_status(), ==, "running");
+    clock_step(PERIOD_NS);
+    g_assert_cmpstr(get_status(), ==, "watchdog");
+
+    qtest_end();
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/fm3-wdt/sw-feed", test_sw_feed);
+    qtest_add_func("/fm3-wdt/hw-feed", test_hw_feed);
+
+    ret = g_test_run();
+
+    return ret;
+}